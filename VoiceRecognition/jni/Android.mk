@@ -21,10 +21,15 @@ LOCAL_SRC_FILES := \
 	flac/src/libFLAC/bitreader.c \
 	flac/src/libFLAC/cpu.c \
 	flac/src/libFLAC/crc.c \
+	flac/src/libFLAC/crc_intrin_pclmul.c \
 	flac/src/libFLAC/fixed.c \
 	flac/src/libFLAC/float.c \
 	flac/src/libFLAC/format.c \
 	flac/src/libFLAC/lpc.c \
+	flac/src/libFLAC/lpc_intrin_avx.c \
+	flac/src/libFLAC/lpc_intrin_avx2.c \
+	flac/src/libFLAC/lpc_intrin_sse2.c \
+	flac/src/libFLAC/lpc_intrin_sse41.c \
 	flac/src/libFLAC/md5.c \
 	flac/src/libFLAC/memory.c \
 	flac/src/libFLAC/metadata_iterators.c \
@@ -35,10 +40,28 @@ LOCAL_SRC_FILES := \
 	flac/src/libFLAC/ogg_mapping.c \
 	flac/src/libFLAC/stream_decoder.c \
 	flac/src/libFLAC/stream_encoder.c \
+	flac/src/libFLAC/stream_encoder_intrin_avx2.c \
+	flac/src/libFLAC/stream_encoder_intrin_sse2.c \
 	flac/src/libFLAC/stream_encoder_framing.c \
 	flac/src/libFLAC/window.c \
 	flac/src/libFLAC/bitwriter.c
 
+# NEON kernels. On ARMv7 only these files are built with NEON enabled, and
+# FLAC__cpu_info() checks for NEON at runtime before they are used.
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+LOCAL_SRC_FILES += flac/src/libFLAC/lpc_intrin_neon.c.neon
+LOCAL_SRC_FILES += flac/src/libFLAC/stream_encoder_intrin_neon.c.neon
+LOCAL_CFLAGS += -DFLAC__HAS_NEONINTRIN=1
+endif
+ifeq ($(TARGET_ARCH_ABI),arm64-v8a)
+LOCAL_SRC_FILES += flac/src/libFLAC/lpc_intrin_neon.c
+LOCAL_SRC_FILES += flac/src/libFLAC/stream_encoder_intrin_neon.c
+# The CRC-16 kernel needs PMULL from the crypto extension. The compiler only
+# emits it for the intrinsics, and FLAC__cpu_info() checks for it at runtime.
+LOCAL_SRC_FILES += flac/src/libFLAC/crc_intrin_pmull.c
+LOCAL_CFLAGS += -march=armv8-a+crypto
+endif
+
 include $(BUILD_STATIC_LIBRARY)
 
 # Lastly build the JNI wrapper and link both other libs against it
@@ -49,9 +72,26 @@ LOCAL_MODULE    := audioboo-native
 LOCAL_SRC_FILES := \
 	jni/FLACStreamEncoder.cpp \
 	jni/FLACStreamDecoder.cpp \
+	jni/log.cpp \
+	jni/meter.cpp \
 	jni/util.cpp
 LOCAL_LDLIBS := -llog
 
-LOCAL_STATIC_LIBRARIES := audioboo-ogg audioboo-flac
+# Vectorized metering kernels. On ARMv7 the NEON kernel is built with NEON
+# enabled for that file only, and picked at runtime via cpufeatures.
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+LOCAL_SRC_FILES += jni/meter_neon.cpp.neon
+LOCAL_CFLAGS += -DAUDIOBOO_HAVE_NEON
+endif
+ifeq ($(TARGET_ARCH_ABI),arm64-v8a)
+LOCAL_SRC_FILES += jni/meter_neon.cpp
+endif
+ifneq ($(filter x86 x86_64,$(TARGET_ARCH_ABI)),)
+LOCAL_SRC_FILES += jni/meter_sse2.cpp
+endif
+
+LOCAL_STATIC_LIBRARIES := audioboo-ogg audioboo-flac cpufeatures
 
 include $(BUILD_SHARED_LIBRARY)
+
+$(call import-module,android/cpufeatures)
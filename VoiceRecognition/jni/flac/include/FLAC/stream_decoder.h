@@ -136,7 +136,8 @@ extern "C" {
  *   returns FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM or
  *   FLAC__STREAM_DECODER_READ_STATUS_ABORT.  The client will get one metadata,
  *   write, or error callback per metadata block, audio frame, or sync error,
- *   respectively.
+ *   respectively.  Decoders reading from a file can spread the frames over
+ *   several threads; see FLAC__stream_decoder_set_num_threads().
  *
  * When the decoder has finished decoding (normally or through an abort),
  * the instance is finished by calling FLAC__stream_decoder_finish(), which
@@ -150,6 +151,16 @@ extern "C" {
  * Subsequently, the first time the write callback is called it will be
  * passed a (possibly partial) block starting at that sample.
  *
+ * Streams without a SEEKTABLE are seeked by bisecting the input, which
+ * takes several reads and frame syncs per seek.  A decoder can instead
+ * keep an index of the sample number and byte offset of every frame; see
+ * FLAC__stream_decoder_set_frame_indexing() and
+ * FLAC__stream_decoder_build_frame_index().  Seeks to a sample in an
+ * indexed frame go straight to that frame.  The index can be stored
+ * next to the stream with FLAC__stream_decoder_save_frame_index() and
+ * FLAC__stream_decoder_load_frame_index(), or turned into a SEEKTABLE
+ * with FLAC__stream_decoder_get_frame_index_seek_table().
+ *
  * If the client cannot seek via the callback interface provided, but still
  * has another way of seeking, it can flush the decoder using
  * FLAC__stream_decoder_flush() and start feeding data from the new position
@@ -194,6 +205,12 @@ extern "C" {
  */
 
 
+/** The maximum number of threads accepted by
+ *  FLAC__stream_decoder_set_num_threads().
+ */
+#define FLAC__STREAM_DECODER_MAX_THREADS (64u)
+
+
 /** State values for a FLAC__StreamDecoder
  *
  * The decoder's state can be obtained by calling FLAC__stream_decoder_get_state().
@@ -878,6 +895,71 @@ FLAC_API FLAC__bool FLAC__stream_decoder_set_metadata_ignore_application(FLAC__S
  */
 FLAC_API FLAC__bool FLAC__stream_decoder_set_metadata_ignore_all(FLAC__StreamDecoder *decoder);
 
+/** Set the number of threads used to decode frames.
+ *  With a value greater than \c 1,
+ *  FLAC__stream_decoder_process_until_end_of_stream() splits the audio
+ *  frames of the stream into byte ranges and decodes them concurrently
+ *  on a pool of worker threads.  Range boundaries are taken from the
+ *  SEEKTABLE when there is one, and are otherwise found by scanning for
+ *  frame sync codes followed by a header with a valid CRC-8.  The
+ *  decoded frames are delivered strictly in stream order on the thread
+ *  that called FLAC__stream_decoder_process_until_end_of_stream(), so
+ *  the write and error callbacks are never called from a worker thread
+ *  and see the same sequence of frames as with a single thread.
+ *
+ * \note
+ * Parallel decoding needs random access to the input, so it is only used
+ * for native FLAC decoders initialized with
+ * FLAC__stream_decoder_init_file() or FLAC__stream_decoder_init_FILE()
+ * on a regular file, and only once the STREAMINFO block has been read.
+ * All other cases, and FLAC__stream_decoder_process_single(), decode
+ * serially as before.
+ *
+ * \note
+ * In parallel mode the \a frame passed to the write callback carries
+ * the header and footer, but not the subframes.
+ *
+ * \note
+ * Libraries built without thread support only accept \c 1.
+ *
+ * \default \c 1
+ * \param  decoder  A decoder instance to set.
+ * \param  value    The number of threads; between \c 1 and
+ *                  \c FLAC__STREAM_DECODER_MAX_THREADS.
+ * \assert
+ *    \code decoder != NULL \endcode
+ * \retval FLAC__bool
+ *    \c false if the decoder is already initialized, or if \a value is
+ *    out of range, else \c true.
+ */
+FLAC_API FLAC__bool FLAC__stream_decoder_set_num_threads(FLAC__StreamDecoder *decoder, unsigned value);
+
+/** Set the "frame indexing" flag.  If \c true, the decoder records the
+ *  sample number and byte offset of every frame it decodes with a
+ *  matching CRC, including the frames read while seeking, and
+ *  FLAC__stream_decoder_seek_absolute() goes straight to the frame
+ *  holding the target sample when it has been recorded.  Each recorded
+ *  frame costs one call to the tell callback and about 24 bytes of
+ *  memory.  The index is cleared by FLAC__stream_decoder_reset() and
+ *  FLAC__stream_decoder_finish().
+ *
+ * \note
+ * Frames are only recorded for native FLAC streams with a tell callback,
+ * and not by the worker threads of a parallel
+ * FLAC__stream_decoder_process_until_end_of_stream().  Use
+ * FLAC__stream_decoder_build_frame_index() to index a whole stream up
+ * front instead.
+ *
+ * \default \c false
+ * \param  decoder  A decoder instance to set.
+ * \param  value    Flag value (see above).
+ * \assert
+ *    \code decoder != NULL \endcode
+ * \retval FLAC__bool
+ *    \c false if the decoder is already initialized, else \c true.
+ */
+FLAC_API FLAC__bool FLAC__stream_decoder_set_frame_indexing(FLAC__StreamDecoder *decoder, FLAC__bool value);
+
 /** Get the current decoder state.
  *
  * \param  decoder  A decoder instance to query.
@@ -984,6 +1066,28 @@ FLAC_API unsigned FLAC__stream_decoder_get_sample_rate(const FLAC__StreamDecoder
  */
 FLAC_API unsigned FLAC__stream_decoder_get_blocksize(const FLAC__StreamDecoder *decoder);
 
+/** Get the number of decoding threads.
+ *
+ * \param  decoder  A decoder instance to query.
+ * \assert
+ *    \code decoder != NULL \endcode
+ * \retval unsigned
+ *    See FLAC__stream_decoder_set_num_threads().
+ */
+FLAC_API unsigned FLAC__stream_decoder_get_num_threads(const FLAC__StreamDecoder *decoder);
+
+/** Get the "frame indexing" flag.
+ *  This is the value of the setting, not whether frames have been
+ *  indexed yet.
+ *
+ * \param  decoder  A decoder instance to query.
+ * \assert
+ *    \code decoder != NULL \endcode
+ * \retval FLAC__bool
+ *    See FLAC__stream_decoder_set_frame_indexing().
+ */
+FLAC_API FLAC__bool FLAC__stream_decoder_get_frame_indexing(const FLAC__StreamDecoder *decoder);
+
 /** Returns the decoder's current read position within the stream.
  *  The position is the byte offset from the start of the stream.
  *  Bytes before this position have been fully decoded.  Note that
@@ -1357,6 +1461,9 @@ FLAC_API FLAC__StreamDecoderInitStatus FLAC__stream_decoder_init_ogg_file(
  *  but it is good practice to match every FLAC__stream_decoder_init_*()
  *  with a FLAC__stream_decoder_finish().
  *
+ *  The output buffers are not released; they are reused if the decoder
+ *  is initialized again.  FLAC__stream_decoder_delete() frees them.
+ *
  * \param  decoder  An uninitialized decoder instance.
  * \assert
  *    \code decoder != NULL \endcode
@@ -1550,6 +1657,89 @@ FLAC_API FLAC__bool FLAC__stream_decoder_skip_single_frame(FLAC__StreamDecoder *
  */
 FLAC_API FLAC__bool FLAC__stream_decoder_seek_absolute(FLAC__StreamDecoder *decoder, FLAC__uint64 sample);
 
+/** Index the frames from the current position to the end of the stream
+ *  without decoding them.  The input is read in large blocks and scanned
+ *  for frame headers; a header is only taken if it passes its CRC-8,
+ *  agrees with the STREAMINFO block and starts exactly where the previous
+ *  frame's samples end, so the scan never needs to parse subframes.  The
+ *  frames found are added to the index used by
+ *  FLAC__stream_decoder_seek_absolute(), whether or not
+ *  FLAC__stream_decoder_set_frame_indexing() is on.  Afterwards the input
+ *  is put back where it was and the decoder flushed, which, as with a
+ *  seek, turns off MD5 checking.
+ *
+ *  This function should only be called when the stream has advanced
+ *  past all the metadata and before the next frame has been synced,
+ *  i.e. in the FLAC__STREAM_DECODER_SEARCH_FOR_FRAME_SYNC or
+ *  FLAC__STREAM_DECODER_END_OF_STREAM state.
+ *
+ * \param  decoder  A decoder instance of a native FLAC stream with
+ *                  seek, tell and length callbacks.
+ * \assert
+ *    \code decoder != NULL \endcode
+ * \retval FLAC__bool
+ *    \c false if the stream cannot be indexed, or if a read, seek or
+ *    memory allocation error occurred, else \c true.  A scan that stops
+ *    at a damaged frame still returns \c true and keeps the frames found
+ *    before it.
+ */
+FLAC_API FLAC__bool FLAC__stream_decoder_build_frame_index(FLAC__StreamDecoder *decoder);
+
+/** Create a SEEKTABLE from the frame index.  The table can be written
+ *  to the stream with the metadata interface (see \link flac_metadata
+ *  metadata \endlink) so that later decoders seek quickly without an
+ *  index of their own.
+ *
+ * \param  decoder     A decoder instance to query.
+ * \param  max_points  The most seek points to emit, or \c 0 for one
+ *                     point per indexed frame.  With fewer points than
+ *                     frames, the points are spread evenly over the
+ *                     samples of the stream.
+ * \assert
+ *    \code decoder != NULL \endcode
+ * \retval FLAC__StreamMetadata*
+ *    A new SEEKTABLE object the caller must free with
+ *    FLAC__metadata_object_delete(), or \c NULL if the index is empty or
+ *    memory allocation failed.
+ */
+FLAC_API FLAC__StreamMetadata *FLAC__stream_decoder_get_frame_index_seek_table(const FLAC__StreamDecoder *decoder, unsigned max_points);
+
+/** Write the frame index to \a file, e.g. a sidecar file stored next to
+ *  the stream.  The STREAMINFO total sample count and MD5 signature are
+ *  written along with the index, so FLAC__stream_decoder_load_frame_index()
+ *  can reject an index that belongs to a different stream.
+ *
+ * \param  decoder  A decoder instance to query.
+ * \param  file     An open file, positioned where the index should go.
+ *                  The file is not closed.
+ * \assert
+ *    \code decoder != NULL \endcode
+ *    \code file != NULL \endcode
+ * \retval FLAC__bool
+ *    \c false if the decoder has not read the STREAMINFO block or a
+ *    write failed, else \c true.
+ */
+FLAC_API FLAC__bool FLAC__stream_decoder_save_frame_index(const FLAC__StreamDecoder *decoder, FILE *file);
+
+/** Replace the frame index with one written by
+ *  FLAC__stream_decoder_save_frame_index().  The STREAMINFO block must
+ *  have been read, e.g. with
+ *  FLAC__stream_decoder_process_until_end_of_metadata().
+ *
+ * \param  decoder  A decoder instance to set.
+ * \param  file     An open file, positioned at the saved index.  The
+ *                  file is not closed.
+ * \assert
+ *    \code decoder != NULL \endcode
+ *    \code file != NULL \endcode
+ * \retval FLAC__bool
+ *    \c true if the index was loaded.  \c false if the STREAMINFO block
+ *    has not been read, the saved index is malformed or belongs to a
+ *    different stream, or a read or memory allocation error occurred;
+ *    the index is then left unchanged.
+ */
+FLAC_API FLAC__bool FLAC__stream_decoder_load_frame_index(FLAC__StreamDecoder *decoder, FILE *file);
+
 /* \} */
 
 #ifdef __cplusplus
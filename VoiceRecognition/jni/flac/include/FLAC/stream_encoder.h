@@ -96,7 +96,9 @@ extern "C" {
  *   metadata, then the following should also be called:
  *   - FLAC__stream_encoder_set_compression_level()
  *   - FLAC__stream_encoder_set_verify()
+ *   - FLAC__stream_encoder_set_verify_decode_interval()
  *   - FLAC__stream_encoder_set_metadata()
+ *   - FLAC__stream_encoder_set_num_threads() (to spread encoding over several cores)
  * - The rest of the set functions should only be called if the client needs
  *   exact control over how the audio is compressed; thorough understanding
  *   of the FLAC format is necessary to achieve good results.
@@ -106,8 +108,9 @@ extern "C" {
  *     or FLAC__stream_encoder_init_file() for native FLAC
  *   - FLAC__stream_encoder_init_ogg_stream() or FLAC__stream_encoder_init_ogg_FILE()
  *     or FLAC__stream_encoder_init_ogg_file() for Ogg FLAC
- * - The program calls FLAC__stream_encoder_process() or
- *   FLAC__stream_encoder_process_interleaved() to encode data, which
+ * - The program calls FLAC__stream_encoder_process(),
+ *   FLAC__stream_encoder_process_interleaved() or
+ *   FLAC__stream_encoder_process_interleaved_int16() to encode data, which
  *   subsequently calls the callbacks when there is encoder data ready
  *   to be written.
  * - The program finishes the encoding with FLAC__stream_encoder_finish(),
@@ -229,6 +232,12 @@ extern "C" {
  */
 
 
+/** The maximum number of threads accepted by
+ *  FLAC__stream_encoder_set_num_threads().
+ */
+#define FLAC__STREAM_ENCODER_MAX_THREADS (64u)
+
+
 /** State values for a FLAC__StreamEncoder.
  *
  * The encoder's state can be obtained by calling FLAC__stream_encoder_get_state().
@@ -742,6 +751,29 @@ FLAC_API FLAC__bool FLAC__stream_encoder_set_ogg_serial_number(FLAC__StreamEncod
  */
 FLAC_API FLAC__bool FLAC__stream_encoder_set_verify(FLAC__StreamEncoder *encoder, FLAC__bool value);
 
+/** Set how often the "verify" decoder runs.  With verification on, only
+ *  every \a value th frame is fed through the internal decoder, starting
+ *  with the first; \c 0 means none.  Every other frame is checked more
+ *  cheaply by rebuilding each subframe from its own predictor and residual
+ *  and comparing it against the signal it was computed from.  That check
+ *  does not catch errors in the residual coding or framing, which is what
+ *  the sampled decoding is for.
+ *
+ *  A mismatch found either way is reported the same, through
+ *  FLAC__stream_encoder_get_verify_decoder_error_stats(); for a subframe
+ *  check the channel and values are those of the subframe's own signal
+ *  (e.g. the side channel), with wasted bits removed.
+ *
+ * \default \c 1
+ * \param  encoder  An encoder instance to set.
+ * \param  value    See above.
+ * \assert
+ *    \code encoder != NULL \endcode
+ * \retval FLAC__bool
+ *    \c false if the encoder is already initialized, else \c true.
+ */
+FLAC_API FLAC__bool FLAC__stream_encoder_set_verify_decode_interval(FLAC__StreamEncoder *encoder, unsigned value);
+
 /** Set the <A HREF="../format.html#subset">Subset</A> flag.  If \c true,
  *  the encoder will comply with the Subset and will check the
  *  settings during FLAC__stream_encoder_init_*() to see if all settings
@@ -808,8 +840,10 @@ FLAC_API FLAC__bool FLAC__stream_encoder_set_sample_rate(FLAC__StreamEncoder *en
  * suitable for most applications.
  *
  * Currently the levels range from \c 0 (fastest, least compression) to
- * \c 8 (slowest, most compression).  A value larger than \c 8 will be
- * treated as \c 8.
+ * \c 8 (slowest, most compression).  A value larger than \c 9 will be
+ * treated as \c 8.  Level \c 9 is not stronger than level \c 8: it runs
+ * the level \c 8 search with FLAC__stream_encoder_set_do_early_termination(),
+ * keeping most of its compression at a cost between levels \c 5 and \c 8.
  *
  * This function automatically calls the following other \c _set_
  * functions with appropriate values, so the client does not need to
@@ -822,6 +856,7 @@ FLAC_API FLAC__bool FLAC__stream_encoder_set_sample_rate(FLAC__StreamEncoder *en
  * - FLAC__stream_encoder_set_do_qlp_coeff_prec_search()
  * - FLAC__stream_encoder_set_do_escape_coding()
  * - FLAC__stream_encoder_set_do_exhaustive_model_search()
+ * - FLAC__stream_encoder_set_do_early_termination()
  * - FLAC__stream_encoder_set_min_residual_partition_order()
  * - FLAC__stream_encoder_set_max_residual_partition_order()
  * - FLAC__stream_encoder_set_rice_parameter_search_dist()
@@ -838,19 +873,21 @@ FLAC_API FLAC__bool FLAC__stream_encoder_set_sample_rate(FLAC__StreamEncoder *en
  *  <td>qlp coeff prec search<td>
  *  <td>escape coding<td>
  *  <td>exhaustive model search<td>
+ *  <td>early termination<td>
  *  <td>min residual partition order<td>
  *  <td>max residual partition order<td>
  *  <td>rice parameter search dist<td>
  * </tr>
- * <tr>  <td><b>0</b><td>  <td>false<td>  <td>false<td>  <td>tukey(0.5)<td>  <td>0<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>3<td>  <td>0<td>  </tr>
- * <tr>  <td><b>1</b><td>  <td>true<td>   <td>true<td>   <td>tukey(0.5)<td>  <td>0<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>3<td>  <td>0<td>  </tr>
- * <tr>  <td><b>2</b><td>  <td>true<td>   <td>false<td>  <td>tukey(0.5)<td>  <td>0<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>3<td>  <td>0<td>  </tr>
- * <tr>  <td><b>3</b><td>  <td>false<td>  <td>false<td>  <td>tukey(0.5)<td>  <td>6<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>4<td>  <td>0<td>  </tr>
- * <tr>  <td><b>4</b><td>  <td>true<td>   <td>true<td>   <td>tukey(0.5)<td>  <td>8<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>4<td>  <td>0<td>  </tr>
- * <tr>  <td><b>5</b><td>  <td>true<td>   <td>false<td>  <td>tukey(0.5)<td>  <td>8<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>5<td>  <td>0<td>  </tr>
- * <tr>  <td><b>6</b><td>  <td>true<td>   <td>false<td>  <td>tukey(0.5)<td>  <td>8<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>6<td>  <td>0<td>  </tr>
- * <tr>  <td><b>7</b><td>  <td>true<td>   <td>false<td>  <td>tukey(0.5)<td>  <td>8<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>true<td>   <td>0<td>  <td>6<td>  <td>0<td>  </tr>
- * <tr>  <td><b>8</b><td>  <td>true<td>   <td>false<td>  <td>tukey(0.5)<td>  <td>12<td>  <td>0<td>  <td>false<td>  <td>false<td>  <td>true<td>   <td>0<td>  <td>6<td>  <td>0<td>  </tr>
+ * <tr>  <td><b>0</b><td>  <td>false<td>  <td>false<td>  <td>tukey(0.5)<td>  <td>0<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>3<td>  <td>0<td>  </tr>
+ * <tr>  <td><b>1</b><td>  <td>true<td>   <td>true<td>   <td>tukey(0.5)<td>  <td>0<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>3<td>  <td>0<td>  </tr>
+ * <tr>  <td><b>2</b><td>  <td>true<td>   <td>false<td>  <td>tukey(0.5)<td>  <td>0<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>3<td>  <td>0<td>  </tr>
+ * <tr>  <td><b>3</b><td>  <td>false<td>  <td>false<td>  <td>tukey(0.5)<td>  <td>6<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>4<td>  <td>0<td>  </tr>
+ * <tr>  <td><b>4</b><td>  <td>true<td>   <td>true<td>   <td>tukey(0.5)<td>  <td>8<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>4<td>  <td>0<td>  </tr>
+ * <tr>  <td><b>5</b><td>  <td>true<td>   <td>false<td>  <td>tukey(0.5)<td>  <td>8<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>5<td>  <td>0<td>  </tr>
+ * <tr>  <td><b>6</b><td>  <td>true<td>   <td>false<td>  <td>tukey(0.5)<td>  <td>8<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>false<td>  <td>0<td>  <td>6<td>  <td>0<td>  </tr>
+ * <tr>  <td><b>7</b><td>  <td>true<td>   <td>false<td>  <td>tukey(0.5)<td>  <td>8<td>   <td>0<td>  <td>false<td>  <td>false<td>  <td>true<td>   <td>false<td>  <td>0<td>  <td>6<td>  <td>0<td>  </tr>
+ * <tr>  <td><b>8</b><td>  <td>true<td>   <td>false<td>  <td>tukey(0.5)<td>  <td>12<td>  <td>0<td>  <td>false<td>  <td>false<td>  <td>true<td>   <td>false<td>  <td>0<td>  <td>6<td>  <td>0<td>  </tr>
+ * <tr>  <td><b>9</b><td>  <td>true<td>   <td>false<td>  <td>tukey(0.5)<td>  <td>12<td>  <td>0<td>  <td>false<td>  <td>false<td>  <td>true<td>   <td>true<td>   <td>0<td>  <td>6<td>  <td>0<td>  </tr>
  * </table>
  *
  * \default \c 5
@@ -1023,6 +1060,26 @@ FLAC_API FLAC__bool FLAC__stream_encoder_set_do_escape_coding(FLAC__StreamEncode
  */
 FLAC_API FLAC__bool FLAC__stream_encoder_set_do_exhaustive_model_search(FLAC__StreamEncoder *encoder, FLAC__bool value);
 
+/** Set to \c true to let the encoder cut its model search short once
+ *  the estimated or actual size of the candidates stops improving: fixed
+ *  and LPC orders estimated well above the best, apodization windows that
+ *  predict no better than an earlier one, higher LPC orders after two
+ *  that didn't help, and higher QLP coefficient precisions once the size
+ *  grows.  This mostly pays off together with
+ *  FLAC__stream_encoder_set_do_exhaustive_model_search() and
+ *  FLAC__stream_encoder_set_do_qlp_coeff_prec_search(), at the cost of
+ *  occasionally missing the best model.
+ *
+ * \default \c false
+ * \param  encoder  An encoder instance to set.
+ * \param  value    See above.
+ * \assert
+ *    \code encoder != NULL \endcode
+ * \retval FLAC__bool
+ *    \c false if the encoder is already initialized, else \c true.
+ */
+FLAC_API FLAC__bool FLAC__stream_encoder_set_do_early_termination(FLAC__StreamEncoder *encoder, FLAC__bool value);
+
 /** Set the minimum partition order to search when coding the residual.
  *  This is used in tandem with
  *  FLAC__stream_encoder_set_max_residual_partition_order().
@@ -1134,7 +1191,10 @@ FLAC_API FLAC__bool FLAC__stream_encoder_set_total_samples_estimate(FLAC__Stream
  * FLAC__stream_encoder_init*_file() or FLAC__stream_encoder_init*_FILE()),
  * then while it is encoding the encoder will fill the stream offsets in
  * for you and when encoding is finished, it will seek back and write the
- * real values into the SEEKTABLE block in the stream.  There are helper
+ * real values into the SEEKTABLE block in the stream.  Template points
+ * beyond the end of the stream, e.g. from a template sized for a longer
+ * stream than was actually encoded, are written as placeholder points.
+ * There are helper
  * routines for manipulating seektable template blocks; see metadata.h:
  * FLAC__metadata_object_seektable_template_*().  If the client does
  * not support seeking, the SEEKTABLE will have inaccurate offsets which
@@ -1180,6 +1240,41 @@ FLAC_API FLAC__bool FLAC__stream_encoder_set_total_samples_estimate(FLAC__Stream
  */
 FLAC_API FLAC__bool FLAC__stream_encoder_set_metadata(FLAC__StreamEncoder *encoder, FLAC__StreamMetadata **metadata, unsigned num_blocks);
 
+/** Set the number of threads used to encode frames.
+ *  With a value greater than \c 1, full blocks are handed to a pool of
+ *  worker threads which encode them concurrently, each into its own
+ *  frame buffer.  The frames are then written, MD5-summed and verified
+ *  strictly in stream order on the thread that calls
+ *  FLAC__stream_encoder_process() or
+ *  FLAC__stream_encoder_process_interleaved(), so the write callback
+ *  is never called from a worker thread and sees exactly the same
+ *  sequence of frames as with a single thread.
+ *
+ * \note
+ * Up to \a value frames may be in flight at any time, so the write
+ * callback can lag the input by as many blocks.  All outstanding frames
+ * are written by FLAC__stream_encoder_finish().
+ *
+ * \note
+ * With loose mid-side stereo, each worker adapts its channel assignment
+ * only to the frames it encodes itself, so the encoded output may differ
+ * slightly from the single-threaded encoder.  It is equally valid.
+ *
+ * \note
+ * Libraries built without thread support only accept \c 1.
+ *
+ * \default \c 1
+ * \param  encoder  An encoder instance to set.
+ * \param  value    The number of threads; between \c 1 and
+ *                  \c FLAC__STREAM_ENCODER_MAX_THREADS.
+ * \assert
+ *    \code encoder != NULL \endcode
+ * \retval FLAC__bool
+ *    \c false if the encoder is already initialized, or if \a value is
+ *    out of range, else \c true.
+ */
+FLAC_API FLAC__bool FLAC__stream_encoder_set_num_threads(FLAC__StreamEncoder *encoder, unsigned value);
+
 /** Get the current encoder state.
  *
  * \param  encoder  An encoder instance to query.
@@ -1244,6 +1339,16 @@ FLAC_API void FLAC__stream_encoder_get_verify_decoder_error_stats(const FLAC__St
  */
 FLAC_API FLAC__bool FLAC__stream_encoder_get_verify(const FLAC__StreamEncoder *encoder);
 
+/** Get the interval at which the "verify" decoder runs.
+ *
+ * \param  encoder  An encoder instance to query.
+ * \assert
+ *    \code encoder != NULL \endcode
+ * \retval unsigned
+ *    See FLAC__stream_encoder_set_verify_decode_interval().
+ */
+FLAC_API unsigned FLAC__stream_encoder_get_verify_decode_interval(const FLAC__StreamEncoder *encoder);
+
 /** Get the <A HREF="../format.html#subset>Subset</A> flag.
  *
  * \param  encoder  An encoder instance to query.
@@ -1364,6 +1469,16 @@ FLAC_API FLAC__bool FLAC__stream_encoder_get_do_escape_coding(const FLAC__Stream
  */
 FLAC_API FLAC__bool FLAC__stream_encoder_get_do_exhaustive_model_search(const FLAC__StreamEncoder *encoder);
 
+/** Get the early termination flag.
+ *
+ * \param  encoder  An encoder instance to query.
+ * \assert
+ *    \code encoder != NULL \endcode
+ * \retval FLAC__bool
+ *    See FLAC__stream_encoder_set_do_early_termination().
+ */
+FLAC_API FLAC__bool FLAC__stream_encoder_get_do_early_termination(const FLAC__StreamEncoder *encoder);
+
 /** Get the minimum residual partition order setting.
  *
  * \param  encoder  An encoder instance to query.
@@ -1407,6 +1522,16 @@ FLAC_API unsigned FLAC__stream_encoder_get_rice_parameter_search_dist(const FLAC
  */
 FLAC_API FLAC__uint64 FLAC__stream_encoder_get_total_samples_estimate(const FLAC__StreamEncoder *encoder);
 
+/** Get the number of encoding threads.
+ *
+ * \param  encoder  An encoder instance to query.
+ * \assert
+ *    \code encoder != NULL \endcode
+ * \retval unsigned
+ *    See FLAC__stream_encoder_set_num_threads().
+ */
+FLAC_API unsigned FLAC__stream_encoder_get_num_threads(const FLAC__StreamEncoder *encoder);
+
 /** Initialize the encoder instance to encode native FLAC streams.
  *
  *  This flavor of initialization sets up the encoder to encode to a
@@ -1688,6 +1813,11 @@ FLAC_API FLAC__StreamEncoderInitStatus FLAC__stream_encoder_init_ogg_file(FLAC__
  *  but it is good practice to match every FLAC__stream_encoder_init_*()
  *  with a FLAC__stream_encoder_finish().
  *
+ *  The signal and workspace buffers are not released; they are reused
+ *  if the encoder is initialized again, which makes encoding many short
+ *  streams with one instance cheaper than creating an instance for each.
+ *  FLAC__stream_encoder_delete() frees them.
+ *
  * \param  encoder  An uninitialized encoder instance.
  * \assert
  *    \code encoder != NULL \endcode
@@ -1759,6 +1889,32 @@ FLAC_API FLAC__bool FLAC__stream_encoder_process(FLAC__StreamEncoder *encoder, c
  */
 FLAC_API FLAC__bool FLAC__stream_encoder_process_interleaved(FLAC__StreamEncoder *encoder, const FLAC__int32 buffer[], unsigned samples);
 
+/** Submit 16-bit data for encoding.
+ *  This version is like FLAC__stream_encoder_process_interleaved(),
+ *  except that the channel-interleaved input is given as 16-bit
+ *  samples, e.g. native-endian PCM as delivered by most capture APIs.
+ *  The samples are widened while they are deinterleaved into the
+ *  encoder's internal buffers, so the client does not have to convert
+ *  its data to \c FLAC__int32 first.
+ *
+ *  This may only be used if the resolution set by
+ *  FLAC__stream_encoder_set_bits_per_sample() is 16 bits or less.
+ *
+ * \param  encoder  An initialized encoder instance in the OK state.
+ * \param  buffer   An array of channel-interleaved 16-bit data.
+ * \param  samples  The number of samples in one channel, the same as for
+ *                  FLAC__stream_encoder_process_interleaved().
+ * \assert
+ *    \code encoder != NULL \endcode
+ *    \code FLAC__stream_encoder_get_state(encoder) == FLAC__STREAM_ENCODER_OK \endcode
+ *    \code FLAC__stream_encoder_get_bits_per_sample(encoder) <= 16 \endcode
+ * \retval FLAC__bool
+ *    \c true if successful, else \c false; in this case, check the
+ *    encoder state with FLAC__stream_encoder_get_state() to see what
+ *    went wrong.
+ */
+FLAC_API FLAC__bool FLAC__stream_encoder_process_interleaved_int16(FLAC__StreamEncoder *encoder, const FLAC__int16 buffer[], unsigned samples);
+
 /* \} */
 
 #ifdef __cplusplus
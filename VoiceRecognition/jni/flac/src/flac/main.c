@@ -951,10 +951,9 @@ int parse_option(int short_option, const char *long_option, const char *option_a
 			case '6':
 			case '7':
 			case '8':
+			case '9':
 				add_compression_setting_unsigned(CST_COMPRESSION_LEVEL, short_option-'0');
 				break;
-			case '9':
-				return usage_error("ERROR: compression level '9' is reserved\n");
 			case 'V':
 				option_values.verify = true;
 				break;
@@ -1238,6 +1237,9 @@ void show_help(void)
 	printf("  -6, --compression-level-6          Synonymous with -l 8 -b 4096 -m -r 6\n");
 	printf("  -7, --compression-level-7          Synonymous with -l 8 -b 4096 -m -e -r 6\n");
 	printf("  -8, --compression-level-8, --best  Synonymous with -l 12 -b 4096 -m -e -r 6\n");
+	printf("  -9, --compression-level-9          Like -8, but cuts the model search short\n");
+	printf("                                     once the size stops improving; faster\n");
+	printf("                                     than -8 at nearly the same size\n");
 	printf("  -b, --blocksize=#                  Specify blocksize in samples\n");
 	printf("  -m, --mid-side                     Try mid-side coding for each frame\n");
 	printf("  -M, --adaptive-mid-side            Adaptive mid-side coding for all frames\n");
@@ -1532,6 +1534,9 @@ void show_explain(void)
 	printf("  -6, --compression-level-6          Synonymous with -l 8 -b 4096 -m -r 6\n");
 	printf("  -7, --compression-level-7          Synonymous with -l 8 -b 4096 -m -e -r 6\n");
 	printf("  -8, --compression-level-8, --best  Synonymous with -l 12 -b 4096 -m -e -r 6\n");
+	printf("  -9, --compression-level-9          Like -8, but cuts the model search short\n");
+	printf("                                     once the size stops improving; faster\n");
+	printf("                                     than -8 at nearly the same size\n");
 	printf("  -m, --mid-side                     Try mid-side coding for each frame\n");
 	printf("                                     (stereo only)\n");
 	printf("  -M, --adaptive-mid-side            Adaptive mid-side coding for all frames\n");
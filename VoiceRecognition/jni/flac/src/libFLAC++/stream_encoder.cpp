@@ -76,6 +76,12 @@ namespace FLAC {
 			return (bool)::FLAC__stream_encoder_set_verify(encoder_, value);
 		}
 
+		bool Stream::set_verify_decode_interval(unsigned value)
+		{
+			FLAC__ASSERT(is_valid());
+			return (bool)::FLAC__stream_encoder_set_verify_decode_interval(encoder_, value);
+		}
+
 		bool Stream::set_streamable_subset(bool value)
 		{
 			FLAC__ASSERT(is_valid());
@@ -160,6 +166,12 @@ namespace FLAC {
 			return (bool)::FLAC__stream_encoder_set_do_exhaustive_model_search(encoder_, value);
 		}
 
+		bool Stream::set_do_early_termination(bool value)
+		{
+			FLAC__ASSERT(is_valid());
+			return (bool)::FLAC__stream_encoder_set_do_early_termination(encoder_, value);
+		}
+
 		bool Stream::set_min_residual_partition_order(unsigned value)
 		{
 			FLAC__ASSERT(is_valid());
@@ -239,6 +251,12 @@ namespace FLAC {
 			return (bool)::FLAC__stream_encoder_get_verify(encoder_);
 		}
 
+		unsigned Stream::get_verify_decode_interval() const
+		{
+			FLAC__ASSERT(is_valid());
+			return ::FLAC__stream_encoder_get_verify_decode_interval(encoder_);
+		}
+
 		bool Stream::get_streamable_subset() const
 		{
 			FLAC__ASSERT(is_valid());
@@ -311,6 +329,12 @@ namespace FLAC {
 			return (bool)::FLAC__stream_encoder_get_do_exhaustive_model_search(encoder_);
 		}
 
+		bool Stream::get_do_early_termination() const
+		{
+			FLAC__ASSERT(is_valid());
+			return (bool)::FLAC__stream_encoder_get_do_early_termination(encoder_);
+		}
+
 		unsigned Stream::get_min_residual_partition_order() const
 		{
 			FLAC__ASSERT(is_valid());
@@ -49,32 +49,60 @@
 #include "private/crc.h"
 #include "FLAC/assert.h"
 
-/* Things should be fastest when this matches the machine word size */
+/* Things should be fastest when this matches the machine word size; see ENABLE_64_BIT_WORDS in private/cpu.h */
 /* WATCHOUT: if you change this you must also change the following #defines down to COUNT_ZERO_MSBS below to match */
 /* WATCHOUT: there are a few places where the code will not work unless brword is >= 32 bits wide */
 /*           also, some sections currently only have fast versions for 4 or 8 bytes per word */
+#if ENABLE_64_BIT_WORDS == 0
 typedef FLAC__uint32 brword;
 #define FLAC__BYTES_PER_WORD 4
 #define FLAC__BITS_PER_WORD 32
 #define FLAC__WORD_ALL_ONES ((FLAC__uint32)0xffffffff)
+#else
+typedef FLAC__uint64 brword;
+#define FLAC__BYTES_PER_WORD 8
+#define FLAC__BITS_PER_WORD 64
+#define FLAC__WORD_ALL_ONES (~(FLAC__uint64)0)
+#endif
 /* SWAP_BE_WORD_TO_HOST swaps bytes in a brword (which is always big-endian) if necessary to match host byte order */
 #if WORDS_BIGENDIAN
 #define SWAP_BE_WORD_TO_HOST(x) (x)
-#else
+#elif ENABLE_64_BIT_WORDS == 0
 #ifdef _MSC_VER
 #define SWAP_BE_WORD_TO_HOST(x) local_swap32_(x)
 #else
 #define SWAP_BE_WORD_TO_HOST(x) ntohl(x)
 #endif
+#elif defined _MSC_VER
+#define SWAP_BE_WORD_TO_HOST(x) _byteswap_uint64(x)
+#elif defined __GNUC__ && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 3))
+#define SWAP_BE_WORD_TO_HOST(x) __builtin_bswap64(x)
+#else
+#define SWAP_BE_WORD_TO_HOST(x) (((FLAC__uint64)ntohl((FLAC__uint32)(x)) << 32) | ntohl((FLAC__uint32)((x) >> 32)))
 #endif
-/* counts the # of zero MSBs in a word */
-#define COUNT_ZERO_MSBS(word) ( \
+/* counts the # of zero MSBs in a 32-bit value */
+#define COUNT_ZERO_MSBS32(word) ( \
 	(word) <= 0xffff ? \
 		( (word) <= 0xff? byte_to_unary_table[word] + 24 : byte_to_unary_table[(word) >> 8] + 16 ) : \
 		( (word) <= 0xffffff? byte_to_unary_table[word >> 16] + 8 : byte_to_unary_table[(word) >> 24] ) \
 )
 /* this alternate might be slightly faster on some systems/compilers: */
 #define COUNT_ZERO_MSBS2(word) ( (word) <= 0xff ? byte_to_unary_table[word] + 24 : ((word) <= 0xffff ? byte_to_unary_table[(word) >> 8] + 16 : ((word) <= 0xffffff ? byte_to_unary_table[(word) >> 16] + 8 : byte_to_unary_table[(word) >> 24])) )
+/* counts the # of zero MSBs in a nonzero 64-bit value */
+#if defined __GNUC__ && (__GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4))
+#define COUNT_ZERO_MSBS64(x) ((unsigned)__builtin_clzll(x))
+#else
+#define COUNT_ZERO_MSBS64(x) ( (FLAC__uint32)((x) >> 32) ? COUNT_ZERO_MSBS32((FLAC__uint32)((x) >> 32)) : COUNT_ZERO_MSBS32((FLAC__uint32)(x)) + 32 )
+#define NEED_BYTE_TO_UNARY_TABLE 1
+#endif
+/* counts the # of zero MSBs in a word */
+#if ENABLE_64_BIT_WORDS == 0
+#define COUNT_ZERO_MSBS(word) COUNT_ZERO_MSBS32(word)
+#undef NEED_BYTE_TO_UNARY_TABLE
+#define NEED_BYTE_TO_UNARY_TABLE 1
+#else
+#define COUNT_ZERO_MSBS(word) COUNT_ZERO_MSBS64(word)
+#endif
 
 
 /*
@@ -93,6 +121,8 @@ typedef FLAC__uint32 brword;
  */
 static const unsigned FLAC__BITREADER_DEFAULT_CAPACITY = 65536u / FLAC__BITS_PER_WORD; /* in words */
 
+/* only COUNT_ZERO_MSBS32() looks at this */
+#ifdef NEED_BYTE_TO_UNARY_TABLE
 static const unsigned char byte_to_unary_table[] = {
 	8, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4,
 	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
@@ -111,6 +141,7 @@ static const unsigned char byte_to_unary_table[] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
+#endif
 
 #ifdef min
 #undef min
@@ -147,6 +178,8 @@ struct FLAC__BitReader {
 	FLAC__BitReaderReadCallback read_callback;
 	void *client_data;
 	FLAC__CPUInfo cpu_info;
+	unsigned crc16_offset; /* the number of words in the current buffer that are already CRC'd, or should not be */
+	unsigned (*crc16_update_words)(const brword *words, unsigned len, unsigned crc);
 };
 
 #ifdef _MSC_VER
@@ -204,6 +237,22 @@ static FLaC__INLINE void crc16_update_word_(FLAC__BitReader *br, brword word)
 	br->crc16_align = 0;
 }
 
+/*
+ * The CRC is not updated as words are consumed, but in bulk over all words
+ * consumed since the last time: before the buffer is refilled and when the
+ * CRC is asked for.
+ */
+static void crc16_update_block_(FLAC__BitReader *br)
+{
+	if(br->consumed_words > br->crc16_offset && br->crc16_align)
+		crc16_update_word_(br, br->buffer[br->crc16_offset++]);
+
+	if(br->consumed_words > br->crc16_offset)
+		br->read_crc16 = br->crc16_update_words(br->buffer + br->crc16_offset, br->consumed_words - br->crc16_offset, br->read_crc16);
+
+	br->crc16_offset = br->consumed_words;
+}
+
 /* would be static except it needs to be called by asm routines */
 FLAC__bool bitreader_read_from_client_(FLAC__BitReader *br)
 {
@@ -213,6 +262,9 @@ FLAC__bool bitreader_read_from_client_(FLAC__BitReader *br)
 
 	/* first shift the unconsumed buffer data toward the front as much as possible */
 	if(br->consumed_words > 0) {
+		crc16_update_block_(br);
+		br->crc16_offset = 0;
+
 		start = br->consumed_words;
 		end = br->words + (br->bytes? 1:0);
 		memmove(br->buffer, br->buffer+start, FLAC__BYTES_PER_WORD * (end - start));
@@ -336,6 +388,16 @@ FLAC__bool FLAC__bitreader_init(FLAC__BitReader *br, FLAC__CPUInfo cpu, FLAC__Bi
 	br->read_callback = rcb;
 	br->client_data = cd;
 	br->cpu_info = cpu;
+	br->crc16_offset = 0;
+	{
+		FLAC__CPUDispatch dispatch;
+		FLAC__cpu_dispatch(&cpu, &dispatch);
+#if FLAC__BYTES_PER_WORD == 4
+		br->crc16_update_words = 0 != dispatch.crc16_update_words32? dispatch.crc16_update_words32 : FLAC__crc16_update_words32;
+#else
+		br->crc16_update_words = 0 != dispatch.crc16_update_words64? dispatch.crc16_update_words64 : FLAC__crc16_update_words64;
+#endif
+	}
 
 	return true;
 }
@@ -358,6 +420,7 @@ FLAC__bool FLAC__bitreader_clear(FLAC__BitReader *br)
 {
 	br->words = br->bytes = 0;
 	br->consumed_words = br->consumed_bits = 0;
+	br->crc16_offset = 0;
 	return true;
 }
 
@@ -376,7 +439,7 @@ void FLAC__bitreader_dump(const FLAC__BitReader *br, FILE *out)
 				if(i < br->consumed_words || (i == br->consumed_words && j < br->consumed_bits))
 					fprintf(out, ".");
 				else
-					fprintf(out, "%01u", br->buffer[i] & (1 << (FLAC__BITS_PER_WORD-j-1)) ? 1:0);
+					fprintf(out, "%01u", br->buffer[i] & ((brword)1 << (FLAC__BITS_PER_WORD-j-1)) ? 1:0);
 			fprintf(out, "\n");
 		}
 		if(br->bytes > 0) {
@@ -385,7 +448,7 @@ void FLAC__bitreader_dump(const FLAC__BitReader *br, FILE *out)
 				if(i < br->consumed_words || (i == br->consumed_words && j < br->consumed_bits))
 					fprintf(out, ".");
 				else
-					fprintf(out, "%01u", br->buffer[i] & (1 << (br->bytes*8-j-1)) ? 1:0);
+					fprintf(out, "%01u", br->buffer[i] & ((brword)1 << (br->bytes*8-j-1)) ? 1:0);
 			fprintf(out, "\n");
 		}
 	}
@@ -398,6 +461,7 @@ void FLAC__bitreader_reset_read_crc16(FLAC__BitReader *br, FLAC__uint16 seed)
 	FLAC__ASSERT((br->consumed_bits & 7) == 0);
 
 	br->read_crc16 = (unsigned)seed;
+	br->crc16_offset = br->consumed_words;
 	br->crc16_align = br->consumed_bits;
 }
 
@@ -406,6 +470,8 @@ FLAC__uint16 FLAC__bitreader_get_read_crc16(FLAC__BitReader *br)
 	FLAC__ASSERT(0 != br);
 	FLAC__ASSERT(0 != br->buffer);
 	FLAC__ASSERT((br->consumed_bits & 7) == 0);
+
+	crc16_update_block_(br);
 	FLAC__ASSERT(br->crc16_align <= br->consumed_bits);
 
 	/* CRC any tail bytes in a partially-consumed word */
@@ -466,7 +532,6 @@ FLaC__INLINE FLAC__bool FLAC__bitreader_read_raw_uint32(FLAC__BitReader *br, FLA
 			}
 			*val = word & (FLAC__WORD_ALL_ONES >> br->consumed_bits);
 			bits -= n;
-			crc16_update_word_(br, word);
 			br->consumed_words++;
 			br->consumed_bits = 0;
 			if(bits) { /* if there are still bits left to read, there have to be less than 32 so they will all be in the next word */
@@ -485,7 +550,6 @@ FLaC__INLINE FLAC__bool FLAC__bitreader_read_raw_uint32(FLAC__BitReader *br, FLA
 			}
 			/* at this point 'bits' must be == FLAC__BITS_PER_WORD; because of previous assertions, it can't be larger */
 			*val = word;
-			crc16_update_word_(br, word);
 			br->consumed_words++;
 			return true;
 		}
@@ -730,7 +794,6 @@ FLaC__INLINE FLAC__bool FLAC__bitreader_read_unary_unsigned(FLAC__BitReader *br,
 				i++;
 				br->consumed_bits += i;
 				if(br->consumed_bits >= FLAC__BITS_PER_WORD) { /* faster way of testing if(br->consumed_bits == FLAC__BITS_PER_WORD) */
-					crc16_update_word_(br, br->buffer[br->consumed_words]);
 					br->consumed_words++;
 					br->consumed_bits = 0;
 				}
@@ -738,7 +801,6 @@ FLaC__INLINE FLAC__bool FLAC__bitreader_read_unary_unsigned(FLAC__BitReader *br,
 			}
 			else {
 				*val += FLAC__BITS_PER_WORD - br->consumed_bits;
-				crc16_update_word_(br, br->buffer[br->consumed_words]);
 				br->consumed_words++;
 				br->consumed_bits = 0;
 				/* didn't find stop bit yet, have to keep going... */
@@ -764,7 +826,7 @@ FLaC__INLINE FLAC__bool FLAC__bitreader_read_unary_unsigned(FLAC__BitReader *br,
 			}
 			else {
 				*val += end - br->consumed_bits;
-				br->consumed_bits += end;
+				br->consumed_bits = end;
 				FLAC__ASSERT(br->consumed_bits < FLAC__BITS_PER_WORD);
 				/* didn't find stop bit yet, have to keep going... */
 			}
@@ -802,9 +864,9 @@ FLAC__bool FLAC__bitreader_read_rice_signed(FLAC__BitReader *br, int *val, unsig
 	return true;
 }
 
-/* this is by far the most heavily used reader call.  it ain't pretty but it's fast */
+/* this is the slow path of FLAC__bitreader_read_rice_signed_block(), used near the end of the buffer where it may have to refill */
 /* a lot of the logic is copied, then adapted, from FLAC__bitreader_read_unary_unsigned() and FLAC__bitreader_read_raw_uint32() */
-FLAC__bool FLAC__bitreader_read_rice_signed_block(FLAC__BitReader *br, int vals[], unsigned nvals, unsigned parameter)
+static FLAC__bool read_rice_signed_block_slow_(FLAC__BitReader *br, int vals[], unsigned nvals, unsigned parameter)
 /* OPT: possibly faster version for use with MSVC */
 #ifdef _MSC_VER
 {
@@ -853,7 +915,6 @@ FLAC__bool FLAC__bitreader_read_rice_signed_block(FLAC__BitReader *br, int vals[
 					i++;
 					cbits += i;
 					if(cbits == FLAC__BITS_PER_WORD) {
-						crc16_update_word_(br, br->buffer[cwords]);
 						cwords++;
 						cbits = 0;
 					}
@@ -861,7 +922,6 @@ FLAC__bool FLAC__bitreader_read_rice_signed_block(FLAC__BitReader *br, int vals[
 				}
 				else {
 					uval += FLAC__BITS_PER_WORD - cbits;
-					crc16_update_word_(br, br->buffer[cwords]);
 					cwords++;
 					cbits = 0;
 					/* didn't find stop bit yet, have to keep going... */
@@ -888,7 +948,7 @@ FLAC__bool FLAC__bitreader_read_rice_signed_block(FLAC__BitReader *br, int vals[
 				}
 				else {
 					uval += end - cbits;
-					cbits += end;
+					cbits = end;
 					FLAC__ASSERT(cbits < FLAC__BITS_PER_WORD);
 					/* didn't find stop bit yet, have to keep going... */
 				}
@@ -933,7 +993,6 @@ break1:
 					uval <<= n;
 					uval |= word & (FLAC__WORD_ALL_ONES >> cbits);
 					bits -= n;
-					crc16_update_word_(br, word);
 					cwords++;
 					cbits = 0;
 					if(bits) { /* if there are still bits left to read, there have to be less than 32 so they will all be in the next word */
@@ -1036,7 +1095,6 @@ break2:
 					cbits += i;
 					cbits++; /* skip over stop bit */
 					if(cbits >= FLAC__BITS_PER_WORD) { /* faster way of testing if(cbits == FLAC__BITS_PER_WORD) */
-						crc16_update_word_(br, br->buffer[cwords]);
 						cwords++;
 						cbits = 0;
 					}
@@ -1044,7 +1102,6 @@ break2:
 				}
 				else {
 					uval += FLAC__BITS_PER_WORD - cbits;
-					crc16_update_word_(br, br->buffer[cwords]);
 					cwords++;
 					cbits = 0;
 					/* didn't find stop bit yet, have to keep going... */
@@ -1070,7 +1127,7 @@ break2:
 				}
 				else {
 					uval += end - cbits;
-					cbits += end;
+					cbits = end;
 					FLAC__ASSERT(cbits < FLAC__BITS_PER_WORD);
 					/* didn't find stop bit yet, have to keep going... */
 				}
@@ -1123,7 +1180,6 @@ break1:
 					else {
 						uval <<= n;
 						uval |= word & (FLAC__WORD_ALL_ONES >> cbits);
-						crc16_update_word_(br, word);
 						cwords++;
 						cbits = parameter - n;
 						if(cbits) { /* parameter > n, i.e. if there are still bits left to read, there have to be less than 32 so they will all be in the next word */
@@ -1177,6 +1233,80 @@ break1:
 }
 #endif
 
+#if FLAC__BITS_PER_WORD == 32
+#define HALF_WORD_(buffer, n) (buffer)[n]
+#else
+/* the n'th 32 bits of the buffer, with 64-bit words */
+#define HALF_WORD_(buffer, n) ((FLAC__uint32)((buffer)[(n) >> 1] >> (~(n) & 1) * 32))
+#endif
+
+/* this is by far the most heavily used reader call.
+ *
+ * Codewords are decoded from a 64-bit cache holding the next 33 to 64
+ * unconsumed bits, left-justified; it is topped up with the next 32
+ * bits of the buffer whenever 32 bits or fewer are left.  Since
+ * parameter < 32, any codeword with a unary part shorter than 32 bits is
+ * then guaranteed to be in the cache, and decoding it takes a count of
+ * the leading zeros and a few shifts, with no branches besides the
+ * refill.  Only when the words in the buffer run out or a codeword does
+ * not fit in the cache does the rest of the block go through
+ * read_rice_signed_block_slow_(), which can read from the client.
+ */
+FLAC__bool FLAC__bitreader_read_rice_signed_block(FLAC__BitReader *br, int vals[], unsigned nvals, unsigned parameter)
+{
+	FLAC__uint64 cache;
+	unsigned avail; /* the # of bits in cache still to be consumed */
+	unsigned next; /* the next 32 bits of the buffer to go into cache, counted in 32-bit units */
+	unsigned pos;
+	const unsigned halves = br->words * (FLAC__BITS_PER_WORD / 32);
+
+	FLAC__ASSERT(0 != br);
+	FLAC__ASSERT(0 != br->buffer);
+	FLAC__ASSERT(FLAC__BITS_PER_WORD >= 32);
+	FLAC__ASSERT(parameter < 32);
+
+	if(nvals == 0 || br->consumed_words >= br->words)
+		return read_rice_signed_block_slow_(br, vals, nvals, parameter);
+
+	next = br->consumed_words * (FLAC__BITS_PER_WORD / 32) + br->consumed_bits / 32;
+	cache = (FLAC__uint64)HALF_WORD_(br->buffer, next) << (32 + br->consumed_bits % 32);
+	avail = 32 - br->consumed_bits % 32;
+	next++;
+
+	while(nvals) {
+		unsigned zeros, uval;
+
+		if(avail <= 32) {
+			if(next >= halves)
+				break;
+			cache |= (FLAC__uint64)HALF_WORD_(br->buffer, next) << (32 - avail);
+			avail += 32;
+			next++;
+		}
+		/* the bits past avail are all zero, so a unary part running off the end of the cache shows up as one too long for it */
+		if(cache == 0)
+			break;
+		zeros = COUNT_ZERO_MSBS64(cache);
+		if(zeros + 1 + parameter > avail)
+			break;
+
+		cache <<= zeros;
+		cache <<= 1;
+		uval = (zeros << parameter) | (unsigned)((cache >> (63 - parameter)) >> 1);
+		cache <<= parameter;
+		avail -= zeros + 1 + parameter;
+
+		*vals++ = (int)(uval >> 1) ^ -(int)(uval & 1);
+		nvals--;
+	}
+
+	pos = next * 32 - avail;
+	br->consumed_words = pos / FLAC__BITS_PER_WORD;
+	br->consumed_bits = pos % FLAC__BITS_PER_WORD;
+
+	return nvals == 0 || read_rice_signed_block_slow_(br, vals, nvals, parameter);
+}
+
 #if 0 /* UNUSED */
 FLAC__bool FLAC__bitreader_read_golomb_signed(FLAC__BitReader *br, int *val, unsigned parameter)
 {
@@ -52,22 +52,35 @@
 #include "FLAC/assert.h"
 #include "share/alloc.h"
 
-/* Things should be fastest when this matches the machine word size */
+/* Things should be fastest when this matches the machine word size; see ENABLE_64_BIT_WORDS in private/cpu.h */
 /* WATCHOUT: if you change this you must also change the following #defines down to SWAP_BE_WORD_TO_HOST below to match */
 /* WATCHOUT: there are a few places where the code will not work unless bwword is >= 32 bits wide */
+#if ENABLE_64_BIT_WORDS == 0
 typedef FLAC__uint32 bwword;
 #define FLAC__BYTES_PER_WORD 4
 #define FLAC__BITS_PER_WORD 32
 #define FLAC__WORD_ALL_ONES ((FLAC__uint32)0xffffffff)
+#else
+typedef FLAC__uint64 bwword;
+#define FLAC__BYTES_PER_WORD 8
+#define FLAC__BITS_PER_WORD 64
+#define FLAC__WORD_ALL_ONES (~(FLAC__uint64)0)
+#endif
 /* SWAP_BE_WORD_TO_HOST swaps bytes in a bwword (which is always big-endian) if necessary to match host byte order */
 #if WORDS_BIGENDIAN
 #define SWAP_BE_WORD_TO_HOST(x) (x)
-#else
+#elif ENABLE_64_BIT_WORDS == 0
 #ifdef _MSC_VER
 #define SWAP_BE_WORD_TO_HOST(x) local_swap32_(x)
 #else
 #define SWAP_BE_WORD_TO_HOST(x) ntohl(x)
 #endif
+#elif defined _MSC_VER
+#define SWAP_BE_WORD_TO_HOST(x) _byteswap_uint64(x)
+#elif defined __GNUC__ && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 3))
+#define SWAP_BE_WORD_TO_HOST(x) __builtin_bswap64(x)
+#else
+#define SWAP_BE_WORD_TO_HOST(x) (((FLAC__uint64)ntohl((FLAC__uint32)(x)) << 32) | ntohl((FLAC__uint32)((x) >> 32)))
 #endif
 
 /*
@@ -116,6 +129,21 @@ static _inline FLAC__uint32 local_swap32_(FLAC__uint32 x)
 }
 #endif
 
+#if WORDS_BIGENDIAN
+#define SWAP_BE32_TO_HOST(x) (x)
+#elif defined _MSC_VER
+#define SWAP_BE32_TO_HOST(x) local_swap32_(x)
+#else
+#define SWAP_BE32_TO_HOST(x) ntohl(x)
+#endif
+
+/* stores 32 bits of the bitstream at any byte offset in the buffer */
+static FLaC__INLINE void store_be32_(FLAC__byte *dst, FLAC__uint32 x)
+{
+	x = SWAP_BE32_TO_HOST(x);
+	memcpy(dst, &x, 4);
+}
+
 /* * WATCHOUT: The current implementation only grows the buffer. */
 static FLAC__bool bitwriter_grow_(FLAC__BitWriter *bw, unsigned bits_to_add)
 {
@@ -219,13 +247,13 @@ void FLAC__bitwriter_dump(const FLAC__BitWriter *bw, FILE *out)
 		for(i = 0; i < bw->words; i++) {
 			fprintf(out, "%08X: ", i);
 			for(j = 0; j < FLAC__BITS_PER_WORD; j++)
-				fprintf(out, "%01u", bw->buffer[i] & (1 << (FLAC__BITS_PER_WORD-j-1)) ? 1:0);
+				fprintf(out, "%01u", bw->buffer[i] & ((bwword)1 << (FLAC__BITS_PER_WORD-j-1)) ? 1:0);
 			fprintf(out, "\n");
 		}
 		if(bw->bits > 0) {
 			fprintf(out, "%08X: ", i);
 			for(j = 0; j < bw->bits; j++)
-				fprintf(out, "%01u", bw->accum & (1 << (bw->bits-j-1)) ? 1:0);
+				fprintf(out, "%01u", bw->accum & ((bwword)1 << (bw->bits-j-1)) ? 1:0);
 			fprintf(out, "\n");
 		}
 	}
@@ -538,119 +566,115 @@ FLAC__bool FLAC__bitwriter_write_rice_signed(FLAC__BitWriter *bw, FLAC__int32 va
 			FLAC__bitwriter_write_raw_uint32(bw, pattern, interesting_bits); /* write the unary end bit and binary LSBs */
 }
 
+/*
+ * The stream is packed 32 bits at a time through a 64-bit accumulator
+ * and stored big-endian straight into the buffer, which in memory is just
+ * the bitstream whatever the word size.  A codeword of up to 32 bits
+ * (almost all of them for a sensible parameter) stores at most one chunk,
+ * so reserving 32 bits per value up front leaves the loop without capacity
+ * checks, and such a codeword costs a shift, an OR and a compare.  Only
+ * longer ones check for room; their unary parts are zero-filled a 32-bit
+ * chunk at a time.
+ */
 FLAC__bool FLAC__bitwriter_write_rice_signed_block(FLAC__BitWriter *bw, const FLAC__int32 *vals, unsigned nvals, unsigned parameter)
 {
-	const FLAC__uint32 mask1 = FLAC__WORD_ALL_ONES << parameter; /* we val|=mask1 to set the stop bit above it... */
-	const FLAC__uint32 mask2 = FLAC__WORD_ALL_ONES >> (31-parameter); /* ...then mask off the bits above the stop bit with val&=mask2*/
-	FLAC__uint32 uval;
-	unsigned left;
+	const FLAC__uint32 mask1 = (FLAC__uint32)0xffffffff << parameter; /* we val|=mask1 to set the stop bit above it... */
+	const FLAC__uint32 mask2 = (FLAC__uint32)0xffffffff >> (31-parameter); /* ...then mask off the bits above the stop bit with val&=mask2*/
 	const unsigned lsbits = 1 + parameter;
-	unsigned msbits;
+	FLAC__uint64 accum;
+	FLAC__byte *dst, *end;
+	unsigned n, msbits, bytes;
+	FLAC__uint32 uval;
 
 	FLAC__ASSERT(0 != bw);
 	FLAC__ASSERT(0 != bw->buffer);
-	FLAC__ASSERT(parameter < 8*sizeof(bwword)-1);
+	FLAC__ASSERT(parameter < 31);
 	/* WATCHOUT: code does not work with <32bit words; we can make things much faster with this assertion */
 	FLAC__ASSERT(FLAC__BITS_PER_WORD >= 32);
 
+	if(nvals == 0)
+		return true;
+
+	/* 32 bits per value; from here on dst + 4*nvals <= end at the top of the loop */
+	if(nvals > (0x7fffffff - FLAC__TOTAL_BITS(bw)) / 32)
+		return false;
+	if(!bitwriter_grow_(bw, 32 * nvals))
+		return false;
+
+	/* take over the partial word; n is the # of bits pending in accum and is kept under 32 */
+	dst = (FLAC__byte*)(bw->buffer + bw->words);
+	end = (FLAC__byte*)(bw->buffer + bw->capacity);
+	n = bw->bits;
+	accum = n? (FLAC__uint64)bw->accum << (64-n) >> (64-n) : 0;
+	if(n >= 32) {
+		n -= 32;
+		store_be32_(dst, (FLAC__uint32)(accum >> n));
+		dst += 4;
+	}
+
 	while(nvals) {
 		/* fold signed to unsigned; actual formula is: negative(v)? -2v-1 : 2v */
-		uval = (*vals<<1) ^ (*vals>>31);
-
+		uval = ((FLAC__uint32)*vals<<1) ^ (FLAC__uint32)(*vals>>31);
 		msbits = uval >> parameter;
+		uval |= mask1; /* set stop bit */
+		uval &= mask2; /* mask off unused top bits */
 
-#if 0 /* OPT: can remove this special case if it doesn't make up for the extra compare (doesn't make a statistically significant difference with msvc or gcc/x86) */
-		if(bw->bits && bw->bits + msbits + lsbits <= FLAC__BITS_PER_WORD) { /* i.e. if the whole thing fits in the current bwword */
-			/* ^^^ if bw->bits is 0 then we may have filled the buffer and have no free bwword to work in */
-			bw->bits = bw->bits + msbits + lsbits;
-			uval |= mask1; /* set stop bit */
-			uval &= mask2; /* mask off unused top bits */
-			/* NOT: bw->accum <<= msbits + lsbits because msbits+lsbits could be 32, then the shift would be a NOP */
-			bw->accum <<= msbits;
-			bw->accum <<= lsbits;
-			bw->accum |= uval;
-			if(bw->bits == FLAC__BITS_PER_WORD) {
-				bw->buffer[bw->words++] = SWAP_BE_WORD_TO_HOST(bw->accum);
-				bw->bits = 0;
-				/* burying the capacity check down here means we have to grow the buffer a little if there are more vals to do */
-				if(bw->capacity <= bw->words && nvals > 1 && !bitwriter_grow_(bw, 1)) {
-					FLAC__ASSERT(bw->capacity == bw->words);
-					return false;
-				}
-			}
-		}
-		else {
-#elif 1 /*@@@@@@ OPT: try this version with MSVC6 to see if better, not much difference for gcc-4 */
-		if(bw->bits && bw->bits + msbits + lsbits < FLAC__BITS_PER_WORD) { /* i.e. if the whole thing fits in the current bwword */
-			/* ^^^ if bw->bits is 0 then we may have filled the buffer and have no free bwword to work in */
-			bw->bits = bw->bits + msbits + lsbits;
-			uval |= mask1; /* set stop bit */
-			uval &= mask2; /* mask off unused top bits */
-			bw->accum <<= msbits + lsbits;
-			bw->accum |= uval;
+		if(msbits < 32 - parameter) { /* i.e. the whole codeword is at most 32 bits */
+			accum <<= msbits + lsbits;
+			accum |= uval;
+			n += msbits + lsbits;
 		}
 		else {
-#endif
-			/* slightly pessimistic size check but faster than "<= bw->words + (bw->bits+msbits+lsbits+FLAC__BITS_PER_WORD-1)/FLAC__BITS_PER_WORD" */
-			/* OPT: pessimism may cause flurry of false calls to grow_ which eat up all savings before it */
-			if(bw->capacity <= bw->words + bw->bits + msbits + 1/*lsbits always fit in 1 bwword*/ && !bitwriter_grow_(bw, msbits+lsbits))
-				return false;
-
-			if(msbits) {
-				/* first part gets to word alignment */
-				if(bw->bits) {
-					left = FLAC__BITS_PER_WORD - bw->bits;
-					if(msbits < left) {
-						bw->accum <<= msbits;
-						bw->bits += msbits;
-						goto break1;
-					}
-					else {
-						bw->accum <<= left;
-						msbits -= left;
-						bw->buffer[bw->words++] = SWAP_BE_WORD_TO_HOST(bw->accum);
-						bw->bits = 0;
-					}
-				}
-				/* do whole words */
-				while(msbits >= FLAC__BITS_PER_WORD) {
-					bw->buffer[bw->words++] = 0;
-					msbits -= FLAC__BITS_PER_WORD;
-				}
-				/* do any leftovers */
-				if(msbits > 0) {
-					bw->accum = 0;
-					bw->bits = msbits;
-				}
-			}
-break1:
-			uval |= mask1; /* set stop bit */
-			uval &= mask2; /* mask off unused top bits */
-
-			left = FLAC__BITS_PER_WORD - bw->bits;
-			if(lsbits < left) {
-				bw->accum <<= lsbits;
-				bw->accum |= uval;
-				bw->bits += lsbits;
+			/* room for this codeword and 32 bits for each of the rest */
+			if((FLAC__uint64)(end - dst) / 4 < ((FLAC__uint64)n + msbits + lsbits) / 32 + nvals - 1) {
+				bytes = (unsigned)(dst - (FLAC__byte*)bw->buffer);
+				bw->words = bytes / FLAC__BYTES_PER_WORD;
+				bw->bits = bytes % FLAC__BYTES_PER_WORD * 8;
+				if((FLAC__uint64)FLAC__TOTAL_BITS(bw) + n + msbits + lsbits + 32 * (FLAC__uint64)(nvals-1) > 0x7fffffff || !bitwriter_grow_(bw, n + msbits + lsbits + 32 * (nvals-1)))
+					return false;
+				dst = (FLAC__byte*)bw->buffer + bytes;
+				end = (FLAC__byte*)(bw->buffer + bw->capacity);
 			}
-			else {
-				/* if bw->bits == 0, left==FLAC__BITS_PER_WORD which will always
-				 * be > lsbits (because of previous assertions) so it would have
-				 * triggered the (lsbits<left) case above.
-				 */
-				FLAC__ASSERT(bw->bits);
-				FLAC__ASSERT(left < FLAC__BITS_PER_WORD);
-				bw->accum <<= left;
-				bw->accum |= uval >> (bw->bits = lsbits - left);
-				bw->buffer[bw->words++] = SWAP_BE_WORD_TO_HOST(bw->accum);
-				bw->accum = uval;
+			/* do the unary part up to a 32-bit boundary, then zero-fill whole chunks */
+			if(n + msbits >= 32) {
+				accum <<= 32 - n;
+				store_be32_(dst, (FLAC__uint32)accum);
+				dst += 4;
+				msbits -= 32 - n;
+				memset(dst, 0, 4 * (msbits / 32));
+				dst += 4 * (msbits / 32);
+				n = 0;
+				msbits %= 32;
 			}
-#if 1
+			accum <<= msbits;
+			n += msbits;
+			accum <<= lsbits;
+			accum |= uval;
+			n += lsbits;
+		}
+		if(n >= 32) {
+			n -= 32;
+			store_be32_(dst, (FLAC__uint32)(accum >> n));
+			dst += 4;
 		}
-#endif
 		vals++;
 		nvals--;
 	}
+
+	/* hand back the complete words and the partial one */
+	bytes = (unsigned)(dst - (FLAC__byte*)bw->buffer);
+	bw->words = bytes / FLAC__BYTES_PER_WORD;
+	bw->bits = n;
+	bw->accum = (bwword)accum;
+#if FLAC__BITS_PER_WORD == 64
+	if(bytes % FLAC__BYTES_PER_WORD) {
+		/* the first half of the partial word has already gone to the buffer */
+		FLAC__uint32 half;
+		memcpy(&half, dst - 4, 4);
+		bw->accum = ((bwword)SWAP_BE32_TO_HOST(half) << n) | (n? accum << (64-n) >> (64-n) : 0);
+		bw->bits += 32;
+	}
+#endif
 	return true;
 }
 
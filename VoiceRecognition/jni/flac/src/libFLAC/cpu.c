@@ -34,9 +34,26 @@
 #endif
 
 #include "private/cpu.h"
+#include "private/crc.h"
+#include "private/lpc.h"
+#include "private/stream_encoder.h"
+#include "FLAC/assert.h"
 #include <stdlib.h>
 #include <stdio.h>
 
+#if FLAC__HAS_X86INTRIN
+# include <cpuid.h>
+#endif
+
+#if (defined __arm__ || defined __aarch64__) && defined __linux__
+# if defined __ANDROID__
+#  include <android/api-level.h>
+# endif
+# if !defined __ANDROID__ || __ANDROID_API__ >= 18
+#  include <sys/auxv.h>
+# endif
+#endif
+
 #if defined FLAC__CPU_IA32
 # include <signal.h>
 #elif defined FLAC__CPU_PPC
@@ -86,6 +103,7 @@ static void sigill_handler (int sig)
 /* how to get sysctlbyname()? */
 #endif
 
+#if (defined FLAC__CPU_IA32 && !defined FLAC__NO_ASM && defined FLAC__HAS_NASM) || FLAC__HAS_X86INTRIN
 /* these are flags in EDX of CPUID AX=00000001 */
 static const unsigned FLAC__CPUINFO_IA32_CPUID_CMOV = 0x00008000;
 static const unsigned FLAC__CPUINFO_IA32_CPUID_MMX = 0x00800000;
@@ -95,10 +113,39 @@ static const unsigned FLAC__CPUINFO_IA32_CPUID_SSE2 = 0x04000000;
 /* these are flags in ECX of CPUID AX=00000001 */
 static const unsigned FLAC__CPUINFO_IA32_CPUID_SSE3 = 0x00000001;
 static const unsigned FLAC__CPUINFO_IA32_CPUID_SSSE3 = 0x00000200;
+# ifdef FLAC__USE_3DNOW
 /* these are flags in EDX of CPUID AX=80000001 */
 static const unsigned FLAC__CPUINFO_IA32_CPUID_EXTENDED_AMD_3DNOW = 0x80000000;
 static const unsigned FLAC__CPUINFO_IA32_CPUID_EXTENDED_AMD_EXT3DNOW = 0x40000000;
 static const unsigned FLAC__CPUINFO_IA32_CPUID_EXTENDED_AMD_EXTMMX = 0x00400000;
+# endif
+# if FLAC__HAS_X86INTRIN
+/* only cpu_info_x86_() looks at these */
+static const unsigned FLAC__CPUINFO_IA32_CPUID_PCLMUL = 0x00000002;
+static const unsigned FLAC__CPUINFO_IA32_CPUID_SSE41 = 0x00080000;
+static const unsigned FLAC__CPUINFO_IA32_CPUID_OSXSAVE = 0x08000000;
+static const unsigned FLAC__CPUINFO_IA32_CPUID_AVX = 0x10000000;
+/* these are flags in EBX of CPUID AX=00000007 CX=00000000 */
+static const unsigned FLAC__CPUINFO_IA32_CPUID_AVX2 = 0x00000020;
+static const unsigned FLAC__CPUINFO_IA32_CPUID_BMI2 = 0x00000100;
+# endif
+#endif
+
+#if defined __arm__ || defined __aarch64__
+/* auxiliary vector entries, and the hwcaps in them, from the Linux ABI */
+static const unsigned long FLAC__CPUINFO_ARM_AT_HWCAP = 16;
+# if defined __aarch64__
+/* these are flags in AT_HWCAP on AArch64 */
+static const unsigned long FLAC__CPUINFO_ARM64_HWCAP_PMULL = 0x00000010;
+static const unsigned long FLAC__CPUINFO_ARM64_HWCAP_CRC32 = 0x00000080;
+# else
+static const unsigned long FLAC__CPUINFO_ARM_AT_HWCAP2 = 26;
+/* these are flags in AT_HWCAP and AT_HWCAP2 respectively on AArch32 */
+static const unsigned long FLAC__CPUINFO_ARM_HWCAP_NEON = 0x00001000;
+static const unsigned long FLAC__CPUINFO_ARM_HWCAP2_PMULL = 0x00000002;
+static const unsigned long FLAC__CPUINFO_ARM_HWCAP2_CRC32 = 0x00000010;
+# endif
+#endif
 
 
 /*
@@ -151,6 +198,95 @@ static const unsigned FLAC__CPUINFO_IA32_CPUID_EXTENDED_AMD_EXTMMX = 0x00400000;
 # endif
 #endif
 
+#if FLAC__HAS_X86INTRIN
+/*
+ * CPUID without the NASM helpers.  AVX and AVX2 are only reported if the OS also
+ * saves the YMM registers on context switches (XCR0 bits 1 and 2).
+ */
+static void cpu_info_x86_(FLAC__CPUInfo_IA32 *info)
+{
+	unsigned eax, ebx, ecx, edx;
+
+	info->cpuid = __get_cpuid(1, &eax, &ebx, &ecx, &edx)? true : false;
+	info->bswap = info->cpuid;
+	info->cmov = info->mmx = info->fxsr = info->sse = info->sse2 = info->sse3 = info->ssse3 = false;
+	info->_3dnow = info->ext3dnow = info->extmmx = false;
+	info->sse41 = info->avx = info->avx2 = info->bmi2 = info->pclmul = false;
+	if(!info->cpuid)
+		return;
+
+	info->cmov  = (edx & FLAC__CPUINFO_IA32_CPUID_CMOV )? true : false;
+	info->mmx   = (edx & FLAC__CPUINFO_IA32_CPUID_MMX  )? true : false;
+	info->fxsr  = (edx & FLAC__CPUINFO_IA32_CPUID_FXSR )? true : false;
+	info->sse   = (edx & FLAC__CPUINFO_IA32_CPUID_SSE  )? true : false;
+	info->sse2  = (edx & FLAC__CPUINFO_IA32_CPUID_SSE2 )? true : false;
+	info->sse3  = (ecx & FLAC__CPUINFO_IA32_CPUID_SSE3 )? true : false;
+	info->ssse3 = (ecx & FLAC__CPUINFO_IA32_CPUID_SSSE3)? true : false;
+	info->sse41 = (ecx & FLAC__CPUINFO_IA32_CPUID_SSE41)? true : false;
+	info->pclmul = (ecx & FLAC__CPUINFO_IA32_CPUID_PCLMUL)? true : false;
+
+	if((ecx & FLAC__CPUINFO_IA32_CPUID_OSXSAVE) && (ecx & FLAC__CPUINFO_IA32_CPUID_AVX)) {
+		unsigned xcr0_lo, xcr0_hi;
+		__asm__ __volatile__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+		info->avx = ((xcr0_lo & 6) == 6)? true : false;
+	}
+	if(__get_cpuid_max(0, 0) >= 7) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		info->avx2 = (info->avx && (ebx & FLAC__CPUINFO_IA32_CPUID_AVX2))? true : false;
+		info->bmi2 = (ebx & FLAC__CPUINFO_IA32_CPUID_BMI2)? true : false;
+	}
+}
+#endif
+
+#if defined __arm__ || defined __aarch64__
+static unsigned long get_auxv_(unsigned long type)
+{
+#if defined __linux__ && defined __ANDROID__ && __ANDROID_API__ < 18
+	/* no getauxval() before Android 4.3, but the kernel exports the same table */
+	unsigned long entry[2], value = 0;
+	FILE *f = fopen("/proc/self/auxv", "rb");
+	if(0 == f)
+		return 0;
+	while(fread(entry, sizeof(entry), 1, f) == 1 && entry[0] != 0) {
+		if(entry[0] == type) {
+			value = entry[1];
+			break;
+		}
+	}
+	fclose(f);
+	return value;
+#elif defined __linux__
+	return getauxval(type);
+#else
+	(void)type;
+	return 0;
+#endif
+}
+
+/*
+ * NEON is mandatory on AArch64, and so is on AArch32 if the whole library
+ * was built for it; otherwise, like the CRC32 extension, it is read from
+ * the hwcaps the kernel passes in the auxiliary vector.
+ */
+static void cpu_info_arm_(FLAC__CPUInfo_ARM *info)
+{
+#if defined __aarch64__
+	const unsigned long hwcap = get_auxv_(FLAC__CPUINFO_ARM_AT_HWCAP);
+	info->neon = true;
+	info->crc32 = (hwcap & FLAC__CPUINFO_ARM64_HWCAP_CRC32)? true : false;
+	info->pmull = (hwcap & FLAC__CPUINFO_ARM64_HWCAP_PMULL)? true : false;
+#else
+	const unsigned long hwcap2 = get_auxv_(FLAC__CPUINFO_ARM_AT_HWCAP2);
+	info->neon = (get_auxv_(FLAC__CPUINFO_ARM_AT_HWCAP) & FLAC__CPUINFO_ARM_HWCAP_NEON)? true : false;
+	info->crc32 = (hwcap2 & FLAC__CPUINFO_ARM_HWCAP2_CRC32)? true : false;
+	info->pmull = (hwcap2 & FLAC__CPUINFO_ARM_HWCAP2_PMULL)? true : false;
+# if defined __ARM_NEON__ || defined __ARM_NEON
+	info->neon = true;
+# endif
+#endif
+}
+#endif
+
 
 void FLAC__cpu_info(FLAC__CPUInfo *info)
 {
@@ -173,6 +309,11 @@ void FLAC__cpu_info(FLAC__CPUInfo *info)
 	info->data.ia32._3dnow = false;
 	info->data.ia32.ext3dnow = false;
 	info->data.ia32.extmmx = false;
+	info->data.ia32.sse41 = false;
+	info->data.ia32.avx = false;
+	info->data.ia32.avx2 = false;
+	info->data.ia32.bmi2 = false;
+	info->data.ia32.pclmul = false;
 	if(info->data.ia32.cpuid) {
 		/* http://www.sandpile.org/ia32/cpuid.htm */
 		FLAC__uint32 flags_edx, flags_ecx;
@@ -194,6 +335,18 @@ void FLAC__cpu_info(FLAC__CPUInfo *info)
 		info->data.ia32._3dnow = info->data.ia32.ext3dnow = info->data.ia32.extmmx = false;
 #endif
 
+#if FLAC__HAS_X86INTRIN
+		{
+			FLAC__CPUInfo_IA32 x86;
+			cpu_info_x86_(&x86);
+			info->data.ia32.sse41 = x86.sse41;
+			info->data.ia32.avx = x86.avx;
+			info->data.ia32.avx2 = x86.avx2;
+			info->data.ia32.bmi2 = x86.bmi2;
+			info->data.ia32.pclmul = x86.pclmul;
+		}
+#endif
+
 #ifdef DEBUG
 		fprintf(stderr, "CPU info (IA-32):\n");
 		fprintf(stderr, "  CPUID ...... %c\n", info->data.ia32.cpuid   ? 'Y' : 'n');
@@ -208,6 +361,11 @@ void FLAC__cpu_info(FLAC__CPUInfo *info)
 		fprintf(stderr, "  3DNow! ..... %c\n", info->data.ia32._3dnow  ? 'Y' : 'n');
 		fprintf(stderr, "  3DNow!-ext . %c\n", info->data.ia32.ext3dnow? 'Y' : 'n');
 		fprintf(stderr, "  3DNow!-MMX . %c\n", info->data.ia32.extmmx  ? 'Y' : 'n');
+		fprintf(stderr, "  SSE4.1 ..... %c\n", info->data.ia32.sse41   ? 'Y' : 'n');
+		fprintf(stderr, "  AVX ........ %c\n", info->data.ia32.avx     ? 'Y' : 'n');
+		fprintf(stderr, "  AVX2 ....... %c\n", info->data.ia32.avx2    ? 'Y' : 'n');
+		fprintf(stderr, "  BMI2 ....... %c\n", info->data.ia32.bmi2    ? 'Y' : 'n');
+		fprintf(stderr, "  PCLMUL ..... %c\n", info->data.ia32.pclmul  ? 'Y' : 'n');
 #endif
 
 		/*
@@ -333,6 +491,8 @@ void FLAC__cpu_info(FLAC__CPUInfo *info)
 			/* no way to test, disable to be safe */
 			info->data.ia32.fxsr = info->data.ia32.sse = info->data.ia32.sse2 = info->data.ia32.sse3 = info->data.ia32.ssse3 = false;
 #endif
+		if(!info->data.ia32.sse2)
+			info->data.ia32.sse41 = info->data.ia32.avx = info->data.ia32.avx2 = info->data.ia32.pclmul = false;
 #ifdef DEBUG
 		fprintf(stderr, "  SSE OS sup . %c\n", info->data.ia32.sse     ? 'Y' : 'n');
 #endif
@@ -408,6 +568,40 @@ void FLAC__cpu_info(FLAC__CPUInfo *info)
 	info->use_asm = false;
 # endif
 
+/*
+ * x86 (including x86-64) without the NASM build, e.g. Android
+ */
+#elif FLAC__HAS_X86INTRIN
+# if defined __x86_64__
+	info->type = FLAC__CPUINFO_TYPE_X86_64;
+# else
+	info->type = FLAC__CPUINFO_TYPE_IA32;
+# endif
+	info->use_asm = true;
+	cpu_info_x86_(&info->data.ia32);
+
+/*
+ * ARMv7 and ARMv8
+ */
+#elif defined __arm__ || defined __aarch64__
+# if defined __aarch64__
+	info->type = FLAC__CPUINFO_TYPE_ARM64;
+# else
+	info->type = FLAC__CPUINFO_TYPE_ARM;
+# endif
+	cpu_info_arm_(&info->data.arm);
+# if FLAC__HAS_NEONINTRIN
+	info->use_asm = info->data.arm.neon;
+# else
+	info->use_asm = false;
+# endif
+#ifdef DEBUG
+	fprintf(stderr, "CPU info (ARM):\n");
+	fprintf(stderr, "  NEON ....... %c\n", info->data.arm.neon ? 'Y' : 'n');
+	fprintf(stderr, "  CRC32 ...... %c\n", info->data.arm.crc32? 'Y' : 'n');
+	fprintf(stderr, "  PMULL ...... %c\n", info->data.arm.pmull? 'Y' : 'n');
+#endif
+
 /*
  * unknown CPI
  */
@@ -416,3 +610,84 @@ void FLAC__cpu_info(FLAC__CPUInfo *info)
 	info->use_asm = false;
 #endif
 }
+
+void FLAC__cpu_dispatch(const FLAC__CPUInfo *info, FLAC__CPUDispatch *dispatch)
+{
+#ifndef FLAC__INTEGER_ONLY_LIBRARY
+	dispatch->lpc_window_data = 0;
+	dispatch->lpc_compute_autocorrelation = 0;
+	dispatch->lpc_compute_residual_from_qlp_coefficients = 0;
+	dispatch->lpc_compute_residual_from_qlp_coefficients_wide = 0;
+#endif
+	dispatch->lpc_restore_signal = 0;
+	dispatch->lpc_restore_signal_wide = 0;
+	dispatch->crc16_update_block = 0;
+	dispatch->crc16_update_words32 = 0;
+	dispatch->crc16_update_words64 = 0;
+	dispatch->precompute_partition_info_sums = 0;
+
+#ifndef FLAC__NO_ASM
+	if(!info->use_asm)
+		return;
+#if FLAC__HAS_X86INTRIN
+	FLAC__ASSERT(info->type == FLAC__CPUINFO_TYPE_IA32 || info->type == FLAC__CPUINFO_TYPE_X86_64);
+#ifndef FLAC__INTEGER_ONLY_LIBRARY
+	if(info->data.ia32.avx) {
+		dispatch->lpc_window_data = FLAC__lpc_window_data_intrin_avx;
+		dispatch->lpc_compute_autocorrelation = FLAC__lpc_compute_autocorrelation_intrin_avx;
+	}
+	else if(info->data.ia32.sse2) {
+		dispatch->lpc_window_data = FLAC__lpc_window_data_intrin_sse2;
+		dispatch->lpc_compute_autocorrelation = FLAC__lpc_compute_autocorrelation_intrin_sse2;
+	}
+	if(info->data.ia32.avx2) {
+		dispatch->lpc_compute_residual_from_qlp_coefficients = FLAC__lpc_compute_residual_from_qlp_coefficients_intrin_avx2;
+		dispatch->lpc_compute_residual_from_qlp_coefficients_wide = FLAC__lpc_compute_residual_from_qlp_coefficients_wide_intrin_avx2;
+	}
+	else if(info->data.ia32.sse41) {
+		dispatch->lpc_compute_residual_from_qlp_coefficients = FLAC__lpc_compute_residual_from_qlp_coefficients_intrin_sse41;
+		dispatch->lpc_compute_residual_from_qlp_coefficients_wide = FLAC__lpc_compute_residual_from_qlp_coefficients_wide_intrin_sse41;
+	}
+#endif
+	if(info->data.ia32.avx2) {
+		dispatch->lpc_restore_signal = FLAC__lpc_restore_signal_intrin_avx2;
+		dispatch->lpc_restore_signal_wide = FLAC__lpc_restore_signal_wide_intrin_avx2;
+	}
+	else if(info->data.ia32.sse41) {
+		dispatch->lpc_restore_signal = FLAC__lpc_restore_signal_intrin_sse41;
+		dispatch->lpc_restore_signal_wide = FLAC__lpc_restore_signal_wide_intrin_sse41;
+	}
+	if(info->data.ia32.avx2)
+		dispatch->precompute_partition_info_sums = FLAC__precompute_partition_info_sums_intrin_avx2;
+	else if(info->data.ia32.sse2)
+		dispatch->precompute_partition_info_sums = FLAC__precompute_partition_info_sums_intrin_sse2;
+	if(info->data.ia32.pclmul && info->data.ia32.ssse3) {
+		dispatch->crc16_update_block = FLAC__crc16_update_block_intrin_pclmul;
+		dispatch->crc16_update_words32 = FLAC__crc16_update_words32_intrin_pclmul;
+		dispatch->crc16_update_words64 = FLAC__crc16_update_words64_intrin_pclmul;
+	}
+#elif FLAC__HAS_NEONINTRIN
+	FLAC__ASSERT(info->type == FLAC__CPUINFO_TYPE_ARM || info->type == FLAC__CPUINFO_TYPE_ARM64);
+	if(info->data.arm.neon) {
+#ifndef FLAC__INTEGER_ONLY_LIBRARY
+		dispatch->lpc_window_data = FLAC__lpc_window_data_intrin_neon;
+		dispatch->lpc_compute_autocorrelation = FLAC__lpc_compute_autocorrelation_intrin_neon;
+		dispatch->lpc_compute_residual_from_qlp_coefficients = FLAC__lpc_compute_residual_from_qlp_coefficients_intrin_neon;
+		dispatch->lpc_compute_residual_from_qlp_coefficients_wide = FLAC__lpc_compute_residual_from_qlp_coefficients_wide_intrin_neon;
+#endif
+		dispatch->lpc_restore_signal = FLAC__lpc_restore_signal_intrin_neon;
+		dispatch->lpc_restore_signal_wide = FLAC__lpc_restore_signal_wide_intrin_neon;
+		dispatch->precompute_partition_info_sums = FLAC__precompute_partition_info_sums_intrin_neon;
+	}
+#if FLAC__HAS_PMULLINTRIN
+	if(info->data.arm.pmull) {
+		dispatch->crc16_update_block = FLAC__crc16_update_block_intrin_pmull;
+		dispatch->crc16_update_words32 = FLAC__crc16_update_words32_intrin_pmull;
+		dispatch->crc16_update_words64 = FLAC__crc16_update_words64_intrin_pmull;
+	}
+#endif
+#endif
+#else
+	(void)info;
+#endif
+}
@@ -0,0 +1,137 @@
+/* libFLAC - Free Lossless Audio Codec library
+ * Copyright (C) 2011  Audioboo Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the Xiph.org Foundation nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "private/cpu.h"
+
+#ifndef FLAC__NO_ASM
+#if FLAC__HAS_X86INTRIN
+
+#include "FLAC/assert.h"
+#include "private/crc.h"
+
+#include <tmmintrin.h> /* SSSE3 */
+#include <wmmintrin.h> /* PCLMUL */
+
+/*
+ * CRC-16 by folding.  Read as a polynomial, a 128 bit chunk A followed by
+ * n more bits of message contributes A*x^n, and mod P that is the same as
+ * A*K(n) with K(n) = x^n mod P.  So a chunk is folded into the one n bits
+ * further on with two carry-less multiplies, one per 64 bit half, and the
+ * CRC's dependency chain shrinks to one multiply per 64 bytes.  The 16
+ * bytes that are left at the end are CRC'd with the tables as usual.
+ */
+
+FLAC__SSE_TARGET("pclmul,ssse3")
+static __inline__ __attribute__ ((__always_inline__)) __m128i fold_(__m128i a, __m128i k, __m128i b)
+{
+	/* k is K(n+64):K(n) */
+	return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(a, k, 0x11), _mm_clmulepi64_si128(a, k, 0x00)), b);
+}
+
+/* order puts the first byte of the message in the top byte of a chunk */
+FLAC__SSE_TARGET("pclmul,ssse3")
+static __inline__ __attribute__ ((__always_inline__)) unsigned crc16_(const FLAC__byte *data, unsigned len, unsigned crc, const __m128i order)
+{
+	const __m128i k16 = _mm_set_epi64x(0x1666, 0x0106); /* K(192):K(128) */
+	const __m128i k64 = _mm_set_epi64x(0x1446, 0x8107); /* K(576):K(512) */
+	__m128i a0, a1, a2, a3;
+	FLAC__byte tail[16];
+
+	FLAC__ASSERT(len >= 64);
+	FLAC__ASSERT(len % 16 == 0);
+
+	/* the CRC so far goes on top of the first 16 bits */
+	a0 = _mm_xor_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), order), _mm_set_epi32((int)(crc << 16), 0, 0, 0));
+	a1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), order);
+	a2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), order);
+	a3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), order);
+
+	for(data += 64, len -= 64; len >= 64; data += 64, len -= 64) {
+		a0 = fold_(a0, k64, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), order));
+		a1 = fold_(a1, k64, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), order));
+		a2 = fold_(a2, k64, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), order));
+		a3 = fold_(a3, k64, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), order));
+	}
+
+	a1 = fold_(a0, k16, a1);
+	a2 = fold_(a1, k16, a2);
+	a3 = fold_(a2, k16, a3);
+	for(; len; data += 16, len -= 16)
+		a3 = fold_(a3, k16, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), order));
+
+	_mm_storeu_si128((__m128i*)tail, _mm_shuffle_epi8(a3, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)));
+	return FLAC__crc16_update_block(tail, 16, 0);
+}
+
+FLAC__SSE_TARGET("pclmul,ssse3")
+unsigned FLAC__crc16_update_block_intrin_pclmul(const FLAC__byte *data, unsigned len, unsigned crc)
+{
+	/* below 64 bytes the tables are as fast */
+	if(len >= 64) {
+		const unsigned n = len & ~15u;
+		crc = crc16_(data, n, crc, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+		data += n;
+		len -= n;
+	}
+	return FLAC__crc16_update_block(data, len, crc);
+}
+
+FLAC__SSE_TARGET("pclmul,ssse3")
+unsigned FLAC__crc16_update_words32_intrin_pclmul(const FLAC__uint32 *words, unsigned len, unsigned crc)
+{
+	/* x86 is little-endian, so each word's bytes are reversed in memory */
+	if(len >= 16) {
+		const unsigned n = len & ~3u;
+		crc = crc16_((const FLAC__byte*)words, n * 4, crc, _mm_set_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+		words += n;
+		len -= n;
+	}
+	return FLAC__crc16_update_words32(words, len, crc);
+}
+
+FLAC__SSE_TARGET("pclmul,ssse3")
+unsigned FLAC__crc16_update_words64_intrin_pclmul(const FLAC__uint64 *words, unsigned len, unsigned crc)
+{
+	if(len >= 8) {
+		const unsigned n = len & ~1u;
+		crc = crc16_((const FLAC__byte*)words, n * 8, crc, _mm_set_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8));
+		words += n;
+		len -= n;
+	}
+	return FLAC__crc16_update_words64(words, len, crc);
+}
+
+#endif /* FLAC__HAS_X86INTRIN */
+#endif /* FLAC__NO_ASM */
@@ -0,0 +1,142 @@
+/* libFLAC - Free Lossless Audio Codec library
+ * Copyright (C) 2011  Audioboo Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the Xiph.org Foundation nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "private/cpu.h"
+
+#ifndef FLAC__NO_ASM
+#if FLAC__HAS_PMULLINTRIN
+
+#include "FLAC/assert.h"
+#include "private/crc.h"
+
+#include <arm_neon.h>
+
+/*
+ * CRC-16 by folding with PMULL, the same way as crc_intrin_pclmul.c; see
+ * there for the maths.
+ */
+
+/* lane 0 is K(n), lane 1 is K(n+64) */
+static const FLAC__uint64 k16_[2] = { 0x0106, 0x1666 }; /* K(128), K(192) */
+static const FLAC__uint64 k64_[2] = { 0x8107, 0x1446 }; /* K(512), K(576) */
+
+/* table lookups that put the first byte of the message in the top byte of a chunk */
+static const FLAC__byte bytes_order_[16] = { 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 };
+static const FLAC__byte words32_order_[16] = { 12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3 };
+static const FLAC__byte words64_order_[16] = { 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7 };
+
+static __inline__ __attribute__ ((__always_inline__)) uint8x16_t load_(const FLAC__byte *data, uint8x16_t order)
+{
+	return vqtbl1q_u8(vld1q_u8(data), order);
+}
+
+static __inline__ __attribute__ ((__always_inline__)) uint8x16_t fold_(uint8x16_t a, poly64x2_t k, uint8x16_t b)
+{
+	const poly64x2_t a64 = vreinterpretq_p64_u8(a);
+	const uint8x16_t hi = vreinterpretq_u8_p128(vmull_high_p64(a64, k));
+	const uint8x16_t lo = vreinterpretq_u8_p128(vmull_p64(vgetq_lane_p64(a64, 0), vgetq_lane_p64(k, 0)));
+	return veorq_u8(veorq_u8(hi, lo), b);
+}
+
+static __inline__ __attribute__ ((__always_inline__)) unsigned crc16_(const FLAC__byte *data, unsigned len, unsigned crc, const uint8x16_t order)
+{
+	const poly64x2_t k16 = vreinterpretq_p64_u64(vld1q_u64(k16_));
+	const poly64x2_t k64 = vreinterpretq_p64_u64(vld1q_u64(k64_));
+	uint8x16_t a0, a1, a2, a3;
+	FLAC__byte tail[16];
+
+	FLAC__ASSERT(len >= 64);
+	FLAC__ASSERT(len % 16 == 0);
+
+	/* the CRC so far goes on top of the first 16 bits */
+	a0 = veorq_u8(load_(data, order), vreinterpretq_u8_u32(vsetq_lane_u32(crc << 16, vdupq_n_u32(0), 3)));
+	a1 = load_(data + 16, order);
+	a2 = load_(data + 32, order);
+	a3 = load_(data + 48, order);
+
+	for(data += 64, len -= 64; len >= 64; data += 64, len -= 64) {
+		a0 = fold_(a0, k64, load_(data, order));
+		a1 = fold_(a1, k64, load_(data + 16, order));
+		a2 = fold_(a2, k64, load_(data + 32, order));
+		a3 = fold_(a3, k64, load_(data + 48, order));
+	}
+
+	a1 = fold_(a0, k16, a1);
+	a2 = fold_(a1, k16, a2);
+	a3 = fold_(a2, k16, a3);
+	for(; len; data += 16, len -= 16)
+		a3 = fold_(a3, k16, load_(data, order));
+
+	vst1q_u8(tail, vqtbl1q_u8(a3, vld1q_u8(bytes_order_)));
+	return FLAC__crc16_update_block(tail, 16, 0);
+}
+
+unsigned FLAC__crc16_update_block_intrin_pmull(const FLAC__byte *data, unsigned len, unsigned crc)
+{
+	/* below 64 bytes the tables are as fast */
+	if(len >= 64) {
+		const unsigned n = len & ~15u;
+		crc = crc16_(data, n, crc, vld1q_u8(bytes_order_));
+		data += n;
+		len -= n;
+	}
+	return FLAC__crc16_update_block(data, len, crc);
+}
+
+unsigned FLAC__crc16_update_words32_intrin_pmull(const FLAC__uint32 *words, unsigned len, unsigned crc)
+{
+	/* Android on ARM is little-endian, so each word's bytes are reversed in memory */
+	if(len >= 16) {
+		const unsigned n = len & ~3u;
+		crc = crc16_((const FLAC__byte*)words, n * 4, crc, vld1q_u8(words32_order_));
+		words += n;
+		len -= n;
+	}
+	return FLAC__crc16_update_words32(words, len, crc);
+}
+
+unsigned FLAC__crc16_update_words64_intrin_pmull(const FLAC__uint64 *words, unsigned len, unsigned crc)
+{
+	if(len >= 8) {
+		const unsigned n = len & ~1u;
+		crc = crc16_((const FLAC__byte*)words, n * 8, crc, vld1q_u8(words64_order_));
+		words += n;
+		len -= n;
+	}
+	return FLAC__crc16_update_words64(words, len, crc);
+}
+
+#endif /* FLAC__HAS_PMULLINTRIN */
+#endif /* FLAC__NO_ASM */
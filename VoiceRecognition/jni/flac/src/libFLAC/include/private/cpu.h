@@ -33,14 +33,58 @@
 #define FLAC__PRIVATE__CPU_H
 
 #include "FLAC/ordinals.h"
+#include "private/float.h"
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
 
+/*
+ * Intrinsics kernels.  These need no configure support: the x86 ones are
+ * compiled with per-function target attributes and only called when
+ * FLAC__cpu_info() finds the instruction set, so the rest of the library
+ * keeps the ABI's baseline.  NEON is mandatory on ARMv8.  On ARMv7 the
+ * kernels are built when the library itself is built for NEON, or when the
+ * build defines FLAC__HAS_NEONINTRIN and compiles only lpc_intrin_neon.c
+ * with NEON enabled; FLAC__cpu_info() then checks for NEON at runtime.
+ */
+#if !defined FLAC__NO_ASM && (defined __clang__ || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#  if defined __i386__ || defined __x86_64__
+#    define FLAC__HAS_X86INTRIN 1
+#    define FLAC__SSE_TARGET(x) __attribute__ ((__target__ (x)))
+#  elif (defined __aarch64__ || defined __ARM_NEON__ || defined __ARM_NEON) && !defined FLAC__HAS_NEONINTRIN
+#    define FLAC__HAS_NEONINTRIN 1
+#  endif
+#endif
+
+/*
+ * The ARMv8 CRC-16 kernel also needs the 64 bit carry-less multiply from the
+ * crypto extension, which the compiler only offers when the build enables
+ * it (e.g. -march=armv8-a+crypto); FLAC__cpu_info() checks for it at runtime.
+ */
+#if FLAC__HAS_NEONINTRIN && defined __aarch64__ && !defined __AARCH64EB__ && (defined __ARM_FEATURE_CRYPTO || defined __ARM_FEATURE_AES)
+#  define FLAC__HAS_PMULLINTRIN 1
+#endif
+
+/*
+ * The bitreader and bitwriter move data a machine word at a time; 64 bit
+ * words halve the refills and flushes on 64 bit targets.  Builds can force
+ * either size by defining ENABLE_64_BIT_WORDS to 0 or 1.
+ */
+#ifndef ENABLE_64_BIT_WORDS
+#  if defined __x86_64__ || defined _M_X64 || defined __aarch64__
+#    define ENABLE_64_BIT_WORDS 1
+#  else
+#    define ENABLE_64_BIT_WORDS 0
+#  endif
+#endif
+
 typedef enum {
 	FLAC__CPUINFO_TYPE_IA32,
 	FLAC__CPUINFO_TYPE_PPC,
+	FLAC__CPUINFO_TYPE_X86_64,
+	FLAC__CPUINFO_TYPE_ARM,
+	FLAC__CPUINFO_TYPE_ARM64,
 	FLAC__CPUINFO_TYPE_UNKNOWN
 } FLAC__CPUInfo_Type;
 
@@ -57,24 +101,59 @@ typedef struct {
 	FLAC__bool _3dnow;
 	FLAC__bool ext3dnow;
 	FLAC__bool extmmx;
-} FLAC__CPUInfo_IA32;
+	FLAC__bool sse41;
+	FLAC__bool avx; /* only set if the OS also saves the YMM registers */
+	FLAC__bool avx2; /* ditto */
+	FLAC__bool bmi2;
+	FLAC__bool pclmul;
+} FLAC__CPUInfo_IA32; /* also used for FLAC__CPUINFO_TYPE_X86_64 */
 
 typedef struct {
 	FLAC__bool altivec;
 	FLAC__bool ppc64;
 } FLAC__CPUInfo_PPC;
 
+typedef struct {
+	FLAC__bool neon;
+	FLAC__bool crc32;
+	FLAC__bool pmull;
+} FLAC__CPUInfo_ARM; /* also used for FLAC__CPUINFO_TYPE_ARM64 */
+
 typedef struct {
 	FLAC__bool use_asm;
 	FLAC__CPUInfo_Type type;
 	union {
 		FLAC__CPUInfo_IA32 ia32;
 		FLAC__CPUInfo_PPC ppc;
+		FLAC__CPUInfo_ARM arm;
 	} data;
 } FLAC__CPUInfo;
 
 void FLAC__cpu_info(FLAC__CPUInfo *info);
 
+/*
+ * The intrinsics kernels FLAC__cpu_info() found usable, whatever the
+ * architecture, so the encoder and decoder select them in one place.
+ * Entries are NULL where there is nothing better than the C version;
+ * callers keep their own defaults (and any NASM choices) for those.
+ */
+typedef struct {
+#ifndef FLAC__INTEGER_ONLY_LIBRARY
+	void (*lpc_window_data)(const FLAC__int32 in[], const FLAC__real window[], FLAC__real out[], unsigned data_len);
+	void (*lpc_compute_autocorrelation)(const FLAC__real data[], unsigned data_len, unsigned lag, FLAC__real autoc[]);
+	void (*lpc_compute_residual_from_qlp_coefficients)(const FLAC__int32 *data, unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 residual[]);
+	void (*lpc_compute_residual_from_qlp_coefficients_wide)(const FLAC__int32 *data, unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 residual[]);
+#endif
+	void (*lpc_restore_signal)(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 data[]);
+	void (*lpc_restore_signal_wide)(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 data[]);
+	unsigned (*crc16_update_block)(const FLAC__byte *data, unsigned len, unsigned crc);
+	unsigned (*crc16_update_words32)(const FLAC__uint32 *words, unsigned len, unsigned crc);
+	unsigned (*crc16_update_words64)(const FLAC__uint64 *words, unsigned len, unsigned crc);
+	void (*precompute_partition_info_sums)(const FLAC__int32 residual[], FLAC__uint64 abs_residual_partition_sums[], unsigned residual_samples, unsigned predictor_order, unsigned partition_order);
+} FLAC__CPUDispatch;
+
+void FLAC__cpu_dispatch(const FLAC__CPUInfo *info, FLAC__CPUDispatch *dispatch);
+
 #ifndef FLAC__NO_ASM
 #ifdef FLAC__CPU_IA32
 #ifdef FLAC__HAS_NASM
@@ -33,6 +33,7 @@
 #define FLAC__PRIVATE__CRC_H
 
 #include "FLAC/ordinals.h"
+#include "private/cpu.h"
 
 /* 8 bit CRC generator, MSB shifted first
 ** polynomial = x^8 + x^2 + x^1 + x^0
@@ -57,5 +58,22 @@ extern unsigned FLAC__crc16_table[256];
 #endif
 
 unsigned FLAC__crc16(const FLAC__byte *data, unsigned len);
+/* continues a CRC over more bytes, 8 bytes per step */
+unsigned FLAC__crc16_update_block(const FLAC__byte *data, unsigned len, unsigned crc);
+/* the same over host-order words holding big-endian data, e.g. a bitreader's buffer */
+unsigned FLAC__crc16_update_words32(const FLAC__uint32 *words, unsigned len, unsigned crc);
+unsigned FLAC__crc16_update_words64(const FLAC__uint64 *words, unsigned len, unsigned crc);
+
+#ifndef FLAC__NO_ASM
+#  if FLAC__HAS_X86INTRIN
+unsigned FLAC__crc16_update_block_intrin_pclmul(const FLAC__byte *data, unsigned len, unsigned crc);
+unsigned FLAC__crc16_update_words32_intrin_pclmul(const FLAC__uint32 *words, unsigned len, unsigned crc);
+unsigned FLAC__crc16_update_words64_intrin_pclmul(const FLAC__uint64 *words, unsigned len, unsigned crc);
+#  elif FLAC__HAS_PMULLINTRIN
+unsigned FLAC__crc16_update_block_intrin_pmull(const FLAC__byte *data, unsigned len, unsigned crc);
+unsigned FLAC__crc16_update_words32_intrin_pmull(const FLAC__uint32 *words, unsigned len, unsigned crc);
+unsigned FLAC__crc16_update_words64_intrin_pmull(const FLAC__uint64 *words, unsigned len, unsigned crc);
+#  endif
+#endif
 
 #endif
@@ -45,6 +45,8 @@ typedef struct FLAC__StreamDecoderProtected {
 	unsigned sample_rate; /* in Hz */
 	unsigned blocksize; /* in samples (per channel) */
 	FLAC__bool md5_checking; /* if true, generate MD5 signature of decoded data and compare against signature in the STREAMINFO metadata block */
+	unsigned num_threads; /* number of threads decoding frames in FLAC__stream_decoder_process_until_end_of_stream() */
+	FLAC__bool frame_indexing; /* if true, record the sample number and byte offset of every decoded frame for seeking */
 #if FLAC__HAS_OGG
 	FLAC__OggDecoderAspect ogg_decoder_aspect;
 #endif
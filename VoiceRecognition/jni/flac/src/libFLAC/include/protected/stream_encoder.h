@@ -78,6 +78,7 @@ typedef struct {
 typedef struct FLAC__StreamEncoderProtected {
 	FLAC__StreamEncoderState state;
 	FLAC__bool verify;
+	unsigned verify_decode_interval;
 	FLAC__bool streamable_subset;
 	FLAC__bool do_md5;
 	FLAC__bool do_mid_side_stereo;
@@ -94,10 +95,12 @@ typedef struct FLAC__StreamEncoderProtected {
 	unsigned qlp_coeff_precision;
 	FLAC__bool do_qlp_coeff_prec_search;
 	FLAC__bool do_exhaustive_model_search;
+	FLAC__bool do_early_termination;
 	FLAC__bool do_escape_coding;
 	unsigned min_residual_partition_order;
 	unsigned max_residual_partition_order;
 	unsigned rice_parameter_search_dist;
+	unsigned num_threads;
 	FLAC__uint64 total_samples_estimate;
 	FLAC__StreamMetadata **metadata;
 	unsigned num_metadata_blocks;
@@ -0,0 +1,142 @@
+/* libFLAC - Free Lossless Audio Codec library
+ * Copyright (C) 2011  Audioboo Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the Xiph.org Foundation nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "private/cpu.h"
+
+#ifndef FLAC__INTEGER_ONLY_LIBRARY
+#ifndef FLAC__NO_ASM
+#if FLAC__HAS_X86INTRIN
+
+#include "FLAC/assert.h"
+#include "FLAC/format.h"
+#include "private/lpc.h"
+
+#include <immintrin.h> /* AVX */
+
+/* Vectors needed for FLAC__MAX_LPC_ORDER+1 lags */
+#define MAX_VECTORS_ ((FLAC__MAX_LPC_ORDER + 1 + 7) / 8)
+
+FLAC__SSE_TARGET("avx")
+void FLAC__lpc_window_data_intrin_avx(const FLAC__int32 in[], const FLAC__real window[], FLAC__real out[], unsigned data_len)
+{
+	unsigned i;
+
+	for(i = 0; i + 8 <= data_len; i += 8)
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(in + i))), _mm256_loadu_ps(window + i)));
+	for(; i < data_len; i++)
+		out[i] = in[i] * window[i];
+}
+
+/*
+ * The autocorrelation is vectorised across lags: every sample is
+ * broadcast and multiplied with the 8*vectors samples following it, so
+ * lane k of sum[] gathers autoc[k].  With few vectors, two samples go
+ * into separate sums per iteration to hide the latency of the additions.
+ */
+FLAC__SSE_TARGET("avx")
+static __inline__ __attribute__ ((__always_inline__)) unsigned accumulate_(const FLAC__real data[], unsigned sample, unsigned end, __m256 sum[], __m256 sum2[], const unsigned vectors)
+{
+	unsigned m;
+
+	if(vectors <= 2) {
+		for(; sample + 2 <= end; sample += 2) {
+			const __m256 d = _mm256_set1_ps(data[sample]), d2 = _mm256_set1_ps(data[sample+1]);
+			for(m = 0; m < vectors; m++) {
+				sum[m] = _mm256_add_ps(sum[m], _mm256_mul_ps(d, _mm256_loadu_ps(data + sample + 8*m)));
+				sum2[m] = _mm256_add_ps(sum2[m], _mm256_mul_ps(d2, _mm256_loadu_ps(data + sample + 1 + 8*m)));
+			}
+		}
+	}
+	for(; sample < end; sample++) {
+		const __m256 d = _mm256_set1_ps(data[sample]);
+		for(m = 0; m < vectors; m++)
+			sum[m] = _mm256_add_ps(sum[m], _mm256_mul_ps(d, _mm256_loadu_ps(data + sample + 8*m)));
+	}
+	return sample;
+}
+
+/*
+ * Stores the lags and adds in the samples too close to the end for
+ * whole vectors.
+ */
+FLAC__SSE_TARGET("avx")
+static __inline__ __attribute__ ((__always_inline__)) void finish_(const FLAC__real data[], unsigned sample, unsigned data_len, unsigned lag, FLAC__real autoc[], __m256 sum[], __m256 sum2[], const unsigned vectors)
+{
+	FLAC__real lags[8 * MAX_VECTORS_];
+	unsigned m, coeff;
+
+	for(m = 0; m < vectors; m++)
+		_mm256_storeu_ps(lags + 8*m, _mm256_add_ps(sum[m], sum2[m]));
+	for(coeff = 0; coeff < lag; coeff++)
+		autoc[coeff] = lags[coeff];
+	for(; sample < data_len; sample++) {
+		const FLAC__real d = data[sample];
+		for(coeff = 0; coeff < lag && coeff < data_len - sample; coeff++)
+			autoc[coeff] += d * data[sample+coeff];
+	}
+}
+
+FLAC__SSE_TARGET("avx")
+static __inline__ __attribute__ ((__always_inline__)) void autocorrelation_(const FLAC__real data[], unsigned data_len, unsigned lag, FLAC__real autoc[], const unsigned vectors)
+{
+	__m256 sum[MAX_VECTORS_], sum2[MAX_VECTORS_];
+	unsigned m, sample = 0;
+
+	FLAC__ASSERT(lag > 0);
+	FLAC__ASSERT(lag <= 8 * vectors);
+	FLAC__ASSERT(lag <= data_len);
+
+	for(m = 0; m < vectors; m++)
+		sum[m] = sum2[m] = _mm256_setzero_ps();
+	if(data_len >= 8 * vectors)
+		sample = accumulate_(data, 0, data_len - 8 * vectors + 1, sum, sum2, vectors);
+	finish_(data, sample, data_len, lag, autoc, sum, sum2, vectors);
+}
+
+FLAC__SSE_TARGET("avx")
+void FLAC__lpc_compute_autocorrelation_intrin_avx(const FLAC__real data[], unsigned data_len, unsigned lag, FLAC__real autoc[])
+{
+	switch((lag + 7) / 8) {
+		case 1: autocorrelation_(data, data_len, lag, autoc, 1); break;
+		case 2: autocorrelation_(data, data_len, lag, autoc, 2); break;
+		case 3: autocorrelation_(data, data_len, lag, autoc, 3); break;
+		case 4: autocorrelation_(data, data_len, lag, autoc, 4); break;
+		default: autocorrelation_(data, data_len, lag, autoc, 5); break;
+	}
+}
+
+#endif /* FLAC__HAS_X86INTRIN */
+#endif /* FLAC__NO_ASM */
+#endif /* !defined FLAC__INTEGER_ONLY_LIBRARY */
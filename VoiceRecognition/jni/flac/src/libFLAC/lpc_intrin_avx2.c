@@ -0,0 +1,259 @@
+/* libFLAC - Free Lossless Audio Codec library
+ * Copyright (C) 2011  Audioboo Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the Xiph.org Foundation nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "private/cpu.h"
+
+#ifndef FLAC__NO_ASM
+#if FLAC__HAS_X86INTRIN
+
+#include "FLAC/assert.h"
+#include "FLAC/format.h"
+#include "private/lpc.h"
+
+#include <immintrin.h> /* AVX2 */
+
+/* Vectors needed for the taps the restore filters apply in vector code */
+#define MAX_VECTORS_ ((FLAC__MAX_LPC_ORDER - 4 + 7) / 8)
+
+#ifndef FLAC__INTEGER_ONLY_LIBRARY
+
+/*
+ * Same scheme as the SSE4.1 version, sixteen samples at a time.
+ */
+FLAC__SSE_TARGET("avx2")
+void FLAC__lpc_compute_residual_from_qlp_coefficients_intrin_avx2(const FLAC__int32 *data, unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 residual[])
+{
+	const __m128i cnt = _mm_cvtsi32_si128(lp_quantization);
+	int i, j;
+	FLAC__int32 sum;
+
+	FLAC__ASSERT(order > 0);
+	FLAC__ASSERT(order <= 32);
+
+	for(i = 0; i + 16 <= (int)data_len; i += 16) {
+		__m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+		for(j = 0; j < (int)order; j++) {
+			const __m256i q = _mm256_set1_epi32(qlp_coeff[j]);
+			const FLAC__int32 *d = data + i - j - 1;
+			sum0 = _mm256_add_epi32(sum0, _mm256_mullo_epi32(q, _mm256_loadu_si256((const __m256i*)d)));
+			sum1 = _mm256_add_epi32(sum1, _mm256_mullo_epi32(q, _mm256_loadu_si256((const __m256i*)(d + 8))));
+		}
+		sum0 = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(data + i)), _mm256_sra_epi32(sum0, cnt));
+		sum1 = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(data + i + 8)), _mm256_sra_epi32(sum1, cnt));
+		_mm256_storeu_si256((__m256i*)(residual + i), sum0);
+		_mm256_storeu_si256((__m256i*)(residual + i + 8), sum1);
+	}
+	for(; i < (int)data_len; i++) {
+		sum = 0;
+		for(j = 0; j < (int)order; j++)
+			sum += qlp_coeff[j] * data[i-j-1];
+		residual[i] = data[i] - (sum >> lp_quantization);
+	}
+}
+
+/*
+ * Same scheme as the SSE4.1 version, eight samples at a time.
+ */
+FLAC__SSE_TARGET("avx2")
+void FLAC__lpc_compute_residual_from_qlp_coefficients_wide_intrin_avx2(const FLAC__int32 *data, unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 residual[])
+{
+	const __m128i cnt = _mm_cvtsi32_si128(lp_quantization);
+	const __m256i low_halves = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	int i, j;
+	FLAC__int64 sum;
+
+	FLAC__ASSERT(order > 0);
+	FLAC__ASSERT(order <= 32);
+
+	for(i = 0; i + 8 <= (int)data_len; i += 8) {
+		__m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+		for(j = 0; j < (int)order; j++) {
+			const __m256i q = _mm256_set1_epi32(qlp_coeff[j]);
+			const FLAC__int32 *d = data + i - j - 1;
+			sum0 = _mm256_add_epi64(sum0, _mm256_mul_epi32(q, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)d))));
+			sum1 = _mm256_add_epi64(sum1, _mm256_mul_epi32(q, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(d + 4)))));
+		}
+		sum0 = _mm256_permutevar8x32_epi32(_mm256_srl_epi64(sum0, cnt), low_halves);
+		sum1 = _mm256_permutevar8x32_epi32(_mm256_srl_epi64(sum1, cnt), low_halves);
+		sum0 = _mm256_permute2x128_si256(sum0, sum1, 0x20);
+		_mm256_storeu_si256((__m256i*)(residual + i), _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(data + i)), sum0));
+	}
+	for(; i < (int)data_len; i++) {
+		sum = 0;
+		for(j = 0; j < (int)order; j++)
+			sum += qlp_coeff[j] * (FLAC__int64)data[i-j-1];
+		residual[i] = data[i] - (FLAC__int32)(sum >> lp_quantization);
+	}
+}
+
+#endif /* !defined FLAC__INTEGER_ONLY_LIBRARY */
+
+/*
+ * Same scheme as the SSE4.1 restore filters (see there), with the older
+ * taps in eight lane vectors.
+ */
+static unsigned setup_restore_(const FLAC__int32 qlp_coeff[], unsigned order, const FLAC__int32 data[], FLAC__int32 coeff[], FLAC__int32 history[])
+{
+	const unsigned n = (order - 4 + 7) & ~7u;
+	unsigned k;
+
+	for(k = 0; k < n; k++) {
+		const unsigned tap = 3 + n - k;
+		coeff[k] = (tap < order)? qlp_coeff[tap] : 0;
+		history[k] = (tap < order)? data[(int)k - 4 - (int)n] : 0;
+	}
+	return n / 8;
+}
+
+/* Moves every lane of the history chain down by one, appending x */
+FLAC__SSE_TARGET("avx2")
+static __inline__ __attribute__ ((__always_inline__)) void age_history_(__m256i h[], const unsigned vectors, FLAC__int32 x)
+{
+	unsigned m;
+
+	for(m = 0; m + 1 < vectors; m++)
+		h[m] = _mm256_alignr_epi8(_mm256_permute2x128_si256(h[m], h[m+1], 0x21), h[m], 4);
+	h[vectors-1] = _mm256_alignr_epi8(_mm256_permute2x128_si256(h[vectors-1], _mm256_castsi128_si256(_mm_cvtsi32_si128(x)), 0x21), h[vectors-1], 4);
+}
+
+FLAC__SSE_TARGET("avx2")
+static __inline__ __attribute__ ((__always_inline__)) void restore_signal_(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], const FLAC__int32 coeff[], const FLAC__int32 history[], const unsigned vectors, int lp_quantization, FLAC__int32 data[])
+{
+	const FLAC__int32 q0 = qlp_coeff[0], q1 = qlp_coeff[1], q2 = qlp_coeff[2], q3 = qlp_coeff[3];
+	FLAC__int32 x1 = data[-1], x2 = data[-2], x3 = data[-3], x4 = data[-4], x;
+	__m256i c[MAX_VECTORS_], h[MAX_VECTORS_], sum8;
+	__m128i sum;
+	unsigned i, m;
+
+	for(m = 0; m < vectors; m++) {
+		c[m] = _mm256_loadu_si256((const __m256i*)(coeff + 8*m));
+		h[m] = _mm256_loadu_si256((const __m256i*)(history + 8*m));
+	}
+	for(i = 0; i < data_len; i++) {
+		sum8 = _mm256_mullo_epi32(c[0], h[0]);
+		for(m = 1; m < vectors; m++)
+			sum8 = _mm256_add_epi32(sum8, _mm256_mullo_epi32(c[m], h[m]));
+		sum = _mm_add_epi32(_mm256_castsi256_si128(sum8), _mm256_extracti128_si256(sum8, 1));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1,0,3,2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2,3,0,1)));
+
+		x = residual[i] + ((_mm_cvtsi128_si32(sum) + q0 * x1 + q1 * x2 + q2 * x3 + q3 * x4) >> lp_quantization);
+		data[i] = x;
+
+		age_history_(h, vectors, x4);
+		x4 = x3; x3 = x2; x2 = x1; x1 = x;
+	}
+}
+
+FLAC__SSE_TARGET("avx2")
+static __inline__ __attribute__ ((__always_inline__)) void restore_signal_wide_(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], const FLAC__int32 coeff[], const FLAC__int32 history[], const unsigned vectors, int lp_quantization, FLAC__int32 data[])
+{
+	const FLAC__int64 q0 = qlp_coeff[0], q1 = qlp_coeff[1], q2 = qlp_coeff[2], q3 = qlp_coeff[3];
+	FLAC__int32 x1 = data[-1], x2 = data[-2], x3 = data[-3], x4 = data[-4], x;
+	__m256i c[MAX_VECTORS_], c_odd[MAX_VECTORS_], h[MAX_VECTORS_], sum4;
+	__m128i sum;
+	FLAC__int64 wide;
+	unsigned i, m;
+
+	for(m = 0; m < vectors; m++) {
+		c[m] = _mm256_loadu_si256((const __m256i*)(coeff + 8*m));
+		c_odd[m] = _mm256_srli_epi64(c[m], 32);
+		h[m] = _mm256_loadu_si256((const __m256i*)(history + 8*m));
+	}
+	for(i = 0; i < data_len; i++) {
+		/* _mm256_mul_epi32() only reads the even lanes, so the odd ones are shifted down */
+		sum4 = _mm256_add_epi64(_mm256_mul_epi32(c[0], h[0]), _mm256_mul_epi32(c_odd[0], _mm256_srli_epi64(h[0], 32)));
+		for(m = 1; m < vectors; m++) {
+			sum4 = _mm256_add_epi64(sum4, _mm256_mul_epi32(c[m], h[m]));
+			sum4 = _mm256_add_epi64(sum4, _mm256_mul_epi32(c_odd[m], _mm256_srli_epi64(h[m], 32)));
+		}
+		sum = _mm_add_epi64(_mm256_castsi256_si128(sum4), _mm256_extracti128_si256(sum4, 1));
+		sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+		_mm_storel_epi64((__m128i*)&wide, sum);
+
+		x = residual[i] + (FLAC__int32)((wide + q0 * x1 + q1 * x2 + q2 * x3 + q3 * x4) >> lp_quantization);
+		data[i] = x;
+
+		age_history_(h, vectors, x4);
+		x4 = x3; x3 = x2; x2 = x1; x1 = x;
+	}
+}
+
+/* One specialisation per vector count, so that the history stays in registers */
+#define RESTORE_CASES_(kernel) \
+	switch(vectors) { \
+		case 1: kernel(residual, data_len, qlp_coeff, coeff, history, 1, lp_quantization, data); break; \
+		case 2: kernel(residual, data_len, qlp_coeff, coeff, history, 2, lp_quantization, data); break; \
+		case 3: kernel(residual, data_len, qlp_coeff, coeff, history, 3, lp_quantization, data); break; \
+		default: kernel(residual, data_len, qlp_coeff, coeff, history, 4, lp_quantization, data); break; \
+	}
+
+FLAC__SSE_TARGET("avx2")
+void FLAC__lpc_restore_signal_intrin_avx2(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 data[])
+{
+	FLAC__int32 coeff[FLAC__MAX_LPC_ORDER], history[FLAC__MAX_LPC_ORDER];
+	unsigned vectors;
+
+	FLAC__ASSERT(order > 0);
+	FLAC__ASSERT(order <= 32);
+
+	/* up to order 8 the unrolled C filter is as fast */
+	if(order <= 8) {
+		FLAC__lpc_restore_signal(residual, data_len, qlp_coeff, order, lp_quantization, data);
+		return;
+	}
+	vectors = setup_restore_(qlp_coeff, order, data, coeff, history);
+	RESTORE_CASES_(restore_signal_)
+}
+
+FLAC__SSE_TARGET("avx2")
+void FLAC__lpc_restore_signal_wide_intrin_avx2(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 data[])
+{
+	FLAC__int32 coeff[FLAC__MAX_LPC_ORDER], history[FLAC__MAX_LPC_ORDER];
+	unsigned vectors;
+
+	FLAC__ASSERT(order > 0);
+	FLAC__ASSERT(order <= 32);
+
+	if(order <= 4) {
+		FLAC__lpc_restore_signal_wide(residual, data_len, qlp_coeff, order, lp_quantization, data);
+		return;
+	}
+	vectors = setup_restore_(qlp_coeff, order, data, coeff, history);
+	RESTORE_CASES_(restore_signal_wide_)
+}
+
+#endif /* FLAC__HAS_X86INTRIN */
+#endif /* FLAC__NO_ASM */
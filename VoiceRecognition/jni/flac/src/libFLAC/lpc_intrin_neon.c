@@ -0,0 +1,343 @@
+/* libFLAC - Free Lossless Audio Codec library
+ * Copyright (C) 2011  Audioboo Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the Xiph.org Foundation nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "private/cpu.h"
+
+#ifndef FLAC__NO_ASM
+#if FLAC__HAS_NEONINTRIN
+
+#include "FLAC/assert.h"
+#include "FLAC/format.h"
+#include "private/lpc.h"
+
+#include <arm_neon.h>
+
+/* Vectors needed for the taps the restore filters apply in vector code */
+#define MAX_VECTORS_ ((FLAC__MAX_LPC_ORDER - 4) / 4)
+
+/* Vectors needed for FLAC__MAX_LPC_ORDER+1 autocorrelation lags */
+#define AUTOC_VECTORS_ ((FLAC__MAX_LPC_ORDER + 1 + 3) / 4)
+
+
+#ifndef FLAC__INTEGER_ONLY_LIBRARY
+
+/*
+ * The residual has no feedback, so eight consecutive samples are filtered
+ * at once; every coefficient is applied to two unaligned loads of history.
+ */
+void FLAC__lpc_compute_residual_from_qlp_coefficients_intrin_neon(const FLAC__int32 *data, unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 residual[])
+{
+	const int32x4_t shift = vdupq_n_s32(-lp_quantization);
+	int i, j;
+	FLAC__int32 sum;
+
+	FLAC__ASSERT(order > 0);
+	FLAC__ASSERT(order <= 32);
+
+	for(i = 0; i + 8 <= (int)data_len; i += 8) {
+		int32x4_t sum0 = vdupq_n_s32(0), sum1 = vdupq_n_s32(0);
+		for(j = 0; j < (int)order; j++) {
+			const FLAC__int32 *d = data + i - j - 1;
+			sum0 = vmlaq_n_s32(sum0, vld1q_s32(d), qlp_coeff[j]);
+			sum1 = vmlaq_n_s32(sum1, vld1q_s32(d + 4), qlp_coeff[j]);
+		}
+		/* a negative shift count shifts right, arithmetically */
+		vst1q_s32(residual + i, vsubq_s32(vld1q_s32(data + i), vshlq_s32(sum0, shift)));
+		vst1q_s32(residual + i + 4, vsubq_s32(vld1q_s32(data + i + 4), vshlq_s32(sum1, shift)));
+	}
+	for(; i < (int)data_len; i++) {
+		sum = 0;
+		for(j = 0; j < (int)order; j++)
+			sum += qlp_coeff[j] * data[i-j-1];
+		residual[i] = data[i] - (sum >> lp_quantization);
+	}
+}
+
+/*
+ * As above, but with 64 bit products and sums, four samples at a time.
+ */
+void FLAC__lpc_compute_residual_from_qlp_coefficients_wide_intrin_neon(const FLAC__int32 *data, unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 residual[])
+{
+	const int64x2_t shift = vdupq_n_s64(-lp_quantization);
+	int i, j;
+	FLAC__int64 sum;
+
+	FLAC__ASSERT(order > 0);
+	FLAC__ASSERT(order <= 32);
+
+	for(i = 0; i + 4 <= (int)data_len; i += 4) {
+		int64x2_t sum0 = vdupq_n_s64(0), sum1 = vdupq_n_s64(0);
+		for(j = 0; j < (int)order; j++) {
+			const int32x4_t d = vld1q_s32(data + i - j - 1);
+			const int32x2_t q = vdup_n_s32(qlp_coeff[j]);
+			sum0 = vmlal_s32(sum0, vget_low_s32(d), q);
+			sum1 = vmlal_s32(sum1, vget_high_s32(d), q);
+		}
+		sum0 = vshlq_s64(sum0, shift);
+		sum1 = vshlq_s64(sum1, shift);
+		vst1q_s32(residual + i, vsubq_s32(vld1q_s32(data + i), vcombine_s32(vmovn_s64(sum0), vmovn_s64(sum1))));
+	}
+	for(; i < (int)data_len; i++) {
+		sum = 0;
+		for(j = 0; j < (int)order; j++)
+			sum += qlp_coeff[j] * (FLAC__int64)data[i-j-1];
+		residual[i] = data[i] - (FLAC__int32)(sum >> lp_quantization);
+	}
+}
+
+void FLAC__lpc_window_data_intrin_neon(const FLAC__int32 in[], const FLAC__real window[], FLAC__real out[], unsigned data_len)
+{
+	unsigned i;
+
+	for(i = 0; i + 4 <= data_len; i += 4)
+		vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(vld1q_s32(in + i)), vld1q_f32(window + i)));
+	for(; i < data_len; i++)
+		out[i] = in[i] * window[i];
+}
+
+/*
+ * As in the SSE2 version, the autocorrelation is vectorised across lags,
+ * with two samples per iteration going into separate sums for low lags.
+ */
+static __inline__ __attribute__ ((__always_inline__)) unsigned accumulate_(const FLAC__real data[], unsigned sample, unsigned end, float32x4_t sum[], float32x4_t sum2[], const unsigned vectors)
+{
+	unsigned m;
+
+	if(vectors <= 4) {
+		for(; sample + 2 <= end; sample += 2) {
+			const float32_t d = data[sample], d2 = data[sample+1];
+			for(m = 0; m < vectors; m++) {
+				sum[m] = vmlaq_n_f32(sum[m], vld1q_f32(data + sample + 4*m), d);
+				sum2[m] = vmlaq_n_f32(sum2[m], vld1q_f32(data + sample + 1 + 4*m), d2);
+			}
+		}
+	}
+	for(; sample < end; sample++) {
+		const float32_t d = data[sample];
+		for(m = 0; m < vectors; m++)
+			sum[m] = vmlaq_n_f32(sum[m], vld1q_f32(data + sample + 4*m), d);
+	}
+	return sample;
+}
+
+static __inline__ __attribute__ ((__always_inline__)) void finish_(const FLAC__real data[], unsigned sample, unsigned data_len, unsigned lag, FLAC__real autoc[], float32x4_t sum[], float32x4_t sum2[], const unsigned vectors)
+{
+	FLAC__real lags[4 * AUTOC_VECTORS_];
+	unsigned m, coeff;
+
+	for(m = 0; m < vectors; m++)
+		vst1q_f32(lags + 4*m, vaddq_f32(sum[m], sum2[m]));
+	for(coeff = 0; coeff < lag; coeff++)
+		autoc[coeff] = lags[coeff];
+	for(; sample < data_len; sample++) {
+		const FLAC__real d = data[sample];
+		for(coeff = 0; coeff < lag && coeff < data_len - sample; coeff++)
+			autoc[coeff] += d * data[sample+coeff];
+	}
+}
+
+static __inline__ __attribute__ ((__always_inline__)) void autocorrelation_(const FLAC__real data[], unsigned data_len, unsigned lag, FLAC__real autoc[], const unsigned vectors)
+{
+	float32x4_t sum[AUTOC_VECTORS_], sum2[AUTOC_VECTORS_];
+	unsigned m, sample = 0;
+
+	FLAC__ASSERT(lag > 0);
+	FLAC__ASSERT(lag <= 4 * vectors);
+	FLAC__ASSERT(lag <= data_len);
+
+	for(m = 0; m < vectors; m++)
+		sum[m] = sum2[m] = vdupq_n_f32(0.0f);
+	if(data_len >= 4 * vectors)
+		sample = accumulate_(data, 0, data_len - 4 * vectors + 1, sum, sum2, vectors);
+	finish_(data, sample, data_len, lag, autoc, sum, sum2, vectors);
+}
+
+void FLAC__lpc_compute_autocorrelation_intrin_neon(const FLAC__real data[], unsigned data_len, unsigned lag, FLAC__real autoc[])
+{
+	switch((lag + 3) / 4) {
+		case 1:
+		case 2: autocorrelation_(data, data_len, lag, autoc, 2); break;
+		case 3: autocorrelation_(data, data_len, lag, autoc, 3); break;
+		case 4: autocorrelation_(data, data_len, lag, autoc, 4); break;
+		case 5: autocorrelation_(data, data_len, lag, autoc, 5); break;
+		case 6: autocorrelation_(data, data_len, lag, autoc, 6); break;
+		case 7: autocorrelation_(data, data_len, lag, autoc, 7); break;
+		case 8: autocorrelation_(data, data_len, lag, autoc, 8); break;
+		default: autocorrelation_(data, data_len, lag, autoc, 9); break;
+	}
+}
+
+#endif /* !defined FLAC__INTEGER_ONLY_LIBRARY */
+
+/*
+ * Same scheme as the SSE4.1 restore filters (see there): the four newest
+ * taps in scalar code, the older ones in vectors of register history.
+ */
+static unsigned setup_restore_(const FLAC__int32 qlp_coeff[], unsigned order, const FLAC__int32 data[], FLAC__int32 coeff[], FLAC__int32 history[])
+{
+	const unsigned n = (order - 4 + 3) & ~3u;
+	unsigned k;
+
+	for(k = 0; k < n; k++) {
+		const unsigned tap = 3 + n - k;
+		coeff[k] = (tap < order)? qlp_coeff[tap] : 0;
+		history[k] = (tap < order)? data[(int)k - 4 - (int)n] : 0;
+	}
+	return n / 4;
+}
+
+static __inline__ __attribute__ ((__always_inline__)) FLAC__int32 add_lanes_(int32x4_t v)
+{
+#if defined __aarch64__
+	return vaddvq_s32(v);
+#else
+	const int32x2_t t = vadd_s32(vget_low_s32(v), vget_high_s32(v));
+	return vget_lane_s32(vpadd_s32(t, t), 0);
+#endif
+}
+
+static __inline__ __attribute__ ((__always_inline__)) FLAC__int64 add_lanes_wide_(int64x2_t v)
+{
+#if defined __aarch64__
+	return vaddvq_s64(v);
+#else
+	return vgetq_lane_s64(v, 0) + vgetq_lane_s64(v, 1);
+#endif
+}
+
+static __inline__ __attribute__ ((__always_inline__)) void restore_signal_(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], const FLAC__int32 coeff[], const FLAC__int32 history[], const unsigned vectors, int lp_quantization, FLAC__int32 data[])
+{
+	const FLAC__int32 q0 = qlp_coeff[0], q1 = qlp_coeff[1], q2 = qlp_coeff[2], q3 = qlp_coeff[3];
+	FLAC__int32 x1 = data[-1], x2 = data[-2], x3 = data[-3], x4 = data[-4], x;
+	int32x4_t c[MAX_VECTORS_], h[MAX_VECTORS_], sum;
+	unsigned i, m;
+
+	for(m = 0; m < vectors; m++) {
+		c[m] = vld1q_s32(coeff + 4*m);
+		h[m] = vld1q_s32(history + 4*m);
+	}
+	for(i = 0; i < data_len; i++) {
+		sum = vmulq_s32(c[0], h[0]);
+		for(m = 1; m < vectors; m++)
+			sum = vmlaq_s32(sum, c[m], h[m]);
+
+		x = residual[i] + ((add_lanes_(sum) + q0 * x1 + q1 * x2 + q2 * x3 + q3 * x4) >> lp_quantization);
+		data[i] = x;
+
+		/* age the history by one sample */
+		for(m = 0; m + 1 < vectors; m++)
+			h[m] = vextq_s32(h[m], h[m+1], 1);
+		h[vectors-1] = vextq_s32(h[vectors-1], vdupq_n_s32(x4), 1);
+		x4 = x3; x3 = x2; x2 = x1; x1 = x;
+	}
+}
+
+static __inline__ __attribute__ ((__always_inline__)) void restore_signal_wide_(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], const FLAC__int32 coeff[], const FLAC__int32 history[], const unsigned vectors, int lp_quantization, FLAC__int32 data[])
+{
+	const FLAC__int64 q0 = qlp_coeff[0], q1 = qlp_coeff[1], q2 = qlp_coeff[2], q3 = qlp_coeff[3];
+	FLAC__int32 x1 = data[-1], x2 = data[-2], x3 = data[-3], x4 = data[-4], x;
+	int32x4_t c[MAX_VECTORS_], h[MAX_VECTORS_];
+	int64x2_t sum;
+	unsigned i, m;
+
+	for(m = 0; m < vectors; m++) {
+		c[m] = vld1q_s32(coeff + 4*m);
+		h[m] = vld1q_s32(history + 4*m);
+	}
+	for(i = 0; i < data_len; i++) {
+		sum = vmull_s32(vget_low_s32(c[0]), vget_low_s32(h[0]));
+		sum = vmlal_s32(sum, vget_high_s32(c[0]), vget_high_s32(h[0]));
+		for(m = 1; m < vectors; m++) {
+			sum = vmlal_s32(sum, vget_low_s32(c[m]), vget_low_s32(h[m]));
+			sum = vmlal_s32(sum, vget_high_s32(c[m]), vget_high_s32(h[m]));
+		}
+
+		x = residual[i] + (FLAC__int32)((add_lanes_wide_(sum) + q0 * x1 + q1 * x2 + q2 * x3 + q3 * x4) >> lp_quantization);
+		data[i] = x;
+
+		for(m = 0; m + 1 < vectors; m++)
+			h[m] = vextq_s32(h[m], h[m+1], 1);
+		h[vectors-1] = vextq_s32(h[vectors-1], vdupq_n_s32(x4), 1);
+		x4 = x3; x3 = x2; x2 = x1; x1 = x;
+	}
+}
+
+/* One specialisation per vector count, so that the history stays in registers */
+#define RESTORE_CASES_(kernel) \
+	switch(vectors) { \
+		case 1: kernel(residual, data_len, qlp_coeff, coeff, history, 1, lp_quantization, data); break; \
+		case 2: kernel(residual, data_len, qlp_coeff, coeff, history, 2, lp_quantization, data); break; \
+		case 3: kernel(residual, data_len, qlp_coeff, coeff, history, 3, lp_quantization, data); break; \
+		case 4: kernel(residual, data_len, qlp_coeff, coeff, history, 4, lp_quantization, data); break; \
+		case 5: kernel(residual, data_len, qlp_coeff, coeff, history, 5, lp_quantization, data); break; \
+		case 6: kernel(residual, data_len, qlp_coeff, coeff, history, 6, lp_quantization, data); break; \
+		default: kernel(residual, data_len, qlp_coeff, coeff, history, 7, lp_quantization, data); break; \
+	}
+
+void FLAC__lpc_restore_signal_intrin_neon(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 data[])
+{
+	FLAC__int32 coeff[FLAC__MAX_LPC_ORDER], history[FLAC__MAX_LPC_ORDER];
+	unsigned vectors;
+
+	FLAC__ASSERT(order > 0);
+	FLAC__ASSERT(order <= 32);
+
+	/* up to order 8 the unrolled C filter is as fast */
+	if(order <= 8) {
+		FLAC__lpc_restore_signal(residual, data_len, qlp_coeff, order, lp_quantization, data);
+		return;
+	}
+	vectors = setup_restore_(qlp_coeff, order, data, coeff, history);
+	RESTORE_CASES_(restore_signal_)
+}
+
+void FLAC__lpc_restore_signal_wide_intrin_neon(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 data[])
+{
+	FLAC__int32 coeff[FLAC__MAX_LPC_ORDER], history[FLAC__MAX_LPC_ORDER];
+	unsigned vectors;
+
+	FLAC__ASSERT(order > 0);
+	FLAC__ASSERT(order <= 32);
+
+	if(order <= 4) {
+		FLAC__lpc_restore_signal_wide(residual, data_len, qlp_coeff, order, lp_quantization, data);
+		return;
+	}
+	vectors = setup_restore_(qlp_coeff, order, data, coeff, history);
+	RESTORE_CASES_(restore_signal_wide_)
+}
+
+#endif /* FLAC__HAS_NEONINTRIN */
+#endif /* FLAC__NO_ASM */
@@ -0,0 +1,146 @@
+/* libFLAC - Free Lossless Audio Codec library
+ * Copyright (C) 2011  Audioboo Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the Xiph.org Foundation nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "private/cpu.h"
+
+#ifndef FLAC__INTEGER_ONLY_LIBRARY
+#ifndef FLAC__NO_ASM
+#if FLAC__HAS_X86INTRIN
+
+#include "FLAC/assert.h"
+#include "FLAC/format.h"
+#include "private/lpc.h"
+
+#include <emmintrin.h> /* SSE2 */
+
+/* Vectors needed for FLAC__MAX_LPC_ORDER+1 lags */
+#define MAX_VECTORS_ ((FLAC__MAX_LPC_ORDER + 1 + 3) / 4)
+
+FLAC__SSE_TARGET("sse2")
+void FLAC__lpc_window_data_intrin_sse2(const FLAC__int32 in[], const FLAC__real window[], FLAC__real out[], unsigned data_len)
+{
+	unsigned i;
+
+	for(i = 0; i + 4 <= data_len; i += 4)
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(in + i))), _mm_loadu_ps(window + i)));
+	for(; i < data_len; i++)
+		out[i] = in[i] * window[i];
+}
+
+/*
+ * The autocorrelation is vectorised across lags: every sample is
+ * broadcast and multiplied with the 4*vectors samples following it, so
+ * lane k of sum[] gathers autoc[k].  With few vectors, two samples go
+ * into separate sums per iteration to hide the latency of the additions.
+ */
+FLAC__SSE_TARGET("sse2")
+static __inline__ __attribute__ ((__always_inline__)) unsigned accumulate_(const FLAC__real data[], unsigned sample, unsigned end, __m128 sum[], __m128 sum2[], const unsigned vectors)
+{
+	unsigned m;
+
+	if(vectors <= 4) {
+		for(; sample + 2 <= end; sample += 2) {
+			const __m128 d = _mm_set1_ps(data[sample]), d2 = _mm_set1_ps(data[sample+1]);
+			for(m = 0; m < vectors; m++) {
+				sum[m] = _mm_add_ps(sum[m], _mm_mul_ps(d, _mm_loadu_ps(data + sample + 4*m)));
+				sum2[m] = _mm_add_ps(sum2[m], _mm_mul_ps(d2, _mm_loadu_ps(data + sample + 1 + 4*m)));
+			}
+		}
+	}
+	for(; sample < end; sample++) {
+		const __m128 d = _mm_set1_ps(data[sample]);
+		for(m = 0; m < vectors; m++)
+			sum[m] = _mm_add_ps(sum[m], _mm_mul_ps(d, _mm_loadu_ps(data + sample + 4*m)));
+	}
+	return sample;
+}
+
+/*
+ * Stores the lags and adds in the samples too close to the end for
+ * whole vectors.
+ */
+FLAC__SSE_TARGET("sse2")
+static __inline__ __attribute__ ((__always_inline__)) void finish_(const FLAC__real data[], unsigned sample, unsigned data_len, unsigned lag, FLAC__real autoc[], __m128 sum[], __m128 sum2[], const unsigned vectors)
+{
+	FLAC__real lags[4 * MAX_VECTORS_];
+	unsigned m, coeff;
+
+	for(m = 0; m < vectors; m++)
+		_mm_storeu_ps(lags + 4*m, _mm_add_ps(sum[m], sum2[m]));
+	for(coeff = 0; coeff < lag; coeff++)
+		autoc[coeff] = lags[coeff];
+	for(; sample < data_len; sample++) {
+		const FLAC__real d = data[sample];
+		for(coeff = 0; coeff < lag && coeff < data_len - sample; coeff++)
+			autoc[coeff] += d * data[sample+coeff];
+	}
+}
+
+FLAC__SSE_TARGET("sse2")
+static __inline__ __attribute__ ((__always_inline__)) void autocorrelation_(const FLAC__real data[], unsigned data_len, unsigned lag, FLAC__real autoc[], const unsigned vectors)
+{
+	__m128 sum[MAX_VECTORS_], sum2[MAX_VECTORS_];
+	unsigned m, sample = 0;
+
+	FLAC__ASSERT(lag > 0);
+	FLAC__ASSERT(lag <= 4 * vectors);
+	FLAC__ASSERT(lag <= data_len);
+
+	for(m = 0; m < vectors; m++)
+		sum[m] = sum2[m] = _mm_setzero_ps();
+	if(data_len >= 4 * vectors)
+		sample = accumulate_(data, 0, data_len - 4 * vectors + 1, sum, sum2, vectors);
+	finish_(data, sample, data_len, lag, autoc, sum, sum2, vectors);
+}
+
+FLAC__SSE_TARGET("sse2")
+void FLAC__lpc_compute_autocorrelation_intrin_sse2(const FLAC__real data[], unsigned data_len, unsigned lag, FLAC__real autoc[])
+{
+	switch((lag + 3) / 4) {
+		case 1:
+		case 2: autocorrelation_(data, data_len, lag, autoc, 2); break;
+		case 3: autocorrelation_(data, data_len, lag, autoc, 3); break;
+		case 4: autocorrelation_(data, data_len, lag, autoc, 4); break;
+		case 5: autocorrelation_(data, data_len, lag, autoc, 5); break;
+		case 6: autocorrelation_(data, data_len, lag, autoc, 6); break;
+		case 7: autocorrelation_(data, data_len, lag, autoc, 7); break;
+		case 8: autocorrelation_(data, data_len, lag, autoc, 8); break;
+		default: autocorrelation_(data, data_len, lag, autoc, 9); break;
+	}
+}
+
+#endif /* FLAC__HAS_X86INTRIN */
+#endif /* FLAC__NO_ASM */
+#endif /* !defined FLAC__INTEGER_ONLY_LIBRARY */
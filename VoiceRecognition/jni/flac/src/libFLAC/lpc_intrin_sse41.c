@@ -0,0 +1,265 @@
+/* libFLAC - Free Lossless Audio Codec library
+ * Copyright (C) 2011  Audioboo Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the Xiph.org Foundation nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "private/cpu.h"
+
+#ifndef FLAC__NO_ASM
+#if FLAC__HAS_X86INTRIN
+
+#include "FLAC/assert.h"
+#include "FLAC/format.h"
+#include "private/lpc.h"
+
+#include <smmintrin.h> /* SSE4.1 */
+
+/* Vectors needed for the taps the restore filters apply in vector code */
+#define MAX_VECTORS_ ((FLAC__MAX_LPC_ORDER - 4) / 4)
+
+#ifndef FLAC__INTEGER_ONLY_LIBRARY
+
+/*
+ * The residual has no feedback, so eight consecutive samples are filtered
+ * at once; every coefficient is applied to two unaligned loads of history.
+ */
+FLAC__SSE_TARGET("sse4.1")
+void FLAC__lpc_compute_residual_from_qlp_coefficients_intrin_sse41(const FLAC__int32 *data, unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 residual[])
+{
+	const __m128i cnt = _mm_cvtsi32_si128(lp_quantization);
+	int i, j;
+	FLAC__int32 sum;
+
+	FLAC__ASSERT(order > 0);
+	FLAC__ASSERT(order <= 32);
+
+	for(i = 0; i + 8 <= (int)data_len; i += 8) {
+		__m128i sum0 = _mm_setzero_si128(), sum1 = _mm_setzero_si128();
+		for(j = 0; j < (int)order; j++) {
+			const __m128i q = _mm_set1_epi32(qlp_coeff[j]);
+			const FLAC__int32 *d = data + i - j - 1;
+			sum0 = _mm_add_epi32(sum0, _mm_mullo_epi32(q, _mm_loadu_si128((const __m128i*)d)));
+			sum1 = _mm_add_epi32(sum1, _mm_mullo_epi32(q, _mm_loadu_si128((const __m128i*)(d + 4))));
+		}
+		sum0 = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(data + i)), _mm_sra_epi32(sum0, cnt));
+		sum1 = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(data + i + 4)), _mm_sra_epi32(sum1, cnt));
+		_mm_storeu_si128((__m128i*)(residual + i), sum0);
+		_mm_storeu_si128((__m128i*)(residual + i + 4), sum1);
+	}
+	for(; i < (int)data_len; i++) {
+		sum = 0;
+		for(j = 0; j < (int)order; j++)
+			sum += qlp_coeff[j] * data[i-j-1];
+		residual[i] = data[i] - (sum >> lp_quantization);
+	}
+}
+
+/*
+ * As above, but with 64 bit products and sums: _mm_mul_epi32() multiplies
+ * the sign-extended samples of two 64 bit lanes at a time.  Only the low
+ * 32 bits of the shifted sum are kept, and for shifts below 32 those are
+ * the same for a logical as for an arithmetic shift.
+ */
+FLAC__SSE_TARGET("sse4.1")
+void FLAC__lpc_compute_residual_from_qlp_coefficients_wide_intrin_sse41(const FLAC__int32 *data, unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 residual[])
+{
+	const __m128i cnt = _mm_cvtsi32_si128(lp_quantization);
+	int i, j;
+	FLAC__int64 sum;
+
+	FLAC__ASSERT(order > 0);
+	FLAC__ASSERT(order <= 32);
+
+	for(i = 0; i + 4 <= (int)data_len; i += 4) {
+		__m128i sum0 = _mm_setzero_si128(), sum1 = _mm_setzero_si128();
+		for(j = 0; j < (int)order; j++) {
+			const __m128i q = _mm_set1_epi32(qlp_coeff[j]);
+			const __m128i d = _mm_loadu_si128((const __m128i*)(data + i - j - 1));
+			sum0 = _mm_add_epi64(sum0, _mm_mul_epi32(q, _mm_cvtepi32_epi64(d)));
+			sum1 = _mm_add_epi64(sum1, _mm_mul_epi32(q, _mm_cvtepi32_epi64(_mm_srli_si128(d, 8))));
+		}
+		sum0 = _mm_srl_epi64(sum0, cnt);
+		sum1 = _mm_srl_epi64(sum1, cnt);
+		/* gather the low halves of the four 64 bit sums */
+		sum0 = _mm_unpacklo_epi64(_mm_shuffle_epi32(sum0, _MM_SHUFFLE(2,0,2,0)), _mm_shuffle_epi32(sum1, _MM_SHUFFLE(2,0,2,0)));
+		_mm_storeu_si128((__m128i*)(residual + i), _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(data + i)), sum0));
+	}
+	for(; i < (int)data_len; i++) {
+		sum = 0;
+		for(j = 0; j < (int)order; j++)
+			sum += qlp_coeff[j] * (FLAC__int64)data[i-j-1];
+		residual[i] = data[i] - (FLAC__int32)(sum >> lp_quantization);
+	}
+}
+
+#endif /* !defined FLAC__INTEGER_ONLY_LIBRARY */
+
+/*
+ * The restore filters feed every sample back into the next prediction, so
+ * they run one sample at a time and only pay off for longer filters.  The
+ * four newest taps are applied in scalar code; the older ones only depend
+ * on samples restored at least four iterations earlier, which keeps the
+ * slow vector multiply and reduction off the feedback path.  That history
+ * is kept in registers, aged by one sample per iteration, as reloading it
+ * from data[] right after a store would stall on store forwarding.
+ *
+ * Lane k of the history holds data[i-4-n+k], with n the number of older
+ * taps rounded up to whole vectors; the coefficients are laid out to
+ * match, zero padded at the front.
+ */
+static unsigned setup_restore_(const FLAC__int32 qlp_coeff[], unsigned order, const FLAC__int32 data[], FLAC__int32 coeff[], FLAC__int32 history[])
+{
+	const unsigned n = (order - 4 + 3) & ~3u;
+	unsigned k;
+
+	for(k = 0; k < n; k++) {
+		const unsigned tap = 3 + n - k;
+		coeff[k] = (tap < order)? qlp_coeff[tap] : 0;
+		history[k] = (tap < order)? data[(int)k - 4 - (int)n] : 0;
+	}
+	return n / 4;
+}
+
+FLAC__SSE_TARGET("sse4.1")
+static __inline__ __attribute__ ((__always_inline__)) void restore_signal_(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], const FLAC__int32 coeff[], const FLAC__int32 history[], const unsigned vectors, int lp_quantization, FLAC__int32 data[])
+{
+	const FLAC__int32 q0 = qlp_coeff[0], q1 = qlp_coeff[1], q2 = qlp_coeff[2], q3 = qlp_coeff[3];
+	FLAC__int32 x1 = data[-1], x2 = data[-2], x3 = data[-3], x4 = data[-4], x;
+	__m128i c[MAX_VECTORS_], h[MAX_VECTORS_], sum;
+	unsigned i, m;
+
+	for(m = 0; m < vectors; m++) {
+		c[m] = _mm_loadu_si128((const __m128i*)(coeff + 4*m));
+		h[m] = _mm_loadu_si128((const __m128i*)(history + 4*m));
+	}
+	for(i = 0; i < data_len; i++) {
+		sum = _mm_mullo_epi32(c[0], h[0]);
+		for(m = 1; m < vectors; m++)
+			sum = _mm_add_epi32(sum, _mm_mullo_epi32(c[m], h[m]));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1,0,3,2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2,3,0,1)));
+
+		x = residual[i] + ((_mm_cvtsi128_si32(sum) + q0 * x1 + q1 * x2 + q2 * x3 + q3 * x4) >> lp_quantization);
+		data[i] = x;
+
+		/* age the history by one sample */
+		for(m = 0; m + 1 < vectors; m++)
+			h[m] = _mm_alignr_epi8(h[m+1], h[m], 4);
+		h[vectors-1] = _mm_alignr_epi8(_mm_cvtsi32_si128(x4), h[vectors-1], 4);
+		x4 = x3; x3 = x2; x2 = x1; x1 = x;
+	}
+}
+
+FLAC__SSE_TARGET("sse4.1")
+static __inline__ __attribute__ ((__always_inline__)) void restore_signal_wide_(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], const FLAC__int32 coeff[], const FLAC__int32 history[], const unsigned vectors, int lp_quantization, FLAC__int32 data[])
+{
+	const FLAC__int64 q0 = qlp_coeff[0], q1 = qlp_coeff[1], q2 = qlp_coeff[2], q3 = qlp_coeff[3];
+	FLAC__int32 x1 = data[-1], x2 = data[-2], x3 = data[-3], x4 = data[-4], x;
+	__m128i c[MAX_VECTORS_], c_odd[MAX_VECTORS_], h[MAX_VECTORS_], sum;
+	FLAC__int64 wide;
+	unsigned i, m;
+
+	for(m = 0; m < vectors; m++) {
+		c[m] = _mm_loadu_si128((const __m128i*)(coeff + 4*m));
+		c_odd[m] = _mm_srli_epi64(c[m], 32);
+		h[m] = _mm_loadu_si128((const __m128i*)(history + 4*m));
+	}
+	for(i = 0; i < data_len; i++) {
+		/* _mm_mul_epi32() only reads the even lanes, so the odd ones are shifted down */
+		sum = _mm_add_epi64(_mm_mul_epi32(c[0], h[0]), _mm_mul_epi32(c_odd[0], _mm_srli_epi64(h[0], 32)));
+		for(m = 1; m < vectors; m++) {
+			sum = _mm_add_epi64(sum, _mm_mul_epi32(c[m], h[m]));
+			sum = _mm_add_epi64(sum, _mm_mul_epi32(c_odd[m], _mm_srli_epi64(h[m], 32)));
+		}
+		sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+		_mm_storel_epi64((__m128i*)&wide, sum);
+
+		x = residual[i] + (FLAC__int32)((wide + q0 * x1 + q1 * x2 + q2 * x3 + q3 * x4) >> lp_quantization);
+		data[i] = x;
+
+		for(m = 0; m + 1 < vectors; m++)
+			h[m] = _mm_alignr_epi8(h[m+1], h[m], 4);
+		h[vectors-1] = _mm_alignr_epi8(_mm_cvtsi32_si128(x4), h[vectors-1], 4);
+		x4 = x3; x3 = x2; x2 = x1; x1 = x;
+	}
+}
+
+/* One specialisation per vector count, so that the history stays in registers */
+#define RESTORE_CASES_(kernel) \
+	switch(vectors) { \
+		case 1: kernel(residual, data_len, qlp_coeff, coeff, history, 1, lp_quantization, data); break; \
+		case 2: kernel(residual, data_len, qlp_coeff, coeff, history, 2, lp_quantization, data); break; \
+		case 3: kernel(residual, data_len, qlp_coeff, coeff, history, 3, lp_quantization, data); break; \
+		case 4: kernel(residual, data_len, qlp_coeff, coeff, history, 4, lp_quantization, data); break; \
+		case 5: kernel(residual, data_len, qlp_coeff, coeff, history, 5, lp_quantization, data); break; \
+		case 6: kernel(residual, data_len, qlp_coeff, coeff, history, 6, lp_quantization, data); break; \
+		default: kernel(residual, data_len, qlp_coeff, coeff, history, 7, lp_quantization, data); break; \
+	}
+
+FLAC__SSE_TARGET("sse4.1")
+void FLAC__lpc_restore_signal_intrin_sse41(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 data[])
+{
+	FLAC__int32 coeff[FLAC__MAX_LPC_ORDER], history[FLAC__MAX_LPC_ORDER];
+	unsigned vectors;
+
+	FLAC__ASSERT(order > 0);
+	FLAC__ASSERT(order <= 32);
+
+	/* up to order 8 the unrolled C filter is as fast */
+	if(order <= 8) {
+		FLAC__lpc_restore_signal(residual, data_len, qlp_coeff, order, lp_quantization, data);
+		return;
+	}
+	vectors = setup_restore_(qlp_coeff, order, data, coeff, history);
+	RESTORE_CASES_(restore_signal_)
+}
+
+FLAC__SSE_TARGET("sse4.1")
+void FLAC__lpc_restore_signal_wide_intrin_sse41(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 data[])
+{
+	FLAC__int32 coeff[FLAC__MAX_LPC_ORDER], history[FLAC__MAX_LPC_ORDER];
+	unsigned vectors;
+
+	FLAC__ASSERT(order > 0);
+	FLAC__ASSERT(order <= 32);
+
+	if(order <= 4) {
+		FLAC__lpc_restore_signal_wide(residual, data_len, qlp_coeff, order, lp_quantization, data);
+		return;
+	}
+	vectors = setup_restore_(qlp_coeff, order, data, coeff, history);
+	RESTORE_CASES_(restore_signal_wide_)
+}
+
+#endif /* FLAC__HAS_X86INTRIN */
+#endif /* FLAC__NO_ASM */
@@ -2,11 +2,22 @@
 #  include <config.h>
 #endif
 
-#include <stdlib.h>		/* for malloc() */
 #include <string.h>		/* for memcpy() */
 
 #include "private/md5.h"
-#include "share/alloc.h"
+#include "FLAC/assert.h"
+#include "FLAC/format.h"
+
+#if defined __SSE2__
+#include <emmintrin.h>
+#elif defined __ARM_NEON__ || defined __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef min
+#undef min
+#endif
+#define min(x,y) ((x)<(y)?(x):(y))
 
 #ifndef FLaC__INLINE
 #define FLaC__INLINE
@@ -41,7 +52,9 @@
 
 /* #define F1(x, y, z) (x & y | ~x & z) */
 #define F1(x, y, z) (z ^ (x & (y ^ z)))
-#define F2(x, y, z) F1(z, x, y)
+/* #define F2(x, y, z) F1(z, x, y) */
+/* the two terms never share a bit, and adding them lets the one without x start early */
+#define F2(x, y, z) ((x & z) + (y & ~z))
 #define F3(x, y, z) (x ^ y ^ z)
 #define F4(x, y, z) (y ^ (x | ~z))
 
@@ -174,45 +187,6 @@ static void byteSwapX16(FLAC__uint32 *buf)
 #define byteSwapX16(buf)
 #endif
 
-/*
- * Update context to reflect the concatenation of another buffer full
- * of bytes.
- */
-static void FLAC__MD5Update(FLAC__MD5Context *ctx, FLAC__byte const *buf, unsigned len)
-{
-	FLAC__uint32 t;
-
-	/* Update byte count */
-
-	t = ctx->bytes[0];
-	if ((ctx->bytes[0] = t + len) < t)
-		ctx->bytes[1]++;	/* Carry from low to high */
-
-	t = 64 - (t & 0x3f);	/* Space available in ctx->in (at least 1) */
-	if (t > len) {
-		memcpy((FLAC__byte *)ctx->in + 64 - t, buf, len);
-		return;
-	}
-	/* First chunk is an odd size */
-	memcpy((FLAC__byte *)ctx->in + 64 - t, buf, t);
-	byteSwapX16(ctx->in);
-	FLAC__MD5Transform(ctx->buf, ctx->in);
-	buf += t;
-	len -= t;
-
-	/* Process data in 64-byte chunks */
-	while (len >= 64) {
-		memcpy(ctx->in, buf, 64);
-		byteSwapX16(ctx->in);
-		FLAC__MD5Transform(ctx->buf, ctx->in);
-		buf += 64;
-		len -= 64;
-	}
-
-	/* Handle any remaining bytes of data. */
-	memcpy(ctx->in, buf, len);
-}
-
 /*
  * Start MD5 accumulation.  Set bit count to 0 and buffer to mysterious
  * initialization constants.
@@ -226,9 +200,6 @@ void FLAC__MD5Init(FLAC__MD5Context *ctx)
 
 	ctx->bytes[0] = 0;
 	ctx->bytes[1] = 0;
-
-	ctx->internal_buf = 0;
-	ctx->capacity = 0;
 }
 
 /*
@@ -263,41 +234,80 @@ void FLAC__MD5Final(FLAC__byte digest[16], FLAC__MD5Context *ctx)
 
 	byteSwap(ctx->buf, 4);
 	memcpy(digest, ctx->buf, 16);
-	memset(ctx, 0, sizeof(ctx));	/* In case it's sensitive */
-	if(0 != ctx->internal_buf) {
-		free(ctx->internal_buf);
-		ctx->internal_buf = 0;
-		ctx->capacity = 0;
-	}
+	memset(ctx, 0, sizeof(*ctx));	/* In case it's sensitive */
 }
 
 /*
- * Convert the incoming audio signal to a byte stream
+ * Convert the incoming audio signal to a byte stream.  The common 8 and 16
+ * bit layouts are narrowed and interleaved with the SIMD instructions every
+ * ABI we build for has anyway.
  */
 static void format_input_(FLAC__byte *buf, const FLAC__int32 * const signal[], unsigned channels, unsigned samples, unsigned bytes_per_sample)
 {
-	unsigned channel, sample;
+	unsigned channel, sample = 0;
 	register FLAC__int32 a_word;
 	register FLAC__byte *buf_ = buf;
 
 #if WORDS_BIGENDIAN
-#else
+#elif defined __SSE2__
+	/* the signal fits the narrow type, so the saturating packs are exact */
 	if(channels == 2 && bytes_per_sample == 2) {
-		FLAC__int16 *buf1_ = ((FLAC__int16*)buf_) + 1;
-		memcpy(buf_, signal[0], sizeof(FLAC__int32) * samples);
-		for(sample = 0; sample < samples; sample++, buf1_+=2)
-			*buf1_ = (FLAC__int16)signal[1][sample];
+		for( ; sample + 8 <= samples; sample += 8, buf_ += 32) {
+			const __m128i l = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(signal[0] + sample)), _mm_loadu_si128((const __m128i*)(signal[0] + sample + 4)));
+			const __m128i r = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(signal[1] + sample)), _mm_loadu_si128((const __m128i*)(signal[1] + sample + 4)));
+			_mm_storeu_si128((__m128i*)buf_, _mm_unpacklo_epi16(l, r));
+			_mm_storeu_si128((__m128i*)(buf_ + 16), _mm_unpackhi_epi16(l, r));
+		}
 	}
 	else if(channels == 1 && bytes_per_sample == 2) {
-		FLAC__int16 *buf1_ = (FLAC__int16*)buf_;
-		for(sample = 0; sample < samples; sample++)
-			*buf1_++ = (FLAC__int16)signal[0][sample];
+		for( ; sample + 8 <= samples; sample += 8, buf_ += 16)
+			_mm_storeu_si128((__m128i*)buf_, _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(signal[0] + sample)), _mm_loadu_si128((const __m128i*)(signal[0] + sample + 4))));
+	}
+	else if(channels == 2 && bytes_per_sample == 1) {
+		for( ; sample + 8 <= samples; sample += 8, buf_ += 16) {
+			const __m128i l = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(signal[0] + sample)), _mm_loadu_si128((const __m128i*)(signal[0] + sample + 4)));
+			const __m128i r = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(signal[1] + sample)), _mm_loadu_si128((const __m128i*)(signal[1] + sample + 4)));
+			_mm_storeu_si128((__m128i*)buf_, _mm_packs_epi16(_mm_unpacklo_epi16(l, r), _mm_unpackhi_epi16(l, r)));
+		}
+	}
+	else if(channels == 1 && bytes_per_sample == 1) {
+		for( ; sample + 16 <= samples; sample += 16, buf_ += 16) {
+			const __m128i lo = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(signal[0] + sample)), _mm_loadu_si128((const __m128i*)(signal[0] + sample + 4)));
+			const __m128i hi = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(signal[0] + sample + 8)), _mm_loadu_si128((const __m128i*)(signal[0] + sample + 12)));
+			_mm_storeu_si128((__m128i*)buf_, _mm_packs_epi16(lo, hi));
+		}
+	}
+#elif defined __ARM_NEON__ || defined __ARM_NEON
+	if(channels == 2 && bytes_per_sample == 2) {
+		for( ; sample + 8 <= samples; sample += 8, buf_ += 32) {
+			int16x8x2_t lr;
+			lr.val[0] = vcombine_s16(vmovn_s32(vld1q_s32(signal[0] + sample)), vmovn_s32(vld1q_s32(signal[0] + sample + 4)));
+			lr.val[1] = vcombine_s16(vmovn_s32(vld1q_s32(signal[1] + sample)), vmovn_s32(vld1q_s32(signal[1] + sample + 4)));
+			vst2q_s16((FLAC__int16*)buf_, lr);
+		}
+	}
+	else if(channels == 1 && bytes_per_sample == 2) {
+		for( ; sample + 8 <= samples; sample += 8, buf_ += 16)
+			vst1q_s16((FLAC__int16*)buf_, vcombine_s16(vmovn_s32(vld1q_s32(signal[0] + sample)), vmovn_s32(vld1q_s32(signal[0] + sample + 4))));
+	}
+	else if(channels == 2 && bytes_per_sample == 1) {
+		for( ; sample + 8 <= samples; sample += 8, buf_ += 16) {
+			int8x8x2_t lr;
+			lr.val[0] = vmovn_s16(vcombine_s16(vmovn_s32(vld1q_s32(signal[0] + sample)), vmovn_s32(vld1q_s32(signal[0] + sample + 4))));
+			lr.val[1] = vmovn_s16(vcombine_s16(vmovn_s32(vld1q_s32(signal[1] + sample)), vmovn_s32(vld1q_s32(signal[1] + sample + 4))));
+			vst2_s8((FLAC__int8*)buf_, lr);
+		}
+	}
+	else if(channels == 1 && bytes_per_sample == 1) {
+		for( ; sample + 8 <= samples; sample += 8, buf_ += 8)
+			vst1_s8((FLAC__int8*)buf_, vmovn_s16(vcombine_s16(vmovn_s32(vld1q_s32(signal[0] + sample)), vmovn_s32(vld1q_s32(signal[0] + sample + 4)))));
 	}
-	else
 #endif
+
+	/* the rest, and whatever the vector code above left over */
 	if(bytes_per_sample == 2) {
 		if(channels == 2) {
-			for(sample = 0; sample < samples; sample++) {
+			for( ; sample < samples; sample++) {
 				a_word = signal[0][sample];
 				*buf_++ = (FLAC__byte)a_word; a_word >>= 8;
 				*buf_++ = (FLAC__byte)a_word;
@@ -307,14 +317,14 @@ static void format_input_(FLAC__byte *buf, const FLAC__int32 * const signal[], u
 			}
 		}
 		else if(channels == 1) {
-			for(sample = 0; sample < samples; sample++) {
+			for( ; sample < samples; sample++) {
 				a_word = signal[0][sample];
 				*buf_++ = (FLAC__byte)a_word; a_word >>= 8;
 				*buf_++ = (FLAC__byte)a_word;
 			}
 		}
 		else {
-			for(sample = 0; sample < samples; sample++) {
+			for( ; sample < samples; sample++) {
 				for(channel = 0; channel < channels; channel++) {
 					a_word = signal[channel][sample];
 					*buf_++ = (FLAC__byte)a_word; a_word >>= 8;
@@ -325,7 +335,7 @@ static void format_input_(FLAC__byte *buf, const FLAC__int32 * const signal[], u
 	}
 	else if(bytes_per_sample == 3) {
 		if(channels == 2) {
-			for(sample = 0; sample < samples; sample++) {
+			for( ; sample < samples; sample++) {
 				a_word = signal[0][sample];
 				*buf_++ = (FLAC__byte)a_word; a_word >>= 8;
 				*buf_++ = (FLAC__byte)a_word; a_word >>= 8;
@@ -337,7 +347,7 @@ static void format_input_(FLAC__byte *buf, const FLAC__int32 * const signal[], u
 			}
 		}
 		else if(channels == 1) {
-			for(sample = 0; sample < samples; sample++) {
+			for( ; sample < samples; sample++) {
 				a_word = signal[0][sample];
 				*buf_++ = (FLAC__byte)a_word; a_word >>= 8;
 				*buf_++ = (FLAC__byte)a_word; a_word >>= 8;
@@ -345,7 +355,7 @@ static void format_input_(FLAC__byte *buf, const FLAC__int32 * const signal[], u
 			}
 		}
 		else {
-			for(sample = 0; sample < samples; sample++) {
+			for( ; sample < samples; sample++) {
 				for(channel = 0; channel < channels; channel++) {
 					a_word = signal[channel][sample];
 					*buf_++ = (FLAC__byte)a_word; a_word >>= 8;
@@ -357,7 +367,7 @@ static void format_input_(FLAC__byte *buf, const FLAC__int32 * const signal[], u
 	}
 	else if(bytes_per_sample == 1) {
 		if(channels == 2) {
-			for(sample = 0; sample < samples; sample++) {
+			for( ; sample < samples; sample++) {
 				a_word = signal[0][sample];
 				*buf_++ = (FLAC__byte)a_word;
 				a_word = signal[1][sample];
@@ -365,13 +375,13 @@ static void format_input_(FLAC__byte *buf, const FLAC__int32 * const signal[], u
 			}
 		}
 		else if(channels == 1) {
-			for(sample = 0; sample < samples; sample++) {
+			for( ; sample < samples; sample++) {
 				a_word = signal[0][sample];
 				*buf_++ = (FLAC__byte)a_word;
 			}
 		}
 		else {
-			for(sample = 0; sample < samples; sample++) {
+			for( ; sample < samples; sample++) {
 				for(channel = 0; channel < channels; channel++) {
 					a_word = signal[channel][sample];
 					*buf_++ = (FLAC__byte)a_word;
@@ -380,7 +390,7 @@ static void format_input_(FLAC__byte *buf, const FLAC__int32 * const signal[], u
 		}
 	}
 	else { /* bytes_per_sample == 4, maybe optimize more later */
-		for(sample = 0; sample < samples; sample++) {
+		for( ; sample < samples; sample++) {
 			for(channel = 0; channel < channels; channel++) {
 				a_word = signal[channel][sample];
 				*buf_++ = (FLAC__byte)a_word; a_word >>= 8;
@@ -393,32 +403,44 @@ static void format_input_(FLAC__byte *buf, const FLAC__int32 * const signal[], u
 }
 
 /*
- * Convert the incoming audio signal to a byte stream and FLAC__MD5Update it.
+ * Convert the incoming audio signal to a byte stream and hash it.  The
+ * signal is converted a few KiB at a time, right behind any bytes still
+ * waiting in ctx->in, so that whole blocks can be transformed where they
+ * are instead of being copied into ctx->in first.
  */
 FLAC__bool FLAC__MD5Accumulate(FLAC__MD5Context *ctx, const FLAC__int32 * const signal[], unsigned channels, unsigned samples, unsigned bytes_per_sample)
 {
-	const size_t bytes_needed = (size_t)channels * (size_t)samples * (size_t)bytes_per_sample;
-
-	/* overflow check */
-	if((size_t)channels > SIZE_MAX / (size_t)bytes_per_sample)
-		return false;
-	if((size_t)channels * (size_t)bytes_per_sample > SIZE_MAX / (size_t)samples)
-		return false;
-
-	if(ctx->capacity < bytes_needed) {
-		FLAC__byte *tmp = (FLAC__byte*)realloc(ctx->internal_buf, bytes_needed);
-		if(0 == tmp) {
-			free(ctx->internal_buf);
-			if(0 == (ctx->internal_buf = (FLAC__byte*)safe_malloc_(bytes_needed)))
-				return false;
+	FLAC__uint32 block[(4096 + 64) / 4];
+	const FLAC__int32 *chunk[FLAC__MAX_CHANNELS];
+	const unsigned frame_bytes = channels * bytes_per_sample;
+	const unsigned max_samples = 4096 / frame_bytes;
+	unsigned channel, sample, n, len, i, t;
+
+	FLAC__ASSERT(channels > 0 && channels <= FLAC__MAX_CHANNELS);
+	FLAC__ASSERT(bytes_per_sample > 0 && bytes_per_sample <= 4);
+
+	for(sample = 0; sample < samples; sample += n) {
+		const unsigned pending = ctx->bytes[0] & 0x3f;
+
+		n = min(samples - sample, max_samples);
+		for(channel = 0; channel < channels; channel++)
+			chunk[channel] = signal[channel] + sample;
+
+		memcpy(block, ctx->in, pending);
+		format_input_((FLAC__byte*)block + pending, chunk, channels, n, bytes_per_sample);
+		len = pending + n * frame_bytes;
+
+		/* Update byte count */
+		t = ctx->bytes[0];
+		if ((ctx->bytes[0] = t + n * frame_bytes) < t)
+			ctx->bytes[1]++;	/* Carry from low to high */
+
+		for(i = 0; i + 64 <= len; i += 64) {
+			byteSwapX16(block + i / 4);
+			FLAC__MD5Transform(ctx->buf, block + i / 4);
 		}
-		ctx->internal_buf = tmp;
-		ctx->capacity = bytes_needed;
+		memcpy(ctx->in, (FLAC__byte*)block + i, len - i);
 	}
 
-	format_input_(ctx->internal_buf, signal, channels, samples, bytes_per_sample);
-
-	FLAC__MD5Update(ctx, ctx->internal_buf, bytes_needed);
-
 	return true;
 }
@@ -46,6 +46,16 @@
 #include <string.h> /* for memset/memcpy() */
 #include <sys/stat.h> /* for stat() */
 #include <sys/types.h> /* for off_t */
+/* Frame-parallel decoding uses POSIX threads and pread(); define
+ * FLAC__NO_THREADS to build without them.
+ */
+#if !defined FLAC__NO_THREADS && !defined _WIN32
+#define FLAC__HAS_THREADS 1
+#include <pthread.h>
+#include <unistd.h> /* for pread() */
+#else
+#define FLAC__HAS_THREADS 0
+#endif
 #if defined _MSC_VER || defined __BORLANDC__ || defined __MINGW32__
 #if _MSC_VER <= 1600 || defined __BORLANDC__ /* @@@ [2G limit] */
 #define fseeko fseek
@@ -53,6 +63,7 @@
 #endif
 #endif
 #include "FLAC/assert.h"
+#include "FLAC/metadata.h"
 #include "share/alloc.h"
 #include "protected/stream_decoder.h"
 #include "private/bitreader.h"
@@ -96,6 +107,89 @@ FLAC_API int FLAC_API_SUPPORTS_OGG_FLAC =
 
 static FLAC__byte ID3V2_TAG_[3] = { 'I', 'D', '3' };
 
+/* Identifies a frame index written by FLAC__stream_decoder_save_frame_index(). */
+static const FLAC__byte FRAME_INDEX_ID_[4] = { 'f', 'L', 'a', 'I' };
+
+/* Length of the frame index file header (ID, total samples, MD5 signature,
+ * number of points), and of a point, which is packed like a seek point.
+ */
+#define FRAME_INDEX_HEADER_BYTES_ 32
+#define FRAME_INDEX_POINT_BYTES_ 18
+
+/* Read size when scanning for frame boundaries, and the longest possible
+ * frame header (sync, 7 byte UTF-8 sample number, 16 bit blocksize and
+ * sample rate, CRC-8), which must never straddle two reads.
+ */
+#define SCAN_BUFFER_BYTES_ 16384
+#define FRAME_HEADER_MAX_BYTES_ 16
+
+#if FLAC__HAS_THREADS
+/* Bounds for the byte ranges handed to the decoding threads. */
+static const FLAC__uint64 MIN_JOB_BYTES_ = 32768;
+static const FLAC__uint64 MAX_JOB_BYTES_ = 512 * 1024;
+
+typedef enum {
+	JOB_FREE = 0,    /* not in use */
+	JOB_QUEUED = 1,  /* waiting for a worker */
+	JOB_RUNNING = 2, /* being decoded */
+	JOB_DONE = 3     /* decoded frames wait to be delivered */
+} DecoderJobState;
+
+typedef struct {
+	FLAC__bool is_error;
+	FLAC__StreamDecoderErrorStatus error;
+	FLAC__FrameHeader header;
+	FLAC__FrameFooter footer;
+	unsigned offset; /* of the frame's first sample in the job's sample buffers */
+} decoder_job_event;
+
+/*
+ * A byte range of the input.  A worker decodes every frame starting in
+ * [start, end) and records the frames and errors, in stream order, for
+ * the calling thread to deliver.
+ */
+typedef struct {
+	DecoderJobState state; /* guarded by pool->mutex */
+	FLAC__uint64 start, end;
+	FLAC__uint64 end_position; /* where the worker actually stopped */
+	FLAC__StreamDecoderState result; /* state of the worker's decoder afterwards */
+	FLAC__bool out_of_memory;
+	decoder_job_event *events;
+	unsigned num_events, events_capacity;
+	FLAC__int32 *samples[FLAC__MAX_CHANNELS];
+	unsigned samples_used, samples_capacity[FLAC__MAX_CHANNELS];
+} decoder_job;
+
+struct decoder_thread_pool;
+
+typedef struct {
+	FLAC__StreamDecoder *decoder; /* shadow decoder reading through pread(), so it has its own file offset */
+	struct decoder_thread_pool *pool;
+	decoder_job *job;
+	FLAC__uint64 offset;
+	pthread_t thread;
+} decoder_worker;
+
+/*
+ * Jobs form a ring in stream order, starting at oldest_job.  Workers take
+ * the oldest queued job; the calling thread delivers them in order and
+ * hands out new ranges as jobs are freed.
+ */
+typedef struct decoder_thread_pool {
+	decoder_worker *workers;
+	unsigned num_workers;
+	decoder_job *jobs;
+	unsigned num_jobs;
+	unsigned oldest_job; /* guarded by mutex */
+	int fd;
+	FLAC__byte *scan_buffer;
+	FLAC__bool quit;
+	pthread_mutex_t mutex;
+	pthread_cond_t work;
+	pthread_cond_t done;
+} decoder_thread_pool;
+#endif
+
 /***********************************************************************
  *
  * Private class method prototypes
@@ -104,6 +198,7 @@ static FLAC__byte ID3V2_TAG_[3] = { 'I', 'D', '3' };
 
 static void set_defaults_(FLAC__StreamDecoder *decoder);
 static FILE *get_binary_stdin_(void);
+static void free_output_(FLAC__StreamDecoder *decoder);
 static FLAC__bool allocate_output_(FLAC__StreamDecoder *decoder, unsigned size, unsigned channels);
 static FLAC__bool has_id_filtered_(FLAC__StreamDecoder *decoder, FLAC__byte *id);
 static FLAC__bool find_metadata_(FLAC__StreamDecoder *decoder);
@@ -140,6 +235,24 @@ static FLAC__StreamDecoderSeekStatus file_seek_callback_(const FLAC__StreamDecod
 static FLAC__StreamDecoderTellStatus file_tell_callback_(const FLAC__StreamDecoder *decoder, FLAC__uint64 *absolute_byte_offset, void *client_data);
 static FLAC__StreamDecoderLengthStatus file_length_callback_(const FLAC__StreamDecoder *decoder, FLAC__uint64 *stream_length, void *client_data);
 static FLAC__bool file_eof_callback_(const FLAC__StreamDecoder *decoder, void *client_data);
+static unsigned frame_index_upper_bound_(const FLAC__StreamDecoder *decoder, FLAC__uint64 sample);
+static FLAC__bool add_to_frame_index_(FLAC__StreamDecoder *decoder, FLAC__uint64 sample_number, FLAC__uint64 offset, unsigned frame_samples);
+static FLAC__bool is_frame_header_(const FLAC__byte *header, size_t bytes, const FLAC__StreamMetadata_StreamInfo *stream_info, FLAC__FrameHeader *frame_header);
+static void pack_uint64_(FLAC__byte *b, FLAC__uint64 value, unsigned bytes);
+static FLAC__uint64 unpack_uint64_(const FLAC__byte *b, unsigned bytes);
+#if FLAC__HAS_THREADS
+static FLAC__bool init_threads_(FLAC__StreamDecoder *decoder);
+static void free_threads_(FLAC__StreamDecoder *decoder);
+static void *worker_thread_(void *arg);
+static void decode_job_(decoder_worker *worker, decoder_job *job);
+static FLAC__bool process_frames_in_parallel_(FLAC__StreamDecoder *decoder, FLAC__uint64 start, FLAC__uint64 stream_length);
+static FLAC__bool deliver_job_(FLAC__StreamDecoder *decoder, const decoder_job *job);
+static FLAC__uint64 find_frame_boundary_(FLAC__StreamDecoder *decoder, FLAC__uint64 from, FLAC__uint64 range, FLAC__uint64 stream_length);
+static FLAC__StreamDecoderReadStatus worker_read_callback_(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data);
+static FLAC__StreamDecoderTellStatus worker_tell_callback_(const FLAC__StreamDecoder *decoder, FLAC__uint64 *absolute_byte_offset, void *client_data);
+static FLAC__StreamDecoderWriteStatus worker_write_callback_(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data);
+static void worker_error_callback_(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data);
+#endif
 
 /***********************************************************************
  *
@@ -200,6 +313,13 @@ typedef struct FLAC__StreamDecoderPrivate {
 	FLAC__uint64 first_frame_offset; /* hint to the seek routine of where in the stream the first audio frame starts */
 	FLAC__uint64 target_sample;
 	unsigned unparseable_frame_count; /* used to tell whether we're decoding a future version of FLAC or just got a bad sync */
+	/* frames by ascending sample number; stream_offset is relative to first_frame_offset, as in a SEEKTABLE */
+	FLAC__StreamMetadata_SeekPoint *frame_index;
+	unsigned frame_index_length, frame_index_capacity;
+	FLAC__uint64 frame_offset; /* of the frame being read, or 0 if unknown; only set with protected_->frame_indexing */
+#if FLAC__HAS_THREADS
+	decoder_thread_pool *threads; /* created by the first parallel FLAC__stream_decoder_process_until_end_of_stream(), else NULL */
+#endif
 #if FLAC__HAS_OGG
 	FLAC__bool got_a_frame; /* hack needed in Ogg FLAC seek routine to check when process_single() actually writes a frame */
 #endif
@@ -329,6 +449,11 @@ FLAC_API FLAC__StreamDecoder *FLAC__stream_decoder_new(void)
 		FLAC__format_entropy_coding_method_partitioned_rice_contents_init(&decoder->private_->partitioned_rice_contents[i]);
 
 	decoder->private_->file = 0;
+#if FLAC__HAS_THREADS
+	decoder->private_->threads = 0;
+#endif
+	decoder->private_->frame_index = 0;
+	decoder->private_->frame_index_length = decoder->private_->frame_index_capacity = 0;
 
 	set_defaults_(decoder);
 
@@ -348,6 +473,8 @@ FLAC_API void FLAC__stream_decoder_delete(FLAC__StreamDecoder *decoder)
 
 	(void)FLAC__stream_decoder_finish(decoder);
 
+	free_output_(decoder);
+
 	if(0 != decoder->private_->metadata_filter_ids)
 		free(decoder->private_->metadata_filter_ids);
 
@@ -418,10 +545,11 @@ static FLAC__StreamDecoderInitStatus init_stream_internal_(
 	/* now override with asm where appropriate */
 #ifndef FLAC__NO_ASM
 	if(decoder->private_->cpuinfo.use_asm) {
+		FLAC__CPUDispatch dispatch;
 #ifdef FLAC__CPU_IA32
 		FLAC__ASSERT(decoder->private_->cpuinfo.type == FLAC__CPUINFO_TYPE_IA32);
 #ifdef FLAC__HAS_NASM
-#if 1 /*@@@@@@ OPT: not clearly faster, needs more testing */
+#if 0 /* CRCs each word as it is consumed, but the bitreader now does the CRC in bulk */
 		if(decoder->private_->cpuinfo.data.ia32.bswap)
 			decoder->private_->local_bitreader_read_rice_signed_block = FLAC__bitreader_read_rice_signed_block_asm_ia32_bswap;
 #endif
@@ -443,6 +571,13 @@ static FLAC__StreamDecoderInitStatus init_stream_internal_(
 			decoder->private_->local_lpc_restore_signal_16bit_order8 = FLAC__lpc_restore_signal_asm_ppc_altivec_16_order8;
 		}
 #endif
+		/* the intrinsics filters hand short orders back to the C ones, so they leave _16bit_order8 alone */
+		FLAC__cpu_dispatch(&decoder->private_->cpuinfo, &dispatch);
+		if(0 != dispatch.lpc_restore_signal) {
+			decoder->private_->local_lpc_restore_signal = dispatch.lpc_restore_signal;
+			decoder->private_->local_lpc_restore_signal_64bit = dispatch.lpc_restore_signal_wide;
+			decoder->private_->local_lpc_restore_signal_16bit = dispatch.lpc_restore_signal;
+		}
 	}
 #endif
 
@@ -663,7 +798,6 @@ FLAC_API FLAC__StreamDecoderInitStatus FLAC__stream_decoder_init_ogg_file(
 FLAC_API FLAC__bool FLAC__stream_decoder_finish(FLAC__StreamDecoder *decoder)
 {
 	FLAC__bool md5_failed = false;
-	unsigned i;
 
 	FLAC__ASSERT(0 != decoder);
 	FLAC__ASSERT(0 != decoder->private_);
@@ -683,30 +817,23 @@ FLAC_API FLAC__bool FLAC__stream_decoder_finish(FLAC__StreamDecoder *decoder)
 		decoder->private_->has_seek_table = false;
 	}
 	FLAC__bitreader_free(decoder->private_->input);
-	for(i = 0; i < FLAC__MAX_CHANNELS; i++) {
-		/* WATCHOUT:
-		 * FLAC__lpc_restore_signal_asm_ia32_mmx() requires that the
-		 * output arrays have a buffer of up to 3 zeroes in front
-		 * (at negative indices) for alignment purposes; we use 4
-		 * to keep the data well-aligned.
-		 */
-		if(0 != decoder->private_->output[i]) {
-			free(decoder->private_->output[i]-4);
-			decoder->private_->output[i] = 0;
-		}
-		if(0 != decoder->private_->residual_unaligned[i]) {
-			free(decoder->private_->residual_unaligned[i]);
-			decoder->private_->residual_unaligned[i] = decoder->private_->residual[i] = 0;
-		}
+	/* the output and residual buffers are kept for the next stream; allocate_output_() only grows them */
+
+	if(0 != decoder->private_->frame_index) {
+		free(decoder->private_->frame_index);
+		decoder->private_->frame_index = 0;
 	}
-	decoder->private_->output_capacity = 0;
-	decoder->private_->output_channels = 0;
+	decoder->private_->frame_index_length = decoder->private_->frame_index_capacity = 0;
 
 #if FLAC__HAS_OGG
 	if(decoder->private_->is_ogg)
 		FLAC__ogg_decoder_aspect_finish(&decoder->protected_->ogg_decoder_aspect);
 #endif
 
+#if FLAC__HAS_THREADS
+	free_threads_(decoder);
+#endif
+
 	if(0 != decoder->private_->file) {
 		if(decoder->private_->file != stdin)
 			fclose(decoder->private_->file);
@@ -869,6 +996,32 @@ FLAC_API FLAC__bool FLAC__stream_decoder_set_metadata_ignore_all(FLAC__StreamDec
 	return true;
 }
 
+FLAC_API FLAC__bool FLAC__stream_decoder_set_num_threads(FLAC__StreamDecoder *decoder, unsigned value)
+{
+	FLAC__ASSERT(0 != decoder);
+	FLAC__ASSERT(0 != decoder->protected_);
+	if(decoder->protected_->state != FLAC__STREAM_DECODER_UNINITIALIZED)
+		return false;
+	if(value == 0 || value > FLAC__STREAM_DECODER_MAX_THREADS)
+		return false;
+#if !FLAC__HAS_THREADS
+	if(value > 1)
+		return false;
+#endif
+	decoder->protected_->num_threads = value;
+	return true;
+}
+
+FLAC_API FLAC__bool FLAC__stream_decoder_set_frame_indexing(FLAC__StreamDecoder *decoder, FLAC__bool value)
+{
+	FLAC__ASSERT(0 != decoder);
+	FLAC__ASSERT(0 != decoder->protected_);
+	if(decoder->protected_->state != FLAC__STREAM_DECODER_UNINITIALIZED)
+		return false;
+	decoder->protected_->frame_indexing = value;
+	return true;
+}
+
 FLAC_API FLAC__StreamDecoderState FLAC__stream_decoder_get_state(const FLAC__StreamDecoder *decoder)
 {
 	FLAC__ASSERT(0 != decoder);
@@ -930,6 +1083,20 @@ FLAC_API unsigned FLAC__stream_decoder_get_blocksize(const FLAC__StreamDecoder *
 	return decoder->protected_->blocksize;
 }
 
+FLAC_API unsigned FLAC__stream_decoder_get_num_threads(const FLAC__StreamDecoder *decoder)
+{
+	FLAC__ASSERT(0 != decoder);
+	FLAC__ASSERT(0 != decoder->protected_);
+	return decoder->protected_->num_threads;
+}
+
+FLAC_API FLAC__bool FLAC__stream_decoder_get_frame_indexing(const FLAC__StreamDecoder *decoder)
+{
+	FLAC__ASSERT(0 != decoder);
+	FLAC__ASSERT(0 != decoder->protected_);
+	return decoder->protected_->frame_indexing;
+}
+
 FLAC_API FLAC__bool FLAC__stream_decoder_get_decode_position(const FLAC__StreamDecoder *decoder, FLAC__uint64 *position)
 {
 	FLAC__ASSERT(0 != decoder);
@@ -1031,6 +1198,7 @@ FLAC_API FLAC__bool FLAC__stream_decoder_reset(FLAC__StreamDecoder *decoder)
 
 	decoder->private_->first_frame_offset = 0;
 	decoder->private_->unparseable_frame_count = 0;
+	decoder->private_->frame_index_length = 0;
 
 	return true;
 }
@@ -1102,9 +1270,38 @@ FLAC_API FLAC__bool FLAC__stream_decoder_process_until_end_of_metadata(FLAC__Str
 FLAC_API FLAC__bool FLAC__stream_decoder_process_until_end_of_stream(FLAC__StreamDecoder *decoder)
 {
 	FLAC__bool dummy;
+#if FLAC__HAS_THREADS
+	FLAC__uint64 start, stream_length;
+#endif
 	FLAC__ASSERT(0 != decoder);
 	FLAC__ASSERT(0 != decoder->protected_);
 
+#if FLAC__HAS_THREADS
+	/* frames can only be decoded in parallel from a file, once we have the STREAMINFO */
+	if(
+		decoder->protected_->num_threads > 1 &&
+		0 != decoder->private_->file &&
+		decoder->private_->file != stdin
+#if FLAC__HAS_OGG
+		&& !decoder->private_->is_ogg
+#endif
+	) {
+		if(!FLAC__stream_decoder_process_until_end_of_metadata(decoder))
+			return false; /* above function sets the status for us */
+		if(
+			decoder->protected_->state == FLAC__STREAM_DECODER_SEARCH_FOR_FRAME_SYNC &&
+			decoder->private_->has_stream_info &&
+			!decoder->private_->cached &&
+			!decoder->private_->is_seeking &&
+			FLAC__stream_decoder_get_decode_position(decoder, &start) &&
+			decoder->private_->length_callback(decoder, &stream_length, decoder->private_->client_data) == FLAC__STREAM_DECODER_LENGTH_STATUS_OK &&
+			(0 != decoder->private_->threads || init_threads_(decoder))
+		)
+			return process_frames_in_parallel_(decoder, start, stream_length);
+		/* else fall back to decoding serially */
+	}
+#endif
+
 	while(1) {
 		switch(decoder->protected_->state) {
 			case FLAC__STREAM_DECODER_SEARCH_FOR_METADATA:
@@ -1231,6 +1428,262 @@ FLAC_API FLAC__bool FLAC__stream_decoder_seek_absolute(FLAC__StreamDecoder *deco
 	}
 }
 
+FLAC_API FLAC__bool FLAC__stream_decoder_build_frame_index(FLAC__StreamDecoder *decoder)
+{
+	const FLAC__StreamMetadata_StreamInfo *stream_info = &decoder->private_->stream_info.data.stream_info;
+	const FLAC__uint64 first_frame_offset = decoder->private_->first_frame_offset;
+	FLAC__uint64 resume_position, base, next_sample = 0;
+	FLAC__FrameHeader header;
+	FLAC__byte *buffer;
+	size_t used = 0, k = 0, bytes;
+	unsigned i, fixed_blocksize;
+	FLAC__bool eof = false, ok = true;
+
+	FLAC__ASSERT(0 != decoder);
+	FLAC__ASSERT(0 != decoder->protected_);
+
+	if(
+		decoder->protected_->state != FLAC__STREAM_DECODER_SEARCH_FOR_FRAME_SYNC &&
+		decoder->protected_->state != FLAC__STREAM_DECODER_END_OF_STREAM
+	)
+		return false;
+#if FLAC__HAS_OGG
+	if(decoder->private_->is_ogg)
+		return false;
+#endif
+	if(0 == decoder->private_->seek_callback || !decoder->private_->has_stream_info || 0 == first_frame_offset)
+		return false;
+	if(!FLAC__stream_decoder_get_decode_position(decoder, &resume_position))
+		return false;
+	/* a cached lookahead byte has been read but not decoded yet */
+	if(decoder->private_->cached)
+		resume_position--;
+
+	/* frame numbers count blocks of the stream's fixed blocksize, which is only known from the first frame if STREAMINFO allows more than one */
+	fixed_blocksize = stream_info->min_blocksize == stream_info->max_blocksize? stream_info->min_blocksize : 0;
+	if(0 == fixed_blocksize && decoder->private_->frame_index_length > 0 && decoder->private_->frame_index[0].sample_number == 0)
+		fixed_blocksize = decoder->private_->frame_index[0].frame_samples;
+
+	/* frames already indexed from the start of the stream on need not be scanned again */
+	base = first_frame_offset;
+	for(i = 0; i < decoder->private_->frame_index_length && decoder->private_->frame_index[i].sample_number == next_sample; i++) {
+		next_sample += decoder->private_->frame_index[i].frame_samples;
+		base = first_frame_offset + decoder->private_->frame_index[i].stream_offset + 1;
+	}
+	if(stream_info->total_samples > 0 && next_sample >= stream_info->total_samples)
+		return true;
+
+	if(0 == (buffer = (FLAC__byte*)malloc(SCAN_BUFFER_BYTES_)))
+		return false;
+	if(decoder->private_->seek_callback(decoder, base, decoder->private_->client_data) != FLAC__STREAM_DECODER_SEEK_STATUS_OK)
+		ok = false;
+
+	/* buffer[0..used) holds the input from 'base' on, and k is the next byte to look at */
+	while(ok && (stream_info->total_samples == 0 || next_sample < stream_info->total_samples)) {
+		if(k > used) {
+			/* skipped past the buffered input */
+			if(eof)
+				break;
+			base += k;
+			used = k = 0;
+			if(decoder->private_->seek_callback(decoder, base, decoder->private_->client_data) != FLAC__STREAM_DECODER_SEEK_STATUS_OK)
+				ok = false;
+			continue;
+		}
+		if(used - k < FRAME_HEADER_MAX_BYTES_ && !eof) {
+			/* keep the tail, which may hold the start of a header, and top up the buffer */
+			memmove(buffer, buffer + k, used - k);
+			base += k;
+			used -= k;
+			k = 0;
+			bytes = SCAN_BUFFER_BYTES_ - used;
+			switch(decoder->private_->read_callback(decoder, buffer + used, &bytes, decoder->private_->client_data)) {
+				case FLAC__STREAM_DECODER_READ_STATUS_CONTINUE:
+					eof = (bytes == 0);
+					break;
+				case FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM:
+					eof = true;
+					break;
+				default:
+					ok = false;
+					bytes = 0;
+					break;
+			}
+			used += bytes;
+			continue;
+		}
+		if(k + 1 >= used)
+			break; /* end of input */
+
+		/* only take the header that continues the indexed samples, which rules out false syncs in the frame data */
+		if(buffer[k] == 0xff && buffer[k+1] >> 1 == 0x7c && is_frame_header_(buffer + k, used - k, stream_info, &header)) {
+			FLAC__uint64 sample_number = header.number.sample_number;
+			if(header.number_type == FLAC__FRAME_NUMBER_TYPE_FRAME_NUMBER) {
+				if(0 == fixed_blocksize && 0 == header.number.frame_number)
+					fixed_blocksize = header.blocksize;
+				sample_number = (FLAC__uint64)header.number.frame_number * fixed_blocksize;
+			}
+			if(sample_number == next_sample) {
+				if(!add_to_frame_index_(decoder, sample_number, base + k - first_frame_offset, header.blocksize)) {
+					ok = false;
+					break;
+				}
+				next_sample += header.blocksize;
+				/* no frame is shorter than STREAMINFO says */
+				k += stream_info->min_framesize > 0? stream_info->min_framesize : 1;
+				continue;
+			}
+		}
+		k++;
+	}
+	free(buffer);
+
+	/* put the input back where decoding left off */
+	if(decoder->private_->seek_callback(decoder, resume_position, decoder->private_->client_data) != FLAC__STREAM_DECODER_SEEK_STATUS_OK) {
+		decoder->protected_->state = FLAC__STREAM_DECODER_SEEK_ERROR;
+		return false;
+	}
+	decoder->private_->cached = false;
+	if(!FLAC__stream_decoder_flush(decoder)) {
+		/* above call sets the state for us */
+		return false;
+	}
+
+	return ok;
+}
+
+FLAC_API FLAC__StreamMetadata *FLAC__stream_decoder_get_frame_index_seek_table(const FLAC__StreamDecoder *decoder, unsigned max_points)
+{
+	const FLAC__StreamMetadata_SeekPoint *frame_index = decoder->private_->frame_index;
+	const unsigned length = decoder->private_->frame_index_length;
+	FLAC__StreamMetadata *seek_table;
+	FLAC__uint64 spacing;
+	unsigned i, num_points;
+
+	FLAC__ASSERT(0 != decoder);
+	FLAC__ASSERT(0 != decoder->private_);
+
+	if(0 == length)
+		return 0;
+	if(0 == max_points || max_points > length)
+		max_points = length;
+	if(0 == (seek_table = FLAC__metadata_object_new(FLAC__METADATA_TYPE_SEEKTABLE)))
+		return 0;
+	if(!FLAC__metadata_object_seektable_resize_points(seek_table, max_points)) {
+		FLAC__metadata_object_delete(seek_table);
+		return 0;
+	}
+
+	if(max_points == length) {
+		memcpy(seek_table->data.seek_table.points, frame_index, length * sizeof(FLAC__StreamMetadata_SeekPoint));
+		return seek_table;
+	}
+
+	/* take the first frame at or after each of max_points evenly spaced samples */
+	spacing = (frame_index[length-1].sample_number + frame_index[length-1].frame_samples) / max_points;
+	for(i = num_points = 0; i < length && num_points < max_points; i++) {
+		if(frame_index[i].sample_number >= spacing * num_points)
+			seek_table->data.seek_table.points[num_points++] = frame_index[i];
+	}
+	if(num_points < max_points && !FLAC__metadata_object_seektable_resize_points(seek_table, num_points)) {
+		FLAC__metadata_object_delete(seek_table);
+		return 0;
+	}
+
+	return seek_table;
+}
+
+FLAC_API FLAC__bool FLAC__stream_decoder_save_frame_index(const FLAC__StreamDecoder *decoder, FILE *file)
+{
+	const FLAC__StreamMetadata_StreamInfo *stream_info = &decoder->private_->stream_info.data.stream_info;
+	FLAC__byte buffer[FRAME_INDEX_HEADER_BYTES_];
+	unsigned i;
+
+	FLAC__ASSERT(0 != decoder);
+	FLAC__ASSERT(0 != decoder->private_);
+	FLAC__ASSERT(0 != file);
+
+	if(!decoder->private_->has_stream_info)
+		return false;
+
+	memcpy(buffer, FRAME_INDEX_ID_, sizeof(FRAME_INDEX_ID_));
+	pack_uint64_(buffer + 4, stream_info->total_samples, 8);
+	memcpy(buffer + 12, stream_info->md5sum, 16);
+	pack_uint64_(buffer + 28, decoder->private_->frame_index_length, 4);
+	if(fwrite(buffer, 1, FRAME_INDEX_HEADER_BYTES_, file) != FRAME_INDEX_HEADER_BYTES_)
+		return false;
+
+	for(i = 0; i < decoder->private_->frame_index_length; i++) {
+		const FLAC__StreamMetadata_SeekPoint *point = &decoder->private_->frame_index[i];
+		pack_uint64_(buffer, point->sample_number, 8);
+		pack_uint64_(buffer + 8, point->stream_offset, 8);
+		pack_uint64_(buffer + 16, point->frame_samples, 2);
+		if(fwrite(buffer, 1, FRAME_INDEX_POINT_BYTES_, file) != FRAME_INDEX_POINT_BYTES_)
+			return false;
+	}
+
+	return true;
+}
+
+FLAC_API FLAC__bool FLAC__stream_decoder_load_frame_index(FLAC__StreamDecoder *decoder, FILE *file)
+{
+	const FLAC__StreamMetadata_StreamInfo *stream_info = &decoder->private_->stream_info.data.stream_info;
+	FLAC__byte buffer[FRAME_INDEX_HEADER_BYTES_];
+	FLAC__StreamMetadata_SeekPoint *frame_index;
+	FLAC__uint64 next_sample = 0, next_offset = 0;
+	unsigned i, length;
+
+	FLAC__ASSERT(0 != decoder);
+	FLAC__ASSERT(0 != decoder->private_);
+	FLAC__ASSERT(0 != file);
+
+	if(!decoder->private_->has_stream_info)
+		return false;
+
+	if(fread(buffer, 1, FRAME_INDEX_HEADER_BYTES_, file) != FRAME_INDEX_HEADER_BYTES_)
+		return false;
+	if(
+		memcmp(buffer, FRAME_INDEX_ID_, sizeof(FRAME_INDEX_ID_)) ||
+		unpack_uint64_(buffer + 4, 8) != stream_info->total_samples ||
+		memcmp(buffer + 12, stream_info->md5sum, 16)
+	)
+		return false;
+	length = (unsigned)unpack_uint64_(buffer + 28, 4);
+	/* every frame holds at least one sample, which also bounds the allocation for a corrupt length */
+	if(stream_info->total_samples > 0 && length > stream_info->total_samples)
+		return false;
+
+	if(0 == (frame_index = (FLAC__StreamMetadata_SeekPoint*)safe_malloc_mul_2op_(length, sizeof(FLAC__StreamMetadata_SeekPoint))))
+		return false;
+	for(i = 0; i < length; i++) {
+		if(fread(buffer, 1, FRAME_INDEX_POINT_BYTES_, file) != FRAME_INDEX_POINT_BYTES_)
+			break;
+		frame_index[i].sample_number = unpack_uint64_(buffer, 8);
+		frame_index[i].stream_offset = unpack_uint64_(buffer + 8, 8);
+		frame_index[i].frame_samples = (unsigned)unpack_uint64_(buffer + 16, 2);
+		/* the points must be distinct frames in stream order */
+		if(
+			frame_index[i].sample_number < next_sample ||
+			frame_index[i].stream_offset < next_offset ||
+			frame_index[i].frame_samples == 0 ||
+			(stream_info->total_samples > 0 && frame_index[i].sample_number >= stream_info->total_samples)
+		)
+			break;
+		next_sample = frame_index[i].sample_number + frame_index[i].frame_samples;
+		next_offset = frame_index[i].stream_offset + 1;
+	}
+	if(i < length) {
+		free(frame_index);
+		return false;
+	}
+
+	if(0 != decoder->private_->frame_index)
+		free(decoder->private_->frame_index);
+	decoder->private_->frame_index = frame_index;
+	decoder->private_->frame_index_length = decoder->private_->frame_index_capacity = length;
+	return true;
+}
+
 /***********************************************************************
  *
  * Protected class methods
@@ -1271,6 +1724,8 @@ void set_defaults_(FLAC__StreamDecoder *decoder)
 	decoder->private_->metadata_filter_ids_count = 0;
 
 	decoder->protected_->md5_checking = false;
+	decoder->protected_->num_threads = 1;
+	decoder->protected_->frame_indexing = false;
 
 #if FLAC__HAS_OGG
 	FLAC__ogg_decoder_aspect_set_defaults(&decoder->protected_->ogg_decoder_aspect);
@@ -1298,17 +1753,17 @@ FILE *get_binary_stdin_(void)
 	return stdin;
 }
 
-FLAC__bool allocate_output_(FLAC__StreamDecoder *decoder, unsigned size, unsigned channels)
+void free_output_(FLAC__StreamDecoder *decoder)
 {
 	unsigned i;
-	FLAC__int32 *tmp;
-
-	if(size <= decoder->private_->output_capacity && channels <= decoder->private_->output_channels)
-		return true;
-
-	/* simply using realloc() is not practical because the number of channels may change mid-stream */
 
 	for(i = 0; i < FLAC__MAX_CHANNELS; i++) {
+		/* WATCHOUT:
+		 * FLAC__lpc_restore_signal_asm_ia32_mmx() requires that the
+		 * output arrays have a buffer of up to 3 zeroes in front
+		 * (at negative indices) for alignment purposes; we use 4
+		 * to keep the data well-aligned.
+		 */
 		if(0 != decoder->private_->output[i]) {
 			free(decoder->private_->output[i]-4);
 			decoder->private_->output[i] = 0;
@@ -1318,6 +1773,21 @@ FLAC__bool allocate_output_(FLAC__StreamDecoder *decoder, unsigned size, unsigne
 			decoder->private_->residual_unaligned[i] = decoder->private_->residual[i] = 0;
 		}
 	}
+	decoder->private_->output_capacity = 0;
+	decoder->private_->output_channels = 0;
+}
+
+FLAC__bool allocate_output_(FLAC__StreamDecoder *decoder, unsigned size, unsigned channels)
+{
+	unsigned i;
+	FLAC__int32 *tmp;
+
+	if(size <= decoder->private_->output_capacity && channels <= decoder->private_->output_channels)
+		return true;
+
+	/* simply using realloc() is not practical because the number of channels may change mid-stream */
+
+	free_output_(decoder);
 
 	for(i = 0; i < channels; i++) {
 		/* WATCHOUT:
@@ -1980,6 +2450,13 @@ FLAC__bool frame_sync_(FLAC__StreamDecoder *decoder)
 			else if(x >> 2 == 0x3e) { /* MAGIC NUMBER for the last 6 sync bits */
 				decoder->private_->header_warmup[1] = (FLAC__byte)x;
 				decoder->protected_->state = FLAC__STREAM_DECODER_READ_FRAME;
+				/* the frame started with the two sync bytes just read */
+				if(decoder->protected_->frame_indexing) {
+					if(FLAC__stream_decoder_get_decode_position(decoder, &decoder->private_->frame_offset))
+						decoder->private_->frame_offset -= 2;
+					else
+						decoder->private_->frame_offset = 0;
+				}
 				return true;
 			}
 		}
@@ -2127,6 +2604,15 @@ FLAC__bool read_frame_(FLAC__StreamDecoder *decoder, FLAC__bool *got_a_frame, FL
 	FLAC__ASSERT(decoder->private_->frame.header.number_type == FLAC__FRAME_NUMBER_TYPE_SAMPLE_NUMBER);
 	decoder->private_->samples_decoded = decoder->private_->frame.header.number.sample_number + decoder->private_->frame.header.blocksize;
 
+	/* index the frame unless it failed its CRC; running out of memory only costs seek speed */
+	if(
+		decoder->protected_->frame_indexing &&
+		frame_crc == x &&
+		decoder->private_->first_frame_offset > 0 &&
+		decoder->private_->frame_offset >= decoder->private_->first_frame_offset
+	)
+		(void)add_to_frame_index_(decoder, decoder->private_->frame.header.number.sample_number, decoder->private_->frame_offset - decoder->private_->first_frame_offset, decoder->private_->frame.header.blocksize);
+
 	/* write it */
 	if(do_full_decode) {
 		if(write_audio_frame_to_client_(decoder, &decoder->private_->frame, (const FLAC__int32 * const *)decoder->private_->output) != FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE)
@@ -2985,6 +3471,32 @@ FLAC__bool seek_to_absolute_sample_(FLAC__StreamDecoder *decoder, FLAC__uint64 s
 	unsigned channels = FLAC__stream_decoder_get_channels(decoder);
 	unsigned bps = FLAC__stream_decoder_get_bits_per_sample(decoder);
 	const FLAC__StreamMetadata_SeekTable *seek_table = decoder->private_->has_seek_table? &decoder->private_->seek_table.data.seek_table : 0;
+	unsigned indexed = frame_index_upper_bound_(decoder, target_sample);
+
+	/*
+	 * If the frame holding target_sample is indexed, go straight to it.
+	 * Should it not be there (the index was loaded for a stream that has
+	 * since changed), drop the index and search as usual.
+	 */
+	if(indexed > 0 && target_sample < decoder->private_->frame_index[indexed-1].sample_number + decoder->private_->frame_index[indexed-1].frame_samples) {
+		decoder->private_->target_sample = target_sample;
+		if(decoder->private_->seek_callback(decoder, first_frame_offset + decoder->private_->frame_index[indexed-1].stream_offset, decoder->private_->client_data) != FLAC__STREAM_DECODER_SEEK_STATUS_OK) {
+			decoder->protected_->state = FLAC__STREAM_DECODER_SEEK_ERROR;
+			return false;
+		}
+		if(!FLAC__stream_decoder_flush(decoder)) {
+			/* above call sets the state for us */
+			return false;
+		}
+		decoder->private_->unparseable_frame_count = 0;
+		if(!FLAC__stream_decoder_process_single(decoder)) {
+			decoder->protected_->state = FLAC__STREAM_DECODER_SEEK_ERROR;
+			return false;
+		}
+		if(!decoder->private_->is_seeking)
+			return true;
+		decoder->private_->frame_index_length = indexed = 0;
+	}
 
 	/* use values from stream info if we didn't decode a frame */
 	if(channels == 0)
@@ -3071,6 +3583,16 @@ FLAC__bool seek_to_absolute_sample_(FLAC__StreamDecoder *decoder, FLAC__uint64 s
 		}
 	}
 
+	/* the indexed frames around target_sample narrow the search further */
+	if(indexed > 0 && decoder->private_->frame_index[indexed-1].sample_number > lower_bound_sample) {
+		lower_bound = first_frame_offset + decoder->private_->frame_index[indexed-1].stream_offset;
+		lower_bound_sample = decoder->private_->frame_index[indexed-1].sample_number;
+	}
+	if(indexed < decoder->private_->frame_index_length && decoder->private_->frame_index[indexed].sample_number < upper_bound_sample) {
+		upper_bound = first_frame_offset + decoder->private_->frame_index[indexed].stream_offset;
+		upper_bound_sample = decoder->private_->frame_index[indexed].sample_number;
+	}
+
 	FLAC__ASSERT(upper_bound_sample >= lower_bound_sample);
 	/* there are 2 insidious ways that the following equality occurs, which
 	 * we need to fix:
@@ -3183,6 +3705,193 @@ FLAC__bool seek_to_absolute_sample_(FLAC__StreamDecoder *decoder, FLAC__uint64 s
 	return true;
 }
 
+/*
+ * Returns the number of indexed frames starting at or before 'sample',
+ * so the frame that may hold it is the one before the returned position.
+ */
+unsigned frame_index_upper_bound_(const FLAC__StreamDecoder *decoder, FLAC__uint64 sample)
+{
+	const FLAC__StreamMetadata_SeekPoint *frame_index = decoder->private_->frame_index;
+	unsigned low = 0, high = decoder->private_->frame_index_length;
+
+	/* frames are mostly indexed in stream order, so try the end first */
+	if(high > 0 && frame_index[high-1].sample_number <= sample)
+		return high;
+	while(low < high) {
+		const unsigned mid = low + (high - low) / 2;
+		if(frame_index[mid].sample_number <= sample)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+FLAC__bool add_to_frame_index_(FLAC__StreamDecoder *decoder, FLAC__uint64 sample_number, FLAC__uint64 offset, unsigned frame_samples)
+{
+	const unsigned i = frame_index_upper_bound_(decoder, sample_number);
+	FLAC__StreamMetadata_SeekPoint *frame_index = decoder->private_->frame_index;
+
+	/* frames are seen again after a seek */
+	if(i > 0 && frame_index[i-1].sample_number == sample_number)
+		return true;
+
+	if(decoder->private_->frame_index_length == decoder->private_->frame_index_capacity) {
+		const unsigned capacity = decoder->private_->frame_index_capacity? decoder->private_->frame_index_capacity * 2 : 256;
+		if(0 == (frame_index = (FLAC__StreamMetadata_SeekPoint*)safe_realloc_mul_2op_(frame_index, capacity, sizeof(FLAC__StreamMetadata_SeekPoint))))
+			return false;
+		decoder->private_->frame_index = frame_index;
+		decoder->private_->frame_index_capacity = capacity;
+	}
+
+	memmove(frame_index + i + 1, frame_index + i, (decoder->private_->frame_index_length - i) * sizeof(FLAC__StreamMetadata_SeekPoint));
+	frame_index[i].sample_number = sample_number;
+	frame_index[i].stream_offset = offset;
+	frame_index[i].frame_samples = frame_samples;
+	decoder->private_->frame_index_length++;
+	return true;
+}
+
+/*
+ * Checks whether 'header' starts a frame header that is well-formed, has
+ * a matching CRC-8, and agrees with the STREAMINFO block.  'header' must
+ * start with a sync code.  If it does and 'frame_header' is not NULL, the
+ * blocksize and the frame or sample number are returned there.
+ */
+FLAC__bool is_frame_header_(const FLAC__byte *header, size_t bytes, const FLAC__StreamMetadata_StreamInfo *stream_info, FLAC__FrameHeader *frame_header)
+{
+	static const unsigned bits_per_sample_table[8] = { 0, 8, 12, 0, 16, 20, 24, 0 };
+	const unsigned blocksize_hint = header[2] >> 4;
+	const unsigned sample_rate_hint = header[2] & 0x0f;
+	const unsigned channel_assignment = header[3] >> 4;
+	const unsigned bps_hint = (header[3] >> 1) & 0x07;
+	const FLAC__bool is_variable_blocksize = header[1] & 0x01;
+	FLAC__uint64 number;
+	unsigned length = 4, extra_bytes, blocksize;
+
+	FLAC__ASSERT(header[0] == 0xff && header[1] >> 1 == 0x7c);
+
+	if(bytes < 6)
+		return false;
+	/* reserved values */
+	if(blocksize_hint == 0 || sample_rate_hint == 15 || channel_assignment > 10 || bps_hint == 3 || bps_hint == 7 || (header[3] & 0x01))
+		return false;
+
+	/* the frame or sample number, UTF-8 coded */
+	if(!(header[4] & 0x80)) {
+		number = header[4];
+		extra_bytes = 0;
+	}
+	else if((header[4] & 0xe0) == 0xc0) {
+		number = header[4] & 0x1f;
+		extra_bytes = 1;
+	}
+	else if((header[4] & 0xf0) == 0xe0) {
+		number = header[4] & 0x0f;
+		extra_bytes = 2;
+	}
+	else if((header[4] & 0xf8) == 0xf0) {
+		number = header[4] & 0x07;
+		extra_bytes = 3;
+	}
+	else if((header[4] & 0xfc) == 0xf8) {
+		number = header[4] & 0x03;
+		extra_bytes = 4;
+	}
+	else if((header[4] & 0xfe) == 0xfc) {
+		number = header[4] & 0x01;
+		extra_bytes = 5;
+	}
+	else if(header[4] == 0xfe && is_variable_blocksize) {
+		number = 0;
+		extra_bytes = 6;
+	}
+	else
+		return false;
+	length++;
+	if(length + extra_bytes > bytes)
+		return false;
+	for( ; extra_bytes > 0; extra_bytes--, length++) {
+		if((header[length] & 0xc0) != 0x80)
+			return false;
+		number = (number << 6) | (header[length] & 0x3f);
+	}
+
+	switch(blocksize_hint) {
+		case 1: blocksize = 192; break;
+		case 2: case 3: case 4: case 5: blocksize = 576 << (blocksize_hint - 2); break;
+		case 6: case 7: blocksize = 0; break; /* read below */
+		default: blocksize = 256 << (blocksize_hint - 8); break;
+	}
+	if(blocksize_hint == 6 || blocksize_hint == 7) {
+		const unsigned blocksize_bytes = blocksize_hint - 5;
+		if(length + blocksize_bytes > bytes)
+			return false;
+		blocksize = header[length++];
+		if(blocksize_bytes == 2)
+			blocksize = (blocksize << 8) | header[length++];
+		blocksize++;
+	}
+	if(sample_rate_hint >= 12)
+		length += sample_rate_hint == 12? 1 : 2;
+
+	/* the CRC-8 byte follows the header */
+	if(length + 1 > bytes || FLAC__crc8(header, length) != header[length])
+		return false;
+
+	/* only a real frame of this stream gets this far, or a one in 256 false sync */
+	if(blocksize > stream_info->max_blocksize)
+		return false;
+	if((channel_assignment < 8? channel_assignment + 1 : 2) != stream_info->channels)
+		return false;
+	if(bps_hint != 0 && bits_per_sample_table[bps_hint] != stream_info->bits_per_sample)
+		return false;
+
+	if(0 != frame_header) {
+		frame_header->blocksize = blocksize;
+		if(is_variable_blocksize) {
+			frame_header->number_type = FLAC__FRAME_NUMBER_TYPE_SAMPLE_NUMBER;
+			frame_header->number.sample_number = number;
+		}
+		else {
+			frame_header->number_type = FLAC__FRAME_NUMBER_TYPE_FRAME_NUMBER;
+			frame_header->number.frame_number = (FLAC__uint32)number;
+		}
+	}
+
+	if(stream_info->total_samples > 0) {
+		if(!is_variable_blocksize) {
+			if(stream_info->min_blocksize != stream_info->max_blocksize)
+				return true; /* can't tell the sample number from the frame number */
+			number *= stream_info->min_blocksize;
+		}
+		if(number >= stream_info->total_samples)
+			return false;
+	}
+
+	return true;
+}
+
+void pack_uint64_(FLAC__byte *b, FLAC__uint64 value, unsigned bytes)
+{
+	b += bytes;
+
+	while(bytes--) {
+		*(--b) = (FLAC__byte)(value & 0xff);
+		value >>= 8;
+	}
+}
+
+FLAC__uint64 unpack_uint64_(const FLAC__byte *b, unsigned bytes)
+{
+	FLAC__uint64 ret = 0;
+
+	while(bytes--)
+		ret = (ret << 8) | (FLAC__uint64)(*b++);
+
+	return ret;
+}
+
 #if FLAC__HAS_OGG
 FLAC__bool seek_to_absolute_sample_ogg_(FLAC__StreamDecoder *decoder, FLAC__uint64 stream_length, FLAC__uint64 target_sample)
 {
@@ -3385,3 +4094,477 @@ FLAC__bool file_eof_callback_(const FLAC__StreamDecoder *decoder, void *client_d
 
 	return feof(decoder->private_->file)? true : false;
 }
+
+#if FLAC__HAS_THREADS
+/*
+ * Creates a shadow decoder for a worker.  It reads the input through the
+ * worker callbacks and starts out past the metadata, with a copy of the
+ * STREAMINFO, so it can be flushed to any frame boundary and decode from
+ * there.
+ */
+static FLAC__StreamDecoder *new_worker_decoder_(const FLAC__StreamDecoder *decoder, decoder_worker *worker)
+{
+	FLAC__StreamDecoder *shadow = FLAC__stream_decoder_new();
+
+	if(0 == shadow)
+		return 0;
+
+	if(FLAC__stream_decoder_init_stream(shadow, worker_read_callback_, /*seek_callback=*/0, worker_tell_callback_, /*length_callback=*/0, /*eof_callback=*/0, worker_write_callback_, /*metadata_callback=*/0, worker_error_callback_, worker) != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+		FLAC__stream_decoder_delete(shadow);
+		return 0;
+	}
+
+	shadow->private_->has_stream_info = true;
+	shadow->private_->stream_info = decoder->private_->stream_info;
+	shadow->protected_->state = FLAC__STREAM_DECODER_SEARCH_FOR_FRAME_SYNC;
+
+	return shadow;
+}
+
+FLAC__bool init_threads_(FLAC__StreamDecoder *decoder)
+{
+	decoder_thread_pool *threads;
+	const unsigned num_threads = decoder->protected_->num_threads;
+	struct stat filestats;
+
+	FLAC__ASSERT(num_threads > 1);
+	FLAC__ASSERT(0 == decoder->private_->threads);
+
+	/* the workers read with pread(), which needs a regular file */
+	if(fstat(fileno(decoder->private_->file), &filestats) != 0 || !S_ISREG(filestats.st_mode))
+		return false;
+
+	threads = (decoder_thread_pool*)calloc(1, sizeof(decoder_thread_pool));
+	if(0 == threads)
+		return false;
+	threads->workers = (decoder_worker*)safe_calloc_(num_threads, sizeof(decoder_worker));
+	threads->jobs = (decoder_job*)safe_calloc_(2 * num_threads, sizeof(decoder_job));
+	threads->scan_buffer = (FLAC__byte*)malloc(SCAN_BUFFER_BYTES_);
+	if(0 == threads->workers || 0 == threads->jobs || 0 == threads->scan_buffer) {
+		free(threads->workers);
+		free(threads->jobs);
+		free(threads->scan_buffer);
+		free(threads);
+		return false;
+	}
+	threads->num_jobs = 2 * num_threads;
+	threads->fd = fileno(decoder->private_->file);
+	pthread_mutex_init(&threads->mutex, 0);
+	pthread_cond_init(&threads->work, 0);
+	pthread_cond_init(&threads->done, 0);
+	decoder->private_->threads = threads;
+
+	/* num_workers only counts fully started workers, so free_threads_() can clean up after a partial start */
+	while(threads->num_workers < num_threads) {
+		decoder_worker *worker = &threads->workers[threads->num_workers];
+
+		worker->pool = threads;
+		worker->decoder = new_worker_decoder_(decoder, worker);
+		if(0 == worker->decoder) {
+			free_threads_(decoder);
+			return false;
+		}
+		if(0 != pthread_create(&worker->thread, 0, worker_thread_, worker)) {
+			FLAC__stream_decoder_delete(worker->decoder);
+			worker->decoder = 0;
+			free_threads_(decoder);
+			return false;
+		}
+		threads->num_workers++;
+	}
+
+	return true;
+}
+
+void free_threads_(FLAC__StreamDecoder *decoder)
+{
+	decoder_thread_pool *threads = decoder->private_->threads;
+	unsigned i, channel;
+
+	if(0 == threads)
+		return;
+
+	pthread_mutex_lock(&threads->mutex);
+	threads->quit = true;
+	pthread_cond_broadcast(&threads->work);
+	pthread_mutex_unlock(&threads->mutex);
+
+	for(i = 0; i < threads->num_workers; i++) {
+		pthread_join(threads->workers[i].thread, 0);
+		FLAC__stream_decoder_delete(threads->workers[i].decoder);
+	}
+	for(i = 0; i < threads->num_jobs; i++) {
+		free(threads->jobs[i].events);
+		for(channel = 0; channel < FLAC__MAX_CHANNELS; channel++)
+			free(threads->jobs[i].samples[channel]);
+	}
+
+	pthread_cond_destroy(&threads->done);
+	pthread_cond_destroy(&threads->work);
+	pthread_mutex_destroy(&threads->mutex);
+	free(threads->scan_buffer);
+	free(threads->jobs);
+	free(threads->workers);
+	free(threads);
+	decoder->private_->threads = 0;
+}
+
+void *worker_thread_(void *arg)
+{
+	decoder_worker *worker = (decoder_worker*)arg;
+	decoder_thread_pool *threads = worker->pool;
+	decoder_job *job;
+	unsigned i;
+
+	pthread_mutex_lock(&threads->mutex);
+	for(;;) {
+		job = 0;
+		while(!threads->quit) {
+			for(i = 0; i < threads->num_jobs && 0 == job; i++) {
+				decoder_job *candidate = &threads->jobs[(threads->oldest_job + i) % threads->num_jobs];
+				if(candidate->state == JOB_QUEUED)
+					job = candidate;
+			}
+			if(0 != job)
+				break;
+			pthread_cond_wait(&threads->work, &threads->mutex);
+		}
+		if(threads->quit)
+			break;
+		job->state = JOB_RUNNING;
+		pthread_mutex_unlock(&threads->mutex);
+
+		decode_job_(worker, job);
+
+		pthread_mutex_lock(&threads->mutex);
+		job->state = JOB_DONE;
+		pthread_cond_signal(&threads->done);
+	}
+	pthread_mutex_unlock(&threads->mutex);
+
+	return 0;
+}
+
+void decode_job_(decoder_worker *worker, decoder_job *job)
+{
+	FLAC__StreamDecoder *decoder = worker->decoder;
+	FLAC__uint64 position = job->start;
+
+	job->num_events = 0;
+	job->samples_used = 0;
+	job->out_of_memory = false;
+	worker->job = job;
+	worker->offset = job->start;
+
+	/* drop whatever the last job left behind, including a cached sync byte */
+	decoder->private_->cached = false;
+	if(FLAC__stream_decoder_flush(decoder)) {
+		while(position < job->end) {
+			if(!FLAC__stream_decoder_process_single(decoder))
+				break;
+			if(decoder->protected_->state == FLAC__STREAM_DECODER_END_OF_STREAM || decoder->protected_->state == FLAC__STREAM_DECODER_ABORTED)
+				break;
+			/* can't fail between frames, which are byte aligned; but never let the caller resume from a stale position */
+			if(!FLAC__stream_decoder_get_decode_position(decoder, &position)) {
+				decoder->protected_->state = FLAC__STREAM_DECODER_ABORTED;
+				break;
+			}
+		}
+	}
+
+	job->end_position = position;
+	job->result = decoder->protected_->state;
+}
+
+FLAC__bool process_frames_in_parallel_(FLAC__StreamDecoder *decoder, FLAC__uint64 start, FLAC__uint64 stream_length)
+{
+	decoder_thread_pool *threads = decoder->private_->threads;
+	decoder_job *job;
+	FLAC__uint64 job_bytes, next_start = start, expected_start = start;
+	unsigned pending = 0, i;
+	FLAC__bool ok = true, done = false;
+
+	FLAC__ASSERT(0 != threads);
+
+	/* a few ranges per worker, so one slow range doesn't stall the others for long */
+	job_bytes = (stream_length - start) / (threads->num_workers * 4);
+	if(job_bytes < MIN_JOB_BYTES_)
+		job_bytes = MIN_JOB_BYTES_;
+	else if(job_bytes > MAX_JOB_BYTES_)
+		job_bytes = MAX_JOB_BYTES_;
+
+	while(!done) {
+		/* keep every job slot busy */
+		while(pending < threads->num_jobs && next_start < stream_length) {
+			job = &threads->jobs[(threads->oldest_job + pending) % threads->num_jobs];
+			if(next_start < expected_start)
+				next_start = expected_start;
+			job->start = next_start;
+			job->end = next_start = find_frame_boundary_(decoder, next_start + job_bytes, job_bytes, stream_length);
+			pthread_mutex_lock(&threads->mutex);
+			job->state = JOB_QUEUED;
+			pthread_cond_signal(&threads->work);
+			pthread_mutex_unlock(&threads->mutex);
+			pending++;
+		}
+		if(pending == 0) {
+			decoder->protected_->state = FLAC__STREAM_DECODER_END_OF_STREAM;
+			break;
+		}
+
+		job = &threads->jobs[threads->oldest_job];
+		pthread_mutex_lock(&threads->mutex);
+		while(job->state != JOB_DONE)
+			pthread_cond_wait(&threads->done, &threads->mutex);
+		pthread_mutex_unlock(&threads->mutex);
+
+		if(job->start != expected_start) {
+			/*
+			 * The previous range ran into this one, either because its last
+			 * frame crossed a false frame boundary or because it had to skip
+			 * over a bad frame.  Decode the rest of the range again from
+			 * where the previous one really stopped.
+			 */
+			if(expected_start < job->end) {
+				job->start = expected_start;
+				pthread_mutex_lock(&threads->mutex);
+				job->state = JOB_QUEUED;
+				pthread_cond_signal(&threads->work);
+				pthread_mutex_unlock(&threads->mutex);
+				continue;
+			}
+		}
+		else {
+			if(!deliver_job_(decoder, job)) {
+				ok = false;
+				done = true;
+			}
+			else if(job->result == FLAC__STREAM_DECODER_END_OF_STREAM) {
+				decoder->protected_->state = FLAC__STREAM_DECODER_END_OF_STREAM;
+				done = true;
+			}
+			expected_start = job->end_position;
+		}
+
+		pthread_mutex_lock(&threads->mutex);
+		job->state = JOB_FREE;
+		threads->oldest_job = (threads->oldest_job + 1) % threads->num_jobs;
+		pthread_mutex_unlock(&threads->mutex);
+		pending--;
+	}
+
+	/* cancel or wait out the jobs still in flight */
+	pthread_mutex_lock(&threads->mutex);
+	for(i = 0; i < threads->num_jobs; i++) {
+		job = &threads->jobs[i];
+		while(job->state == JOB_RUNNING)
+			pthread_cond_wait(&threads->done, &threads->mutex);
+		job->state = JOB_FREE;
+	}
+	threads->oldest_job = 0;
+	pthread_mutex_unlock(&threads->mutex);
+
+	/* leave the input where the delivered frames end, as serial decoding would */
+	if(!FLAC__bitreader_clear(decoder->private_->input)) {
+		decoder->protected_->state = FLAC__STREAM_DECODER_MEMORY_ALLOCATION_ERROR;
+		return false;
+	}
+	if(fseeko(decoder->private_->file, (off_t)expected_start, SEEK_SET) < 0) {
+		decoder->protected_->state = FLAC__STREAM_DECODER_SEEK_ERROR;
+		return false;
+	}
+
+	return ok;
+}
+
+FLAC__bool deliver_job_(FLAC__StreamDecoder *decoder, const decoder_job *job)
+{
+	const FLAC__int32 *buffer[FLAC__MAX_CHANNELS];
+	unsigned i, channel;
+
+	for(i = 0; i < job->num_events; i++) {
+		const decoder_job_event *event = &job->events[i];
+
+		if(event->is_error) {
+			send_error_to_client_(decoder, event->error);
+			continue;
+		}
+
+		decoder->private_->frame.header = event->header;
+		decoder->private_->frame.footer = event->footer;
+		for(channel = 0; channel < event->header.channels; channel++)
+			buffer[channel] = job->samples[channel] + event->offset;
+
+		/* put the latest values into the public section of the decoder instance */
+		decoder->protected_->channels = event->header.channels;
+		decoder->protected_->channel_assignment = event->header.channel_assignment;
+		decoder->protected_->bits_per_sample = event->header.bits_per_sample;
+		decoder->protected_->sample_rate = event->header.sample_rate;
+		decoder->protected_->blocksize = event->header.blocksize;
+
+		FLAC__ASSERT(event->header.number_type == FLAC__FRAME_NUMBER_TYPE_SAMPLE_NUMBER);
+		decoder->private_->samples_decoded = event->header.number.sample_number + event->header.blocksize;
+
+		if(write_audio_frame_to_client_(decoder, &decoder->private_->frame, buffer) != FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE)
+			return false;
+	}
+
+	if(job->out_of_memory) {
+		decoder->protected_->state = FLAC__STREAM_DECODER_MEMORY_ALLOCATION_ERROR;
+		return false;
+	}
+	switch(job->result) {
+		case FLAC__STREAM_DECODER_SEARCH_FOR_FRAME_SYNC:
+		case FLAC__STREAM_DECODER_READ_FRAME:
+		case FLAC__STREAM_DECODER_END_OF_STREAM:
+			return true;
+		default:
+			decoder->protected_->state = job->result;
+			return false;
+	}
+}
+
+/*
+ * Returns the offset of the first frame starting at or after 'from', or
+ * 'stream_length' if there is none.  Seek points are exact, so the first
+ * one within 'range' is used if the stream has a SEEKTABLE; otherwise the
+ * input is scanned for a sync code starting a plausible frame header.
+ * Either can be wrong for a broken stream, which only costs decoding
+ * part of a range twice; see process_frames_in_parallel_().
+ */
+FLAC__uint64 find_frame_boundary_(FLAC__StreamDecoder *decoder, FLAC__uint64 from, FLAC__uint64 range, FLAC__uint64 stream_length)
+{
+	decoder_thread_pool *threads = decoder->private_->threads;
+	const FLAC__StreamMetadata_StreamInfo *stream_info = &decoder->private_->stream_info.data.stream_info;
+	const FLAC__byte *buffer = threads->scan_buffer;
+	unsigned i;
+
+	if(from >= stream_length)
+		return stream_length;
+
+	if(decoder->private_->has_seek_table) {
+		const FLAC__StreamMetadata_SeekTable *seek_table = &decoder->private_->seek_table.data.seek_table;
+		FLAC__uint64 boundary = stream_length;
+
+		for(i = 0; i < seek_table->num_points; i++) {
+			const FLAC__uint64 offset = decoder->private_->first_frame_offset + seek_table->points[i].stream_offset;
+			if(seek_table->points[i].sample_number != FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER && offset >= from && offset < boundary)
+				boundary = offset;
+		}
+		if(boundary - from < range)
+			return boundary;
+	}
+
+	while(from < stream_length) {
+		const ssize_t bytes = pread(threads->fd, threads->scan_buffer, SCAN_BUFFER_BYTES_, (off_t)from);
+		size_t n, k;
+
+		if(bytes <= 0)
+			break;
+		n = (size_t)bytes;
+		for(k = 0; k + 1 < n; k++) {
+			/* the 14 bit sync code and the reserved bit after it */
+			if(buffer[k] == 0xff && buffer[k+1] >> 1 == 0x7c) {
+				/* rescan a header cut off by the end of the buffer, unless the input ends there */
+				if(n - k < FRAME_HEADER_MAX_BYTES_ && from + n < stream_length)
+					break;
+				if(is_frame_header_(buffer + k, n - k, stream_info, /*frame_header=*/0))
+					return from + k;
+			}
+		}
+		from += k > 0? k : 1;
+	}
+
+	return stream_length;
+}
+
+FLAC__StreamDecoderReadStatus worker_read_callback_(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data)
+{
+	decoder_worker *worker = (decoder_worker*)client_data;
+	ssize_t got;
+	(void)decoder;
+
+	if(*bytes == 0)
+		return FLAC__STREAM_DECODER_READ_STATUS_ABORT; /* abort to avoid a deadlock */
+	got = pread(worker->pool->fd, buffer, *bytes, (off_t)worker->offset);
+	if(got < 0)
+		return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+	*bytes = (size_t)got;
+	worker->offset += (FLAC__uint64)got;
+	return got == 0? FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM : FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+FLAC__StreamDecoderTellStatus worker_tell_callback_(const FLAC__StreamDecoder *decoder, FLAC__uint64 *absolute_byte_offset, void *client_data)
+{
+	(void)decoder;
+
+	*absolute_byte_offset = ((decoder_worker*)client_data)->offset;
+	return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+}
+
+/*
+ * Grows the job's event list by one, returning the new event, or NULL if
+ * out of memory.
+ */
+static decoder_job_event *add_job_event_(decoder_job *job)
+{
+	if(job->num_events == job->events_capacity) {
+		const unsigned capacity = job->events_capacity > 0? job->events_capacity * 2 : 64;
+		decoder_job_event *events = (decoder_job_event*)safe_realloc_mul_2op_(job->events, sizeof(decoder_job_event), capacity);
+		if(0 == events)
+			return 0;
+		job->events = events;
+		job->events_capacity = capacity;
+	}
+	return &job->events[job->num_events++];
+}
+
+FLAC__StreamDecoderWriteStatus worker_write_callback_(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
+{
+	decoder_job *job = ((decoder_worker*)client_data)->job;
+	decoder_job_event *event;
+	const unsigned blocksize = frame->header.blocksize;
+	unsigned channel;
+	(void)decoder;
+
+	for(channel = 0; channel < frame->header.channels; channel++) {
+		if(job->samples_capacity[channel] < job->samples_used + blocksize) {
+			const unsigned capacity = max(job->samples_used + blocksize, job->samples_capacity[channel] * 2);
+			FLAC__int32 *samples = (FLAC__int32*)safe_realloc_mul_2op_(job->samples[channel], sizeof(FLAC__int32), capacity);
+			if(0 == samples) {
+				job->out_of_memory = true;
+				return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+			}
+			job->samples[channel] = samples;
+			job->samples_capacity[channel] = capacity;
+		}
+		memcpy(job->samples[channel] + job->samples_used, buffer[channel], sizeof(FLAC__int32) * blocksize);
+	}
+
+	if(0 == (event = add_job_event_(job))) {
+		job->out_of_memory = true;
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+	}
+	event->is_error = false;
+	event->header = frame->header;
+	event->footer = frame->footer;
+	event->offset = job->samples_used;
+	job->samples_used += blocksize;
+
+	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+void worker_error_callback_(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
+{
+	decoder_job *job = ((decoder_worker*)client_data)->job;
+	decoder_job_event *event;
+	(void)decoder;
+
+	if(0 == (event = add_job_event_(job))) {
+		job->out_of_memory = true;
+		return;
+	}
+	event->is_error = true;
+	event->error = status;
+}
+#endif
@@ -46,6 +46,15 @@
 #include <stdlib.h> /* for malloc() */
 #include <string.h> /* for memcpy() */
 #include <sys/types.h> /* for off_t */
+/* Frame-parallel encoding uses POSIX threads; define FLAC__NO_THREADS to
+ * build without them.
+ */
+#if !defined FLAC__NO_THREADS && !defined _WIN32
+#define FLAC__HAS_THREADS 1
+#include <pthread.h>
+#else
+#define FLAC__HAS_THREADS 0
+#endif
 #if defined _MSC_VER || defined __BORLANDC__ || defined __MINGW32__
 #if _MSC_VER <= 1600 || defined __BORLANDC__ /* @@@ [2G limit] */
 #define fseeko fseek
@@ -69,6 +78,7 @@
 #include "private/ogg_helper.h"
 #include "private/ogg_mapping.h"
 #endif
+#include "private/stream_encoder.h"
 #include "private/stream_encoder_framing.h"
 #include "private/window.h"
 
@@ -117,6 +127,44 @@ typedef enum {
 	ENCODER_IN_AUDIO = 2
 } EncoderStateHint;
 
+#if FLAC__HAS_THREADS
+typedef enum {
+	WORKER_IDLE = 0,   /* no block assigned */
+	WORKER_QUEUED = 1, /* a block is assigned and being encoded */
+	WORKER_DONE = 2    /* the encoded frame waits to be written */
+} EncoderWorkerState;
+
+struct encoder_thread_pool;
+
+typedef struct {
+	FLAC__StreamEncoder *encoder; /* shadow encoder with the worker's own workspaces and frame bitbuffer */
+	struct encoder_thread_pool *pool;
+	pthread_t thread;
+	pthread_cond_t wakeup;
+	EncoderWorkerState state; /* guarded by pool->mutex */
+	FLAC__bool is_fractional_block;
+	FLAC__bool is_last_block;
+	FLAC__bool ok;
+} encoder_worker;
+
+/*
+ * Blocks are handed to the workers round-robin, so the worker that gets
+ * the next block is always the one holding the oldest unwritten frame
+ * once all of them are busy; frames are collected in the same order.
+ */
+typedef struct encoder_thread_pool {
+	encoder_worker *workers;
+	unsigned num_workers;
+	unsigned next_worker;       /* gets the next block */
+	unsigned oldest_worker;     /* holds the oldest unwritten frame, if any */
+	unsigned frames_pending;    /* queued or encoded, but not yet written */
+	unsigned next_frame_number; /* frame number of the next block */
+	FLAC__bool quit;
+	pthread_mutex_t mutex;
+	pthread_cond_t done;
+} encoder_thread_pool;
+#endif
+
 static struct CompressionLevels {
 	FLAC__bool do_mid_side_stereo;
 	FLAC__bool loose_mid_side_stereo;
@@ -125,21 +173,27 @@ static struct CompressionLevels {
 	FLAC__bool do_qlp_coeff_prec_search;
 	FLAC__bool do_escape_coding;
 	FLAC__bool do_exhaustive_model_search;
+	FLAC__bool do_early_termination;
 	unsigned min_residual_partition_order;
 	unsigned max_residual_partition_order;
 	unsigned rice_parameter_search_dist;
 } compression_levels_[] = {
-	{ false, false,  0, 0, false, false, false, 0, 3, 0 },
-	{ true , true ,  0, 0, false, false, false, 0, 3, 0 },
-	{ true , false,  0, 0, false, false, false, 0, 3, 0 },
-	{ false, false,  6, 0, false, false, false, 0, 4, 0 },
-	{ true , true ,  8, 0, false, false, false, 0, 4, 0 },
-	{ true , false,  8, 0, false, false, false, 0, 5, 0 },
-	{ true , false,  8, 0, false, false, false, 0, 6, 0 },
-	{ true , false,  8, 0, false, false, true , 0, 6, 0 },
-	{ true , false, 12, 0, false, false, true , 0, 6, 0 }
+	{ false, false,  0, 0, false, false, false, false, 0, 3, 0 },
+	{ true , true ,  0, 0, false, false, false, false, 0, 3, 0 },
+	{ true , false,  0, 0, false, false, false, false, 0, 3, 0 },
+	{ false, false,  6, 0, false, false, false, false, 0, 4, 0 },
+	{ true , true ,  8, 0, false, false, false, false, 0, 4, 0 },
+	{ true , false,  8, 0, false, false, false, false, 0, 5, 0 },
+	{ true , false,  8, 0, false, false, false, false, 0, 6, 0 },
+	{ true , false,  8, 0, false, false, true , false, 0, 6, 0 },
+	{ true , false, 12, 0, false, false, true , false, 0, 6, 0 },
+	{ true , false, 12, 0, false, false, true , true , 0, 6, 0 }
 };
 
+/* Level 9 trades a little of level 8's compression for speed rather than
+ * searching harder, so out-of-range levels still mean level 8. */
+#define COMPRESSION_LEVEL_STRONGEST_ 8
+
 
 /***********************************************************************
  *
@@ -149,6 +203,7 @@ static struct CompressionLevels {
 
 static void set_defaults_(FLAC__StreamEncoder *encoder);
 static void free_(FLAC__StreamEncoder *encoder);
+static void free_buffers_(FLAC__StreamEncoder *encoder);
 static FLAC__bool resize_buffers_(FLAC__StreamEncoder *encoder, unsigned new_blocksize);
 static FLAC__bool write_bitbuffer_(FLAC__StreamEncoder *encoder, unsigned samples, FLAC__bool is_last_block);
 static FLAC__StreamEncoderWriteStatus write_frame_(FLAC__StreamEncoder *encoder, const FLAC__byte buffer[], size_t bytes, unsigned samples, FLAC__bool is_last_block);
@@ -157,6 +212,15 @@ static void update_metadata_(const FLAC__StreamEncoder *encoder);
 static void update_ogg_metadata_(FLAC__StreamEncoder *encoder);
 #endif
 static FLAC__bool process_frame_(FLAC__StreamEncoder *encoder, FLAC__bool is_fractional_block, FLAC__bool is_last_block);
+static FLAC__bool encode_frame_(FLAC__StreamEncoder *encoder, FLAC__bool is_fractional_block);
+#if FLAC__HAS_THREADS
+static FLAC__bool init_threads_(FLAC__StreamEncoder *encoder);
+static void free_threads_(FLAC__StreamEncoder *encoder);
+static FLAC__bool queue_frame_(FLAC__StreamEncoder *encoder, FLAC__bool is_fractional_block, FLAC__bool is_last_block);
+static FLAC__bool write_next_frame_(FLAC__StreamEncoder *encoder);
+static FLAC__bool write_pending_frames_(FLAC__StreamEncoder *encoder);
+static void *worker_thread_(void *arg);
+#endif
 static FLAC__bool process_subframes_(FLAC__StreamEncoder *encoder, FLAC__bool is_fractional_block);
 
 static FLAC__bool process_subframe_(
@@ -229,6 +293,13 @@ static unsigned evaluate_lpc_subframe_(
 	FLAC__Subframe *subframe,
 	FLAC__EntropyCodingMethod_PartitionedRiceContents *partitioned_rice_contents
 );
+
+static FLAC__double estimate_lpc_bits_(
+	const FLAC__double lpc_error[],
+	unsigned order,
+	unsigned blocksize,
+	unsigned overhead_bits_per_order
+);
 #endif
 
 static unsigned evaluate_verbatim_subframe_(
@@ -257,6 +328,7 @@ static unsigned find_best_partition_order_(
 );
 
 static void precompute_partition_info_sums_(
+	struct FLAC__StreamEncoderPrivate *private_,
 	const FLAC__int32 residual[],
 	FLAC__uint64 abs_residual_partition_sums[],
 	unsigned residual_samples,
@@ -266,6 +338,14 @@ static void precompute_partition_info_sums_(
 	unsigned bps
 );
 
+static void precompute_partition_info_sums_32bit_(
+	const FLAC__int32 residual[],
+	FLAC__uint64 abs_residual_partition_sums[],
+	unsigned residual_samples,
+	unsigned predictor_order,
+	unsigned partition_order
+);
+
 static void precompute_partition_info_escapes_(
 	const FLAC__int32 residual[],
 	unsigned raw_bits_per_partition[],
@@ -311,6 +391,16 @@ static void append_to_verify_fifo_interleaved_(
 	unsigned wide_samples
 );
 
+static void dequeue_from_verify_fifo_(verify_input_fifo *fifo, unsigned channels, unsigned wide_samples);
+static FLAC__bool verify_decodes_frame_(const FLAC__StreamEncoder *encoder);
+static FLAC__bool check_subframe_(
+	FLAC__StreamEncoder *encoder,
+	const FLAC__Subframe *subframe,
+	const FLAC__int32 signal[],
+	unsigned blocksize,
+	unsigned subframe_bps,
+	unsigned channel
+);
 static FLAC__StreamDecoderReadStatus verify_read_callback_(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data);
 static FLAC__StreamDecoderWriteStatus verify_write_callback_(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data);
 static void verify_metadata_callback_(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data);
@@ -373,11 +463,16 @@ typedef struct FLAC__StreamEncoderPrivate {
 	unsigned (*local_fixed_compute_best_predictor)(const FLAC__int32 data[], unsigned data_len, FLAC__fixedpoint residual_bits_per_sample[FLAC__MAX_FIXED_ORDER+1]);
 #endif
 #ifndef FLAC__INTEGER_ONLY_LIBRARY
+	void (*local_lpc_window_data)(const FLAC__int32 in[], const FLAC__real window[], FLAC__real out[], unsigned data_len);
 	void (*local_lpc_compute_autocorrelation)(const FLAC__real data[], unsigned data_len, unsigned lag, FLAC__real autoc[]);
 	void (*local_lpc_compute_residual_from_qlp_coefficients)(const FLAC__int32 *data, unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 residual[]);
 	void (*local_lpc_compute_residual_from_qlp_coefficients_64bit)(const FLAC__int32 *data, unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 residual[]);
 	void (*local_lpc_compute_residual_from_qlp_coefficients_16bit)(const FLAC__int32 *data, unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 residual[]);
 #endif
+	void (*local_lpc_restore_signal)(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 data[]);
+	void (*local_lpc_restore_signal_64bit)(const FLAC__int32 residual[], unsigned data_len, const FLAC__int32 qlp_coeff[], unsigned order, int lp_quantization, FLAC__int32 data[]);
+	unsigned (*local_crc16_update_block)(const FLAC__byte *data, unsigned len, unsigned crc);
+	void (*local_precompute_partition_info_sums)(const FLAC__int32 residual[], FLAC__uint64 abs_residual_partition_sums[], unsigned residual_samples, unsigned predictor_order, unsigned partition_order);
 	FLAC__bool use_wide_by_block;          /* use slow 64-bit versions of some functions because of the block size */
 	FLAC__bool use_wide_by_partition;      /* use slow 64-bit versions of some functions because of the min partition order and blocksize */
 	FLAC__bool use_wide_by_order;          /* use slow 64-bit versions of some functions because of the lpc order */
@@ -430,6 +525,10 @@ typedef struct FLAC__StreamEncoderPrivate {
 		FLAC__bool needs_magic_hack;
 		verify_input_fifo input_fifo;
 		verify_output output;
+		FLAC__bool check_subframes;        /* rebuild subframes from their own parameters for the frames the decoder skips */
+		FLAC__int32 *restored_signal;      /* where check_subframe_() rebuilds a subframe */
+		FLAC__int32 *restored_signal_unaligned;
+		unsigned corrupt_frame;            /* frame whose rebuilt subframes get a sample flipped, for the test suite */
 		struct {
 			FLAC__uint64 absolute_sample;
 			unsigned frame_number;
@@ -440,6 +539,9 @@ typedef struct FLAC__StreamEncoderPrivate {
 		} error_stats;
 	} verify;
 	FLAC__bool is_being_deleted; /* if true, call to ..._finish() from ..._delete() will not call the callbacks */
+#if FLAC__HAS_THREADS
+	encoder_thread_pool *threads;          /* only when encoding with more than one thread */
+#endif
 } FLAC__StreamEncoderPrivate;
 
 /***********************************************************************
@@ -604,6 +706,8 @@ FLAC_API void FLAC__stream_encoder_delete(FLAC__StreamEncoder *encoder)
 
 	(void)FLAC__stream_encoder_finish(encoder);
 
+	free_buffers_(encoder);
+
 	if(0 != encoder->private_->verify.decoder)
 		FLAC__stream_decoder_delete(encoder->private_->verify.decoder);
 
@@ -850,36 +954,11 @@ static FLAC__StreamEncoderInitStatus init_stream_internal_(
 		}
 	}
 
-	encoder->private_->input_capacity = 0;
-	for(i = 0; i < encoder->protected_->channels; i++) {
-		encoder->private_->integer_signal_unaligned[i] = encoder->private_->integer_signal[i] = 0;
-#ifndef FLAC__INTEGER_ONLY_LIBRARY
-		encoder->private_->real_signal_unaligned[i] = encoder->private_->real_signal[i] = 0;
-#endif
-	}
-	for(i = 0; i < 2; i++) {
-		encoder->private_->integer_signal_mid_side_unaligned[i] = encoder->private_->integer_signal_mid_side[i] = 0;
-#ifndef FLAC__INTEGER_ONLY_LIBRARY
-		encoder->private_->real_signal_mid_side_unaligned[i] = encoder->private_->real_signal_mid_side[i] = 0;
-#endif
-	}
-#ifndef FLAC__INTEGER_ONLY_LIBRARY
-	for(i = 0; i < encoder->protected_->num_apodizations; i++)
-		encoder->private_->window_unaligned[i] = encoder->private_->window[i] = 0;
-	encoder->private_->windowed_signal_unaligned = encoder->private_->windowed_signal = 0;
-#endif
-	for(i = 0; i < encoder->protected_->channels; i++) {
-		encoder->private_->residual_workspace_unaligned[i][0] = encoder->private_->residual_workspace[i][0] = 0;
-		encoder->private_->residual_workspace_unaligned[i][1] = encoder->private_->residual_workspace[i][1] = 0;
+	/* the signal and workspace buffers survive FLAC__stream_encoder_finish(); resize_buffers_() reuses whatever a previous stream left */
+	for(i = 0; i < encoder->protected_->channels; i++)
 		encoder->private_->best_subframe[i] = 0;
-	}
-	for(i = 0; i < 2; i++) {
-		encoder->private_->residual_workspace_mid_side_unaligned[i][0] = encoder->private_->residual_workspace_mid_side[i][0] = 0;
-		encoder->private_->residual_workspace_mid_side_unaligned[i][1] = encoder->private_->residual_workspace_mid_side[i][1] = 0;
+	for(i = 0; i < 2; i++)
 		encoder->private_->best_subframe_mid_side[i] = 0;
-	}
-	encoder->private_->abs_residual_partition_sums_unaligned = encoder->private_->abs_residual_partition_sums = 0;
-	encoder->private_->raw_bits_per_partition_unaligned = encoder->private_->raw_bits_per_partition = 0;
 #ifndef FLAC__INTEGER_ONLY_LIBRARY
 	encoder->private_->loose_mid_side_stereo_frames = (unsigned)((FLAC__double)encoder->protected_->sample_rate * 0.4 / (FLAC__double)encoder->protected_->blocksize + 0.5);
 #else
@@ -907,6 +986,7 @@ static FLAC__StreamEncoderInitStatus init_stream_internal_(
 	FLAC__cpu_info(&encoder->private_->cpuinfo);
 	/* first default to the non-asm routines */
 #ifndef FLAC__INTEGER_ONLY_LIBRARY
+	encoder->private_->local_lpc_window_data = FLAC__lpc_window_data;
 	encoder->private_->local_lpc_compute_autocorrelation = FLAC__lpc_compute_autocorrelation;
 #endif
 	encoder->private_->local_fixed_compute_best_predictor = FLAC__fixed_compute_best_predictor;
@@ -915,10 +995,15 @@ static FLAC__StreamEncoderInitStatus init_stream_internal_(
 	encoder->private_->local_lpc_compute_residual_from_qlp_coefficients_64bit = FLAC__lpc_compute_residual_from_qlp_coefficients_wide;
 	encoder->private_->local_lpc_compute_residual_from_qlp_coefficients_16bit = FLAC__lpc_compute_residual_from_qlp_coefficients;
 #endif
+	encoder->private_->local_lpc_restore_signal = FLAC__lpc_restore_signal;
+	encoder->private_->local_lpc_restore_signal_64bit = FLAC__lpc_restore_signal_wide;
+	encoder->private_->local_crc16_update_block = FLAC__crc16_update_block;
+	encoder->private_->local_precompute_partition_info_sums = precompute_partition_info_sums_32bit_;
 	/* now override with asm where appropriate */
-#ifndef FLAC__INTEGER_ONLY_LIBRARY
-# ifndef FLAC__NO_ASM
+#ifndef FLAC__NO_ASM
 	if(encoder->private_->cpuinfo.use_asm) {
+		FLAC__CPUDispatch dispatch;
+# ifndef FLAC__INTEGER_ONLY_LIBRARY
 #  ifdef FLAC__CPU_IA32
 		FLAC__ASSERT(encoder->private_->cpuinfo.type == FLAC__CPUINFO_TYPE_IA32);
 #   ifdef FLAC__HAS_NASM
@@ -948,9 +1033,29 @@ static FLAC__StreamEncoderInitStatus init_stream_internal_(
 			encoder->private_->local_fixed_compute_best_predictor = FLAC__fixed_compute_best_predictor_asm_ia32_mmx_cmov;
 #   endif /* FLAC__HAS_NASM */
 #  endif /* FLAC__CPU_IA32 */
+# endif /* !FLAC__INTEGER_ONLY_LIBRARY */
+		FLAC__cpu_dispatch(&encoder->private_->cpuinfo, &dispatch);
+# ifndef FLAC__INTEGER_ONLY_LIBRARY
+		if(0 != dispatch.lpc_window_data)
+			encoder->private_->local_lpc_window_data = dispatch.lpc_window_data;
+		if(0 != dispatch.lpc_compute_autocorrelation)
+			encoder->private_->local_lpc_compute_autocorrelation = dispatch.lpc_compute_autocorrelation;
+		if(0 != dispatch.lpc_compute_residual_from_qlp_coefficients) {
+			encoder->private_->local_lpc_compute_residual_from_qlp_coefficients = dispatch.lpc_compute_residual_from_qlp_coefficients;
+			encoder->private_->local_lpc_compute_residual_from_qlp_coefficients_64bit = dispatch.lpc_compute_residual_from_qlp_coefficients_wide;
+			encoder->private_->local_lpc_compute_residual_from_qlp_coefficients_16bit = dispatch.lpc_compute_residual_from_qlp_coefficients;
+		}
+# endif /* !FLAC__INTEGER_ONLY_LIBRARY */
+		if(0 != dispatch.lpc_restore_signal) {
+			encoder->private_->local_lpc_restore_signal = dispatch.lpc_restore_signal;
+			encoder->private_->local_lpc_restore_signal_64bit = dispatch.lpc_restore_signal_wide;
+		}
+		if(0 != dispatch.crc16_update_block)
+			encoder->private_->local_crc16_update_block = dispatch.crc16_update_block;
+		if(0 != dispatch.precompute_partition_info_sums)
+			encoder->private_->local_precompute_partition_info_sums = dispatch.precompute_partition_info_sums;
 	}
-# endif /* !FLAC__NO_ASM */
-#endif /* !FLAC__INTEGER_ONLY_LIBRARY */
+#endif /* !FLAC__NO_ASM */
 	/* finally override based on wide-ness if necessary */
 	if(encoder->private_->use_wide_by_block) {
 		encoder->private_->local_fixed_compute_best_predictor = FLAC__fixed_compute_best_predictor_wide;
@@ -974,6 +1079,8 @@ static FLAC__StreamEncoderInitStatus init_stream_internal_(
 	encoder->private_->metadata_callback = metadata_callback;
 	encoder->private_->client_data = client_data;
 
+	encoder->private_->verify.check_subframes = encoder->protected_->verify && encoder->protected_->verify_decode_interval != 1;
+
 	if(!resize_buffers_(encoder, encoder->protected_->blocksize)) {
 		/* the above function sets the state for us in case of an error */
 		return FLAC__STREAM_ENCODER_INIT_STATUS_ENCODER_ERROR;
@@ -984,6 +1091,13 @@ static FLAC__StreamEncoderInitStatus init_stream_internal_(
 		return FLAC__STREAM_ENCODER_INIT_STATUS_ENCODER_ERROR;
 	}
 
+#if FLAC__HAS_THREADS
+	if(encoder->protected_->num_threads > 1 && !init_threads_(encoder)) {
+		/* the above function sets the state for us in case of an error */
+		return FLAC__STREAM_ENCODER_INIT_STATUS_ENCODER_ERROR;
+	}
+#endif
+
 	/*
 	 * Set up the verify stuff if necessary
 	 */
@@ -993,6 +1107,11 @@ static FLAC__StreamEncoderInitStatus init_stream_internal_(
 		 * original signal to compare against
 		 */
 		encoder->private_->verify.input_fifo.size = encoder->protected_->blocksize+OVERREAD_;
+#if FLAC__HAS_THREADS
+		/* with worker threads, up to num_threads whole blocks await verification besides the one being filled */
+		if(0 != encoder->private_->threads)
+			encoder->private_->verify.input_fifo.size += encoder->protected_->blocksize * encoder->protected_->num_threads;
+#endif
 		for(i = 0; i < encoder->protected_->channels; i++) {
 			if(0 == (encoder->private_->verify.input_fifo.data[i] = (FLAC__int32*)safe_malloc_mul_2op_(sizeof(FLAC__int32), /*times*/encoder->private_->verify.input_fifo.size))) {
 				encoder->protected_->state = FLAC__STREAM_ENCODER_MEMORY_ALLOCATION_ERROR;
@@ -1325,12 +1444,21 @@ FLAC_API FLAC__bool FLAC__stream_encoder_finish(FLAC__StreamEncoder *encoder)
 		return true;
 
 	if(encoder->protected_->state == FLAC__STREAM_ENCODER_OK && !encoder->private_->is_being_deleted) {
-		if(encoder->private_->current_sample_number != 0) {
+#if FLAC__HAS_THREADS
+		/* frames still in flight were encoded with the full blocksize; write them before it changes */
+		if(0 != encoder->private_->threads && !write_pending_frames_(encoder))
+			error = true;
+#endif
+		if(!error && encoder->private_->current_sample_number != 0) {
 			const FLAC__bool is_fractional_block = encoder->protected_->blocksize != encoder->private_->current_sample_number;
 			encoder->protected_->blocksize = encoder->private_->current_sample_number;
 			if(!process_frame_(encoder, is_fractional_block, /*is_last_block=*/true))
 				error = true;
 		}
+#if FLAC__HAS_THREADS
+		if(!error && 0 != encoder->private_->threads && !write_pending_frames_(encoder))
+			error = true;
+#endif
 	}
 
 	if(encoder->protected_->do_md5)
@@ -1411,6 +1539,17 @@ FLAC_API FLAC__bool FLAC__stream_encoder_set_verify(FLAC__StreamEncoder *encoder
 	return true;
 }
 
+FLAC_API FLAC__bool FLAC__stream_encoder_set_verify_decode_interval(FLAC__StreamEncoder *encoder, unsigned value)
+{
+	FLAC__ASSERT(0 != encoder);
+	FLAC__ASSERT(0 != encoder->private_);
+	FLAC__ASSERT(0 != encoder->protected_);
+	if(encoder->protected_->state != FLAC__STREAM_ENCODER_UNINITIALIZED)
+		return false;
+	encoder->protected_->verify_decode_interval = value;
+	return true;
+}
+
 FLAC_API FLAC__bool FLAC__stream_encoder_set_streamable_subset(FLAC__StreamEncoder *encoder, FLAC__bool value)
 {
 	FLAC__ASSERT(0 != encoder);
@@ -1475,7 +1614,7 @@ FLAC_API FLAC__bool FLAC__stream_encoder_set_compression_level(FLAC__StreamEncod
 	if(encoder->protected_->state != FLAC__STREAM_ENCODER_UNINITIALIZED)
 		return false;
 	if(value >= sizeof(compression_levels_)/sizeof(compression_levels_[0]))
-		value = sizeof(compression_levels_)/sizeof(compression_levels_[0]) - 1;
+		value = COMPRESSION_LEVEL_STRONGEST_;
 	ok &= FLAC__stream_encoder_set_do_mid_side_stereo          (encoder, compression_levels_[value].do_mid_side_stereo);
 	ok &= FLAC__stream_encoder_set_loose_mid_side_stereo       (encoder, compression_levels_[value].loose_mid_side_stereo);
 #ifndef FLAC__INTEGER_ONLY_LIBRARY
@@ -1494,6 +1633,7 @@ FLAC_API FLAC__bool FLAC__stream_encoder_set_compression_level(FLAC__StreamEncod
 	ok &= FLAC__stream_encoder_set_do_qlp_coeff_prec_search    (encoder, compression_levels_[value].do_qlp_coeff_prec_search);
 	ok &= FLAC__stream_encoder_set_do_escape_coding            (encoder, compression_levels_[value].do_escape_coding);
 	ok &= FLAC__stream_encoder_set_do_exhaustive_model_search  (encoder, compression_levels_[value].do_exhaustive_model_search);
+	ok &= FLAC__stream_encoder_set_do_early_termination        (encoder, compression_levels_[value].do_early_termination);
 	ok &= FLAC__stream_encoder_set_min_residual_partition_order(encoder, compression_levels_[value].min_residual_partition_order);
 	ok &= FLAC__stream_encoder_set_max_residual_partition_order(encoder, compression_levels_[value].max_residual_partition_order);
 	ok &= FLAC__stream_encoder_set_rice_parameter_search_dist  (encoder, compression_levels_[value].rice_parameter_search_dist);
@@ -1665,6 +1805,17 @@ FLAC_API FLAC__bool FLAC__stream_encoder_set_do_exhaustive_model_search(FLAC__St
 	return true;
 }
 
+FLAC_API FLAC__bool FLAC__stream_encoder_set_do_early_termination(FLAC__StreamEncoder *encoder, FLAC__bool value)
+{
+	FLAC__ASSERT(0 != encoder);
+	FLAC__ASSERT(0 != encoder->private_);
+	FLAC__ASSERT(0 != encoder->protected_);
+	if(encoder->protected_->state != FLAC__STREAM_ENCODER_UNINITIALIZED)
+		return false;
+	encoder->protected_->do_early_termination = value;
+	return true;
+}
+
 FLAC_API FLAC__bool FLAC__stream_encoder_set_min_residual_partition_order(FLAC__StreamEncoder *encoder, unsigned value)
 {
 	FLAC__ASSERT(0 != encoder);
@@ -1747,7 +1898,7 @@ FLAC_API FLAC__bool FLAC__stream_encoder_set_metadata(FLAC__StreamEncoder *encod
 }
 
 /*
- * These three functions are not static, but not publically exposed in
+ * These four functions are not static, but not publically exposed in
  * include/FLAC/ either.  They are used by the test suite.
  */
 FLAC_API FLAC__bool FLAC__stream_encoder_disable_constant_subframes(FLAC__StreamEncoder *encoder, FLAC__bool value)
@@ -1783,6 +1934,35 @@ FLAC_API FLAC__bool FLAC__stream_encoder_disable_verbatim_subframes(FLAC__Stream
 	return true;
 }
 
+/* makes check_subframe_() see a wrong last sample in every subframe of the given frame */
+FLAC_API FLAC__bool FLAC__stream_encoder_set_verify_corrupt_frame(FLAC__StreamEncoder *encoder, unsigned value)
+{
+	FLAC__ASSERT(0 != encoder);
+	FLAC__ASSERT(0 != encoder->private_);
+	FLAC__ASSERT(0 != encoder->protected_);
+	if(encoder->protected_->state != FLAC__STREAM_ENCODER_UNINITIALIZED)
+		return false;
+	encoder->private_->verify.corrupt_frame = value;
+	return true;
+}
+
+FLAC_API FLAC__bool FLAC__stream_encoder_set_num_threads(FLAC__StreamEncoder *encoder, unsigned value)
+{
+	FLAC__ASSERT(0 != encoder);
+	FLAC__ASSERT(0 != encoder->private_);
+	FLAC__ASSERT(0 != encoder->protected_);
+	if(encoder->protected_->state != FLAC__STREAM_ENCODER_UNINITIALIZED)
+		return false;
+	if(value == 0 || value > FLAC__STREAM_ENCODER_MAX_THREADS)
+		return false;
+#if !FLAC__HAS_THREADS
+	if(value > 1)
+		return false;
+#endif
+	encoder->protected_->num_threads = value;
+	return true;
+}
+
 FLAC_API FLAC__StreamEncoderState FLAC__stream_encoder_get_state(const FLAC__StreamEncoder *encoder)
 {
 	FLAC__ASSERT(0 != encoder);
@@ -1840,6 +2020,14 @@ FLAC_API FLAC__bool FLAC__stream_encoder_get_verify(const FLAC__StreamEncoder *e
 	return encoder->protected_->verify;
 }
 
+FLAC_API unsigned FLAC__stream_encoder_get_verify_decode_interval(const FLAC__StreamEncoder *encoder)
+{
+	FLAC__ASSERT(0 != encoder);
+	FLAC__ASSERT(0 != encoder->private_);
+	FLAC__ASSERT(0 != encoder->protected_);
+	return encoder->protected_->verify_decode_interval;
+}
+
 FLAC_API FLAC__bool FLAC__stream_encoder_get_streamable_subset(const FLAC__StreamEncoder *encoder)
 {
 	FLAC__ASSERT(0 != encoder);
@@ -1944,6 +2132,14 @@ FLAC_API FLAC__bool FLAC__stream_encoder_get_do_exhaustive_model_search(const FL
 	return encoder->protected_->do_exhaustive_model_search;
 }
 
+FLAC_API FLAC__bool FLAC__stream_encoder_get_do_early_termination(const FLAC__StreamEncoder *encoder)
+{
+	FLAC__ASSERT(0 != encoder);
+	FLAC__ASSERT(0 != encoder->private_);
+	FLAC__ASSERT(0 != encoder->protected_);
+	return encoder->protected_->do_early_termination;
+}
+
 FLAC_API unsigned FLAC__stream_encoder_get_min_residual_partition_order(const FLAC__StreamEncoder *encoder)
 {
 	FLAC__ASSERT(0 != encoder);
@@ -1976,6 +2172,14 @@ FLAC_API FLAC__uint64 FLAC__stream_encoder_get_total_samples_estimate(const FLAC
 	return encoder->protected_->total_samples_estimate;
 }
 
+FLAC_API unsigned FLAC__stream_encoder_get_num_threads(const FLAC__StreamEncoder *encoder)
+{
+	FLAC__ASSERT(0 != encoder);
+	FLAC__ASSERT(0 != encoder->private_);
+	FLAC__ASSERT(0 != encoder->protected_);
+	return encoder->protected_->num_threads;
+}
+
 FLAC_API FLAC__bool FLAC__stream_encoder_process(FLAC__StreamEncoder *encoder, const FLAC__int32 * const buffer[], unsigned samples)
 {
 	unsigned i, j = 0, channel;
@@ -2110,6 +2314,108 @@ FLAC_API FLAC__bool FLAC__stream_encoder_process_interleaved(FLAC__StreamEncoder
 	return true;
 }
 
+FLAC_API FLAC__bool FLAC__stream_encoder_process_interleaved_int16(FLAC__StreamEncoder *encoder, const FLAC__int16 buffer[], unsigned samples)
+{
+	unsigned i, j, k, channel, start;
+	FLAC__int32 x, mid, side;
+	const unsigned channels = encoder->protected_->channels, blocksize = encoder->protected_->blocksize;
+
+	FLAC__ASSERT(0 != encoder);
+	FLAC__ASSERT(0 != encoder->private_);
+	FLAC__ASSERT(0 != encoder->protected_);
+	FLAC__ASSERT(encoder->protected_->state == FLAC__STREAM_ENCODER_OK);
+	FLAC__ASSERT(encoder->protected_->bits_per_sample <= 16);
+
+	/*
+	 * same loops as FLAC__stream_encoder_process_interleaved(), except that
+	 * the input is widened while it is deinterleaved, and the verify FIFO is
+	 * filled from integer_signal[] afterwards instead of from the input
+	 */
+	j = k = 0;
+	if(encoder->protected_->do_mid_side_stereo && channels == 2) {
+		/*
+		 * stereo coding: unroll channel loop
+		 */
+		do {
+			/* "i <= blocksize" to overread 1 sample; see comment in OVERREAD_ decl */
+			start = encoder->private_->current_sample_number;
+			for(i = start; i <= blocksize && j < samples; i++, j++) {
+				encoder->private_->integer_signal[0][i] = mid = side = buffer[k++];
+				x = buffer[k++];
+				encoder->private_->integer_signal[1][i] = x;
+				mid += x;
+				side -= x;
+				mid >>= 1; /* NOTE: not the same as 'mid = (left + right) / 2' ! */
+				encoder->private_->integer_signal_mid_side[1][i] = side;
+				encoder->private_->integer_signal_mid_side[0][i] = mid;
+			}
+			if(encoder->protected_->verify)
+				append_to_verify_fifo_(&encoder->private_->verify.input_fifo, (const FLAC__int32 * const *)encoder->private_->integer_signal, start, channels, i - start);
+			encoder->private_->current_sample_number = i;
+			/* we only process if we have a full block + 1 extra sample; final block is always handled by FLAC__stream_encoder_finish() */
+			if(i > blocksize) {
+				if(!process_frame_(encoder, /*is_fractional_block=*/false, /*is_last_block=*/false))
+					return false;
+				/* move unprocessed overread samples to beginnings of arrays */
+				FLAC__ASSERT(i == blocksize+OVERREAD_);
+				FLAC__ASSERT(OVERREAD_ == 1); /* assert we only overread 1 sample which simplifies the rest of the code below */
+				encoder->private_->integer_signal[0][0] = encoder->private_->integer_signal[0][blocksize];
+				encoder->private_->integer_signal[1][0] = encoder->private_->integer_signal[1][blocksize];
+				encoder->private_->integer_signal_mid_side[0][0] = encoder->private_->integer_signal_mid_side[0][blocksize];
+				encoder->private_->integer_signal_mid_side[1][0] = encoder->private_->integer_signal_mid_side[1][blocksize];
+				encoder->private_->current_sample_number = 1;
+			}
+		} while(j < samples);
+	}
+	else if(channels == 1) {
+		/*
+		 * mono: no deinterleaving needed at all
+		 */
+		do {
+			start = encoder->private_->current_sample_number;
+			for(i = start; i <= blocksize && j < samples; i++, j++)
+				encoder->private_->integer_signal[0][i] = buffer[j];
+			if(encoder->protected_->verify)
+				append_to_verify_fifo_(&encoder->private_->verify.input_fifo, (const FLAC__int32 * const *)encoder->private_->integer_signal, start, channels, i - start);
+			encoder->private_->current_sample_number = i;
+			if(i > blocksize) {
+				if(!process_frame_(encoder, /*is_fractional_block=*/false, /*is_last_block=*/false))
+					return false;
+				FLAC__ASSERT(i == blocksize+OVERREAD_);
+				FLAC__ASSERT(OVERREAD_ == 1);
+				encoder->private_->integer_signal[0][0] = encoder->private_->integer_signal[0][blocksize];
+				encoder->private_->current_sample_number = 1;
+			}
+		} while(j < samples);
+	}
+	else {
+		/*
+		 * independent channel coding: buffer each channel in inner loop
+		 */
+		do {
+			start = encoder->private_->current_sample_number;
+			for(i = start; i <= blocksize && j < samples; i++, j++) {
+				for(channel = 0; channel < channels; channel++)
+					encoder->private_->integer_signal[channel][i] = buffer[k++];
+			}
+			if(encoder->protected_->verify)
+				append_to_verify_fifo_(&encoder->private_->verify.input_fifo, (const FLAC__int32 * const *)encoder->private_->integer_signal, start, channels, i - start);
+			encoder->private_->current_sample_number = i;
+			if(i > blocksize) {
+				if(!process_frame_(encoder, /*is_fractional_block=*/false, /*is_last_block=*/false))
+					return false;
+				FLAC__ASSERT(i == blocksize+OVERREAD_);
+				FLAC__ASSERT(OVERREAD_ == 1);
+				for(channel = 0; channel < channels; channel++)
+					encoder->private_->integer_signal[channel][0] = encoder->private_->integer_signal[channel][blocksize];
+				encoder->private_->current_sample_number = 1;
+			}
+		} while(j < samples);
+	}
+
+	return true;
+}
+
 /***********************************************************************
  *
  * Private class methods
@@ -2125,6 +2431,7 @@ void set_defaults_(FLAC__StreamEncoder *encoder)
 #else
 	encoder->protected_->verify = false;
 #endif
+	encoder->protected_->verify_decode_interval = 1;
 	encoder->protected_->streamable_subset = true;
 	encoder->protected_->do_md5 = true;
 	encoder->protected_->do_mid_side_stereo = false;
@@ -2142,11 +2449,13 @@ void set_defaults_(FLAC__StreamEncoder *encoder)
 	encoder->protected_->qlp_coeff_precision = 0;
 	encoder->protected_->do_qlp_coeff_prec_search = false;
 	encoder->protected_->do_exhaustive_model_search = false;
+	encoder->protected_->do_early_termination = false;
 	encoder->protected_->do_escape_coding = false;
 	encoder->protected_->min_residual_partition_order = 0;
 	encoder->protected_->max_residual_partition_order = 0;
 	encoder->protected_->rice_parameter_search_dist = 0;
 	encoder->protected_->total_samples_estimate = 0;
+	encoder->protected_->num_threads = 1;
 	encoder->protected_->metadata = 0;
 	encoder->protected_->num_metadata_blocks = 0;
 
@@ -2154,6 +2463,7 @@ void set_defaults_(FLAC__StreamEncoder *encoder)
 	encoder->private_->disable_constant_subframes = false;
 	encoder->private_->disable_fixed_subframes = false;
 	encoder->private_->disable_verbatim_subframes = false;
+	encoder->private_->verify.corrupt_frame = (unsigned)(-1);
 #if FLAC__HAS_OGG
 	encoder->private_->is_ogg = false;
 #endif
@@ -2172,7 +2482,7 @@ void set_defaults_(FLAC__StreamEncoder *encoder)
 
 void free_(FLAC__StreamEncoder *encoder)
 {
-	unsigned i, channel;
+	unsigned i;
 
 	FLAC__ASSERT(0 != encoder);
 	if(encoder->protected_->metadata) {
@@ -2180,47 +2490,72 @@ void free_(FLAC__StreamEncoder *encoder)
 		encoder->protected_->metadata = 0;
 		encoder->protected_->num_metadata_blocks = 0;
 	}
-	for(i = 0; i < encoder->protected_->channels; i++) {
+	if(encoder->protected_->verify) {
+		for(i = 0; i < encoder->protected_->channels; i++) {
+			if(0 != encoder->private_->verify.input_fifo.data[i]) {
+				free(encoder->private_->verify.input_fifo.data[i]);
+				encoder->private_->verify.input_fifo.data[i] = 0;
+			}
+		}
+	}
+	FLAC__bitwriter_free(encoder->private_->frame);
+#if FLAC__HAS_THREADS
+	free_threads_(encoder);
+#endif
+}
+
+/*
+ * Frees what resize_buffers_() allocated.  Unlike free_(), this only
+ * happens when the encoder is deleted, so that an encoder which is
+ * finished and initialized again keeps its buffers.  The settings they
+ * were sized for may be gone by then, so all possible slots are checked.
+ */
+void free_buffers_(FLAC__StreamEncoder *encoder)
+{
+	unsigned i, channel;
+
+	FLAC__ASSERT(0 != encoder);
+	for(i = 0; i < FLAC__MAX_CHANNELS; i++) {
 		if(0 != encoder->private_->integer_signal_unaligned[i]) {
 			free(encoder->private_->integer_signal_unaligned[i]);
-			encoder->private_->integer_signal_unaligned[i] = 0;
+			encoder->private_->integer_signal_unaligned[i] = encoder->private_->integer_signal[i] = 0;
 		}
 #ifndef FLAC__INTEGER_ONLY_LIBRARY
 		if(0 != encoder->private_->real_signal_unaligned[i]) {
 			free(encoder->private_->real_signal_unaligned[i]);
-			encoder->private_->real_signal_unaligned[i] = 0;
+			encoder->private_->real_signal_unaligned[i] = encoder->private_->real_signal[i] = 0;
 		}
 #endif
 	}
 	for(i = 0; i < 2; i++) {
 		if(0 != encoder->private_->integer_signal_mid_side_unaligned[i]) {
 			free(encoder->private_->integer_signal_mid_side_unaligned[i]);
-			encoder->private_->integer_signal_mid_side_unaligned[i] = 0;
+			encoder->private_->integer_signal_mid_side_unaligned[i] = encoder->private_->integer_signal_mid_side[i] = 0;
 		}
 #ifndef FLAC__INTEGER_ONLY_LIBRARY
 		if(0 != encoder->private_->real_signal_mid_side_unaligned[i]) {
 			free(encoder->private_->real_signal_mid_side_unaligned[i]);
-			encoder->private_->real_signal_mid_side_unaligned[i] = 0;
+			encoder->private_->real_signal_mid_side_unaligned[i] = encoder->private_->real_signal_mid_side[i] = 0;
 		}
 #endif
 	}
 #ifndef FLAC__INTEGER_ONLY_LIBRARY
-	for(i = 0; i < encoder->protected_->num_apodizations; i++) {
+	for(i = 0; i < FLAC__MAX_APODIZATION_FUNCTIONS; i++) {
 		if(0 != encoder->private_->window_unaligned[i]) {
 			free(encoder->private_->window_unaligned[i]);
-			encoder->private_->window_unaligned[i] = 0;
+			encoder->private_->window_unaligned[i] = encoder->private_->window[i] = 0;
 		}
 	}
 	if(0 != encoder->private_->windowed_signal_unaligned) {
 		free(encoder->private_->windowed_signal_unaligned);
-		encoder->private_->windowed_signal_unaligned = 0;
+		encoder->private_->windowed_signal_unaligned = encoder->private_->windowed_signal = 0;
 	}
 #endif
-	for(channel = 0; channel < encoder->protected_->channels; channel++) {
+	for(channel = 0; channel < FLAC__MAX_CHANNELS; channel++) {
 		for(i = 0; i < 2; i++) {
 			if(0 != encoder->private_->residual_workspace_unaligned[channel][i]) {
 				free(encoder->private_->residual_workspace_unaligned[channel][i]);
-				encoder->private_->residual_workspace_unaligned[channel][i] = 0;
+				encoder->private_->residual_workspace_unaligned[channel][i] = encoder->private_->residual_workspace[channel][i] = 0;
 			}
 		}
 	}
@@ -2228,41 +2563,42 @@ void free_(FLAC__StreamEncoder *encoder)
 		for(i = 0; i < 2; i++) {
 			if(0 != encoder->private_->residual_workspace_mid_side_unaligned[channel][i]) {
 				free(encoder->private_->residual_workspace_mid_side_unaligned[channel][i]);
-				encoder->private_->residual_workspace_mid_side_unaligned[channel][i] = 0;
+				encoder->private_->residual_workspace_mid_side_unaligned[channel][i] = encoder->private_->residual_workspace_mid_side[channel][i] = 0;
 			}
 		}
 	}
 	if(0 != encoder->private_->abs_residual_partition_sums_unaligned) {
 		free(encoder->private_->abs_residual_partition_sums_unaligned);
-		encoder->private_->abs_residual_partition_sums_unaligned = 0;
+		encoder->private_->abs_residual_partition_sums_unaligned = encoder->private_->abs_residual_partition_sums = 0;
 	}
 	if(0 != encoder->private_->raw_bits_per_partition_unaligned) {
 		free(encoder->private_->raw_bits_per_partition_unaligned);
-		encoder->private_->raw_bits_per_partition_unaligned = 0;
+		encoder->private_->raw_bits_per_partition_unaligned = encoder->private_->raw_bits_per_partition = 0;
 	}
-	if(encoder->protected_->verify) {
-		for(i = 0; i < encoder->protected_->channels; i++) {
-			if(0 != encoder->private_->verify.input_fifo.data[i]) {
-				free(encoder->private_->verify.input_fifo.data[i]);
-				encoder->private_->verify.input_fifo.data[i] = 0;
-			}
-		}
+	if(0 != encoder->private_->verify.restored_signal_unaligned) {
+		free(encoder->private_->verify.restored_signal_unaligned);
+		encoder->private_->verify.restored_signal_unaligned = encoder->private_->verify.restored_signal = 0;
 	}
-	FLAC__bitwriter_free(encoder->private_->frame);
+	encoder->private_->input_capacity = 0;
 }
 
 FLAC__bool resize_buffers_(FLAC__StreamEncoder *encoder, unsigned new_blocksize)
 {
-	FLAC__bool ok;
-	unsigned i, channel;
+	FLAC__bool ok, grow;
+	unsigned i, channel, capacity;
 
 	FLAC__ASSERT(new_blocksize > 0);
 	FLAC__ASSERT(encoder->protected_->state == FLAC__STREAM_ENCODER_OK);
 	FLAC__ASSERT(encoder->private_->current_sample_number == 0);
 
-	/* To avoid excessive malloc'ing, we only grow the buffer; no shrinking. */
-	if(new_blocksize <= encoder->private_->input_capacity)
-		return true;
+	/* To avoid excessive malloc'ing, we only grow the buffers; no shrinking.
+	 * They also outlive FLAC__stream_encoder_finish(), so a reinitialized
+	 * encoder only allocates buffers its previous streams didn't need, e.g.
+	 * for additional channels.  Those get the current capacity, so that all
+	 * buffers are always at least input_capacity long.
+	 */
+	grow = new_blocksize > encoder->private_->input_capacity;
+	capacity = grow? new_blocksize : encoder->private_->input_capacity;
 
 	ok = true;
 
@@ -2273,9 +2609,13 @@ FLAC__bool resize_buffers_(FLAC__StreamEncoder *encoder, unsigned new_blocksize)
 	 */
 
 	for(i = 0; ok && i < encoder->protected_->channels; i++) {
-		ok = ok && FLAC__memory_alloc_aligned_int32_array(new_blocksize+4+OVERREAD_, &encoder->private_->integer_signal_unaligned[i], &encoder->private_->integer_signal[i]);
-		memset(encoder->private_->integer_signal[i], 0, sizeof(FLAC__int32)*4);
-		encoder->private_->integer_signal[i] += 4;
+		if(grow || 0 == encoder->private_->integer_signal_unaligned[i]) {
+			ok = ok && FLAC__memory_alloc_aligned_int32_array(capacity+4+OVERREAD_, &encoder->private_->integer_signal_unaligned[i], &encoder->private_->integer_signal[i]);
+			if(ok) {
+				memset(encoder->private_->integer_signal[i], 0, sizeof(FLAC__int32)*4);
+				encoder->private_->integer_signal[i] += 4;
+			}
+		}
 #ifndef FLAC__INTEGER_ONLY_LIBRARY
 #if 0 /* @@@ currently unused */
 		if(encoder->protected_->max_lpc_order > 0)
@@ -2284,9 +2624,13 @@ FLAC__bool resize_buffers_(FLAC__StreamEncoder *encoder, unsigned new_blocksize)
 #endif
 	}
 	for(i = 0; ok && i < 2; i++) {
-		ok = ok && FLAC__memory_alloc_aligned_int32_array(new_blocksize+4+OVERREAD_, &encoder->private_->integer_signal_mid_side_unaligned[i], &encoder->private_->integer_signal_mid_side[i]);
-		memset(encoder->private_->integer_signal_mid_side[i], 0, sizeof(FLAC__int32)*4);
-		encoder->private_->integer_signal_mid_side[i] += 4;
+		if(grow || 0 == encoder->private_->integer_signal_mid_side_unaligned[i]) {
+			ok = ok && FLAC__memory_alloc_aligned_int32_array(capacity+4+OVERREAD_, &encoder->private_->integer_signal_mid_side_unaligned[i], &encoder->private_->integer_signal_mid_side[i]);
+			if(ok) {
+				memset(encoder->private_->integer_signal_mid_side[i], 0, sizeof(FLAC__int32)*4);
+				encoder->private_->integer_signal_mid_side[i] += 4;
+			}
+		}
 #ifndef FLAC__INTEGER_ONLY_LIBRARY
 #if 0 /* @@@ currently unused */
 		if(encoder->protected_->max_lpc_order > 0)
@@ -2296,30 +2640,38 @@ FLAC__bool resize_buffers_(FLAC__StreamEncoder *encoder, unsigned new_blocksize)
 	}
 #ifndef FLAC__INTEGER_ONLY_LIBRARY
 	if(ok && encoder->protected_->max_lpc_order > 0) {
-		for(i = 0; ok && i < encoder->protected_->num_apodizations; i++)
-			ok = ok && FLAC__memory_alloc_aligned_real_array(new_blocksize, &encoder->private_->window_unaligned[i], &encoder->private_->window[i]);
-		ok = ok && FLAC__memory_alloc_aligned_real_array(new_blocksize, &encoder->private_->windowed_signal_unaligned, &encoder->private_->windowed_signal);
+		for(i = 0; ok && i < encoder->protected_->num_apodizations; i++) {
+			if(grow || 0 == encoder->private_->window_unaligned[i])
+				ok = ok && FLAC__memory_alloc_aligned_real_array(capacity, &encoder->private_->window_unaligned[i], &encoder->private_->window[i]);
+		}
+		if(grow || 0 == encoder->private_->windowed_signal_unaligned)
+			ok = ok && FLAC__memory_alloc_aligned_real_array(capacity, &encoder->private_->windowed_signal_unaligned, &encoder->private_->windowed_signal);
 	}
 #endif
 	for(channel = 0; ok && channel < encoder->protected_->channels; channel++) {
 		for(i = 0; ok && i < 2; i++) {
-			ok = ok && FLAC__memory_alloc_aligned_int32_array(new_blocksize, &encoder->private_->residual_workspace_unaligned[channel][i], &encoder->private_->residual_workspace[channel][i]);
+			if(grow || 0 == encoder->private_->residual_workspace_unaligned[channel][i])
+				ok = ok && FLAC__memory_alloc_aligned_int32_array(capacity, &encoder->private_->residual_workspace_unaligned[channel][i], &encoder->private_->residual_workspace[channel][i]);
 		}
 	}
 	for(channel = 0; ok && channel < 2; channel++) {
 		for(i = 0; ok && i < 2; i++) {
-			ok = ok && FLAC__memory_alloc_aligned_int32_array(new_blocksize, &encoder->private_->residual_workspace_mid_side_unaligned[channel][i], &encoder->private_->residual_workspace_mid_side[channel][i]);
+			if(grow || 0 == encoder->private_->residual_workspace_mid_side_unaligned[channel][i])
+				ok = ok && FLAC__memory_alloc_aligned_int32_array(capacity, &encoder->private_->residual_workspace_mid_side_unaligned[channel][i], &encoder->private_->residual_workspace_mid_side[channel][i]);
 		}
 	}
 	/* the *2 is an approximation to the series 1 + 1/2 + 1/4 + ... that sums tree occupies in a flat array */
 	/*@@@ new_blocksize*2 is too pessimistic, but to fix, we need smarter logic because a smaller new_blocksize can actually increase the # of partitions; would require moving this out into a separate function, then checking its capacity against the need of the current blocksize&min/max_partition_order (and maybe predictor order) */
-	ok = ok && FLAC__memory_alloc_aligned_uint64_array(new_blocksize * 2, &encoder->private_->abs_residual_partition_sums_unaligned, &encoder->private_->abs_residual_partition_sums);
-	if(encoder->protected_->do_escape_coding)
-		ok = ok && FLAC__memory_alloc_aligned_unsigned_array(new_blocksize * 2, &encoder->private_->raw_bits_per_partition_unaligned, &encoder->private_->raw_bits_per_partition);
-
-	/* now adjust the windows if the blocksize has changed */
+	if(grow || 0 == encoder->private_->abs_residual_partition_sums_unaligned)
+		ok = ok && FLAC__memory_alloc_aligned_uint64_array(capacity * 2, &encoder->private_->abs_residual_partition_sums_unaligned, &encoder->private_->abs_residual_partition_sums);
+	if(encoder->protected_->do_escape_coding && (grow || 0 == encoder->private_->raw_bits_per_partition_unaligned))
+		ok = ok && FLAC__memory_alloc_aligned_unsigned_array(capacity * 2, &encoder->private_->raw_bits_per_partition_unaligned, &encoder->private_->raw_bits_per_partition);
+	if(encoder->private_->verify.check_subframes && (grow || 0 == encoder->private_->verify.restored_signal_unaligned))
+		ok = ok && FLAC__memory_alloc_aligned_int32_array(capacity, &encoder->private_->verify.restored_signal_unaligned, &encoder->private_->verify.restored_signal);
+
+	/* now compute the windows; even at the same blocksize, a previous stream may have used other apodizations */
 #ifndef FLAC__INTEGER_ONLY_LIBRARY
-	if(ok && new_blocksize != encoder->private_->input_capacity && encoder->protected_->max_lpc_order > 0) {
+	if(ok && encoder->protected_->max_lpc_order > 0) {
 		for(i = 0; ok && i < encoder->protected_->num_apodizations; i++) {
 			switch(encoder->protected_->apodizations[i].type) {
 				case FLAC__APODIZATION_BARTLETT:
@@ -2378,7 +2730,7 @@ FLAC__bool resize_buffers_(FLAC__StreamEncoder *encoder, unsigned new_blocksize)
 #endif
 
 	if(ok)
-		encoder->private_->input_capacity = new_blocksize;
+		encoder->private_->input_capacity = capacity;
 	else
 		encoder->protected_->state = FLAC__STREAM_ENCODER_MEMORY_ALLOCATION_ERROR;
 
@@ -2403,6 +2755,10 @@ FLAC__bool write_bitbuffer_(FLAC__StreamEncoder *encoder, unsigned samples, FLAC
 		if(encoder->private_->verify.state_hint == ENCODER_IN_MAGIC) {
 			encoder->private_->verify.needs_magic_hack = true;
 		}
+		else if(samples > 0 && !verify_decodes_frame_(encoder)) {
+			/* process_subframes_() checked this one */
+			dequeue_from_verify_fifo_(&encoder->private_->verify.input_fifo, encoder->protected_->channels, samples);
+		}
 		else {
 			if(!FLAC__stream_decoder_process_single(encoder->private_->verify.decoder)) {
 				FLAC__bitwriter_release_buffer(encoder->private_->frame);
@@ -2634,6 +2990,10 @@ void update_metadata_(const FLAC__StreamEncoder *encoder)
 	if(0 != encoder->private_->seek_table && encoder->private_->seek_table->num_points > 0 && encoder->protected_->seektable_offset > 0) {
 		unsigned i;
 
+		/* template points past the last frame were never filled in */
+		for(i = encoder->private_->first_seekpoint_to_check; i < encoder->private_->seek_table->num_points; i++)
+			encoder->private_->seek_table->points[i].sample_number = FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER;
+
 		FLAC__format_seektable_sort(encoder->private_->seek_table);
 
 		FLAC__ASSERT(FLAC__format_seektable_is_legal(encoder->private_->seek_table));
@@ -2815,6 +3175,10 @@ void update_ogg_metadata_(FLAC__StreamEncoder *encoder)
 		unsigned i;
 		FLAC__byte *p;
 
+		/* template points past the last frame were never filled in */
+		for(i = encoder->private_->first_seekpoint_to_check; i < encoder->private_->seek_table->num_points; i++)
+			encoder->private_->seek_table->points[i].sample_number = FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER;
+
 		FLAC__format_seektable_sort(encoder->private_->seek_table);
 
 		FLAC__ASSERT(FLAC__format_seektable_is_legal(encoder->private_->seek_table));
@@ -2869,7 +3233,6 @@ void update_ogg_metadata_(FLAC__StreamEncoder *encoder)
 
 FLAC__bool process_frame_(FLAC__StreamEncoder *encoder, FLAC__bool is_fractional_block, FLAC__bool is_last_block)
 {
-	FLAC__uint16 crc;
 	FLAC__ASSERT(encoder->protected_->state == FLAC__STREAM_ENCODER_OK);
 
 	/*
@@ -2880,6 +3243,56 @@ FLAC__bool process_frame_(FLAC__StreamEncoder *encoder, FLAC__bool is_fractional
 		return false;
 	}
 
+#if FLAC__HAS_THREADS
+	/*
+	 * Hand the block to a worker; the frame gets written once it and all
+	 * frames before it are encoded
+	 */
+	if(0 != encoder->private_->threads) {
+		if(!queue_frame_(encoder, is_fractional_block, is_last_block)) {
+			/* the above function sets the state for us in case of an error */
+			return false;
+		}
+		encoder->private_->current_sample_number = 0;
+		return true;
+	}
+#endif
+
+	if(!encode_frame_(encoder, is_fractional_block)) {
+		/* the above function sets the state for us in case of an error */
+		return false;
+	}
+
+	/*
+	 * Write it
+	 */
+	if(!write_bitbuffer_(encoder, encoder->protected_->blocksize, is_last_block)) {
+		/* the above function sets the state for us in case of an error */
+		return false;
+	}
+
+	/*
+	 * Get ready for the next frame
+	 */
+	encoder->private_->current_sample_number = 0;
+	encoder->private_->current_frame_number++;
+	encoder->private_->streaminfo.data.stream_info.total_samples += (FLAC__uint64)encoder->protected_->blocksize;
+
+	return true;
+}
+
+/*
+ * Encodes the signal in integer_signal[] (and integer_signal_mid_side[])
+ * into the frame bitbuffer, as frame number current_frame_number.  Only
+ * touches the encoder's workspaces, so it is also run by the worker
+ * threads on their shadow encoders.
+ */
+FLAC__bool encode_frame_(FLAC__StreamEncoder *encoder, FLAC__bool is_fractional_block)
+{
+	const FLAC__byte *buffer;
+	size_t bytes;
+	FLAC__uint16 crc;
+
 	/*
 	 * Process the frame header and subframes into the frame bitbuffer
 	 */
@@ -2900,32 +3313,272 @@ FLAC__bool process_frame_(FLAC__StreamEncoder *encoder, FLAC__bool is_fractional
 	 * CRC-16 the whole thing
 	 */
 	FLAC__ASSERT(FLAC__bitwriter_is_byte_aligned(encoder->private_->frame));
-	if(
-		!FLAC__bitwriter_get_write_crc16(encoder->private_->frame, &crc) ||
-		!FLAC__bitwriter_write_raw_uint32(encoder->private_->frame, crc, FLAC__FRAME_FOOTER_CRC_LEN)
-	) {
+	if(!FLAC__bitwriter_get_buffer(encoder->private_->frame, &buffer, &bytes)) {
+		encoder->protected_->state = FLAC__STREAM_ENCODER_MEMORY_ALLOCATION_ERROR;
+		return false;
+	}
+	crc = (FLAC__uint16)encoder->private_->local_crc16_update_block(buffer, (unsigned)bytes, 0);
+	FLAC__bitwriter_release_buffer(encoder->private_->frame);
+	if(!FLAC__bitwriter_write_raw_uint32(encoder->private_->frame, crc, FLAC__FRAME_FOOTER_CRC_LEN)) {
 		encoder->protected_->state = FLAC__STREAM_ENCODER_MEMORY_ALLOCATION_ERROR;
 		return false;
 	}
 
-	/*
-	 * Write it
-	 */
-	if(!write_bitbuffer_(encoder, encoder->protected_->blocksize, is_last_block)) {
+	return true;
+}
+
+#if FLAC__HAS_THREADS
+/*
+ * Creates a shadow encoder for a worker: a copy of the encoder's settings
+ * with its own signal buffers, workspaces and frame bitbuffer.  It never
+ * calls any callbacks; it only ever runs encode_frame_().
+ */
+static FLAC__StreamEncoder *new_worker_encoder_(const FLAC__StreamEncoder *encoder)
+{
+	FLAC__StreamEncoder *worker = FLAC__stream_encoder_new();
+
+	if(0 == worker)
+		return 0;
+
+	*worker->protected_ = *encoder->protected_;
+	worker->protected_->verify = false;
+	worker->protected_->do_md5 = false;
+	worker->protected_->metadata = 0;
+	worker->protected_->num_metadata_blocks = 0;
+	worker->protected_->num_threads = 1;
+	worker->protected_->state = FLAC__STREAM_ENCODER_OK;
+
+	worker->private_->loose_mid_side_stereo_frames = encoder->private_->loose_mid_side_stereo_frames;
+	worker->private_->cpuinfo = encoder->private_->cpuinfo;
+	worker->private_->local_fixed_compute_best_predictor = encoder->private_->local_fixed_compute_best_predictor;
+#ifndef FLAC__INTEGER_ONLY_LIBRARY
+	worker->private_->local_lpc_window_data = encoder->private_->local_lpc_window_data;
+	worker->private_->local_lpc_compute_autocorrelation = encoder->private_->local_lpc_compute_autocorrelation;
+	worker->private_->local_lpc_compute_residual_from_qlp_coefficients = encoder->private_->local_lpc_compute_residual_from_qlp_coefficients;
+	worker->private_->local_lpc_compute_residual_from_qlp_coefficients_64bit = encoder->private_->local_lpc_compute_residual_from_qlp_coefficients_64bit;
+	worker->private_->local_lpc_compute_residual_from_qlp_coefficients_16bit = encoder->private_->local_lpc_compute_residual_from_qlp_coefficients_16bit;
+#endif
+	worker->private_->local_lpc_restore_signal = encoder->private_->local_lpc_restore_signal;
+	worker->private_->local_lpc_restore_signal_64bit = encoder->private_->local_lpc_restore_signal_64bit;
+	worker->private_->local_crc16_update_block = encoder->private_->local_crc16_update_block;
+	worker->private_->local_precompute_partition_info_sums = encoder->private_->local_precompute_partition_info_sums;
+	worker->private_->use_wide_by_block = encoder->private_->use_wide_by_block;
+	worker->private_->use_wide_by_partition = encoder->private_->use_wide_by_partition;
+	worker->private_->use_wide_by_order = encoder->private_->use_wide_by_order;
+	worker->private_->disable_constant_subframes = encoder->private_->disable_constant_subframes;
+	worker->private_->disable_fixed_subframes = encoder->private_->disable_fixed_subframes;
+	worker->private_->disable_verbatim_subframes = encoder->private_->disable_verbatim_subframes;
+	worker->private_->verify.check_subframes = encoder->private_->verify.check_subframes;
+	worker->private_->verify.corrupt_frame = encoder->private_->verify.corrupt_frame;
+	worker->private_->streaminfo.data.stream_info.max_blocksize = encoder->protected_->blocksize; /* for check_subframe_(); the parent's STREAMINFO isn't set up yet */
+
+	if(!resize_buffers_(worker, encoder->protected_->blocksize) || !FLAC__bitwriter_init(worker->private_->frame)) {
+		free_(worker);
+		worker->protected_->state = FLAC__STREAM_ENCODER_UNINITIALIZED;
+		FLAC__stream_encoder_delete(worker);
+		return 0;
+	}
+
+	return worker;
+}
+
+static void delete_worker_encoder_(FLAC__StreamEncoder *worker)
+{
+	free_(worker);
+	/* keeps FLAC__stream_encoder_delete() from finishing the (never initialized) stream */
+	worker->protected_->state = FLAC__STREAM_ENCODER_UNINITIALIZED;
+	FLAC__stream_encoder_delete(worker);
+}
+
+FLAC__bool init_threads_(FLAC__StreamEncoder *encoder)
+{
+	encoder_thread_pool *threads;
+	const unsigned num_threads = encoder->protected_->num_threads;
+
+	FLAC__ASSERT(num_threads > 1);
+	FLAC__ASSERT(0 == encoder->private_->threads);
+
+	threads = (encoder_thread_pool*)calloc(1, sizeof(encoder_thread_pool));
+	if(0 == threads) {
+		encoder->protected_->state = FLAC__STREAM_ENCODER_MEMORY_ALLOCATION_ERROR;
+		return false;
+	}
+	threads->workers = (encoder_worker*)safe_calloc_(num_threads, sizeof(encoder_worker));
+	if(0 == threads->workers) {
+		free(threads);
+		encoder->protected_->state = FLAC__STREAM_ENCODER_MEMORY_ALLOCATION_ERROR;
+		return false;
+	}
+	pthread_mutex_init(&threads->mutex, 0);
+	pthread_cond_init(&threads->done, 0);
+	encoder->private_->threads = threads;
+
+	/* num_workers only counts fully started workers, so free_threads_() can clean up after a partial start */
+	while(threads->num_workers < num_threads) {
+		encoder_worker *worker = &threads->workers[threads->num_workers];
+
+		worker->encoder = new_worker_encoder_(encoder);
+		if(0 == worker->encoder) {
+			encoder->protected_->state = FLAC__STREAM_ENCODER_MEMORY_ALLOCATION_ERROR;
+			return false;
+		}
+		worker->pool = threads;
+		worker->state = WORKER_IDLE;
+		pthread_cond_init(&worker->wakeup, 0);
+		if(0 != pthread_create(&worker->thread, 0, worker_thread_, worker)) {
+			pthread_cond_destroy(&worker->wakeup);
+			delete_worker_encoder_(worker->encoder);
+			worker->encoder = 0;
+			encoder->protected_->state = FLAC__STREAM_ENCODER_MEMORY_ALLOCATION_ERROR;
+			return false;
+		}
+		threads->num_workers++;
+	}
+
+	return true;
+}
+
+void free_threads_(FLAC__StreamEncoder *encoder)
+{
+	encoder_thread_pool *threads = encoder->private_->threads;
+	unsigned i;
+
+	if(0 == threads)
+		return;
+
+	pthread_mutex_lock(&threads->mutex);
+	threads->quit = true;
+	for(i = 0; i < threads->num_workers; i++)
+		pthread_cond_signal(&threads->workers[i].wakeup);
+	pthread_mutex_unlock(&threads->mutex);
+
+	for(i = 0; i < threads->num_workers; i++) {
+		pthread_join(threads->workers[i].thread, 0);
+		pthread_cond_destroy(&threads->workers[i].wakeup);
+		delete_worker_encoder_(threads->workers[i].encoder);
+	}
+
+	pthread_cond_destroy(&threads->done);
+	pthread_mutex_destroy(&threads->mutex);
+	free(threads->workers);
+	free(threads);
+	encoder->private_->threads = 0;
+}
+
+void *worker_thread_(void *arg)
+{
+	encoder_worker *worker = (encoder_worker*)arg;
+	encoder_thread_pool *threads = worker->pool;
+
+	pthread_mutex_lock(&threads->mutex);
+	for(;;) {
+		while(worker->state != WORKER_QUEUED && !threads->quit)
+			pthread_cond_wait(&worker->wakeup, &threads->mutex);
+		if(threads->quit)
+			break;
+		pthread_mutex_unlock(&threads->mutex);
+
+		worker->ok = encode_frame_(worker->encoder, worker->is_fractional_block);
+
+		pthread_mutex_lock(&threads->mutex);
+		worker->state = WORKER_DONE;
+		pthread_cond_signal(&threads->done);
+	}
+	pthread_mutex_unlock(&threads->mutex);
+
+	return 0;
+}
+
+FLAC__bool queue_frame_(FLAC__StreamEncoder *encoder, FLAC__bool is_fractional_block, FLAC__bool is_last_block)
+{
+	encoder_thread_pool *threads = encoder->private_->threads;
+	encoder_worker *worker;
+	const unsigned blocksize = encoder->protected_->blocksize;
+	unsigned channel;
+
+	/* all workers busy: the next one holds the oldest frame, which has to go first */
+	if(threads->frames_pending == threads->num_workers && !write_next_frame_(encoder))
+		return false;
+
+	worker = &threads->workers[threads->next_worker];
+	FLAC__ASSERT(worker->state == WORKER_IDLE);
+
+	for(channel = 0; channel < encoder->protected_->channels; channel++)
+		memcpy(worker->encoder->private_->integer_signal[channel], encoder->private_->integer_signal[channel], sizeof(FLAC__int32) * blocksize);
+	if(encoder->protected_->do_mid_side_stereo) {
+		FLAC__ASSERT(encoder->protected_->channels == 2);
+		for(channel = 0; channel < 2; channel++)
+			memcpy(worker->encoder->private_->integer_signal_mid_side[channel], encoder->private_->integer_signal_mid_side[channel], sizeof(FLAC__int32) * blocksize);
+	}
+	worker->encoder->protected_->blocksize = blocksize;
+	worker->encoder->private_->current_frame_number = threads->next_frame_number++;
+	worker->is_fractional_block = is_fractional_block;
+	worker->is_last_block = is_last_block;
+
+	pthread_mutex_lock(&threads->mutex);
+	worker->state = WORKER_QUEUED;
+	pthread_cond_signal(&worker->wakeup);
+	pthread_mutex_unlock(&threads->mutex);
+
+	threads->next_worker = (threads->next_worker + 1) % threads->num_workers;
+	threads->frames_pending++;
+
+	return true;
+}
+
+FLAC__bool write_next_frame_(FLAC__StreamEncoder *encoder)
+{
+	encoder_thread_pool *threads = encoder->private_->threads;
+	encoder_worker *worker = &threads->workers[threads->oldest_worker];
+	FLAC__BitWriter *frame;
+	unsigned blocksize;
+
+	FLAC__ASSERT(threads->frames_pending > 0);
+
+	pthread_mutex_lock(&threads->mutex);
+	while(worker->state != WORKER_DONE)
+		pthread_cond_wait(&threads->done, &threads->mutex);
+	worker->state = WORKER_IDLE;
+	pthread_mutex_unlock(&threads->mutex);
+
+	threads->oldest_worker = (threads->oldest_worker + 1) % threads->num_workers;
+	threads->frames_pending--;
+
+	if(!worker->ok) {
+		encoder->protected_->state = worker->encoder->protected_->state;
+		encoder->private_->verify.error_stats = worker->encoder->private_->verify.error_stats;
+		return false;
+	}
+
+	FLAC__ASSERT(worker->encoder->private_->current_frame_number == encoder->private_->current_frame_number);
+
+	/* swap bitbuffers instead of copying the frame; ours is always empty between frames */
+	frame = encoder->private_->frame;
+	encoder->private_->frame = worker->encoder->private_->frame;
+	worker->encoder->private_->frame = frame;
+
+	blocksize = worker->encoder->protected_->blocksize;
+	if(!write_bitbuffer_(encoder, blocksize, worker->is_last_block)) {
 		/* the above function sets the state for us in case of an error */
 		return false;
 	}
 
-	/*
-	 * Get ready for the next frame
-	 */
-	encoder->private_->current_sample_number = 0;
 	encoder->private_->current_frame_number++;
-	encoder->private_->streaminfo.data.stream_info.total_samples += (FLAC__uint64)encoder->protected_->blocksize;
+	encoder->private_->streaminfo.data.stream_info.total_samples += (FLAC__uint64)blocksize;
 
 	return true;
 }
 
+FLAC__bool write_pending_frames_(FLAC__StreamEncoder *encoder)
+{
+	while(encoder->private_->threads->frames_pending > 0) {
+		if(!write_next_frame_(encoder))
+			return false;
+	}
+	return true;
+}
+#endif
+
 FLAC__bool process_subframes_(FLAC__StreamEncoder *encoder, FLAC__bool is_fractional_block)
 {
 	FLAC__FrameHeader frame_header;
@@ -3056,6 +3709,7 @@ FLAC__bool process_subframes_(FLAC__StreamEncoder *encoder, FLAC__bool is_fracti
 	if(do_mid_side) {
 		unsigned left_bps = 0, right_bps = 0; /* initialized only to prevent superfluous compiler warning */
 		FLAC__Subframe *left_subframe = 0, *right_subframe = 0; /* initialized only to prevent superfluous compiler warning */
+		const FLAC__int32 *left_signal = 0, *right_signal = 0; /* initialized only to prevent superfluous compiler warning */
 		FLAC__ChannelAssignment channel_assignment;
 
 		FLAC__ASSERT(encoder->protected_->channels == 2);
@@ -3122,23 +3776,39 @@ FLAC__bool process_subframes_(FLAC__StreamEncoder *encoder, FLAC__bool is_fracti
 			case FLAC__CHANNEL_ASSIGNMENT_INDEPENDENT:
 				left_bps  = encoder->private_->subframe_bps         [0];
 				right_bps = encoder->private_->subframe_bps         [1];
+				left_signal  = encoder->private_->integer_signal         [0];
+				right_signal = encoder->private_->integer_signal         [1];
 				break;
 			case FLAC__CHANNEL_ASSIGNMENT_LEFT_SIDE:
 				left_bps  = encoder->private_->subframe_bps         [0];
 				right_bps = encoder->private_->subframe_bps_mid_side[1];
+				left_signal  = encoder->private_->integer_signal         [0];
+				right_signal = encoder->private_->integer_signal_mid_side[1];
 				break;
 			case FLAC__CHANNEL_ASSIGNMENT_RIGHT_SIDE:
 				left_bps  = encoder->private_->subframe_bps_mid_side[1];
 				right_bps = encoder->private_->subframe_bps         [1];
+				left_signal  = encoder->private_->integer_signal_mid_side[1];
+				right_signal = encoder->private_->integer_signal         [1];
 				break;
 			case FLAC__CHANNEL_ASSIGNMENT_MID_SIDE:
 				left_bps  = encoder->private_->subframe_bps_mid_side[0];
 				right_bps = encoder->private_->subframe_bps_mid_side[1];
+				left_signal  = encoder->private_->integer_signal_mid_side[0];
+				right_signal = encoder->private_->integer_signal_mid_side[1];
 				break;
 			default:
 				FLAC__ASSERT(0);
 		}
 
+		/* note that check_subframe_ sets the state for us in case of a mismatch */
+		if(encoder->private_->verify.check_subframes && !verify_decodes_frame_(encoder)) {
+			if(!check_subframe_(encoder, left_subframe, left_signal, frame_header.blocksize, left_bps, 0))
+				return false;
+			if(!check_subframe_(encoder, right_subframe, right_signal, frame_header.blocksize, right_bps, 1))
+				return false;
+		}
+
 		/* note that encoder_add_subframe_ sets the state for us in case of an error */
 		if(!add_subframe_(encoder, frame_header.blocksize, left_bps , left_subframe , encoder->private_->frame))
 			return false;
@@ -3152,6 +3822,12 @@ FLAC__bool process_subframes_(FLAC__StreamEncoder *encoder, FLAC__bool is_fracti
 		}
 
 		for(channel = 0; channel < encoder->protected_->channels; channel++) {
+			if(encoder->private_->verify.check_subframes && !verify_decodes_frame_(encoder)) {
+				if(!check_subframe_(encoder, &encoder->private_->subframe_workspace[channel][encoder->private_->best_subframe[channel]], encoder->private_->integer_signal[channel], frame_header.blocksize, encoder->private_->subframe_bps[channel], channel)) {
+					/* the above function sets the state for us in case of a mismatch */
+					return false;
+				}
+			}
 			if(!add_subframe_(encoder, frame_header.blocksize, encoder->private_->subframe_bps[channel], &encoder->private_->subframe_workspace[channel][encoder->private_->best_subframe[channel]], encoder->private_->frame)) {
 				/* the above function sets the state for us in case of an error */
 				return false;
@@ -3195,6 +3871,9 @@ FLAC__bool process_subframe_(
 	FLAC__double lpc_error[FLAC__MAX_LPC_ORDER];
 	unsigned min_lpc_order, max_lpc_order, lpc_order;
 	unsigned min_qlp_coeff_precision, max_qlp_coeff_precision, qlp_coeff_precision;
+	FLAC__double lpc_estimate_limit, best_window_error;
+	unsigned lpc_overhead_bits_per_order, lpc_misses, previous_candidate_bits;
+	FLAC__bool window_improved, order_improved;
 #endif
 	unsigned min_fixed_order, max_fixed_order, guess_fixed_order, fixed_order;
 	unsigned rice_parameter;
@@ -3257,10 +3936,14 @@ FLAC__bool process_subframe_(
 #ifndef FLAC__INTEGER_ONLY_LIBRARY
 					if(fixed_residual_bits_per_sample[fixed_order] >= (FLAC__float)subframe_bps)
 						continue; /* don't even try */
+					if(encoder->protected_->do_early_termination && fixed_residual_bits_per_sample[fixed_order] > fixed_residual_bits_per_sample[guess_fixed_order] + 0.5)
+						continue; /* estimated at over half a bit per sample worse than the best order */
 					rice_parameter = (fixed_residual_bits_per_sample[fixed_order] > 0.0)? (unsigned)(fixed_residual_bits_per_sample[fixed_order]+0.5) : 0; /* 0.5 is for rounding */
 #else
 					if(FLAC__fixedpoint_trunc(fixed_residual_bits_per_sample[fixed_order]) >= (int)subframe_bps)
 						continue; /* don't even try */
+					if(encoder->protected_->do_early_termination && fixed_residual_bits_per_sample[fixed_order] > fixed_residual_bits_per_sample[guess_fixed_order] + FLAC__FP_ONE_HALF)
+						continue; /* estimated at over half a bit per sample worse than the best order */
 					rice_parameter = (fixed_residual_bits_per_sample[fixed_order] > FLAC__FP_ZERO)? (unsigned)FLAC__fixedpoint_trunc(fixed_residual_bits_per_sample[fixed_order]+FLAC__FP_ONE_HALF) : 0; /* 0.5 is for rounding */
 #endif
 					rice_parameter++; /* to account for the signed->unsigned conversion during rice coding */
@@ -3305,12 +3988,23 @@ FLAC__bool process_subframe_(
 					max_lpc_order = encoder->protected_->max_lpc_order;
 				if(max_lpc_order > 0) {
 					unsigned a;
+					lpc_overhead_bits_per_order = subframe_bps + (encoder->protected_->do_qlp_coeff_prec_search? FLAC__MIN_QLP_COEFF_PRECISION : encoder->protected_->qlp_coeff_precision);
+					best_window_error = 1e32;
 					for (a = 0; a < encoder->protected_->num_apodizations; a++) {
-						FLAC__lpc_window_data(integer_signal, encoder->private_->window[a], encoder->private_->windowed_signal, frame_header->blocksize);
+						encoder->private_->local_lpc_window_data(integer_signal, encoder->private_->window[a], encoder->private_->windowed_signal, frame_header->blocksize);
 						encoder->private_->local_lpc_compute_autocorrelation(encoder->private_->windowed_signal, frame_header->blocksize, max_lpc_order+1, autoc);
 						/* if autoc[0] == 0.0, the signal is constant and we usually won't get here, but it can happen */
 						if(autoc[0] != 0.0) {
 							FLAC__lpc_compute_lp_coefficients(autoc, &max_lpc_order, encoder->private_->lp_coeff, lpc_error);
+							if(encoder->protected_->do_early_termination) {
+								/* relative to the signal's energy the prediction error is comparable
+								 * between windows; skip a window that predicts no better than an
+								 * earlier one at its highest order */
+								const FLAC__double window_error = lpc_error[max_lpc_order-1] / autoc[0];
+								if(window_error >= best_window_error)
+									continue;
+								best_window_error = window_error;
+							}
 							if(encoder->protected_->do_exhaustive_model_search) {
 								min_lpc_order = 1;
 							}
@@ -3330,10 +4024,24 @@ FLAC__bool process_subframe_(
 							}
 							if(max_lpc_order >= frame_header->blocksize)
 								max_lpc_order = frame_header->blocksize - 1;
+							lpc_estimate_limit = 1e32;
+							if(encoder->protected_->do_early_termination && min_lpc_order < max_lpc_order) {
+								/* only try the orders whose estimated size is within 1/16 of the smallest */
+								for(lpc_order = min_lpc_order; lpc_order <= max_lpc_order; lpc_order++) {
+									const FLAC__double estimate = estimate_lpc_bits_(lpc_error, lpc_order, frame_header->blocksize, lpc_overhead_bits_per_order);
+									if(estimate < lpc_estimate_limit)
+										lpc_estimate_limit = estimate;
+								}
+								lpc_estimate_limit += lpc_estimate_limit / 16.0;
+							}
+							lpc_misses = 0;
+							window_improved = false;
 							for(lpc_order = min_lpc_order; lpc_order <= max_lpc_order; lpc_order++) {
 								lpc_residual_bits_per_sample = FLAC__lpc_compute_expected_bits_per_residual_sample(lpc_error[lpc_order-1], frame_header->blocksize-lpc_order);
 								if(lpc_residual_bits_per_sample >= (FLAC__double)subframe_bps)
 									continue; /* don't even try */
+								if(lpc_estimate_limit < 1e32 && estimate_lpc_bits_(lpc_error, lpc_order, frame_header->blocksize, lpc_overhead_bits_per_order) > lpc_estimate_limit)
+									continue; /* early termination: not worth trying */
 								rice_parameter = (lpc_residual_bits_per_sample > 0.0)? (unsigned)(lpc_residual_bits_per_sample+0.5) : 0; /* 0.5 is for rounding */
 								rice_parameter++; /* to account for the signed->unsigned conversion during rice coding */
 								if(rice_parameter >= rice_parameter_limit) {
@@ -3355,6 +4063,8 @@ FLAC__bool process_subframe_(
 								else {
 									min_qlp_coeff_precision = max_qlp_coeff_precision = encoder->protected_->qlp_coeff_precision;
 								}
+								previous_candidate_bits = UINT_MAX;
+								order_improved = false;
 								for(qlp_coeff_precision = min_qlp_coeff_precision; qlp_coeff_precision <= max_qlp_coeff_precision; qlp_coeff_precision++) {
 									_candidate_bits =
 										evaluate_lpc_subframe_(
@@ -3381,8 +4091,24 @@ FLAC__bool process_subframe_(
 										if(_candidate_bits < _best_bits) {
 											_best_subframe = !_best_subframe;
 											_best_bits = _candidate_bits;
+											order_improved = true;
 										}
+										/* the size is usually convex in the precision; stop once it grows */
+										if(encoder->protected_->do_early_termination) {
+											if(_candidate_bits >= previous_candidate_bits)
+												break;
+											previous_candidate_bits = _candidate_bits;
+										}
+									}
+								}
+								/* once this window has found a better subframe, give up after two orders in a row that don't improve on it */
+								if(encoder->protected_->do_early_termination) {
+									if(order_improved) {
+										window_improved = true;
+										lpc_misses = 0;
 									}
+									else if(window_improved && ++lpc_misses == 2)
+										break;
 								}
 							}
 						}
@@ -3645,6 +4371,17 @@ unsigned evaluate_lpc_subframe_(
 
 	return estimate;
 }
+
+/* the size of an LPC subframe predicted from the Levinson-Durbin error alone, as FLAC__lpc_compute_best_order() does */
+FLAC__double estimate_lpc_bits_(
+	const FLAC__double lpc_error[],
+	unsigned order,
+	unsigned blocksize,
+	unsigned overhead_bits_per_order
+)
+{
+	return FLAC__lpc_compute_expected_bits_per_residual_sample(lpc_error[order-1], blocksize-order) * (FLAC__double)(blocksize-order) + (FLAC__double)(order * overhead_bits_per_order);
+}
 #endif
 
 unsigned evaluate_verbatim_subframe_(
@@ -3697,7 +4434,7 @@ unsigned find_best_partition_order_(
 	max_partition_order = FLAC__format_get_max_rice_partition_order_from_blocksize_limited_max_and_predictor_order(max_partition_order, blocksize, predictor_order);
 	min_partition_order = min(min_partition_order, max_partition_order);
 
-	precompute_partition_info_sums_(residual, abs_residual_partition_sums, residual_samples, predictor_order, min_partition_order, max_partition_order, bps);
+	precompute_partition_info_sums_(private_, residual, abs_residual_partition_sums, residual_samples, predictor_order, min_partition_order, max_partition_order, bps);
 
 	if(do_escape_coding)
 		precompute_partition_info_escapes_(residual, raw_bits_per_partition, residual_samples, predictor_order, min_partition_order, max_partition_order);
@@ -3781,6 +4518,7 @@ extern void precompute_partition_info_sums_32bit_asm_ia32_(
 #endif
 
 void precompute_partition_info_sums_(
+	FLAC__StreamEncoderPrivate *private_,
 	const FLAC__int32 residual[],
 	FLAC__uint64 abs_residual_partition_sums[],
 	unsigned residual_samples,
@@ -3810,15 +4548,7 @@ void precompute_partition_info_sums_(
 		/* slightly pessimistic but still catches all common cases */
 		/* WATCHOUT: "+ bps" is an assumption that the average residual magnitude will not be more than "bps" bits */
 		if(FLAC__bitmath_ilog2(default_partition_samples) + bps < 32) {
-			FLAC__uint32 abs_residual_partition_sum;
-
-			for(partition = residual_sample = 0; partition < partitions; partition++) {
-				end += default_partition_samples;
-				abs_residual_partition_sum = 0;
-				for( ; residual_sample < end; residual_sample++)
-					abs_residual_partition_sum += abs(residual[residual_sample]); /* abs(INT_MIN) is undefined, but if the residual is INT_MIN we have bigger problems */
-				abs_residual_partition_sums[partition] = abs_residual_partition_sum;
-			}
+			private_->local_precompute_partition_info_sums(residual, abs_residual_partition_sums, residual_samples, predictor_order, max_partition_order);
 		}
 		else { /* have to pessimistically use 64 bits for accumulator */
 			FLAC__uint64 abs_residual_partition_sum;
@@ -3850,6 +4580,28 @@ void precompute_partition_info_sums_(
 	}
 }
 
+void precompute_partition_info_sums_32bit_(
+	const FLAC__int32 residual[],
+	FLAC__uint64 abs_residual_partition_sums[],
+	unsigned residual_samples,
+	unsigned predictor_order,
+	unsigned partition_order
+)
+{
+	const unsigned default_partition_samples = (residual_samples + predictor_order) >> partition_order;
+	const unsigned partitions = 1u << partition_order;
+	unsigned partition, residual_sample, end = (unsigned)(-(int)predictor_order);
+	FLAC__uint32 abs_residual_partition_sum;
+
+	for(partition = residual_sample = 0; partition < partitions; partition++) {
+		end += default_partition_samples;
+		abs_residual_partition_sum = 0;
+		for( ; residual_sample < end; residual_sample++)
+			abs_residual_partition_sum += abs(residual[residual_sample]); /* abs(INT_MIN) is undefined, but if the residual is INT_MIN we have bigger problems */
+		abs_residual_partition_sums[partition] = abs_residual_partition_sum;
+	}
+}
+
 void precompute_partition_info_escapes_(
 	const FLAC__int32 residual[],
 	unsigned raw_bits_per_partition[],
@@ -3949,6 +4701,34 @@ static FLaC__INLINE unsigned count_rice_bits_in_partition_(
 }
 #endif
 
+/* the # of significant bits in v, which must not be 0 */
+static FLaC__INLINE unsigned bit_length_(FLAC__uint64 v)
+{
+	FLAC__ASSERT(v > 0);
+#if defined __GNUC__ && (__GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4))
+	return 64 - (unsigned)__builtin_clzll(v);
+#else
+	return FLAC__bitmath_ilog2_wide(v) + 1;
+#endif
+}
+
+/*
+ * The smallest rice_parameter with partition_samples << rice_parameter >=
+ * mean.  The bit lengths of the two pin it down to one of two values, so
+ * this takes one compare where shifting up to it took a step per bit.
+ */
+static FLaC__INLINE unsigned rice_parameter_from_sum_(const FLAC__uint64 mean, const unsigned partition_samples)
+{
+	unsigned rice_parameter;
+
+	if(mean <= partition_samples)
+		return 0;
+	rice_parameter = bit_length_(mean) - bit_length_(partition_samples);
+	if(((FLAC__uint64)partition_samples << rice_parameter) < mean)
+		rice_parameter++;
+	return rice_parameter;
+}
+
 FLAC__bool set_partitioned_rice_(
 #ifdef EXACT_RICE_BITS_CALCULATION
 	const FLAC__int32 residual[],
@@ -4034,7 +4814,7 @@ FLAC__bool set_partitioned_rice_(
 	else {
 		unsigned partition, residual_sample;
 		unsigned partition_samples;
-		FLAC__uint64 mean, k;
+		FLAC__uint64 mean;
 		const unsigned partitions = 1u << partition_order;
 		for(partition = residual_sample = 0; partition < partitions; partition++) {
 			partition_samples = (residual_samples+predictor_order) >> partition_order;
@@ -4053,8 +4833,7 @@ FLAC__bool set_partitioned_rice_(
 			 * in the partition, so the actual mean is
 			 * mean/partition_samples
 			 */
-			for(rice_parameter = 0, k = partition_samples; k < mean; rice_parameter++, k <<= 1)
-				;
+			rice_parameter = rice_parameter_from_sum_(mean, partition_samples);
 			if(rice_parameter >= rice_parameter_limit) {
 #ifdef DEBUG_VERBOSE
 				fprintf(stderr, "clipping rice_parameter (%u -> %u) @6\n", rice_parameter, rice_parameter_limit - 1);
@@ -4138,6 +4917,80 @@ unsigned get_wasted_bits_(FLAC__int32 signal[], unsigned samples)
 	return shift;
 }
 
+/*
+ * The verify decoder only sees every verify_decode_interval-th frame (none
+ * if 0); for the rest process_subframes_() runs check_subframe_() instead.
+ */
+FLAC__bool verify_decodes_frame_(const FLAC__StreamEncoder *encoder)
+{
+	const unsigned interval = encoder->protected_->verify_decode_interval;
+	return interval != 0 && encoder->private_->current_frame_number % interval == 0;
+}
+
+/*
+ * Rebuilds a subframe from its warmup samples, predictor and residual the
+ * way the decoder would, and compares it against the signal it was
+ * computed from.  This catches bad predictors and residuals without
+ * parsing the bitstream, but unlike the verify decoder it does not check
+ * the residual coding itself.
+ */
+FLAC__bool check_subframe_(
+	FLAC__StreamEncoder *encoder,
+	const FLAC__Subframe *subframe,
+	const FLAC__int32 signal[],
+	unsigned blocksize,
+	unsigned subframe_bps,
+	unsigned channel
+)
+{
+	FLAC__int32 *restored = encoder->private_->verify.restored_signal;
+	unsigned i, order;
+
+	switch(subframe->type) {
+		case FLAC__SUBFRAME_TYPE_CONSTANT:
+			for(i = 0; i < blocksize; i++)
+				restored[i] = subframe->data.constant.value;
+			break;
+		case FLAC__SUBFRAME_TYPE_FIXED:
+			order = subframe->data.fixed.order;
+			memcpy(restored, subframe->data.fixed.warmup, sizeof(FLAC__int32) * order);
+			FLAC__fixed_restore_signal(subframe->data.fixed.residual, blocksize-order, order, restored+order);
+			break;
+		case FLAC__SUBFRAME_TYPE_LPC:
+			order = subframe->data.lpc.order;
+			memcpy(restored, subframe->data.lpc.warmup, sizeof(FLAC__int32) * order);
+			/* same choice of datapath as the decoder */
+			if(subframe_bps + subframe->data.lpc.qlp_coeff_precision + FLAC__bitmath_ilog2(order) <= 32)
+				encoder->private_->local_lpc_restore_signal(subframe->data.lpc.residual, blocksize-order, subframe->data.lpc.qlp_coeff, order, subframe->data.lpc.quantization_level, restored+order);
+			else
+				encoder->private_->local_lpc_restore_signal_64bit(subframe->data.lpc.residual, blocksize-order, subframe->data.lpc.qlp_coeff, order, subframe->data.lpc.quantization_level, restored+order);
+			break;
+		default:
+			/* a verbatim subframe is the signal itself */
+			return true;
+	}
+	if(encoder->private_->current_frame_number == encoder->private_->verify.corrupt_frame)
+		restored[blocksize-1] ^= 1;
+
+	if(0 != memcmp(restored, signal, sizeof(FLAC__int32) * blocksize)) {
+		for(i = 0; i < blocksize; i++) {
+			if(restored[i] != signal[i])
+				break;
+		}
+		FLAC__ASSERT(i < blocksize);
+		/* the blocksize has already shrunk for a short last frame; frames are numbered in STREAMINFO's */
+		encoder->private_->verify.error_stats.absolute_sample = (FLAC__uint64)encoder->private_->current_frame_number * encoder->private_->streaminfo.data.stream_info.max_blocksize + i;
+		encoder->private_->verify.error_stats.frame_number = encoder->private_->current_frame_number;
+		encoder->private_->verify.error_stats.channel = channel;
+		encoder->private_->verify.error_stats.sample = i;
+		encoder->private_->verify.error_stats.expected = signal[i];
+		encoder->private_->verify.error_stats.got = restored[i];
+		encoder->protected_->state = FLAC__STREAM_ENCODER_VERIFY_MISMATCH_IN_AUDIO_DATA;
+		return false;
+	}
+	return true;
+}
+
 void append_to_verify_fifo_(verify_input_fifo *fifo, const FLAC__int32 * const input[], unsigned input_offset, unsigned channels, unsigned wide_samples)
 {
 	unsigned channel;
@@ -4167,6 +5020,17 @@ void append_to_verify_fifo_interleaved_(verify_input_fifo *fifo, const FLAC__int
 	FLAC__ASSERT(fifo->tail <= fifo->size);
 }
 
+void dequeue_from_verify_fifo_(verify_input_fifo *fifo, unsigned channels, unsigned wide_samples)
+{
+	unsigned channel;
+
+	FLAC__ASSERT(fifo->tail >= wide_samples);
+
+	fifo->tail -= wide_samples;
+	for(channel = 0; channel < channels; channel++)
+		memmove(&fifo->data[channel][0], &fifo->data[channel][wide_samples], fifo->tail * sizeof(fifo->data[0][0]));
+}
+
 FLAC__StreamDecoderReadStatus verify_read_callback_(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data)
 {
 	FLAC__StreamEncoder *encoder = (FLAC__StreamEncoder*)client_data;
@@ -4234,10 +5098,8 @@ FLAC__StreamDecoderWriteStatus verify_write_callback_(const FLAC__StreamDecoder
 		}
 	}
 	/* dequeue the frame from the fifo */
-	encoder->private_->verify.input_fifo.tail -= blocksize;
+	dequeue_from_verify_fifo_(&encoder->private_->verify.input_fifo, channels, blocksize);
 	FLAC__ASSERT(encoder->private_->verify.input_fifo.tail <= OVERREAD_);
-	for(channel = 0; channel < channels; channel++)
-		memmove(&encoder->private_->verify.input_fifo.data[channel][0], &encoder->private_->verify.input_fifo.data[channel][blocksize], encoder->private_->verify.input_fifo.tail * sizeof(encoder->private_->verify.input_fifo.data[0][0]));
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
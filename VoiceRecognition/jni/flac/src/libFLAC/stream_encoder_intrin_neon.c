@@ -0,0 +1,85 @@
+/* libFLAC - Free Lossless Audio Codec library
+ * Copyright (C) 2011  Audioboo Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the Xiph.org Foundation nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "private/cpu.h"
+
+#ifndef FLAC__NO_ASM
+#if FLAC__HAS_NEONINTRIN
+
+#include "private/stream_encoder.h"
+
+#include <stdlib.h> /* for abs() */
+#include <arm_neon.h>
+
+static __inline__ __attribute__ ((__always_inline__)) FLAC__uint32 add_lanes_(uint32x4_t v)
+{
+#if defined __aarch64__
+	return vaddvq_u32(v);
+#else
+	const uint32x2_t t = vadd_u32(vget_low_u32(v), vget_high_u32(v));
+	return vget_lane_u32(vpadd_u32(t, t), 0);
+#endif
+}
+
+void FLAC__precompute_partition_info_sums_intrin_neon(const FLAC__int32 residual[], FLAC__uint64 abs_residual_partition_sums[], unsigned residual_samples, unsigned predictor_order, unsigned partition_order)
+{
+	const unsigned default_partition_samples = (residual_samples + predictor_order) >> partition_order;
+	const unsigned partitions = 1u << partition_order;
+	unsigned partition, residual_sample, end = (unsigned)(-(int)predictor_order);
+
+	for(partition = residual_sample = 0; partition < partitions; partition++) {
+		/* two sums to hide the latency of the additions */
+		uint32x4_t sum = vdupq_n_u32(0), sum2 = vdupq_n_u32(0);
+		FLAC__uint32 abs_residual_partition_sum;
+
+		end += default_partition_samples;
+		for( ; residual_sample + 8 <= end; residual_sample += 8) {
+			sum = vaddq_u32(sum, vreinterpretq_u32_s32(vabsq_s32(vld1q_s32(residual + residual_sample))));
+			sum2 = vaddq_u32(sum2, vreinterpretq_u32_s32(vabsq_s32(vld1q_s32(residual + residual_sample + 4))));
+		}
+		if(residual_sample + 4 <= end) {
+			sum = vaddq_u32(sum, vreinterpretq_u32_s32(vabsq_s32(vld1q_s32(residual + residual_sample))));
+			residual_sample += 4;
+		}
+		abs_residual_partition_sum = add_lanes_(vaddq_u32(sum, sum2));
+		for( ; residual_sample < end; residual_sample++)
+			abs_residual_partition_sum += abs(residual[residual_sample]);
+		abs_residual_partition_sums[partition] = abs_residual_partition_sum;
+	}
+}
+
+#endif /* FLAC__HAS_NEONINTRIN */
+#endif /* FLAC__NO_ASM */
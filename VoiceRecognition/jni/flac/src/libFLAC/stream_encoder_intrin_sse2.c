@@ -0,0 +1,75 @@
+/* libFLAC - Free Lossless Audio Codec library
+ * Copyright (C) 2011  Audioboo Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the Xiph.org Foundation nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "private/cpu.h"
+
+#ifndef FLAC__NO_ASM
+#if FLAC__HAS_X86INTRIN
+
+#include "private/stream_encoder.h"
+
+#include <stdlib.h> /* for abs() */
+#include <emmintrin.h> /* SSE2 */
+
+FLAC__SSE_TARGET("sse2")
+void FLAC__precompute_partition_info_sums_intrin_sse2(const FLAC__int32 residual[], FLAC__uint64 abs_residual_partition_sums[], unsigned residual_samples, unsigned predictor_order, unsigned partition_order)
+{
+	const unsigned default_partition_samples = (residual_samples + predictor_order) >> partition_order;
+	const unsigned partitions = 1u << partition_order;
+	unsigned partition, residual_sample, end = (unsigned)(-(int)predictor_order);
+
+	for(partition = residual_sample = 0; partition < partitions; partition++) {
+		__m128i sum = _mm_setzero_si128();
+		FLAC__uint32 abs_residual_partition_sum;
+
+		end += default_partition_samples;
+		for( ; residual_sample + 4 <= end; residual_sample += 4) {
+			/* SSE2 has no abs, so (r ^ sign) - sign */
+			const __m128i r = _mm_loadu_si128((const __m128i*)(residual + residual_sample));
+			const __m128i sign = _mm_srai_epi32(r, 31);
+			sum = _mm_add_epi32(sum, _mm_sub_epi32(_mm_xor_si128(r, sign), sign));
+		}
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1,0,3,2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2,3,0,1)));
+		abs_residual_partition_sum = (FLAC__uint32)_mm_cvtsi128_si32(sum);
+		for( ; residual_sample < end; residual_sample++)
+			abs_residual_partition_sum += abs(residual[residual_sample]);
+		abs_residual_partition_sums[partition] = abs_residual_partition_sum;
+	}
+}
+
+#endif /* FLAC__HAS_X86INTRIN */
+#endif /* FLAC__NO_ASM */
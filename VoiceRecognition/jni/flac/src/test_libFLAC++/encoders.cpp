@@ -217,6 +217,11 @@ static bool test_stream_encoder(Layer layer, bool is_ogg)
 		return die_s_("returned false", encoder);
 	printf("OK\n");
 
+	printf("testing set_verify_decode_interval()... ");
+	if(!encoder->set_verify_decode_interval(2))
+		return die_s_("returned false", encoder);
+	printf("OK\n");
+
 	printf("testing set_streamable_subset()... ");
 	if(!encoder->set_streamable_subset(true))
 		return die_s_("returned false", encoder);
@@ -282,6 +287,11 @@ static bool test_stream_encoder(Layer layer, bool is_ogg)
 		return die_s_("returned false", encoder);
 	printf("OK\n");
 
+	printf("testing set_do_early_termination()... ");
+	if(!encoder->set_do_early_termination(true))
+		return die_s_("returned false", encoder);
+	printf("OK\n");
+
 	printf("testing set_min_residual_partition_order()... ");
 	if(!encoder->set_min_residual_partition_order(0))
 		return die_s_("returned false", encoder);
@@ -373,6 +383,13 @@ static bool test_stream_encoder(Layer layer, bool is_ogg)
 	}
 	printf("OK\n");
 
+	printf("testing get_verify_decode_interval()... ");
+	if(encoder->get_verify_decode_interval() != 2) {
+		printf("FAILED, expected 2, got %u\n", encoder->get_verify_decode_interval());
+		return false;
+	}
+	printf("OK\n");
+
 	printf("testing get_streamable_subset()... ");
 	if(encoder->get_streamable_subset() != true) {
 		printf("FAILED, expected true, got false\n");
@@ -455,6 +472,13 @@ static bool test_stream_encoder(Layer layer, bool is_ogg)
 	}
 	printf("OK\n");
 
+	printf("testing get_do_early_termination()... ");
+	if(encoder->get_do_early_termination() != true) {
+		printf("FAILED, expected true, got false\n");
+		return false;
+	}
+	printf("OK\n");
+
 	printf("testing get_min_residual_partition_order()... ");
 	if(encoder->get_min_residual_partition_order() != 0) {
 		printf("FAILED, expected %u, got %u\n", 0, encoder->get_min_residual_partition_order());
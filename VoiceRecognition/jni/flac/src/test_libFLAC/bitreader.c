@@ -0,0 +1,349 @@
+/* test_libFLAC - Unit tester for libFLAC
+ * Copyright (C) 2011  Audioboo Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "FLAC/assert.h"
+#include "private/bitreader.h" /* from the libFLAC private include area */
+#include "private/bitwriter.h"
+#include "private/cpu.h"
+#include "private/crc.h"
+#include "bitreader.h"
+#include <stdio.h>
+#include <stdlib.h> /* for rand() */
+#include <string.h> /* for memcmp(), memset() */
+
+/*
+ * Round trip: a random mix of fields is written with the FLAC__BitWriter
+ * and, independently, one bit at a time into a reference buffer.  The
+ * two streams must be identical whatever the word size the library was
+ * built with, and the FLAC__BitReader, fed in ragged chunks so that
+ * refills land inside words and codewords, must read every field back.
+ */
+
+typedef enum {
+	FIELD_RAW32,
+	FIELD_RAW64,
+	FIELD_ZEROES,
+	FIELD_UNARY,
+	FIELD_RICE,
+	FIELD_RICE_BLOCK,
+	FIELD_TYPES
+} field_type;
+
+typedef struct {
+	field_type type;
+	unsigned bits; /* the width, # of zeroes, or Rice parameter */
+	FLAC__uint64 val; /* or, for a Rice block, the # of values */
+	unsigned first; /* the index of a Rice block's values in rice_vals_ */
+} field;
+
+#define MAX_FIELDS 4000
+#define MAX_RICE_VALS 20000
+
+static field fields_[MAX_FIELDS];
+static int rice_vals_[MAX_RICE_VALS], rice_got_[MAX_RICE_VALS];
+static FLAC__byte reference_[1 << 20];
+static unsigned reference_bits_;
+
+typedef struct {
+	unsigned pos, len;
+	unsigned max_chunk;
+} read_state;
+
+static void put_bits_(FLAC__uint64 val, unsigned bits)
+{
+	while(bits--) {
+		if((val >> bits) & 1)
+			reference_[reference_bits_ >> 3] |= 0x80 >> (reference_bits_ & 7);
+		reference_bits_++;
+	}
+}
+
+static void put_rice_(int val, unsigned parameter)
+{
+	const FLAC__uint32 uval = val < 0? ((FLAC__uint32)(-(val+1)) << 1) | 1 : (FLAC__uint32)val << 1;
+	unsigned msbs = uval >> parameter;
+
+	while(msbs--)
+		put_bits_(0, 1);
+	put_bits_(1, 1);
+	put_bits_(uval, parameter);
+}
+
+/*
+ * mostly small residuals with the odd large one, so that unary parts
+ * sometimes run past a word; in a burst they all do, which outruns the
+ * space the bitwriter reserves for a block up front
+ */
+static int random_residual_(unsigned parameter, FLAC__bool burst)
+{
+	const unsigned width = !burst && rand() % 64? parameter + 2 : parameter + 8;
+	const int magnitude = width >= 31? rand() & 0x3fffffff : rand() & ((1 << width) - 1);
+	return rand() & 1? -magnitude - 1 : magnitude;
+}
+
+static FLAC__uint64 random64_(void)
+{
+	return ((FLAC__uint64)rand() << 62) ^ ((FLAC__uint64)rand() << 31) ^ (FLAC__uint64)rand();
+}
+
+static unsigned make_fields_(void)
+{
+	const unsigned nfields = 1 + rand() % MAX_FIELDS;
+	unsigned i, j, nrice = 0;
+	FLAC__bool burst;
+
+	for(i = 0; i < nfields; i++) {
+		field *f = &fields_[i];
+		f->type = (field_type)(rand() % FIELD_TYPES);
+		switch(f->type) {
+			case FIELD_RAW32:
+				f->bits = rand() % 33;
+				f->val = f->bits? random64_() >> (64 - f->bits) : 0;
+				break;
+			case FIELD_RAW64:
+				f->bits = 33 + rand() % 32;
+				f->val = random64_() >> (64 - f->bits);
+				break;
+			case FIELD_ZEROES:
+				f->bits = rand() % 200;
+				break;
+			case FIELD_UNARY:
+				f->val = rand() % 8? rand() % 8 : rand() % 100;
+				break;
+			case FIELD_RICE:
+			case FIELD_RICE_BLOCK:
+				f->bits = rand() % 31;
+				f->val = f->type == FIELD_RICE? 1 : 1 + rand() % 600;
+				if(nrice + f->val > MAX_RICE_VALS) {
+					f->type = FIELD_ZEROES;
+					f->bits = 0;
+					break;
+				}
+				f->first = nrice;
+				burst = f->type == FIELD_RICE_BLOCK && rand() % 50 == 0;
+				for(j = 0; j < f->val; j++)
+					rice_vals_[nrice++] = random_residual_(f->bits, burst);
+				break;
+			default:
+				FLAC__ASSERT(0);
+		}
+	}
+	return nfields;
+}
+
+static FLAC__bool write_fields_(FLAC__BitWriter *bw, unsigned nfields)
+{
+	unsigned i, j;
+
+	memset(reference_, 0, sizeof(reference_));
+	reference_bits_ = 0;
+
+	for(i = 0; i < nfields; i++) {
+		const field *f = &fields_[i];
+		FLAC__bool ok = true;
+		switch(f->type) {
+			case FIELD_RAW32:
+				ok = FLAC__bitwriter_write_raw_uint32(bw, (FLAC__uint32)f->val, f->bits);
+				put_bits_(f->val, f->bits);
+				break;
+			case FIELD_RAW64:
+				ok = FLAC__bitwriter_write_raw_uint64(bw, f->val, f->bits);
+				put_bits_(f->val, f->bits);
+				break;
+			case FIELD_ZEROES:
+				ok = FLAC__bitwriter_write_zeroes(bw, f->bits);
+				for(j = 0; j < f->bits; j++)
+					put_bits_(0, 1);
+				break;
+			case FIELD_UNARY:
+				ok = FLAC__bitwriter_write_unary_unsigned(bw, (unsigned)f->val);
+				for(j = 0; j < f->val; j++)
+					put_bits_(0, 1);
+				put_bits_(1, 1);
+				break;
+			case FIELD_RICE:
+				ok = FLAC__bitwriter_write_rice_signed(bw, rice_vals_[f->first], f->bits);
+				put_rice_(rice_vals_[f->first], f->bits);
+				break;
+			case FIELD_RICE_BLOCK:
+				ok = FLAC__bitwriter_write_rice_signed_block(bw, rice_vals_ + f->first, (unsigned)f->val, f->bits);
+				for(j = 0; j < f->val; j++)
+					put_rice_(rice_vals_[f->first + j], f->bits);
+				break;
+			default:
+				FLAC__ASSERT(0);
+		}
+		if(!ok) {
+			printf("FAILED writing field %u\n", i);
+			return false;
+		}
+	}
+
+	if(!FLAC__bitwriter_zero_pad_to_byte_boundary(bw)) {
+		printf("FAILED padding\n");
+		return false;
+	}
+	reference_bits_ = (reference_bits_ + 7) & ~7u;
+	return true;
+}
+
+static FLAC__bool read_callback_(FLAC__byte buffer[], size_t *bytes, void *client_data)
+{
+	read_state *state = (read_state*)client_data;
+	size_t n = 1 + rand() % state->max_chunk;
+
+	if(n > *bytes)
+		n = *bytes;
+	if(n > state->len - state->pos)
+		n = state->len - state->pos;
+	if(n == 0)
+		return false;
+	memcpy(buffer, reference_ + state->pos, n);
+	state->pos += n;
+	*bytes = n;
+	return true;
+}
+
+static FLAC__bool read_fields_(FLAC__BitReader *br, unsigned nfields)
+{
+	unsigned i, j;
+
+	for(i = 0; i < nfields; i++) {
+		const field *f = &fields_[i];
+		FLAC__uint32 x;
+		FLAC__uint64 xx;
+		unsigned u;
+		int v;
+		FLAC__bool ok = true;
+		switch(f->type) {
+			case FIELD_RAW32:
+				ok = FLAC__bitreader_read_raw_uint32(br, &x, f->bits) && x == f->val;
+				break;
+			case FIELD_RAW64:
+				ok = FLAC__bitreader_read_raw_uint64(br, &xx, f->bits) && xx == f->val;
+				break;
+			case FIELD_ZEROES:
+				for(j = 0; ok && j < f->bits; j += 32)
+					ok = FLAC__bitreader_read_raw_uint32(br, &x, f->bits - j < 32? f->bits - j : 32) && x == 0;
+				break;
+			case FIELD_UNARY:
+				ok = FLAC__bitreader_read_unary_unsigned(br, &u) && u == f->val;
+				break;
+			case FIELD_RICE:
+				ok = FLAC__bitreader_read_rice_signed(br, &v, f->bits) && v == rice_vals_[f->first];
+				break;
+			case FIELD_RICE_BLOCK:
+				ok = FLAC__bitreader_read_rice_signed_block(br, rice_got_, (unsigned)f->val, f->bits) &&
+					0 == memcmp(rice_got_, rice_vals_ + f->first, sizeof(int) * (size_t)f->val);
+				break;
+			default:
+				FLAC__ASSERT(0);
+		}
+		if(!ok) {
+			printf("FAILED reading field %u (type %u)\n", i, (unsigned)f->type);
+			return false;
+		}
+	}
+	return true;
+}
+
+FLAC__bool test_bitreader(void)
+{
+	FLAC__BitWriter *bw;
+	FLAC__BitReader *br;
+	FLAC__CPUInfo cpuinfo;
+	read_state state;
+	unsigned iteration;
+
+	printf("\n+++ libFLAC unit test: bitreader\n\n");
+
+	bw = FLAC__bitwriter_new();
+	br = FLAC__bitreader_new();
+	if(0 == bw || 0 == br) {
+		printf("FAILED, could not create bitwriter and bitreader\n");
+		return false;
+	}
+	FLAC__cpu_info(&cpuinfo);
+
+	printf("testing write/read round trip with %u bit words... ", ENABLE_64_BIT_WORDS? 64u : 32u);
+	for(iteration = 0; iteration < 200; iteration++) {
+		const unsigned nfields = make_fields_();
+		const FLAC__byte *buffer;
+		size_t bytes;
+		FLAC__uint16 write_crc, read_crc;
+
+		/* start from the default capacity each time, so that the buffer has to grow mid-block */
+		if(!FLAC__bitwriter_init(bw)) {
+			printf("FAILED, could not init bitwriter\n");
+			return false;
+		}
+		if(!write_fields_(bw, nfields))
+			return false;
+
+		/* the bitstream has to be bit-for-bit what the reference writer made */
+		if(!FLAC__bitwriter_get_buffer(bw, &buffer, &bytes)) {
+			printf("FAILED, could not get buffer\n");
+			return false;
+		}
+		if(bytes * 8 != reference_bits_ || memcmp(buffer, reference_, bytes) != 0) {
+			printf("FAILED, iteration %u: bitstream differs from the reference (%u bytes, expected %u)\n", iteration, (unsigned)bytes, reference_bits_ / 8);
+			return false;
+		}
+		FLAC__bitwriter_release_buffer(bw);
+		if(!FLAC__bitwriter_get_write_crc16(bw, &write_crc)) {
+			printf("FAILED, could not get write CRC\n");
+			return false;
+		}
+
+		state.pos = 0;
+		state.len = reference_bits_ / 8;
+		state.max_chunk = iteration % 2? 16 : 4096;
+		if(!FLAC__bitreader_init(br, cpuinfo, read_callback_, &state)) {
+			printf("FAILED, could not init bitreader\n");
+			return false;
+		}
+		FLAC__bitreader_reset_read_crc16(br, 0);
+		if(!read_fields_(br, nfields))
+			return false;
+		if(!FLAC__bitreader_is_consumed_byte_aligned(br)) {
+			FLAC__uint32 pad;
+			if(!FLAC__bitreader_read_raw_uint32(br, &pad, FLAC__bitreader_bits_left_for_byte_alignment(br)) || pad != 0) {
+				printf("FAILED reading padding\n");
+				return false;
+			}
+		}
+		read_crc = FLAC__bitreader_get_read_crc16(br);
+		if(read_crc != write_crc || write_crc != FLAC__crc16(reference_, reference_bits_ / 8)) {
+			printf("FAILED, iteration %u: read CRC 0x%04x, write CRC 0x%04x, expected 0x%04x\n", iteration, read_crc, write_crc, FLAC__crc16(reference_, reference_bits_ / 8));
+			return false;
+		}
+		FLAC__bitreader_free(br);
+		FLAC__bitwriter_free(bw);
+	}
+	printf("OK\n");
+
+	FLAC__bitreader_delete(br);
+	FLAC__bitwriter_delete(bw);
+
+	printf("\nPASSED!\n");
+	return true;
+}
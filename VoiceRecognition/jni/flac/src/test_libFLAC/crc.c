@@ -0,0 +1,143 @@
+/* test_libFLAC - Unit tester for libFLAC
+ * Copyright (C) 2011  Audioboo Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "private/cpu.h" /* from the libFLAC private include area */
+#include "private/crc.h"
+#include "crc.h"
+#include <stdio.h>
+#include <stdlib.h> /* for rand() */
+#include <string.h> /* for strlen() */
+#include <time.h> /* for clock() */
+
+typedef unsigned (*crc16_block_fn)(const FLAC__byte *data, unsigned len, unsigned crc);
+typedef unsigned (*crc16_words32_fn)(const FLAC__uint32 *words, unsigned len, unsigned crc);
+typedef unsigned (*crc16_words64_fn)(const FLAC__uint64 *words, unsigned len, unsigned crc);
+
+static FLAC__byte data_[1 << 16];
+static FLAC__uint32 words_[sizeof(data_) / 4];
+static FLAC__uint64 words64_[sizeof(data_) / 8];
+
+/* the plain one-byte-at-a-time CRC everything else is checked against */
+static unsigned crc16_bytewise_(const FLAC__byte *data, unsigned len, unsigned crc)
+{
+	while(len--)
+		crc = FLAC__CRC16_UPDATE(*data++, crc);
+	return crc;
+}
+
+static FLAC__bool test_crc16_(const char *name, crc16_block_fn block, crc16_words32_fn words32, crc16_words64_fn words64)
+{
+	unsigned i, n;
+
+	printf("testing %s CRC-16 over random spans... ", name);
+	for(n = 0; n < 4000; n++) {
+		/* mostly short spans, to hit every tail length, but some whole frames too */
+		const unsigned offset = rand() % 64;
+		const unsigned len = rand() % (n % 4? 256 : sizeof(data_) - 64);
+		const unsigned seed = rand() & 0xffff;
+		const unsigned expect = crc16_bytewise_(data_ + offset, len, seed);
+		const unsigned expect_words = crc16_bytewise_(data_ + offset, len & ~3u, seed);
+		const unsigned expect_words64 = crc16_bytewise_(data_ + offset, len & ~7u, seed);
+		unsigned got, got_words, got_words64;
+
+		for(i = 0; i < len / 4; i++) {
+			const FLAC__byte *b = data_ + offset + 4 * i;
+			words_[i] = ((FLAC__uint32)b[0] << 24) | ((FLAC__uint32)b[1] << 16) | ((FLAC__uint32)b[2] << 8) | b[3];
+		}
+		for(i = 0; i < len / 8; i++)
+			words64_[i] = ((FLAC__uint64)words_[2*i] << 32) | words_[2*i+1];
+		got = block(data_ + offset, len, seed);
+		got_words = words32(words_, len / 4, seed);
+		got_words64 = words64(words64_, len / 8, seed);
+		if(got != expect || got_words != expect_words || got_words64 != expect_words64) {
+			printf("FAILED, len=%u seed=0x%04x: block 0x%04x, words 0x%04x, words64 0x%04x, expected 0x%04x, 0x%04x, 0x%04x\n", len, seed, got, got_words, got_words64, expect, expect_words, expect_words64);
+			return false;
+		}
+	}
+	printf("OK\n");
+	return true;
+}
+
+static void benchmark_crc16_(const char *name, crc16_block_fn block)
+{
+	const unsigned len = 16384; /* about a 4096 sample stereo frame */
+	unsigned i, n = 0, crc = 0;
+	const clock_t start = clock();
+	clock_t elapsed;
+
+	do {
+		for(i = 0; i < 64; i++)
+			crc = block(data_, len, crc);
+		n += 64;
+		elapsed = clock() - start;
+	} while(elapsed < CLOCKS_PER_SEC / 4);
+
+	printf("  %-9s %8.0f MB/s (crc 0x%04x)\n", name, (double)n * len / 1e6 / ((double)elapsed / CLOCKS_PER_SEC), crc);
+}
+
+FLAC__bool test_crc(void)
+{
+	static const char check[] = "123456789";
+	FLAC__CPUInfo cpuinfo;
+	FLAC__CPUDispatch dispatch;
+	unsigned i;
+
+	printf("\n+++ libFLAC unit test: crc\n\n");
+
+	for(i = 0; i < sizeof(data_); i++)
+		data_[i] = (FLAC__byte)rand();
+
+	printf("testing CRC-8 check value... ");
+	if(FLAC__crc8((const FLAC__byte*)check, strlen(check)) != 0xf4) {
+		printf("FAILED, got 0x%02x\n", FLAC__crc8((const FLAC__byte*)check, strlen(check)));
+		return false;
+	}
+	printf("OK\n");
+
+	printf("testing CRC-16 check value... ");
+	if(FLAC__crc16((const FLAC__byte*)check, strlen(check)) != 0xfee8) {
+		printf("FAILED, got 0x%04x\n", FLAC__crc16((const FLAC__byte*)check, strlen(check)));
+		return false;
+	}
+	printf("OK\n");
+
+	if(!test_crc16_("sliced", FLAC__crc16_update_block, FLAC__crc16_update_words32, FLAC__crc16_update_words64))
+		return false;
+
+	FLAC__cpu_info(&cpuinfo);
+	FLAC__cpu_dispatch(&cpuinfo, &dispatch);
+	if(0 != dispatch.crc16_update_block) {
+		if(!test_crc16_("SIMD", dispatch.crc16_update_block, dispatch.crc16_update_words32, dispatch.crc16_update_words64))
+			return false;
+	}
+	else
+		printf("no SIMD CRC-16 on this CPU, skipping\n");
+
+	printf("CRC-16 throughput:\n");
+	benchmark_crc16_("bytewise", crc16_bytewise_);
+	benchmark_crc16_("sliced", FLAC__crc16_update_block);
+	if(0 != dispatch.crc16_update_block)
+		benchmark_crc16_("SIMD", dispatch.crc16_update_block);
+
+	printf("\nPASSED!\n");
+	return true;
+}
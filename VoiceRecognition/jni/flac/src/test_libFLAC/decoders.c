@@ -32,6 +32,7 @@
 #endif
 #include "decoders.h"
 #include "FLAC/assert.h"
+#include "FLAC/metadata.h"
 #include "FLAC/stream_decoder.h"
 #include "share/grabbag.h"
 #include "test_libs_common/file_utils_flac.h"
@@ -51,6 +52,9 @@ static const char * const LayerString[] = {
 	"Filename"
 };
 
+/* frames are only decoded in parallel from files; the stream layers must fall back to one thread */
+static const unsigned NumThreads[] = { 3, 3, 3, 3 };
+
 typedef struct {
 	Layer layer;
 	FILE *file;
@@ -389,6 +393,7 @@ static FLAC__bool test_stream_decoder(Layer layer, FLAC__bool is_ogg)
 	FLAC__StreamDecoderState state;
 	StreamDecoderClientData decoder_client_data;
 	FLAC__bool expect;
+	unsigned num_threads = NumThreads[layer];
 
 	decoder_client_data.layer = layer;
 
@@ -469,6 +474,26 @@ static FLAC__bool test_stream_decoder(Layer layer, FLAC__bool is_ogg)
 		return die_s_("returned false", decoder);
 	printf("OK\n");
 
+	printf("testing FLAC__stream_decoder_set_num_threads(0)... ");
+	if(FLAC__stream_decoder_set_num_threads(decoder, 0))
+		return die_s_("returned true", decoder);
+	printf("OK\n");
+
+	printf("testing FLAC__stream_decoder_set_num_threads()... ");
+	if(!FLAC__stream_decoder_set_num_threads(decoder, num_threads)) {
+		if(!FLAC__stream_decoder_set_num_threads(decoder, 1))
+			return die_s_("returned false", decoder);
+		num_threads = 1;
+		printf("OK (built without thread support)\n");
+	}
+	else
+		printf("OK\n");
+
+	printf("testing FLAC__stream_decoder_set_frame_indexing()... ");
+	if(!FLAC__stream_decoder_set_frame_indexing(decoder, true))
+		return die_s_("returned false", decoder);
+	printf("OK\n");
+
 	if(layer < LAYER_FILENAME) {
 		printf("opening %sFLAC file... ", is_ogg? "Ogg ":"");
 		decoder_client_data.file = fopen(flacfilename(is_ogg), "rb");
@@ -527,6 +552,20 @@ static FLAC__bool test_stream_decoder(Layer layer, FLAC__bool is_ogg)
 	}
 	printf("OK\n");
 
+	printf("testing FLAC__stream_decoder_get_num_threads()... ");
+	if(FLAC__stream_decoder_get_num_threads(decoder) != num_threads) {
+		printf("FAILED, expected %u, got %u\n", num_threads, FLAC__stream_decoder_get_num_threads(decoder));
+		return false;
+	}
+	printf("OK\n");
+
+	printf("testing FLAC__stream_decoder_get_frame_indexing()... ");
+	if(!FLAC__stream_decoder_get_frame_indexing(decoder)) {
+		printf("FAILED, returned false, expected true\n");
+		return false;
+	}
+	printf("OK\n");
+
 	printf("testing FLAC__stream_decoder_process_until_end_of_metadata()... ");
 	if(!FLAC__stream_decoder_process_until_end_of_metadata(decoder))
 		return die_s_("returned false", decoder);
@@ -573,6 +612,34 @@ static FLAC__bool test_stream_decoder(Layer layer, FLAC__bool is_ogg)
 		return die_s_(expect? "returned false" : "returned true", decoder);
 	printf("OK\n");
 
+	expect = (layer != LAYER_STREAM && !is_ogg);
+	printf("testing FLAC__stream_decoder_build_frame_index()... ");
+	if(FLAC__stream_decoder_build_frame_index(decoder) != expect)
+		return die_s_(expect? "returned false" : "returned true", decoder);
+	printf("OK\n");
+
+	if(expect) {
+		FLAC__StreamMetadata *seek_table;
+
+		printf("testing FLAC__stream_decoder_get_frame_index_seek_table()... ");
+		if(0 == (seek_table = FLAC__stream_decoder_get_frame_index_seek_table(decoder, 0))) {
+			printf("FAILED, returned NULL\n");
+			return false;
+		}
+		if(!FLAC__format_seektable_is_legal(&seek_table->data.seek_table)) {
+			printf("FAILED, returned an illegal seek table\n");
+			FLAC__metadata_object_delete(seek_table);
+			return false;
+		}
+		FLAC__metadata_object_delete(seek_table);
+		printf("OK\n");
+
+		printf("testing FLAC__stream_decoder_seek_absolute()... ");
+		if(!FLAC__stream_decoder_seek_absolute(decoder, 0))
+			return die_s_("returned false", decoder);
+		printf("OK\n");
+	}
+
 	printf("testing FLAC__stream_decoder_get_channels()... ");
 	{
 		unsigned channels = FLAC__stream_decoder_get_channels(decoder);
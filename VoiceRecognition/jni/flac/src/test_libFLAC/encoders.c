@@ -24,13 +24,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h> /* for clock() */
 #include "encoders.h"
 #include "FLAC/assert.h"
+#include "FLAC/metadata.h"
 #include "FLAC/stream_encoder.h"
 #include "share/grabbag.h"
 #include "test_libs_common/file_utils_flac.h"
 #include "test_libs_common/metadata_utils.h"
 
+/* unpublished debug routine from libFLAC */
+extern FLAC__bool FLAC__stream_encoder_set_verify_corrupt_frame(FLAC__StreamEncoder *encoder, unsigned value);
+
 typedef enum {
 	LAYER_STREAM = 0, /* FLAC__stream_encoder_init_[ogg_]stream() without seeking */
 	LAYER_SEEKABLE_STREAM, /* FLAC__stream_encoder_init_[ogg_]stream() with seeking */
@@ -45,9 +50,13 @@ static const char * const LayerString[] = {
 	"Filename"
 };
 
+/* exercise the frame-parallel encoder on every other layer */
+static const unsigned NumThreads[] = { 1, 3, 1, 3 };
+
 static FLAC__StreamMetadata streaminfo_, padding_, seektable_, application1_, application2_, vorbiscomment_, cuesheet_, picture_, unknown_;
 static FLAC__StreamMetadata *metadata_sequence_[] = { &vorbiscomment_, &padding_, &seektable_, &application1_, &application2_, &cuesheet_, &picture_, &unknown_ };
 static const unsigned num_metadata_ = sizeof(metadata_sequence_) / sizeof(metadata_sequence_[0]);
+static const FLAC__uint64 UNREACHED_SEEKPOINT_ = (FLAC__uint64)1 << 32;
 
 static const char *flacfilename(FLAC__bool is_ogg)
 {
@@ -81,6 +90,13 @@ static FLAC__bool die_s_(const char *msg, const FLAC__StreamEncoder *encoder)
 static void init_metadata_blocks_(void)
 {
 	mutils__init_metadata_blocks(&streaminfo_, &padding_, &seektable_, &application1_, &application2_, &vorbiscomment_, &cuesheet_, &picture_, &unknown_);
+
+	/* add a template point far beyond the end of the test stream */
+	if(!FLAC__metadata_object_seektable_insert_point(&seektable_, 1, seektable_.data.seek_table.points[0])) {
+		printf("ERROR: out of memory\n");
+		exit(1);
+	}
+	seektable_.data.seek_table.points[1].sample_number = UNREACHED_SEEKPOINT_;
 }
 
 static void free_metadata_blocks_(void)
@@ -156,8 +172,9 @@ static FLAC__bool test_stream_encoder(Layer layer, FLAC__bool is_ogg)
 	FLAC__StreamDecoderState dstate;
 	FILE *file = 0;
 	FLAC__int32 samples[1024];
+	FLAC__int16 samples16[1024];
 	FLAC__int32 *samples_array[1];
-	unsigned i;
+	unsigned i, num_threads = NumThreads[layer];
 
 	samples_array[0] = samples;
 
@@ -183,6 +200,11 @@ static FLAC__bool test_stream_encoder(Layer layer, FLAC__bool is_ogg)
 		return die_s_("returned false", encoder);
 	printf("OK\n");
 
+	printf("testing FLAC__stream_encoder_set_verify_decode_interval()... ");
+	if(!FLAC__stream_encoder_set_verify_decode_interval(encoder, 2))
+		return die_s_("returned false", encoder);
+	printf("OK\n");
+
 	printf("testing FLAC__stream_encoder_set_streamable_subset()... ");
 	if(!FLAC__stream_encoder_set_streamable_subset(encoder, true))
 		return die_s_("returned false", encoder);
@@ -248,6 +270,11 @@ static FLAC__bool test_stream_encoder(Layer layer, FLAC__bool is_ogg)
 		return die_s_("returned false", encoder);
 	printf("OK\n");
 
+	printf("testing FLAC__stream_encoder_set_do_early_termination()... ");
+	if(!FLAC__stream_encoder_set_do_early_termination(encoder, true))
+		return die_s_("returned false", encoder);
+	printf("OK\n");
+
 	printf("testing FLAC__stream_encoder_set_min_residual_partition_order()... ");
 	if(!FLAC__stream_encoder_set_min_residual_partition_order(encoder, 0))
 		return die_s_("returned false", encoder);
@@ -273,6 +300,21 @@ static FLAC__bool test_stream_encoder(Layer layer, FLAC__bool is_ogg)
 		return die_s_("returned false", encoder);
 	printf("OK\n");
 
+	printf("testing FLAC__stream_encoder_set_num_threads(0)... ");
+	if(FLAC__stream_encoder_set_num_threads(encoder, 0))
+		return die_s_("returned true", encoder);
+	printf("OK\n");
+
+	printf("testing FLAC__stream_encoder_set_num_threads()... ");
+	if(!FLAC__stream_encoder_set_num_threads(encoder, num_threads)) {
+		if(!FLAC__stream_encoder_set_num_threads(encoder, 1))
+			return die_s_("returned false", encoder);
+		num_threads = 1;
+		printf("OK (built without thread support)\n");
+	}
+	else
+		printf("OK\n");
+
 	if(layer < LAYER_FILENAME) {
 		printf("opening file for FLAC output... ");
 		file = fopen(flacfilename(is_ogg), "w+b");
@@ -344,6 +386,13 @@ static FLAC__bool test_stream_encoder(Layer layer, FLAC__bool is_ogg)
 	}
 	printf("OK\n");
 
+	printf("testing FLAC__stream_encoder_get_verify_decode_interval()... ");
+	if(FLAC__stream_encoder_get_verify_decode_interval(encoder) != 2) {
+		printf("FAILED, expected 2, got %u\n", FLAC__stream_encoder_get_verify_decode_interval(encoder));
+		return false;
+	}
+	printf("OK\n");
+
 	printf("testing FLAC__stream_encoder_get_streamable_subset()... ");
 	if(FLAC__stream_encoder_get_streamable_subset(encoder) != true) {
 		printf("FAILED, expected true, got false\n");
@@ -426,6 +475,13 @@ static FLAC__bool test_stream_encoder(Layer layer, FLAC__bool is_ogg)
 	}
 	printf("OK\n");
 
+	printf("testing FLAC__stream_encoder_get_do_early_termination()... ");
+	if(FLAC__stream_encoder_get_do_early_termination(encoder) != true) {
+		printf("FAILED, expected true, got false\n");
+		return false;
+	}
+	printf("OK\n");
+
 	printf("testing FLAC__stream_encoder_get_min_residual_partition_order()... ");
 	if(FLAC__stream_encoder_get_min_residual_partition_order(encoder) != 0) {
 		printf("FAILED, expected %u, got %u\n", 0, FLAC__stream_encoder_get_min_residual_partition_order(encoder));
@@ -458,9 +514,18 @@ static FLAC__bool test_stream_encoder(Layer layer, FLAC__bool is_ogg)
 	}
 	printf("OK\n");
 
+	printf("testing FLAC__stream_encoder_get_num_threads()... ");
+	if(FLAC__stream_encoder_get_num_threads(encoder) != num_threads) {
+		printf("FAILED, expected %u, got %u\n", num_threads, FLAC__stream_encoder_get_num_threads(encoder));
+		return false;
+	}
+	printf("OK\n");
+
 	/* init the dummy sample buffer */
 	for(i = 0; i < sizeof(samples) / sizeof(FLAC__int32); i++)
 		samples[i] = i & 7;
+	for(i = 0; i < sizeof(samples16) / sizeof(FLAC__int16); i++)
+		samples16[i] = (FLAC__int16)(i & 7);
 
 	printf("testing FLAC__stream_encoder_process()... ");
 	if(!FLAC__stream_encoder_process(encoder, (const FLAC__int32 * const *)samples_array, sizeof(samples) / sizeof(FLAC__int32)))
@@ -472,11 +537,27 @@ static FLAC__bool test_stream_encoder(Layer layer, FLAC__bool is_ogg)
 		return die_s_("returned false", encoder);
 	printf("OK\n");
 
+	printf("testing FLAC__stream_encoder_process_interleaved_int16()... ");
+	if(!FLAC__stream_encoder_process_interleaved_int16(encoder, samples16, sizeof(samples16) / sizeof(FLAC__int16)))
+		return die_s_("returned false", encoder);
+	printf("OK\n");
+
 	printf("testing FLAC__stream_encoder_finish()... ");
 	if(!FLAC__stream_encoder_finish(encoder))
 		return die_s_("returned false", encoder);
 	printf("OK\n");
 
+	if(layer != LAYER_STREAM) {
+		printf("testing that unreached seek points became placeholders... ");
+		for(i = 0; i < seektable_.data.seek_table.num_points; i++) {
+			if(seektable_.data.seek_table.points[i].sample_number == UNREACHED_SEEKPOINT_) {
+				printf("FAILED, point #%u was left as is\n", i);
+				return false;
+			}
+		}
+		printf("OK\n");
+	}
+
 	if(layer < LAYER_FILE)
 		fclose(file);
 
@@ -489,6 +570,269 @@ static FLAC__bool test_stream_encoder(Layer layer, FLAC__bool is_ogg)
 	return true;
 }
 
+static FLAC__StreamDecoderWriteStatus discard_write_callback_(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
+{
+	FLAC__uint64 *samples = (FLAC__uint64*)client_data;
+	(void)decoder, (void)buffer;
+	*samples += frame->header.blocksize;
+	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void ignore_error_callback_(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
+{
+	(void)decoder, (void)status, (void)client_data;
+}
+
+/*
+ * Finished encoders and decoders keep their buffers for the next stream.
+ * Run one instance of each through streams whose settings need more, fewer
+ * and different buffers than the last one's, and check that every stream
+ * still decodes to the right MD5 sum.
+ */
+static FLAC__bool test_stream_encoder_reuse(FLAC__bool is_ogg)
+{
+	static const struct {
+		unsigned channels, blocksize;
+		const char *apodization;
+		FLAC__bool do_escape_coding;
+	} streams[] = {
+		{ 1, 1152, "tukey(0.5)", false },
+		{ 2, 4608, "tukey(0.5)", false }, /* more channels, larger blocks */
+		{ 2,  576, "hann;welch;bartlett", true }, /* smaller blocks, other windows */
+		{ 6, 1152, "tukey(0.5)", false }  /* more channels at the retained capacity */
+	};
+	FLAC__StreamEncoder *encoder;
+	FLAC__StreamDecoder *decoder;
+	FLAC__int32 samples[6 * 4096];
+	FLAC__uint32 seed = 0x12345678;
+	unsigned i, n;
+
+	printf("\n+++ libFLAC unit test: FLAC__StreamEncoder reuse (format: %s)\n\n", is_ogg? "Ogg FLAC":"FLAC");
+
+	encoder = FLAC__stream_encoder_new();
+	decoder = FLAC__stream_decoder_new();
+	if(0 == encoder || 0 == decoder)
+		return die_("FLAC__stream_encoder_new() or FLAC__stream_decoder_new() returned NULL");
+
+	for(n = 0; n < sizeof(streams) / sizeof(streams[0]); n++) {
+		const unsigned channels = streams[n].channels;
+		const unsigned frames = sizeof(samples) / sizeof(samples[0]) / channels;
+		FLAC__uint64 decoded = 0;
+
+		/* a noisy ramp, so that LPC subframes get chosen */
+		for(i = 0; i < frames * channels; i++) {
+			seed = seed * 1103515245 + 12345;
+			samples[i] = (FLAC__int32)((i / channels) % 2048) - 1024 + (FLAC__int32)((seed >> 16) & 63) - 32;
+		}
+
+		printf("testing stream #%u: %u channels, blocksize %u, apodization %s... ", n, channels, streams[n].blocksize, streams[n].apodization);
+		if(
+			!FLAC__stream_encoder_set_verify(encoder, true) ||
+			!FLAC__stream_encoder_set_channels(encoder, channels) ||
+			!FLAC__stream_encoder_set_bits_per_sample(encoder, 16) ||
+			!FLAC__stream_encoder_set_sample_rate(encoder, 44100) ||
+			!FLAC__stream_encoder_set_compression_level(encoder, 5) ||
+			!FLAC__stream_encoder_set_blocksize(encoder, streams[n].blocksize) ||
+			!FLAC__stream_encoder_set_apodization(encoder, streams[n].apodization) ||
+			!FLAC__stream_encoder_set_do_escape_coding(encoder, streams[n].do_escape_coding)
+		)
+			return die_s_("setting up the encoder failed", encoder);
+		if(channels > 2 && !FLAC__stream_encoder_set_do_mid_side_stereo(encoder, false))
+			return die_s_("FLAC__stream_encoder_set_do_mid_side_stereo() returned false", encoder);
+		if(
+			(is_ogg?
+				FLAC__stream_encoder_init_ogg_file(encoder, flacfilename(is_ogg), 0, 0) :
+				FLAC__stream_encoder_init_file(encoder, flacfilename(is_ogg), 0, 0)
+			) != FLAC__STREAM_ENCODER_INIT_STATUS_OK
+		)
+			return die_s_("init failed", encoder);
+		if(!FLAC__stream_encoder_process_interleaved(encoder, samples, frames))
+			return die_s_("FLAC__stream_encoder_process_interleaved() returned false", encoder);
+		if(!FLAC__stream_encoder_finish(encoder))
+			return die_s_("FLAC__stream_encoder_finish() returned false", encoder);
+
+		if(
+			!FLAC__stream_decoder_set_md5_checking(decoder, true) ||
+			(is_ogg?
+				FLAC__stream_decoder_init_ogg_file(decoder, flacfilename(is_ogg), discard_write_callback_, 0, ignore_error_callback_, &decoded) :
+				FLAC__stream_decoder_init_file(decoder, flacfilename(is_ogg), discard_write_callback_, 0, ignore_error_callback_, &decoded)
+			) != FLAC__STREAM_DECODER_INIT_STATUS_OK ||
+			!FLAC__stream_decoder_process_until_end_of_stream(decoder)
+		) {
+			printf("FAILED, decoder state = %s\n", FLAC__stream_decoder_get_resolved_state_string(decoder));
+			return false;
+		}
+		if(!FLAC__stream_decoder_finish(decoder)) {
+			printf("FAILED, MD5 mismatch\n");
+			return false;
+		}
+		if(decoded != frames) {
+			printf("FAILED, decoded %u samples, expected %u\n", (unsigned)decoded, frames);
+			return false;
+		}
+		printf("OK\n");
+	}
+
+	FLAC__stream_decoder_delete(decoder);
+	FLAC__stream_encoder_delete(encoder);
+
+	printf("\nPASSED!\n");
+
+	return true;
+}
+
+static FLAC__StreamEncoderWriteStatus count_write_callback_(const FLAC__StreamEncoder *encoder, const FLAC__byte buffer[], size_t bytes, unsigned samples, unsigned current_frame, void *client_data)
+{
+	FLAC__uint64 *total = (FLAC__uint64*)client_data;
+	(void)encoder, (void)buffer, (void)samples, (void)current_frame;
+	*total += bytes;
+	return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+/*
+ * Make the subframe check fail on the short last frame and check that the
+ * mismatch is reported at the right place in the stream: frame numbers
+ * count nominal blocks, not the last frame's own blocksize.
+ */
+static FLAC__bool test_stream_encoder_verify_mismatch_(void)
+{
+	const unsigned blocksize = 1152, frames = 3 * 1152 + 100;
+	FLAC__StreamEncoder *encoder;
+	FLAC__int32 samples[3 * 1152 + 100];
+	FLAC__uint32 seed = 0x12345678;
+	FLAC__uint64 bytes = 0, absolute_sample;
+	unsigned i, threads, frame_number, channel, sample;
+	FLAC__int32 expected, got;
+
+	printf("\n+++ libFLAC unit test: FLAC__StreamEncoder verify mismatch\n\n");
+
+	/* a noisy ramp, so that the last frame is not coded verbatim */
+	for(i = 0; i < frames; i++) {
+		seed = seed * 1103515245 + 12345;
+		samples[i] = (FLAC__int32)(i % 2048) - 1024 + (FLAC__int32)((seed >> 16) & 63) - 32;
+	}
+
+	for(threads = 1; threads <= 3; threads += 2) {
+		if(0 == (encoder = FLAC__stream_encoder_new()))
+			return die_("FLAC__stream_encoder_new() returned NULL");
+		if(!FLAC__stream_encoder_set_num_threads(encoder, threads)) {
+			FLAC__stream_encoder_delete(encoder);
+			continue; /* built without threads */
+		}
+		printf("testing a mismatch in the last frame's subframe check with %u thread(s)... ", threads);
+		if(
+			!FLAC__stream_encoder_set_verify(encoder, true) ||
+			!FLAC__stream_encoder_set_verify_decode_interval(encoder, 0) ||
+			!FLAC__stream_encoder_set_channels(encoder, 1) ||
+			!FLAC__stream_encoder_set_bits_per_sample(encoder, 16) ||
+			!FLAC__stream_encoder_set_sample_rate(encoder, 44100) ||
+			!FLAC__stream_encoder_set_compression_level(encoder, 5) ||
+			!FLAC__stream_encoder_set_blocksize(encoder, blocksize) ||
+			!FLAC__stream_encoder_set_verify_corrupt_frame(encoder, frames / blocksize) ||
+			FLAC__stream_encoder_init_stream(encoder, count_write_callback_, 0, 0, 0, &bytes) != FLAC__STREAM_ENCODER_INIT_STATUS_OK
+		)
+			return die_s_("setting up the encoder failed", encoder);
+		if(!FLAC__stream_encoder_process_interleaved(encoder, samples, frames))
+			return die_s_("FLAC__stream_encoder_process_interleaved() returned false", encoder);
+		if(FLAC__stream_encoder_finish(encoder)) {
+			printf("FAILED, FLAC__stream_encoder_finish() returned true\n");
+			return false;
+		}
+		if(FLAC__stream_encoder_get_state(encoder) != FLAC__STREAM_ENCODER_VERIFY_MISMATCH_IN_AUDIO_DATA)
+			return die_s_("expected FLAC__STREAM_ENCODER_VERIFY_MISMATCH_IN_AUDIO_DATA", encoder);
+		FLAC__stream_encoder_get_verify_decoder_error_stats(encoder, &absolute_sample, &frame_number, &channel, &sample, &expected, &got);
+		if(absolute_sample != frames - 1 || frame_number != frames / blocksize || channel != 0 || sample != frames % blocksize - 1 || expected != samples[frames - 1] || got != (expected ^ 1)) {
+			printf("FAILED, got sample %u (frame %u, channel %u, sample %u: %d for %d), expected sample %u (frame %u, channel 0, sample %u)\n", (unsigned)absolute_sample, frame_number, channel, sample, got, expected, frames - 1, frames / blocksize, frames % blocksize - 1);
+			return false;
+		}
+		printf("OK\n");
+
+		FLAC__stream_encoder_delete(encoder);
+	}
+
+	printf("\nPASSED!\n");
+
+	return true;
+}
+
+/*
+ * Not a pass/fail test: encode the same generated signal at the levels a
+ * recording would pick between and print the size and encoder time of
+ * each, so that changes to the presets or the model search can be compared
+ * run against run.
+ */
+static FLAC__bool benchmark_compression_levels_(void)
+{
+	static const unsigned levels[] = { 5, 8, 9 };
+	const unsigned channels = 2, frames = 10 * 44100;
+	FLAC__StreamEncoder *encoder;
+	FLAC__int32 *samples;
+	FLAC__uint32 seed = 0x12345678;
+	double y1[2] = { 0.0, 0.0 }, y2[2] = { 0.0, 0.0 };
+	unsigned i, n;
+
+	printf("\n+++ libFLAC benchmark: compression levels\n\n");
+
+	if(0 == (samples = (FLAC__int32*)malloc(sizeof(FLAC__int32) * channels * frames)))
+		return die_("out of memory");
+
+	/*
+	 * two noise-driven resonators, one low and one high, make a signal
+	 * with some of the spectral shape of speech; the right channel is
+	 * mostly the left so that mid-side coding has something to find
+	 */
+	for(i = 0; i < frames; i++) {
+		double noise[2], x;
+		for(n = 0; n < 2; n++) {
+			seed = seed * 1103515245 + 12345;
+			noise[n] = (double)((FLAC__int32)(seed >> 16) - 32768) / 32768.0;
+		}
+		x = 1.990 * y1[0] - 0.995 * y2[0] + 40.0 * noise[0];
+		y2[0] = y1[0]; y1[0] = x;
+		x = 1.200 * y1[1] - 0.900 * y2[1] + 600.0 * noise[1];
+		y2[1] = y1[1]; y1[1] = x;
+		x = y1[0] + y1[1];
+		if(x > 32767.0) x = 32767.0;
+		if(x < -32768.0) x = -32768.0;
+		samples[i * channels] = (FLAC__int32)x;
+		samples[i * channels + 1] = (FLAC__int32)(0.8 * x + 64.0 * noise[1]) / 2;
+	}
+
+	if(0 == (encoder = FLAC__stream_encoder_new())) {
+		free(samples);
+		return die_("FLAC__stream_encoder_new() returned NULL");
+	}
+
+	printf("  %u s of 16-bit stereo at 44100 Hz, %u bytes raw\n", frames / 44100, frames * channels * 2);
+	for(n = 0; n < sizeof(levels) / sizeof(levels[0]); n++) {
+		FLAC__uint64 bytes = 0;
+		clock_t start, elapsed;
+
+		if(
+			!FLAC__stream_encoder_set_channels(encoder, channels) ||
+			!FLAC__stream_encoder_set_bits_per_sample(encoder, 16) ||
+			!FLAC__stream_encoder_set_sample_rate(encoder, 44100) ||
+			!FLAC__stream_encoder_set_compression_level(encoder, levels[n]) ||
+			FLAC__stream_encoder_init_stream(encoder, count_write_callback_, 0, 0, 0, &bytes) != FLAC__STREAM_ENCODER_INIT_STATUS_OK
+		) {
+			free(samples);
+			return die_s_("setting up the encoder failed", encoder);
+		}
+		start = clock();
+		if(!FLAC__stream_encoder_process_interleaved(encoder, samples, frames) || !FLAC__stream_encoder_finish(encoder)) {
+			free(samples);
+			return die_s_("encoding failed", encoder);
+		}
+		elapsed = clock() - start;
+		printf("  level %u: %9u bytes (%5.2f%%) %7.0f ms\n", levels[n], (unsigned)bytes, 100.0 * (double)bytes / (frames * channels * 2), 1000.0 * (double)elapsed / CLOCKS_PER_SEC);
+	}
+
+	FLAC__stream_encoder_delete(encoder);
+	free(samples);
+
+	return true;
+}
+
 FLAC__bool test_encoders(void)
 {
 	FLAC__bool is_ogg = false;
@@ -508,6 +852,9 @@ FLAC__bool test_encoders(void)
 		if(!test_stream_encoder(LAYER_FILENAME, is_ogg))
 			return false;
 
+		if(!test_stream_encoder_reuse(is_ogg))
+			return false;
+
 		(void) grabbag__file_remove_file(flacfilename(is_ogg));
 
 		free_metadata_blocks_();
@@ -517,5 +864,11 @@ FLAC__bool test_encoders(void)
 		is_ogg = true;
 	}
 
+	if(!test_stream_encoder_verify_mismatch_())
+		return false;
+
+	if(!benchmark_compression_levels_())
+		return false;
+
 	return true;
 }
@@ -20,7 +20,9 @@
 #  include <config.h>
 #endif
 
+#include "bitreader.h"
 #include "bitwriter.h"
+#include "crc.h"
 #include "decoders.h"
 #include "encoders.h"
 #include "format.h"
@@ -33,6 +35,12 @@ int main(int argc, char *argv[])
 	if(!test_bitwriter())
 		return 1;
 
+	if(!test_bitreader())
+		return 1;
+
+	if(!test_crc())
+		return 1;
+
 	if(!test_format())
 		return 1;
 
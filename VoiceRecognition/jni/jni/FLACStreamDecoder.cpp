@@ -14,8 +14,12 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <stdio.h>
 #include <alloca.h>
 #include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 #include <sys/stat.h>
 
@@ -23,6 +27,8 @@
 #include "FLAC/stream_encoder.h"
 
 #include "util.h"
+#include "spsc_ring.h"
+#include "instance_pool.h"
 
 #include <jni.h>
 
@@ -40,6 +46,30 @@ static char const * const IllegalArgumentException_classname  = "java.lang.Illeg
 
 static char const * const LTAG                          = "FLACStreamDecoder/native";
 
+// Frame index files are named after the recording's path, with this suffix,
+// and kept in the directory set with setIndexDirectory().
+static char const * const FrameIndex_suffix             = ".index";
+
+// A SEEKTABLE whose points are at most this many seconds apart makes seeks
+// cheap enough without a frame index. It matches the spacing
+// FLACStreamEncoder writes by default.
+static int SEEK_TABLE_MAX_SPACING                       = 10;
+
+// Read-ahead ring dimensions; see FLACStreamDecoder::init()
+static int READ_AHEAD_BLOCK_SIZE                        = 8192;
+static int READ_AHEAD_BLOCKS                            = 8;
+
+// Released decoders kept for reuse by default; see decoder_pool below.
+static int DECODER_POOL_SIZE                            = 1;
+
+
+/*****************************************************************************
+ * Frame index directory; NULL until Java sets one, and no index is saved
+ * before that. Guarded by index_directory_mutex.
+ **/
+static pthread_mutex_t  index_directory_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *           index_directory       = NULL;
+
 
 /*****************************************************************************
  * FLAC callbacks forward declarations
@@ -90,56 +120,164 @@ void flac_error_helper(
 
 /*****************************************************************************
  * Native FLACStreamDecoder representation
+ *
+ * By default, FLACStreamDecoder decodes on the JNI thread, inside read().
+ * In read-ahead mode it instead mirrors FLACStreamEncoder's writer thread:
+ *
+ * 1. A decoder thread owns the FLAC decoder and the input file. It decodes
+ *    into a ring of fixed-size blocks of PCM that is allocated once in
+ *    init(); we'll call it the read-ahead ring. The decoder thread is the
+ *    ring's only producer, the JNI thread its only consumer.
+ * 2. The decoder thread keeps the ring full, and sleeps on a semaphore
+ *    while it is, or once it has published the end of the stream.
+ * 3. read() on the JNI thread copies PCM out of the ring, handing each
+ *    emptied block back and waking the decoder thread. It only waits for
+ *    the decoder thread if the ring runs empty.
+ * 4. seekTo() bumps a seek generation and wakes the decoder thread, which
+ *    seeks before decoding its next block. Blocks are tagged with the
+ *    generation they were decoded for, so read() drops stale ones.
+ * 5. The decoder thread, the ring and the FLAC decoder outlive a stream.
+ *    close() parks the thread and waits for it to acknowledge that it no
+ *    longer touches the stream; init() hands it the next one. Released
+ *    decoders wait in a pool for that.
  **/
 
 class FLACStreamDecoder
 {
 public:
-  /**
-   * Takes ownership of the infile.
-   **/
-  FLACStreamDecoder(char * infile)
-    : m_infile_name(infile)
+  // Read-ahead ring entry; m_buffer points into the ring's preallocated
+  // storage. A block with a non-zero m_result holds no PCM, and marks the
+  // end of the stream or a fatal error, as read() would report it.
+  struct read_block_t
+  {
+    read_block_t()
+      : m_buffer(NULL)
+      , m_size(0)
+      , m_offset(0)
+      , m_result(0)
+      , m_position(0)
+      , m_generation(0)
+    {
+    }
+
+    char *          m_buffer;
+    int             m_size;       // Bytes of PCM in m_buffer
+    int             m_offset;     // Bytes of m_buffer already read
+    int             m_result;
+    int             m_position;   // Sample position of m_buffer's start
+    unsigned        m_generation;
+  };
+
+  typedef aj::spsc_ring<read_block_t> read_ring_t;
+
+  // Thread trampoline arguments
+  struct trampoline
+  {
+    typedef void * (FLACStreamDecoder::* func_t)(void * args);
+
+    FLACStreamDecoder * m_decoder;
+    func_t              m_func;
+    void *              m_args;
+
+    trampoline(FLACStreamDecoder * decoder, func_t func, void * args)
+      : m_decoder(decoder)
+      , m_func(func)
+      , m_args(args)
+    {
+    }
+  };
+
+
+  FLACStreamDecoder()
+    : m_infile_name(NULL)
     , m_infile(NULL)
+    , m_decoder(NULL)
     , m_sample_rate(-1)
     , m_total_samples(-1)
     , m_channels(-1)
     , m_bits_per_sample(-1)
     , m_min_buffer_size(-1)
-    , m_decoder(NULL)
+    , m_max_blocksize(-1)
     , m_finished(false)
     , m_seek_pos(-1)
-    , m_cur_pos(-1)
+    , m_cur_pos(0)
+    , m_frame_index_ready(false)
     , m_buffer(NULL)
     , m_buf_size(-1)
     , m_buf_used(-1)
+    , m_pending(NULL)
+    , m_pending_capacity(0)
+    , m_pending_offset(0)
+    , m_pending_count(0)
+    , m_read_ahead(false)
+    , m_ring(NULL)
+    , m_ring_storage(NULL)
+    , m_read_block_bytes(0)
+    , m_read_pos(0)
+    , m_requested_seek_pos(-1)
+    , m_seek_generation(0)
+    , m_kill_decoder(false)
+    , m_decoder_started(false)
+    , m_stream_open(false)
+    , m_close_serial(0)
+    , m_idle_serial(0)
   {
   }
 
 
   /**
    * There are no exceptions here, so we need to "construct" outside the ctor.
+   * Opens a stream; the previous one, if any, must be closed. Takes
+   * ownership of the infile. With read_ahead, decoding happens on a
+   * separate thread ahead of read().
    * Returns NULL on success, else an error message
    **/
-  char const * const init()
+  char const * const init(char * infile, bool read_ahead)
   {
+    m_infile_name = infile;
+    m_read_ahead = read_ahead;
+
+    m_sample_rate = -1;
+    m_total_samples = -1;
+    m_channels = -1;
+    m_bits_per_sample = -1;
+    m_min_buffer_size = -1;
+    m_max_blocksize = -1;
+    m_finished = false;
+    m_seek_pos = -1;
+    m_cur_pos = 0;
+    m_frame_index_ready = false;
+    m_pending_offset = 0;
+    m_pending_count = 0;
+    m_read_pos = 0;
+
     if (!m_infile_name) {
       return "No file name given!";
     }
 
 
-    // Try to create the Decoder instance
-    m_decoder = FLAC__stream_decoder_new();
+    // Try to create the Decoder instance; a reused instance still has one.
     if (!m_decoder) {
-      return "Could not create FLAC__StreamDecoder!";
+      m_decoder = FLAC__stream_decoder_new();
+      if (!m_decoder) {
+        return "Could not create FLAC__StreamDecoder!";
+      }
     }
 
+    // Remember where frames start as they are decoded, so seeking back
+    // doesn't need to search the file.
+    FLAC__stream_decoder_set_frame_indexing(m_decoder, true);
+
+    // A fine enough SEEKTABLE makes the frame index unnecessary; see
+    // cb_metadata().
+    FLAC__stream_decoder_set_metadata_respond(m_decoder, FLAC__METADATA_TYPE_SEEKTABLE);
+
     // Open file.
     m_infile = fopen(m_infile_name, "r");
     if (!m_infile) {
       return "Could not open file!";
     }
-    aj::log(ANDROID_LOG_DEBUG, LTAG, "FLAC__StreamDecoder opened %s", m_infile_name);
+    AUDIOBOO_LOG(ANDROID_LOG_DEBUG, LTAG, "FLAC__StreamDecoder opened %s", m_infile_name);
 
     // Try initializing the file stream.
     FLAC__StreamDecoderInitStatus init_status = FLAC__stream_decoder_init_stream(
@@ -150,14 +288,81 @@ public:
     if (FLAC__STREAM_DECODER_INIT_STATUS_OK != init_status) {
       return "Could not initialize FLAC__StreamDecoder for the given file!";
     }
-    aj::log(ANDROID_LOG_DEBUG, LTAG, "FLAC__StreamDecoder initialized OK");
+    AUDIOBOO_LOG(ANDROID_LOG_DEBUG, LTAG, "FLAC__StreamDecoder initialized OK");
 
     // Read first frame. That means we also process any metadata.
     FLAC__bool result = FLAC__stream_decoder_process_until_end_of_metadata(m_decoder);
     if (!result) {
       return "Could not read metadata from FLAC__StreamDecoder!";
     }
-    aj::log(ANDROID_LOG_DEBUG, LTAG, "FLAC__StreamDecoder read metadata OK");
+    AUDIOBOO_LOG(ANDROID_LOG_DEBUG, LTAG, "FLAC__StreamDecoder read metadata OK");
+
+    // Holds the part of a frame that didn't fit into the buffer passed to
+    // read(), until the next call.
+    if (m_max_blocksize <= 0 || m_channels <= 0
+        || (8 != m_bits_per_sample && 16 != m_bits_per_sample))
+    {
+      return "Unsupported stream format!";
+    }
+    int pending_size = m_max_blocksize * m_channels * (m_bits_per_sample / 8);
+    if (pending_size > m_pending_capacity) {
+      delete [] m_pending;
+      m_pending = new char[pending_size];
+      m_pending_capacity = pending_size;
+    }
+
+    if (!m_frame_index_ready) {
+      loadFrameIndex();
+    }
+
+    if (!m_read_ahead) {
+      return NULL;
+    }
+
+    // Allocate the read-ahead ring and all of its sample storage up front.
+    // Blocks hold READ_AHEAD_BLOCK_SIZE samples, rounded down to whole
+    // samples for all channels. Storage is sized for 16 bit samples, so that
+    // later streams may use either sample size.
+    int frame_bytes = m_channels * (m_bits_per_sample / 8);
+    m_read_block_bytes = READ_AHEAD_BLOCK_SIZE / m_channels * frame_bytes;
+    if (!m_ring) {
+      int block_bytes = READ_AHEAD_BLOCK_SIZE * sizeof(int16_t);
+      m_ring = new read_ring_t(READ_AHEAD_BLOCKS);
+      m_ring_storage = new char[m_ring->capacity() * block_bytes];
+      for (unsigned i = 0 ; i < m_ring->capacity() ; ++i) {
+        m_ring->slot_at(i).m_buffer = m_ring_storage + i * block_bytes;
+      }
+    }
+
+    // Hand the stream to the decoder thread. One that is already running
+    // just needs waking.
+    m_stream_open = true;
+    __sync_synchronize();
+    if (m_decoder_started) {
+      sem_post(&m_decoder_sem);
+      return NULL;
+    }
+
+    // The decoder thread sleeps on m_decoder_sem while the ring is full; the
+    // JNI thread sleeps on m_reader_sem while it's empty.
+    if (0 != sem_init(&m_decoder_sem, 0, 0)) {
+      return "Could not initialize decoder thread semaphore!";
+    }
+    if (0 != sem_init(&m_reader_sem, 0, 0)) {
+      sem_destroy(&m_decoder_sem);
+      return "Could not initialize reader semaphore!";
+    }
+
+    // Start thread!
+    int err = pthread_create(&m_decoder_thread, NULL,
+        &FLACStreamDecoder::trampoline_func,
+        new trampoline(this, &FLACStreamDecoder::decoder_thread, NULL));
+    if (err) {
+      sem_destroy(&m_decoder_sem);
+      sem_destroy(&m_reader_sem);
+      return "Could not start decoder thread!";
+    }
+    m_decoder_started = true;
 
     return NULL;
   }
@@ -169,12 +374,70 @@ public:
    **/
   ~FLACStreamDecoder()
   {
+    close();
+
+    if (m_decoder_started) {
+      m_kill_decoder = true;
+      __sync_synchronize();
+      sem_post(&m_decoder_sem);
+
+      void * retval = NULL;
+      pthread_join(m_decoder_thread, &retval);
+      sem_destroy(&m_decoder_sem);
+      sem_destroy(&m_reader_sem);
+    }
+
+    delete m_ring;
+    m_ring = NULL;
+    delete [] m_ring_storage;
+    m_ring_storage = NULL;
+
     if (m_decoder) {
-      FLAC__stream_decoder_finish(m_decoder);
       FLAC__stream_decoder_delete(m_decoder);
       m_decoder = NULL;
     }
 
+    delete [] m_pending;
+    m_pending = NULL;
+  }
+
+
+
+  /**
+   * Ends the current stream and releases the infile. The FLAC decoder, the
+   * buffers and the decoder thread are kept for the next init().
+   **/
+  void close()
+  {
+    if (m_decoder_started && m_stream_open) {
+      // Park the decoder thread, and wait until it says it is parked; it may
+      // be in the middle of decoding a block.
+      m_stream_open = false;
+      __sync_synchronize();
+      unsigned serial = m_close_serial + 1;
+      m_close_serial = serial;
+      __sync_synchronize();
+      sem_post(&m_decoder_sem);
+
+      while (m_idle_serial != serial) {
+        while (0 != sem_wait(&m_reader_sem) && EINTR == errno) {
+          // Interrupted, wait again.
+        }
+      }
+      __sync_synchronize();
+
+      // Drop whatever was decoded ahead, and any seek not yet picked up.
+      while (NULL != m_ring->read_slot()) {
+        m_ring->commit_read();
+      }
+      m_requested_seek_pos = -1;
+    }
+    m_stream_open = false;
+
+    if (m_decoder) {
+      FLAC__stream_decoder_finish(m_decoder);
+    }
+
     if (m_infile_name) {
       free(m_infile_name);
       m_infile_name = NULL;
@@ -190,56 +453,106 @@ public:
 
   /**
    * Reads up to bufsize bytes from the FLAC stream and writes them into buffer.
-   * Returns the number of bytes read, or -1 on fatal errors.
+   * Any buffer size works; only whole samples for all channels are written,
+   * and the rest of a frame that doesn't fit is kept for the next call.
+   * Returns the number of bytes read, or a negative value at the end of the
+   * stream and on fatal errors.
    **/
   int read(char * buffer, int bufsize)
   {
-    //aj::log(ANDROID_LOG_DEBUG, LTAG, "read(%d)", bufsize);
-    // If the decoder is at the end of the stream, exit immediately.
-    int ret = checkState();
-    //aj::log(ANDROID_LOG_DEBUG, LTAG, "state: %d", ret);
-    if (0 != ret) {
-      return ret;
+    if (m_read_ahead) {
+      return readAhead(buffer, bufsize);
     }
+    return decode(buffer, bufsize);
+  }
 
-    // These are set temporarily - this object does not own the buffer.
-    m_buffer = buffer;
-    //m_buf_size = 4096; FOR SAMSUNG S2
-    m_buf_size = bufsize / (m_bits_per_sample / 8);
 
-    m_buf_used = 0;
 
-    FLAC__bool result = 0;
-    do {
-      if (m_seek_pos >= 0) {
-        //aj::log(ANDROID_LOG_DEBUG, LTAG, "seek to: %d", m_seek_pos);
-        result = FLAC__stream_decoder_seek_absolute(m_decoder, m_seek_pos);
-        m_cur_pos = m_seek_pos;
-        m_seek_pos = -1;
-        m_buf_used = 0;
+  /**
+   * Decoder thread function. Keeps the read-ahead ring full while a stream
+   * is open, and sleeps in between, until killed.
+   **/
+  void * decoder_thread(void * args)
+  {
+    unsigned generation = 0;
+    bool ended = false;
+    bool open = false;
 
-        ret = checkState();
-        if (-4 == ret) {
-          ret = 0;
-          FLAC__stream_decoder_flush(m_decoder);
-          continue;
+    while (true) {
+      if (m_kill_decoder) {
+        break;
+      }
+
+      // Between streams, acknowledge each close() and sleep. The close
+      // serial is read after the flag, so the acknowledgement can't claim a
+      // close that is still to come.
+      if (!m_stream_open) {
+        __sync_synchronize();
+        unsigned serial = m_close_serial;
+        if (serial != m_idle_serial) {
+          m_idle_serial = serial;
+          __sync_synchronize();
+          sem_post(&m_reader_sem);
+        }
+        open = false;
+
+        while (0 != sem_wait(&m_decoder_sem) && EINTR == errno) {
+          // Interrupted, wait again.
         }
+        continue;
       }
 
-      result = FLAC__stream_decoder_process_single(m_decoder);
+      // A new stream has not ended yet. A seek requested for the previous
+      // one was cleared by close(), so catching up with its generation
+      // below is harmless.
+      if (!open) {
+        open = true;
+        ended = false;
+      }
 
-      ret = checkState();
-       aj::log(ANDROID_LOG_DEBUG, LTAG, "result: %d, used: %d, size: %d, ret: %d", result, m_buf_used, m_buf_size, ret);
-    } while ((0 == ret) && (result && m_buf_used < m_buf_size));
+      // Pick up seek requests before anything else; the seek position must
+      // be read after the generation it belongs to.
+      unsigned requested = m_seek_generation;
+      __sync_synchronize();
+      if (requested != generation) {
+        generation = requested;
+        m_seek_pos = m_requested_seek_pos;
+        ended = false;
+      }
 
-    aj::log(ANDROID_LOG_DEBUG, LTAG, "finished read()");
+      read_block_t * block = ended ? NULL : m_ring->write_slot();
+      if (!block) {
+        // Wait for the reader to free a block, a seek, a close, or being
+        // killed.
+        while (0 != sem_wait(&m_decoder_sem) && EINTR == errno) {
+          // Interrupted, wait again.
+        }
+        continue;
+      }
 
-    // Clear m_buffer, just to be extra-paranoid that it won't accidentally
-    // be freed.
-    m_buffer = NULL;
-    m_buf_size = 0;
-    return (result ? m_buf_used * (m_bits_per_sample / 8) : ret);
+      int ret = decode(block->m_buffer, m_read_block_bytes);
+      if (ret > 0) {
+        block->m_size = ret;
+        block->m_result = 0;
+      }
+      else {
+        block->m_size = 0;
+        block->m_result = (0 == ret ? -8 : ret);
+        ended = true;
+      }
+      block->m_offset = 0;
+      block->m_position = m_cur_pos
+        - block->m_size / (m_channels * (m_bits_per_sample / 8));
+      block->m_generation = generation;
+      m_ring->commit_write();
+      sem_post(&m_reader_sem);
+
+      if (m_kill_decoder) {
+        break;
+      }
+    }
 
+    return NULL;
   }
 
 
@@ -281,14 +594,25 @@ public:
 
   void seekTo(int sample)
   {
-    m_seek_pos = sample;
+    if (!m_read_ahead) {
+      m_seek_pos = sample;
+      return;
+    }
+
+    // Publish the position before the generation that the decoder thread
+    // polls, and wake it in case it's sleeping.
+    m_requested_seek_pos = sample;
+    m_read_pos = sample;
+    __sync_synchronize();
+    m_seek_generation = m_seek_generation + 1;
+    sem_post(&m_decoder_sem);
   }
 
 
 
   int position()
   {
-    return m_cur_pos;
+    return (m_read_ahead ? m_read_pos : m_cur_pos);
   }
 
 
@@ -312,8 +636,7 @@ public:
     if (ferror(m_infile)) {
       return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
     }
-    else if (feof(m_infile)) {
-      m_finished = true;
+    else if (0 == *bytes && feof(m_infile)) {
       return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
     }
 
@@ -372,10 +695,7 @@ public:
   FLAC__bool cb_eof(
       FLAC__StreamDecoder const * decoder)
   {
-    if (feof(m_infile)) {
-      m_finished = true;
-    }
-    return m_finished;
+    return feof(m_infile) ? true : false;
   }
 
 
@@ -408,7 +728,16 @@ public:
   {
     assert(decoder == m_decoder);
 
-    if (!metadata || FLAC__METADATA_TYPE_STREAMINFO != metadata->type) {
+    if (!metadata) {
+      return;
+    }
+
+    if (FLAC__METADATA_TYPE_SEEKTABLE == metadata->type) {
+      m_frame_index_ready = seekTableSuffices(metadata->data.seek_table);
+      return;
+    }
+
+    if (FLAC__METADATA_TYPE_STREAMINFO != metadata->type) {
       return;
     }
 
@@ -416,10 +745,11 @@ public:
     m_total_samples = metadata->data.stream_info.total_samples;
     m_channels = metadata->data.stream_info.channels;
     m_bits_per_sample = metadata->data.stream_info.bits_per_sample;
+    m_max_blocksize = metadata->data.stream_info.max_blocksize;
 
-    // We report the maximum block size, because a buffer that size will hold
-    // any block. Yes, that's somewhat lazy, but blocks aren't *that* large.
-    m_min_buffer_size = metadata->data.stream_info.max_blocksize
+    // read() takes buffers of any size, but one that holds a whole block
+    // needs the fewest calls.
+    m_min_buffer_size = m_max_blocksize
       * (m_bits_per_sample / 8)
       * m_channels;
   }
@@ -438,34 +768,323 @@ public:
 
 private:
 
+  /**
+   * Copies PCM from the read-ahead ring into buffer; the read-ahead
+   * equivalent of decode(). Waits for the decoder thread only if the ring
+   * is empty.
+   **/
+  int readAhead(char * buffer, int bufsize)
+  {
+    int frame_bytes = m_channels * (m_bits_per_sample / 8);
+    int size = bufsize / frame_bytes * frame_bytes;
+    int copied = 0;
+
+    while (copied < size) {
+      read_block_t * block = m_ring->read_slot();
+      if (!block) {
+        while (0 != sem_wait(&m_reader_sem) && EINTR == errno) {
+          // Interrupted, wait again.
+        }
+        continue;
+      }
+
+      // Drop blocks decoded before the last seek.
+      if (block->m_generation != m_seek_generation) {
+        m_ring->commit_read();
+        sem_post(&m_decoder_sem);
+        continue;
+      }
+
+      // End of stream or error; the block stays in the ring, so that later
+      // calls report it again until the next seek.
+      if (block->m_result) {
+        if (0 == copied) {
+          return block->m_result;
+        }
+        break;
+      }
+
+      int count = block->m_size - block->m_offset;
+      if (count > size - copied) {
+        count = size - copied;
+      }
+      memcpy(buffer + copied, block->m_buffer + block->m_offset, count);
+      copied += count;
+      block->m_offset += count;
+      m_read_pos = block->m_position + block->m_offset / frame_bytes;
+
+      if (block->m_offset >= block->m_size) {
+        m_ring->commit_read();
+        sem_post(&m_decoder_sem);
+      }
+    }
+
+    return copied;
+  }
+
+
+
+  /**
+   * Decodes up to bufsize bytes from the FLAC stream into buffer; see
+   * read(). Only ever called on one thread: the JNI thread, or the decoder
+   * thread in read-ahead mode.
+   **/
+  int decode(char * buffer, int bufsize)
+  {
+    int sample_size = m_bits_per_sample / 8;
+
+    // These are set temporarily - this object does not own the buffer.
+    m_buffer = buffer;
+    m_buf_size = bufsize / sample_size / m_channels * m_channels;
+    m_buf_used = 0;
+
+    if (m_seek_pos >= 0) {
+      if (!m_frame_index_ready) {
+        buildFrameIndex();
+      }
+
+      // FLAC hands the frame containing the target sample straight to
+      // cb_write(), so the position must be set before seeking.
+      m_pending_count = 0;
+      m_cur_pos = m_seek_pos;
+      m_seek_pos = -1;
+      m_finished = false;
+      if (!FLAC__stream_decoder_seek_absolute(m_decoder, m_cur_pos)) {
+        m_buf_used = 0;
+        m_pending_count = 0;
+        if (-4 == checkState()) {
+          FLAC__stream_decoder_flush(m_decoder);
+        }
+      }
+    }
+
+    // Hand out what's left of the last frame first.
+    if (m_pending_count > 0 && m_buf_used < m_buf_size) {
+      int count = m_buf_size - m_buf_used;
+      if (count > m_pending_count) {
+        count = m_pending_count;
+      }
+      memcpy(m_buffer + m_buf_used * sample_size,
+          m_pending + m_pending_offset * sample_size, count * sample_size);
+      m_buf_used += count;
+      m_pending_offset += count;
+      m_pending_count -= count;
+      m_cur_pos += count / m_channels;
+    }
+
+    int ret = 0;
+    while (m_buf_used < m_buf_size) {
+      ret = checkState();
+      if (0 != ret) {
+        break;
+      }
+      if (!FLAC__stream_decoder_process_single(m_decoder)) {
+        ret = checkState();
+        break;
+      }
+    }
+
+    // Clear m_buffer, just to be extra-paranoid that it won't accidentally
+    // be freed.
+    m_buffer = NULL;
+    m_buf_size = 0;
+    return (m_buf_used > 0 ? m_buf_used * sample_size : ret);
+  }
+
+
+
+  /**
+   * Returns true if the resolved points of table are no more than
+   * SEEK_TABLE_MAX_SPACING seconds (plus a block) apart from the start of
+   * the stream to its end, so that a seek only reads a few frames. Needs
+   * the STREAMINFO, which always comes first.
+   **/
+  bool seekTableSuffices(FLAC__StreamMetadata_SeekTable const & table)
+  {
+    if (m_sample_rate <= 0 || m_total_samples <= 0) {
+      return false;
+    }
+
+    FLAC__uint64 spacing = static_cast<FLAC__uint64>(SEEK_TABLE_MAX_SPACING)
+      * m_sample_rate + m_max_blocksize;
+    FLAC__uint64 last = 0;
+    for (unsigned i = 0 ; i < table.num_points ; ++i) {
+      FLAC__StreamMetadata_SeekPoint const & point = table.points[i];
+      if (FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER == point.sample_number
+          || 0 == point.frame_samples)
+      {
+        // Placeholder, or a template point the encoder never reached.
+        continue;
+      }
+      if (point.sample_number < last) {
+        return false;
+      }
+      if (point.sample_number - last > spacing) {
+        return false;
+      }
+      last = point.sample_number;
+    }
+    return (static_cast<FLAC__uint64>(m_total_samples) - last <= spacing);
+  }
+
+
+
+  /**
+   * Writes the name of the frame index file for m_infile_name into path:
+   * the recording's path with slashes replaced, in the index directory.
+   * Returns false if there is no index directory, or the name does not fit.
+   **/
+  bool frameIndexPath(char * path, size_t size)
+  {
+    size_t name_offset = 0;
+    int len = -1;
+    pthread_mutex_lock(&index_directory_mutex);
+    if (index_directory) {
+      name_offset = strlen(index_directory) + 1;
+      len = snprintf(path, size, "%s/%s%s", index_directory, m_infile_name,
+          FrameIndex_suffix);
+    }
+    pthread_mutex_unlock(&index_directory_mutex);
+    if (len <= 0 || static_cast<size_t>(len) >= size) {
+      return false;
+    }
+
+    // All index files share one directory.
+    for (char * p = path + name_offset ; *p ; ++p) {
+      if ('/' == *p) {
+        *p = '_';
+      }
+    }
+    return true;
+  }
+
+
+
+  /**
+   * Loads the frame index saved by an earlier decoder of the same file.
+   * libFLAC rejects an index written for a different recording.
+   **/
+  void loadFrameIndex()
+  {
+    char path[PATH_MAX];
+    if (!frameIndexPath(path, sizeof(path))) {
+      return;
+    }
+
+    FILE * file = fopen(path, "rb");
+    if (!file) {
+      return;
+    }
+    m_frame_index_ready = FLAC__stream_decoder_load_frame_index(m_decoder, file);
+    fclose(file);
+  }
+
+
+
+  /**
+   * Indexes all frames by scanning their headers, so that this and every
+   * later seek is a single read, and saves the index to the index
+   * directory, if there is one, for the next decoder.
+   * Recordings made with FLACStreamEncoder's default seek interval don't
+   * need this; their SEEKTABLE already bounds every seek to a few frames.
+   * Other files may have no SEEKTABLE, or one too coarse to help, and
+   * without an index every seek in them bisects the file. Only attempted
+   * once per decoder.
+   **/
+  void buildFrameIndex()
+  {
+    m_frame_index_ready = true;
+
+    if (!FLAC__stream_decoder_build_frame_index(m_decoder)) {
+      AUDIOBOO_LOG(ANDROID_LOG_ERROR, LTAG, "Could not index frames of %s", m_infile_name);
+      return;
+    }
+
+    char path[PATH_MAX];
+    if (!frameIndexPath(path, sizeof(path))) {
+      return;
+    }
+
+    FILE * file = fopen(path, "wb");
+    if (!file) {
+      return;
+    }
+    bool saved = FLAC__stream_decoder_save_frame_index(m_decoder, file);
+    if (0 != fclose(file) || !saved) {
+      remove(path);
+    }
+  }
+
+
+
   /**
    * Copies samples from buffer into m_buffer as sized samples, and interleaved
-   * for multi-channel streams.
+   * for multi-channel streams. Whatever doesn't fit goes to m_pending.
    **/
   template <typename sized_sampleT>
   FLAC__StreamDecoderWriteStatus
   write_internal(int blocksize, FLAC__int32 const * const buffer[])
   {
-    sized_sampleT * outbuf = reinterpret_cast<sized_sampleT *>(m_buffer);
-    m_buffer += m_buf_used;
+    int direct = (m_buf_size - m_buf_used) / m_channels;
+    if (direct > blocksize) {
+      direct = blocksize;
+    }
+    if (blocksize - direct > m_max_blocksize) {
+      // Should never happen; STREAMINFO says no block is this large.
+      return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+    }
 
-    // We need to interleave the samples for each channel; FLAC on the other
-    // hand keeps them in separate buffers.
-    for (int i = 0 ; i < blocksize ; ++i) {
+    interleave(reinterpret_cast<sized_sampleT *>(m_buffer) + m_buf_used,
+        buffer, 0, direct);
+    m_buf_used += direct * m_channels;
+    m_cur_pos += direct;
+
+    interleave(reinterpret_cast<sized_sampleT *>(m_pending), buffer, direct,
+        blocksize);
+    m_pending_offset = 0;
+    m_pending_count = (blocksize - direct) * m_channels;
+
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+  }
+
+
+
+  /**
+   * Interleaves samples [from, to) of each channel in buffer into outbuf.
+   * FLAC keeps the channels in separate buffers.
+   **/
+  template <typename sized_sampleT>
+  inline void interleave(sized_sampleT * outbuf,
+      FLAC__int32 const * const buffer[], int from, int to)
+  {
+    if (1 == m_channels) {
+      for (int i = from ; i < to ; ++i) {
+        *outbuf++ = buffer[0][i];
+      }
+      return;
+    }
+
+    for (int i = from ; i < to ; ++i) {
       for (int channel = 0 ; channel < m_channels ; ++channel) {
-        if (m_buf_used >= m_buf_size) {
-          // Should never happen, if the buffer we've been handed via the read()
-          // function is large enough.
-          return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
-        }
-        *outbuf = buffer[channel][i];
-        ++outbuf;
-        ++m_buf_used;
-        ++m_cur_pos;
+        *outbuf++ = buffer[channel][i];
       }
     }
+  }
 
-    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+
+
+  // Thread trampoline
+  static void * trampoline_func(void * args)
+  {
+    trampoline * tramp = static_cast<trampoline *>(args);
+    FLACStreamDecoder * decoder = tramp->m_decoder;
+    trampoline::func_t func = tramp->m_func;
+
+    void * result = (decoder->*func)(tramp->m_args);
+
+    // Ownership tor tramp is passed to us, so we'll delete it here.
+    delete tramp;
+    return result;
   }
 
 
@@ -513,7 +1132,7 @@ private:
   }
 
 
-  // Configuration values passed to ctor
+  // Configuration values passed to init()
   char *  m_infile_name;
 
   // FILE pointer we're reading.
@@ -528,6 +1147,7 @@ private:
   int m_channels;
   int m_bits_per_sample;
   int m_min_buffer_size;
+  int m_max_blocksize;
 
   bool m_finished;
 
@@ -535,10 +1155,51 @@ private:
   int m_seek_pos;
   int m_cur_pos;
 
-  // Buffer related data, used by write callback and set by read function
+  // Set once the frame index was loaded, or building it was attempted, or
+  // if the SEEKTABLE makes it unnecessary.
+  bool m_frame_index_ready;
+
+  // Buffer related data, used by write callback and set by read function.
+  // Sizes are in samples, counting each channel.
   char *  m_buffer;
   int     m_buf_size;
   int     m_buf_used;
+
+  // Decoded samples that did not fit into the last buffer passed to read();
+  // m_pending holds up to one block, already interleaved and sized.
+  char *  m_pending;
+  int     m_pending_capacity;
+  int     m_pending_offset;
+  int     m_pending_count;
+
+  // Read-ahead mode. Once the decoder thread runs, it alone touches the
+  // FLAC decoder, the file and everything above; the JNI thread only reads
+  // blocks from the ring.
+  bool            m_read_ahead;
+  read_ring_t *   m_ring;
+  char *          m_ring_storage;
+  int             m_read_block_bytes;
+
+  // JNI thread's view of the playback position.
+  int             m_read_pos;
+
+  // Seek requests from the JNI thread to the decoder thread.
+  volatile int      m_requested_seek_pos;
+  volatile unsigned m_seek_generation;
+
+  // Decoder thread
+  pthread_t       m_decoder_thread;
+  sem_t           m_decoder_sem;
+  sem_t           m_reader_sem;
+  volatile bool   m_kill_decoder;
+  bool            m_decoder_started;
+
+  // Stream handover between the JNI thread and the decoder thread; see
+  // close(). The decoder thread sets m_idle_serial to the m_close_serial it
+  // last saw while parked.
+  volatile bool     m_stream_open;
+  volatile unsigned m_close_serial;
+  volatile unsigned m_idle_serial;
 };
 
 
@@ -639,6 +1300,15 @@ void flac_error_helper(
  * Helper functions
  **/
 
+// Global reference to the Java class, and the ID of its mObject field. Both
+// are looked up once, in JNI_OnLoad; see FLACStreamDecoder_onload().
+static jclass   decoder_class         = NULL;
+static jfieldID decoder_object_field  = NULL;
+
+// Closed decoders, ready for the next stream.
+static aj::instance_pool<FLACStreamDecoder> decoder_pool(DECODER_POOL_SIZE);
+
+
 /**
  * Retrieve FLACStreamDecoder instance from the passed jobject.
  **/
@@ -646,13 +1316,7 @@ static FLACStreamDecoder * get_decoder(JNIEnv * env, jobject obj)
 {
   assert(sizeof(jlong) >= sizeof(FLACStreamDecoder *));
 
-  // Do the JNI dance for getting the mObject field
-  jclass cls = env->FindClass(FLACStreamDecoder_classname);
-  jfieldID object_field = env->GetFieldID(cls, FLACStreamDecoder_mObject, "J");
-  jlong decoder_value = env->GetLongField(obj, object_field);
-
-  env->DeleteLocalRef(cls);
-
+  jlong decoder_value = env->GetLongField(obj, decoder_object_field);
   return reinterpret_cast<FLACStreamDecoder *>(decoder_value);
 }
 
@@ -664,41 +1328,76 @@ static void set_decoder(JNIEnv * env, jobject obj, FLACStreamDecoder * decoder)
 {
   assert(sizeof(jlong) >= sizeof(FLACStreamDecoder *));
 
-  // Do the JNI dance for setting the mObject field
   jlong decoder_value = reinterpret_cast<jlong>(decoder);
-  jclass cls = env->FindClass(FLACStreamDecoder_classname);
-  jfieldID object_field = env->GetFieldID(cls, FLACStreamDecoder_mObject, "J");
-  env->SetLongField(obj, object_field, decoder_value);
-  env->DeleteLocalRef(cls);
+  env->SetLongField(obj, decoder_object_field, decoder_value);
 }
 
 
+/**
+ * Convert the handle Java passes to the static native functions back into
+ * the FLACStreamDecoder instance. Throws if there is none.
+ **/
+static FLACStreamDecoder * from_handle(JNIEnv * env, jlong handle)
+{
+  FLACStreamDecoder * decoder = reinterpret_cast<FLACStreamDecoder *>(handle);
+  if (NULL == decoder) {
+    aj::throwByName(env, IllegalArgumentException_classname,
+        "Called without a valid Decoder instance!");
+  }
+  return decoder;
+}
 
 
 } // anonymous namespace
 
 
 
+namespace audioboo {
+namespace jni {
+
+bool FLACStreamDecoder_onload(JNIEnv * env)
+{
+  jclass cls = env->FindClass(FLACStreamDecoder_classname);
+  if (NULL == cls) {
+    return false;
+  }
+  decoder_class = static_cast<jclass>(env->NewGlobalRef(cls));
+  env->DeleteLocalRef(cls);
+
+  decoder_object_field = env->GetFieldID(decoder_class, FLACStreamDecoder_mObject, "J");
+  return (NULL != decoder_class && NULL != decoder_object_field);
+}
+
+}} // namespace audioboo::jni
+
+
+
 /*****************************************************************************
  * JNI Wrappers
+ *
+ * Apart from init() and deinit(), Java passes its mObject handle to static
+ * functions, so no call needs to look up the object's field.
  **/
 
 extern "C" {
 
 void
 Java_com_example_jni_FLACStreamDecoder_init(JNIEnv * env, jobject obj,
-    jstring infile)
+    jstring infile, jboolean read_ahead)
 {
   assert(sizeof(jlong) >= sizeof(FLACStreamDecoder *));
 
-	aj::log(ANDROID_LOG_DEBUG, LTAG,"FLACStreamDecoder_init.., infile=%s", aj::convert_jstring_path(env, infile));
-
-  FLACStreamDecoder * decoder = new FLACStreamDecoder(
-      aj::convert_jstring_path(env, infile));
+  FLACStreamDecoder * decoder = decoder_pool.acquire();
+  if (NULL == decoder) {
+    decoder = new FLACStreamDecoder();
+  }
 
-  char const * const error = decoder->init();
+  char const * const error = decoder->init(
+      aj::convert_jstring_path(env, infile), read_ahead);
   if (NULL != error) {
-    delete decoder;
+    // The instance, with its decoder thread, is as good as before; keep it.
+    decoder->close();
+    decoder_pool.release(decoder);
 
     aj::throwByName(env, IllegalArgumentException_classname, error);
     return;
@@ -713,27 +1412,61 @@ void
 Java_com_example_jni_FLACStreamDecoder_deinit(JNIEnv * env, jobject obj)
 {
   FLACStreamDecoder * decoder = get_decoder(env, obj);
-  delete decoder;
+  if (NULL == decoder) {
+    return;
+  }
   set_decoder(env, obj, NULL);
+
+  decoder->close();
+  decoder_pool.release(decoder);
 }
 
 
 
-jint
-Java_com_example_jni_FLACStreamDecoder_read(JNIEnv * env, jobject obj,
-    jobject buffer, jint bufsize)
+void
+Java_com_example_jni_FLACStreamDecoder_nativeSetPoolSize(JNIEnv * env,
+    jclass cls, jint size)
 {
-  FLACStreamDecoder * decoder = get_decoder(env, obj);
+  decoder_pool.set_capacity(size < 0 ? 0 : size);
+}
+
 
+
+void
+Java_com_example_jni_FLACStreamDecoder_nativeSetIndexDirectory(JNIEnv * env,
+    jclass cls, jstring directory)
+{
+  char * path = NULL;
+  if (NULL != directory) {
+    path = aj::convert_jstring_path(env, directory);
+    if (NULL == path) {
+      return;
+    }
+  }
+
+  pthread_mutex_lock(&index_directory_mutex);
+  char * old_path = index_directory;
+  index_directory = path;
+  pthread_mutex_unlock(&index_directory_mutex);
+
+  free(old_path);
+}
+
+
+
+jint
+Java_com_example_jni_FLACStreamDecoder_nativeRead(JNIEnv * env, jclass cls,
+    jlong handle, jobject buffer, jint bufsize)
+{
+  FLACStreamDecoder * decoder = from_handle(env, handle);
   if (NULL == decoder) {
-    aj::throwByName(env, IllegalArgumentException_classname,
-        "Called without a valid Decoder instance!");
     return 0;
   }
 
   if (bufsize > env->GetDirectBufferCapacity(buffer)) {
     aj::throwByName(env, IllegalArgumentException_classname,
         "Asked to write more to a buffer than the buffer's capacity!");
+    return 0;
   }
 
   char * buf = static_cast<char *>(env->GetDirectBufferAddress(buffer));
@@ -743,13 +1476,11 @@ Java_com_example_jni_FLACStreamDecoder_read(JNIEnv * env, jobject obj,
 
 
 jint
-Java_com_example_jni_FLACStreamDecoder_bitsPerSample(JNIEnv * env, jobject obj)
+Java_com_example_jni_FLACStreamDecoder_nativeBitsPerSample(JNIEnv * env, jclass cls,
+    jlong handle)
 {
-  FLACStreamDecoder * decoder = get_decoder(env, obj);
-
+  FLACStreamDecoder * decoder = from_handle(env, handle);
   if (NULL == decoder) {
-    aj::throwByName(env, IllegalArgumentException_classname,
-        "Called without a valid Decoder instance!");
     return 0;
   }
 
@@ -759,13 +1490,11 @@ Java_com_example_jni_FLACStreamDecoder_bitsPerSample(JNIEnv * env, jobject obj)
 
 
 jint
-Java_com_example_jni_FLACStreamDecoder_channels(JNIEnv * env, jobject obj)
+Java_com_example_jni_FLACStreamDecoder_nativeChannels(JNIEnv * env, jclass cls,
+    jlong handle)
 {
-  FLACStreamDecoder * decoder = get_decoder(env, obj);
-
+  FLACStreamDecoder * decoder = from_handle(env, handle);
   if (NULL == decoder) {
-    aj::throwByName(env, IllegalArgumentException_classname,
-        "Called without a valid Decoder instance!");
     return 0;
   }
 
@@ -775,13 +1504,11 @@ Java_com_example_jni_FLACStreamDecoder_channels(JNIEnv * env, jobject obj)
 
 
 jint
-Java_com_example_jni_FLACStreamDecoder_sampleRate(JNIEnv * env, jobject obj)
+Java_com_example_jni_FLACStreamDecoder_nativeSampleRate(JNIEnv * env, jclass cls,
+    jlong handle)
 {
-  FLACStreamDecoder * decoder = get_decoder(env, obj);
-
+  FLACStreamDecoder * decoder = from_handle(env, handle);
   if (NULL == decoder) {
-    aj::throwByName(env, IllegalArgumentException_classname,
-        "Called without a valid Decoder instance!");
     return 0;
   }
 
@@ -791,13 +1518,11 @@ Java_com_example_jni_FLACStreamDecoder_sampleRate(JNIEnv * env, jobject obj)
 
 
 jint
-Java_com_example_jni_FLACStreamDecoder_minBufferSize(JNIEnv * env, jobject obj)
+Java_com_example_jni_FLACStreamDecoder_nativeMinBufferSize(JNIEnv * env, jclass cls,
+    jlong handle)
 {
-  FLACStreamDecoder * decoder = get_decoder(env, obj);
-
+  FLACStreamDecoder * decoder = from_handle(env, handle);
   if (NULL == decoder) {
-    aj::throwByName(env, IllegalArgumentException_classname,
-        "Called without a valid Decoder instance!");
     return 0;
   }
 
@@ -807,13 +1532,11 @@ Java_com_example_jni_FLACStreamDecoder_minBufferSize(JNIEnv * env, jobject obj)
 
 
 jint
-Java_com_example_jni_FLACStreamDecoder_totalSamples(JNIEnv * env, jobject obj)
+Java_com_example_jni_FLACStreamDecoder_nativeTotalSamples(JNIEnv * env, jclass cls,
+    jlong handle)
 {
-  FLACStreamDecoder * decoder = get_decoder(env, obj);
-
+  FLACStreamDecoder * decoder = from_handle(env, handle);
   if (NULL == decoder) {
-    aj::throwByName(env, IllegalArgumentException_classname,
-        "Called without a valid Decoder instance!");
     return 0;
   }
 
@@ -823,13 +1546,11 @@ Java_com_example_jni_FLACStreamDecoder_totalSamples(JNIEnv * env, jobject obj)
 
 
 void
-Java_com_example_jni_FLACStreamDecoder_seekTo(JNIEnv * env, jobject obj, jint sample)
+Java_com_example_jni_FLACStreamDecoder_nativeSeekTo(JNIEnv * env, jclass cls,
+    jlong handle, jint sample)
 {
-  FLACStreamDecoder * decoder = get_decoder(env, obj);
-
+  FLACStreamDecoder * decoder = from_handle(env, handle);
   if (NULL == decoder) {
-    aj::throwByName(env, IllegalArgumentException_classname,
-        "Called without a valid Decoder instance!");
     return;
   }
 
@@ -839,13 +1560,11 @@ Java_com_example_jni_FLACStreamDecoder_seekTo(JNIEnv * env, jobject obj, jint sa
 
 
 jint
-Java_com_example_jni_FLACStreamDecoder_position(JNIEnv * env, jobject obj)
+Java_com_example_jni_FLACStreamDecoder_nativePosition(JNIEnv * env, jclass cls,
+    jlong handle)
 {
-  FLACStreamDecoder * decoder = get_decoder(env, obj);
-
+  FLACStreamDecoder * decoder = from_handle(env, handle);
   if (NULL == decoder) {
-    aj::throwByName(env, IllegalArgumentException_classname,
-        "Called without a valid Decoder instance!");
     return 0;
   }
 
@@ -11,16 +11,24 @@
 #define __STDINT_LIMITS 1
 #include <stdint.h>
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
 #include <alloca.h>
 #include <limits.h>
+#include <math.h>
+#include <errno.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "FLAC/metadata.h"
 #include "FLAC/stream_encoder.h"
 
 #include "util.h"
+#include "meter.h"
+#include "spsc_ring.h"
+#include "instance_pool.h"
 
 #include <jni.h>
 
@@ -40,6 +48,49 @@ static char const * const LTAG                          = "FLACStreamEncoder/nat
 
 static int COMPRESSION_LEVEL                            = 5;
 
+// Verification decodes every this many frames; the frames in between only
+// get libFLAC's cheaper subframe check. See FLACStreamEncoder::init()
+static int VERIFY_DECODE_INTERVAL                       = 16;
+
+// Write ring dimensions; see FLACStreamEncoder::init()
+static int WRITE_BLOCK_SIZE                             = 32768;
+static int WRITE_RING_BLOCKS                            = 8;
+
+// Padding reserved after the seek table, as a multiple of the table's own
+// size; see FLACStreamEncoder::grow_seek_table()
+static int SEEK_TABLE_PADDING_FACTOR                    = 1;
+
+// Released encoders kept for reuse by default; see encoder_pool below.
+static int ENCODER_POOL_SIZE                            = 1;
+
+// Size of the chunks that hold encoded output in stream mode, in bytes; see
+// FLACStreamEncoder::readOutput()
+static int OUTPUT_CHUNK_SIZE                            = 16384;
+
+
+/*****************************************************************************
+ * FLAC callbacks forward declarations
+ **/
+
+
+FLAC__StreamEncoderWriteStatus flac_write_helper(
+    FLAC__StreamEncoder const * encoder,
+    FLAC__byte const buffer[],
+    size_t bytes,
+    unsigned samples,
+    unsigned current_frame,
+    void * client_data);
+
+FLAC__StreamEncoderSeekStatus flac_seek_helper(
+    FLAC__StreamEncoder const * encoder,
+    FLAC__uint64 absolute_byte_offset,
+    void * client_data);
+
+FLAC__StreamEncoderTellStatus flac_tell_helper(
+    FLAC__StreamEncoder const * encoder,
+    FLAC__uint64 * absolute_byte_offset,
+    void * client_data);
+
 
 
 /*****************************************************************************
@@ -52,54 +103,77 @@ static int COMPRESSION_LEVEL                            = 5;
  *    JNI thread.
  *    There's also a thread on which data is written to disk via FLAC, the
  *    writer thread.
- * 2. Data is passed from the JNI thread to the writer thread via a locked
- *    singly linked list of buffers; the JNI thread appends buffers to the
- *    list, and once appended, relinquishes ownership which passes to the
- *    writer thread. The writer thread processes the list in a FIFO fashion;
- *    we'll call the list the write FIFO.
- * 3. Upon being called by Java to write data, the JNI thread writes the
- *    data to an internal buffer.
- *    If that buffer becomes full,
- *    a) it's appended to the write FIFO, and ownership is relinquished.
- *    b) a new buffer is allocated for subsequent write calls
- *    c) the writer thread is woken.
+ * 2. Data is passed from the JNI thread to the writer thread via a ring of
+ *    fixed-size blocks of raw PCM that is allocated once in init(); we'll
+ *    call it the write ring. The JNI thread is the ring's only producer, the writer
+ *    thread its only consumer, so neither side needs a lock.
+ * 3. Upon being called by Java to write data, the JNI thread copies the
+ *    data into the block at the head of the write ring, as is. Widening to
+ *    FLAC's 32 bit samples happens only once, on the writer thread, while
+ *    FLAC deinterleaves the block into its per-channel buffers.
+ *    If that block becomes full,
+ *    a) it's published to the writer thread, and ownership is relinquished.
+ *    b) the next free block is used for subsequent write calls
+ *    c) the writer thread is woken via a semaphore.
+ * 4. If the writer thread falls so far behind that no free block is left,
+ *    the JNI thread drops the excess data rather than waiting or allocating,
+ *    and write() reports the short write. queueDepth() lets callers watch
+ *    for that before it happens.
+ * 5. finish() publishes the last block and returns at once. The writer thread
+ *    drains the ring, finalizes the file and signals completion through a
+ *    condition variable, on which awaitFinish() and drain() wait with a
+ *    deadline.
+ * 6. The writer thread, the write ring and the FLAC encoder outlive a
+ *    recording. Once finished, an instance can be init()ed with the next
+ *    one; released instances wait in a pool for that. Recordings are
+ *    numbered, so that neither thread mistakes a request or a completion
+ *    for the previous recording's.
+ * 7. In stream mode, FLAC hands the encoded stream to the writer thread,
+ *    which appends it to a list of output chunks instead of writing a file.
+ *    readOutput() consumes the list from any thread while recording goes on;
+ *    chunks it empties are kept for reuse. If an outfile is given as well,
+ *    the stream is mirrored there, and only that copy gets the final
+ *    STREAMINFO and seek table that FLAC writes back when it's finished.
  **/
 
 class FLACStreamEncoder
 {
 public:
-  // Write FIFO
-  struct write_fifo_t
+  // Write ring entry; m_buffer points into the ring's preallocated storage
+  // and holds m_buffer_fill_size samples of m_bits_per_sample each.
+  struct write_block_t
   {
-    write_fifo_t(FLAC__int32 * buf, int fillsize)
-      : m_next(NULL)
-      , m_buffer(buf) // Taking ownership here.
-      , m_buffer_fill_size(fillsize)
+    write_block_t()
+      : m_buffer(NULL)
+      , m_buffer_fill_size(0)
     {
     }
 
+    char *          m_buffer;
+    int             m_buffer_fill_size;
+  };
+
+  typedef aj::spsc_ring<write_block_t> write_ring_t;
 
-    ~write_fifo_t()
+  // Encoded output in stream mode; m_data holds OUTPUT_CHUNK_SIZE bytes, of
+  // which m_size are used.
+  struct output_chunk_t
+  {
+    output_chunk_t()
+      : m_data(new char[OUTPUT_CHUNK_SIZE])
+      , m_size(0)
+      , m_next(NULL)
     {
-      // We have ownership!
-      delete [] m_buffer;
-      delete m_next;
     }
 
-
-    write_fifo_t * last() volatile
+    ~output_chunk_t()
     {
-      volatile write_fifo_t * last = this;
-      while (last->m_next) {
-        last = last->m_next;
-      }
-      return (write_fifo_t *) last;
+      delete [] m_data;
     }
 
-
-    write_fifo_t *  m_next;
-    FLAC__int32 *   m_buffer;
-    int             m_buffer_fill_size;
+    char *            m_data;
+    int               m_size;
+    output_chunk_t *  m_next;
   };
 
   // Thread trampoline arguments
@@ -120,43 +194,122 @@ public:
   };
 
 
-  /**
-   * Takes ownership of the outfile.
-   **/
-  FLACStreamEncoder(char * outfile, int sample_rate, int channels,
-      int bits_per_sample)
-    : m_outfile(outfile)
-    , m_sample_rate(sample_rate)
-    , m_channels(channels)
-    , m_bits_per_sample(bits_per_sample)
+  FLACStreamEncoder()
+    : m_outfile(NULL)
+    , m_sample_rate(-1)
+    , m_channels(-1)
+    , m_bits_per_sample(-1)
+    , m_expected_duration(0)
+    , m_seek_interval(0)
     , m_encoder(NULL)
+    , m_seek_table(NULL)
+    , m_padding(NULL)
+    , m_samples_encoded(0)
+    , m_seek_points(NULL)
+    , m_seek_point_count(0)
+    , m_seek_point_spacing(0)
+    , m_frame_sample(0)
+    , m_audio_offset(0)
     , m_max_amplitude(0)
     , m_average_sum(0)
     , m_average_count(0)
-    , m_write_buffer(NULL)
+    , m_square_sum(0)
+    , m_square_count(0)
+    , m_clip_count(0)
+    , m_sample_max(0)
     , m_write_buffer_size(0)
-    , m_write_buffer_offset(0)
-    , m_fifo(NULL)
+    , m_write_block(NULL)
+    , m_ring(NULL)
+    , m_ring_storage(NULL)
+    , m_widen_buffer(NULL)
+    , m_overruns(0)
+    , m_writer_started(false)
     , m_kill_writer(false)
+    , m_recording(0)
+    , m_finish_requested(0)
+    , m_encode_failed(false)
+    , m_finished(0)
+    , m_finish_ok(false)
+    , m_stream_output(false)
+    , m_file(NULL)
+    , m_stream_length(0)
+    , m_write_offset(0)
+    , m_output_head(NULL)
+    , m_output_tail(NULL)
+    , m_output_free(NULL)
+    , m_output_offset(0)
+    , m_output_ended(false)
   {
+    pthread_mutex_init(&m_done_mutex, NULL);
+    pthread_cond_init(&m_done_cond, NULL);
+    pthread_mutex_init(&m_output_mutex, NULL);
+    pthread_cond_init(&m_output_cond, NULL);
   }
 
 
   /**
    * There are no exceptions here, so we need to "construct" outside the ctor.
+   * Starts a new recording; the previous one, if any, must be finished.
+   * Takes ownership of the outfile.
+   * With stream_output, the encoded stream is read with readOutput(), and
+   * the outfile, which may then be NULL, only mirrors it.
+   * A seek table with a point every seek_interval seconds is reserved for
+   * recordings of up to expected_duration seconds; a seek_interval of 0
+   * means no seek table is written. Streams get none, only files do.
    * Returns NULL on success, else an error message
    **/
-  char const * const init()
+  char const * const init(char * outfile, bool stream_output, int sample_rate,
+      int channels, int bits_per_sample, int expected_duration,
+      int seek_interval)
   {
-    if (!m_outfile) {
+    assert(isFinished());
+
+    if (m_outfile) {
+      free(m_outfile);
+    }
+    m_outfile = outfile;
+    m_sample_rate = sample_rate;
+    m_channels = channels;
+    m_bits_per_sample = bits_per_sample;
+    m_expected_duration = expected_duration;
+    m_seek_interval = seek_interval;
+
+    m_samples_encoded = 0;
+    m_max_amplitude = 0;
+    m_average_sum = 0;
+    m_average_count = 0;
+    m_square_sum = 0;
+    m_square_count = 0;
+    m_clip_count = 0;
+    m_sample_max = (8 == bits_per_sample
+        ? static_cast<int>(aj::type_traits<int8_t>::MAX)
+        : static_cast<int>(aj::type_traits<int16_t>::MAX));
+    m_overruns = 0;
+    m_encode_failed = false;
+
+    // Output the previous recording left unread is dropped.
+    m_stream_output = stream_output;
+    m_stream_length = 0;
+    m_write_offset = 0;
+    reset_output();
+
+    // From here on, the writer thread works for the new recording.
+    ++m_recording;
+
+    if (!m_outfile && !m_stream_output) {
       return "No file name given!";
     }
+    if (8 != m_bits_per_sample && 16 != m_bits_per_sample) {
+      return "Unsupported sample size!";
+    }
 
 
-    // Try to create the encoder instance
-    m_encoder = FLAC__stream_encoder_new();
+    // Try to create the encoder instance; a reused instance still has one.
     if (!m_encoder) {
-      return "Could not create FLAC__StreamEncoder!";
+      m_encoder = FLAC__stream_encoder_new();
+      if (!m_encoder) {
+        return "Could not create FLAC__StreamEncoder!";
+      }
     }
 
     // Try to initialize the encoder.
@@ -165,42 +318,112 @@ public:
     ok &= FLAC__stream_encoder_set_channels(m_encoder, m_channels);
     ok &= FLAC__stream_encoder_set_bits_per_sample(m_encoder, m_bits_per_sample);
     ok &= FLAC__stream_encoder_set_verify(m_encoder, true);
+    ok &= FLAC__stream_encoder_set_verify_decode_interval(m_encoder, VERIFY_DECODE_INTERVAL);
     ok &= FLAC__stream_encoder_set_compression_level(m_encoder, COMPRESSION_LEVEL);
     if (!ok) {
       return "Could not set up FLAC__StreamEncoder with the given parameters!";
     }
 
-    // Try initializing the file stream.
-    FLAC__StreamEncoderInitStatus init_status = FLAC__stream_encoder_init_file(
-        m_encoder, m_outfile, NULL, NULL);
+    // Reserve a seek table template for the expected duration. FLAC fills in
+    // the points as it encodes and writes the table back when it's finished,
+    // along with the final STREAMINFO. The padding behind it leaves room to
+    // grow the table in place if the recording runs longer than expected.
+    if (m_seek_interval > 0 && m_expected_duration > 0 && m_outfile) {
+      m_seek_table = FLAC__metadata_object_new(FLAC__METADATA_TYPE_SEEKTABLE);
+      m_padding = FLAC__metadata_object_new(FLAC__METADATA_TYPE_PADDING);
+      if (!m_seek_table || !m_padding) {
+        return "Could not create seek table!";
+      }
+
+      ok &= FLAC__metadata_object_seektable_template_append_spaced_points_by_samples(
+          m_seek_table, m_seek_interval * m_sample_rate,
+          static_cast<FLAC__uint64>(m_expected_duration) * m_sample_rate);
+      ok &= FLAC__metadata_object_seektable_template_sort(m_seek_table, true);
+      m_padding->length = m_seek_table->length * SEEK_TABLE_PADDING_FACTOR;
+
+      FLAC__StreamMetadata * metadata[] = { m_seek_table, m_padding };
+      ok &= FLAC__stream_encoder_set_metadata(m_encoder, metadata, 2);
+      if (!ok) {
+        return "Could not set up seek table!";
+      }
+
+      // Room for every point the table can grow to; see record_seek_point().
+      m_seek_points = FLAC__metadata_object_new(FLAC__METADATA_TYPE_SEEKTABLE);
+      if (!m_seek_points || !FLAC__metadata_object_seektable_resize_points(
+            m_seek_points, m_seek_table->data.seek_table.num_points
+              + m_padding->length / FLAC__STREAM_METADATA_SEEKPOINT_LENGTH))
+      {
+        return "Could not set up seek table!";
+      }
+      m_seek_point_count = 0;
+      m_seek_point_spacing = static_cast<FLAC__uint64>(m_seek_interval)
+        * m_sample_rate;
+    }
+    m_frame_sample = 0;
+    m_audio_offset = 0;
+
+    // Try initializing the file stream. The file is written through our own
+    // callbacks, so that they see where each frame lands. In stream mode,
+    // FLAC can only go back to finalize the header if there's a mirror file
+    // to do it in.
+    if (m_outfile) {
+      m_file = fopen(m_outfile, "wb");
+      if (!m_file) {
+        return "Could not open the given file!";
+      }
+    }
+
+    FLAC__StreamEncoderInitStatus init_status = FLAC__stream_encoder_init_stream(
+        m_encoder, flac_write_helper,
+        m_file ? flac_seek_helper : NULL,
+        m_file ? flac_tell_helper : NULL,
+        NULL, this);
 
     if (FLAC__STREAM_ENCODER_INIT_STATUS_OK != init_status) {
       return "Could not initialize FLAC__StreamEncoder for the given file!";
     }
 
-    // Allocate write buffer. Based on observations noted down in issue #106, we'll
-    // choose this to be 32k in size. Actual allocation happens lazily.
-    m_write_buffer_size = 32768;
+    // Everything below is set up once, and kept for later recordings.
+    if (m_writer_started) {
+      return NULL;
+    }
 
-    // The write FIFO gets created lazily. But we'll initialize the mutex for it
-    // here.
-    int err = pthread_mutex_init(&m_fifo_mutex, NULL);
-    if (err) {
-      return "Could not initialize FIFO mutex!";
+    // Block size for the write ring. Based on observations noted down in
+    // issue #106, we'll choose this to be 32k samples in size. That is a
+    // multiple of any channel count we support, so blocks always end on a
+    // frame boundary.
+    m_write_buffer_size = WRITE_BLOCK_SIZE;
+
+    // Allocate the write ring and all of its sample storage up front; the JNI
+    // thread must never allocate. Blocks are sized for 16 bit samples, so
+    // that later recordings may use either sample size.
+    if (!m_ring) {
+      int block_bytes = m_write_buffer_size * sizeof(int16_t);
+      m_ring = new write_ring_t(WRITE_RING_BLOCKS);
+      m_ring_storage = new char[m_ring->capacity() * block_bytes];
+      for (unsigned i = 0 ; i < m_ring->capacity() ; ++i) {
+        m_ring->slot_at(i).m_buffer = m_ring_storage + i * block_bytes;
+      }
+
+      // FLAC only takes 16 bit samples as they are; 8 bit samples need
+      // widening on the writer thread first.
+      m_widen_buffer = new FLAC__int32[m_write_buffer_size];
     }
 
-    // Similarly, create the condition variable for the writer thread.
-    err = pthread_cond_init(&m_writer_condition, NULL);
+    // The writer thread sleeps on this semaphore until blocks are published.
+    int err = sem_init(&m_writer_sem, 0, 0);
     if (err) {
-      return "Could not initialize writer thread condition!";
+      return "Could not initialize writer thread semaphore!";
     }
 
     // Start thread!
     err = pthread_create(&m_writer, NULL, &FLACStreamEncoder::trampoline_func,
         new trampoline(this, &FLACStreamEncoder::writer_thread, NULL));
     if (err) {
+      sem_destroy(&m_writer_sem);
       return "Could not start writer thread!";
     }
+    m_writer_started = true;
 
     return NULL;
   }
@@ -208,32 +431,52 @@ public:
 
 
   /**
-   * Destroys encoder instance, releases outfile
+   * Destroys encoder instance, releases outfile. Finishes the file first if
+   * finish() wasn't called, and waits for that to complete.
    **/
   ~FLACStreamEncoder()
   {
-    // Flush thread.
-    flush_to_fifo();
+    if (m_writer_started) {
+      finish();
 
-    pthread_mutex_lock(&m_fifo_mutex);
-    m_kill_writer = true;
-    pthread_mutex_unlock(&m_fifo_mutex);
+      m_kill_writer = true;
+      __sync_synchronize();
+      sem_post(&m_writer_sem);
+
+      // Clean up thread related stuff.
+      void * retval = NULL;
+      pthread_join(m_writer, &retval);
+      sem_destroy(&m_writer_sem);
+    }
+    else {
+      // init() failed before the writer thread could take over.
+      finish_encoder();
+    }
 
-    pthread_cond_broadcast(&m_writer_condition);
+    pthread_cond_destroy(&m_done_cond);
+    pthread_mutex_destroy(&m_done_mutex);
 
-    // Clean up thread related stuff.
-    void * retval = NULL;
-    pthread_join(m_writer, &retval);
-    pthread_cond_destroy(&m_writer_condition);
-    pthread_mutex_destroy(&m_fifo_mutex);
+    reset_output();
+    while (m_output_free) {
+      output_chunk_t * chunk = m_output_free;
+      m_output_free = chunk->m_next;
+      delete chunk;
+    }
+    pthread_cond_destroy(&m_output_cond);
+    pthread_mutex_destroy(&m_output_mutex);
 
-    // Clean up FLAC stuff
     if (m_encoder) {
-      FLAC__stream_encoder_finish(m_encoder);
       FLAC__stream_encoder_delete(m_encoder);
       m_encoder = NULL;
     }
 
+    delete m_ring;
+    m_ring = NULL;
+    delete [] m_ring_storage;
+    m_ring_storage = NULL;
+    delete [] m_widen_buffer;
+    m_widen_buffer = NULL;
+
     if (m_outfile) {
       free(m_outfile);
       m_outfile = NULL;
@@ -243,146 +486,359 @@ public:
 
 
   /**
-   * Flushes internal buffers to disk.
+   * Hands buffered data to the writer thread. Use drain() to wait until the
+   * writer thread has passed it on to libFLAC.
    **/
-  int flush()
+  void flush()
   {
     //aj::log(ANDROID_LOG_DEBUG, LTAG, "flush() called.");
-    flush_to_fifo();
+    if (m_finish_requested == m_recording) {
+      return;
+    }
+    flush_to_ring();
+  }
 
-    // Signal writer to wake up.
-    pthread_cond_signal(&m_writer_condition);
+
+
+  /**
+   * Asks the writer thread to write out everything buffered so far and
+   * finalize the file, and returns without waiting for it. Subsequent writes
+   * are ignored. Use awaitFinish() to wait for completion.
+   **/
+  void finish()
+  {
+    if (!m_writer_started || m_finish_requested == m_recording) {
+      return;
+    }
+
+    flush_to_ring();
+
+    if (m_overruns) {
+      AUDIOBOO_LOG(ANDROID_LOG_WARN, LTAG, "Write ring overran %d times; audio was "
+          "dropped.", m_overruns);
+    }
+
+    m_finish_requested = m_recording;
+    __sync_synchronize();
+    sem_post(&m_writer_sem);
   }
 
 
 
   /**
-   * Writes bufsize elements from buffer to the stream. Returns the number of
-   * bytes actually written.
+   * Waits up to timeout_msec for the file to be finalized after finish().
+   * Returns true if it is; a timeout of 0 just polls, a negative one waits
+   * as long as it takes.
    **/
-  int write(char * buffer, int bufsize)
+  bool awaitFinish(int timeout_msec)
   {
-    //aj::log(ANDROID_LOG_DEBUG, LTAG, "Asked to write buffer of size %d", bufsize);
+    if (!m_writer_started) {
+      return true;
+    }
+
+    struct timespec deadline;
+    deadline_after(timeout_msec, deadline);
+
+    pthread_mutex_lock(&m_done_mutex);
+    int err = 0;
+    while (m_finished != m_recording && ETIMEDOUT != err) {
+      if (timeout_msec < 0) {
+        err = pthread_cond_wait(&m_done_cond, &m_done_mutex);
+      }
+      else {
+        err = pthread_cond_timedwait(&m_done_cond, &m_done_mutex, &deadline);
+      }
+    }
+    bool done = (m_finished == m_recording);
+    pthread_mutex_unlock(&m_done_mutex);
+
+    return done;
+  }
 
-    // We have 8 or 16 bit pcm in the buffer, but FLAC expects 32 bit samples,
-    // where some of the 32 bits are unused.
-    int bufsize32 = bufsize / (m_bits_per_sample / 8);
-    //aj::log(ANDROID_LOG_DEBUG, LTAG, "Required size: %d", bufsize32);
 
-    // Protect from overly large buffers on the JNI side.
-    if (bufsize32 > m_write_buffer_size) {
-      // The only way we can handle this sanely without fragmenting buffers and
-      // so forth is to use a separate code path here. In this, we'll flush the
-      // current write buffer to the FIFO, and immediately append a new
-      // FIFO entry that's as large as bufsize32.
-      flush_to_fifo();
 
-      m_write_buffer = new FLAC__int32[bufsize32];
-      m_write_buffer_offset = 0;
+  /**
+   * Returns true if the current recording is finalized, or there is none.
+   **/
+  bool isFinished()
+  {
+    return awaitFinish(0);
+  }
 
-      int ret = copyBuffer(buffer, bufsize, bufsize32);
-      flush_to_fifo();
 
-      // Signal writer to wake up.
-      pthread_cond_signal(&m_writer_condition);
 
-      return ret;
+  /**
+   * Cleans up after init() failed, like finishing the recording would, so
+   * that the instance can take the next one. Returns once that's done.
+   **/
+  void abandon()
+  {
+    if (m_writer_started) {
+      finish();
+      awaitFinish(-1);
+    }
+    else {
+      finish_encoder();
     }
+  }
+
+
+
+  /**
+   * Returns true if the file was finalized without errors. Only meaningful
+   * once awaitFinish() returned true.
+   **/
+  bool finishSucceeded()
+  {
+    pthread_mutex_lock(&m_done_mutex);
+    bool ok = (m_finished == m_recording) && m_finish_ok;
+    pthread_mutex_unlock(&m_done_mutex);
+    return ok;
+  }
 
 
-    // If the current write buffer cannot hold the amount of data we've
-    // got, push it onto the write FIFO and create a new buffer.
-    if (m_write_buffer && m_write_buffer_offset + bufsize32 > m_write_buffer_size) {
-      aj::log(ANDROID_LOG_DEBUG, LTAG, "JNI buffer is full, pushing to FIFO");
-      flush_to_fifo();
 
-      // Signal writer to wake up.
-      pthread_cond_signal(&m_writer_condition);
+  /**
+   * Flushes, then waits up to timeout_msec for the writer thread to hand
+   * every published block to libFLAC. Returns true if the write ring ran
+   * empty in time. libFLAC may still hold back the last partial frame, and
+   * nothing is synced to storage; only a finished file is complete. Unlike
+   * finish(), the encoder stays usable.
+   **/
+  bool drain(int timeout_msec)
+  {
+    if (!m_writer_started) {
+      return true;
     }
 
-    // If we need to create a new buffer, do so now.
-    if (!m_write_buffer) {
-      //aj::log(ANDROID_LOG_DEBUG, LTAG, "Need new buffer.");
-      m_write_buffer = new FLAC__int32[m_write_buffer_size];
-      m_write_buffer_offset = 0;
+    flush();
+
+    struct timespec deadline;
+    deadline_after(timeout_msec, deadline);
+
+    pthread_mutex_lock(&m_done_mutex);
+    int err = 0;
+    while (m_ring->size() > 0 && m_finished != m_recording
+        && ETIMEDOUT != err)
+    {
+      err = pthread_cond_timedwait(&m_done_cond, &m_done_mutex, &deadline);
     }
+    bool drained = (0 == m_ring->size());
+    pthread_mutex_unlock(&m_done_mutex);
+
+    return drained;
+  }
+
+
+
+  /**
+   * Backpressure: the number of blocks published to the writer thread and
+   * not yet encoded, out of queueCapacity(). Once the two are equal, write()
+   * starts dropping audio.
+   **/
+  int queueDepth()
+  {
+    return m_ring ? m_ring->size() : 0;
+  }
+
 
-    // At this point we know that there's a write buffer, and we know that
-    // there's enough space in it to write the data we've received.
-    return copyBuffer(buffer, bufsize, bufsize32);
+
+  int queueCapacity()
+  {
+    return m_ring ? m_ring->capacity() : 0;
   }
 
 
 
   /**
-   * Writer thread function.
+   * Stream mode only: copies up to bufsize bytes of the encoded stream into
+   * buffer, waiting up to timeout_msec for any to arrive; a negative
+   * timeout waits as long as it takes. Returns the number of bytes copied,
+   * 0 on timeout, or -1 once the recording is finished and all of it was
+   * read, or if the encoder isn't in stream mode.
+   **/
+  int readOutput(char * buffer, int bufsize, int timeout_msec)
+  {
+    if (!m_stream_output) {
+      return -1;
+    }
+
+    struct timespec deadline;
+    deadline_after(timeout_msec, deadline);
+
+    pthread_mutex_lock(&m_output_mutex);
+    int err = 0;
+    while (!output_available() && !m_output_ended && ETIMEDOUT != err) {
+      if (timeout_msec < 0) {
+        err = pthread_cond_wait(&m_output_cond, &m_output_mutex);
+      }
+      else {
+        err = pthread_cond_timedwait(&m_output_cond, &m_output_mutex,
+            &deadline);
+      }
+    }
+
+    int copied = 0;
+    while (copied < bufsize && output_available()) {
+      output_chunk_t * chunk = m_output_head;
+      int count = chunk->m_size - m_output_offset;
+      if (count > bufsize - copied) {
+        count = bufsize - copied;
+      }
+      memcpy(buffer + copied, chunk->m_data + m_output_offset, count);
+      copied += count;
+      m_output_offset += count;
+
+      // Recycle the chunk once read, unless the writer thread is still
+      // filling it.
+      if (m_output_offset >= chunk->m_size
+          && (chunk->m_next || chunk->m_size >= OUTPUT_CHUNK_SIZE))
+      {
+        m_output_head = chunk->m_next;
+        if (!m_output_head) {
+          m_output_tail = NULL;
+        }
+        m_output_offset = 0;
+        chunk->m_next = m_output_free;
+        m_output_free = chunk;
+      }
+    }
+
+    bool ended = m_output_ended && !output_available();
+    pthread_mutex_unlock(&m_output_mutex);
+
+    if (0 == copied && ended) {
+      return -1;
+    }
+    return copied;
+  }
+
+
+
+  /**
+   * Writes bufsize elements from buffer to the stream. Returns the number of
+   * bytes actually written.
+   **/
+  int write(char * buffer, int bufsize)
+  {
+    //aj::log(ANDROID_LOG_DEBUG, LTAG, "Asked to write buffer of size %d", bufsize);
+    if (m_finish_requested == m_recording) {
+      return 0;
+    }
+
+    // We have 8 or 16 bit pcm in the buffer; the write ring counts samples
+    // rather than bytes.
+    int sample_size = m_bits_per_sample / 8;
+    int samples = bufsize / sample_size;
+    //aj::log(ANDROID_LOG_DEBUG, LTAG, "Required size: %d", samples);
+
+    // Buffers larger than the space left in the current block simply spill
+    // over into the next block(s).
+    int written = 0;
+    while (written < samples) {
+      // If we need a new block, grab the next free one from the ring.
+      if (!m_write_block) {
+        m_write_block = m_ring->write_slot();
+        if (!m_write_block) {
+          // The writer thread can't keep up. Blocking here would stall the
+          // AudioRecord thread, so drop the rest of the buffer instead.
+          ++m_overruns;
+          break;
+        }
+        m_write_block->m_buffer_fill_size = 0;
+      }
+
+      int chunk = m_write_buffer_size - m_write_block->m_buffer_fill_size;
+      if (chunk > samples - written) {
+        chunk = samples - written;
+      }
+
+      copyBuffer(buffer + written * sample_size, chunk * sample_size, chunk);
+      written += chunk;
+
+      // If the current block is full, push it to the writer thread.
+      if (m_write_block->m_buffer_fill_size >= m_write_buffer_size) {
+        flush_to_ring();
+      }
+    }
+
+    return written * sample_size;
+  }
+
+
+
+  /**
+   * Writer thread function. Finalizes each recording itself once finish()
+   * was called for it, so that the JNI thread never waits on FLAC, and then
+   * waits for the next one until the instance is destroyed.
    **/
   void * writer_thread(void * args)
   {
     // Loop while m_kill_writer is false.
-    pthread_mutex_lock(&m_fifo_mutex);
+    bool kill = false;
     do {
       //aj::log(ANDROID_LOG_DEBUG, LTAG, "Going to sleep...");
-      pthread_cond_wait(&m_writer_condition, &m_fifo_mutex);
-      //aj::log(ANDROID_LOG_DEBUG, LTAG, "Wakeup: should I die after this? %s", (m_kill_writer ? "yes" : "no"));
-
-      // Grab ownership over the current FIFO, and release the lock again.
-      write_fifo_t * fifo = (write_fifo_t *) m_fifo;
-      while (fifo) {
-        m_fifo = NULL;
-        pthread_mutex_unlock(&m_fifo_mutex);
-
-        // Now we can take all the time we want to iterate over the FIFO's
-        // contents. We just need to make sure to grab the lock again before
-        // going into the next iteration of this loop.
-        int retry = 0;
-
-        write_fifo_t * current = fifo;
-        while (current) {
-          //aj::log(ANDROID_LOG_DEBUG, LTAG, "Encoding current entry %p, buffer %p, size %d",
-          //    current, current->m_buffer, current->m_buffer_fill_size);
-
-          // Encode!
-          FLAC__bool ok = FLAC__stream_encoder_process_interleaved(m_encoder,
-              current->m_buffer, current->m_buffer_fill_size);
-          if (ok) {
-            retry = 0;
+      while (0 != sem_wait(&m_writer_sem) && EINTR == errno) {
+        // Interrupted, wait again.
+      }
+
+      // Read the flags before draining, so that anything published before
+      // they were set is written out before we finish or exit.
+      unsigned finish = m_finish_requested;
+      kill = m_kill_writer;
+      __sync_synchronize();
+      //aj::log(ANDROID_LOG_DEBUG, LTAG, "Wakeup: should I die after this? %s", (kill ? "yes" : "no"));
+
+      // Consume everything that's been published so far. Blocks stay in the
+      // ring while we encode them, and are only handed back afterwards.
+      write_block_t * current = NULL;
+      while (NULL != (current = m_ring->read_slot())) {
+        //aj::log(ANDROID_LOG_DEBUG, LTAG, "Encoding current entry %p, buffer %p, size %d",
+        //    current, current->m_buffer, current->m_buffer_fill_size);
+
+        // Encode! Once FLAC has failed, its state is final and retrying can't
+        // help, so the remaining blocks are only consumed.
+        if (!m_encode_failed) {
+          if (encodeBlock(current)) {
+            m_samples_encoded += current->m_buffer_fill_size / m_channels;
           }
           else {
-            // We don't really know how much was written, we have to assume it was
-            // nothing.
-            if (++retry > 3) {
-              aj::log(ANDROID_LOG_ERROR, LTAG, "Giving up on writing current FIFO!");
-              break;
-            }
-            else {
-              // Sleep a little before retrying.
-              aj::log(ANDROID_LOG_ERROR, LTAG, "Writing FIFO entry %p failed; retrying...");
-              usleep(5000); // 5msec
-            }
-            continue;
+            m_encode_failed = true;
+            AUDIOBOO_LOG(ANDROID_LOG_ERROR, LTAG, "Encoding failed: %s; "
+                "discarding further audio.",
+                FLAC__stream_encoder_get_resolved_state_string(m_encoder));
           }
-
-          current = current->m_next;
         }
 
-        // Once we've written everything, delete the fifo and grab the lock again.
-        delete fifo;
-        pthread_mutex_lock(&m_fifo_mutex);
-        fifo = (write_fifo_t *) m_fifo;
+        m_ring->commit_read();
+
+        // Wake drain(), if anyone is waiting in it.
+        pthread_mutex_lock(&m_done_mutex);
+        pthread_cond_broadcast(&m_done_cond);
+        pthread_mutex_unlock(&m_done_mutex);
       }
 
-      //aj::log(ANDROID_LOG_DEBUG, LTAG, "End of wakeup, or should I die? %s", (m_kill_writer ? "yes" : "no"));
-    } while (!m_kill_writer);
+      // Wakeups left over from a finished recording change nothing here.
+      if (finish != m_finished) {
+        bool ok = finish_encoder();
+
+        // FLAC won't write any more of the stream; let readOutput() know.
+        pthread_mutex_lock(&m_output_mutex);
+        m_output_ended = true;
+        pthread_cond_broadcast(&m_output_cond);
+        pthread_mutex_unlock(&m_output_mutex);
+
+        pthread_mutex_lock(&m_done_mutex);
+        m_finish_ok = ok;
+        m_finished = finish;
+        pthread_cond_broadcast(&m_done_cond);
+        pthread_mutex_unlock(&m_done_mutex);
+      }
 
-    pthread_mutex_unlock(&m_fifo_mutex);
+      //aj::log(ANDROID_LOG_DEBUG, LTAG, "End of wakeup, or should I die? %s", (kill ? "yes" : "no"));
+    } while (!kill);
 
     //aj::log(ANDROID_LOG_DEBUG, LTAG, "Writer thread dies.");
-	for (long i=0;i<50; i++){
-		aj::log(ANDROID_LOG_DEBUG, LTAG,".");
-		usleep(5000);
-	}
-    aj::log(ANDROID_LOG_DEBUG, LTAG, "slept.");
     return NULL;
   }
 
@@ -390,7 +846,7 @@ public:
 
   float getMaxAmplitude()
   {
-    float result = m_max_amplitude;
+    float result = static_cast<float>(m_max_amplitude) / m_sample_max;
     m_max_amplitude = 0;
     return result;
   }
@@ -399,59 +855,451 @@ public:
 
   float getAverageAmplitude()
   {
-    float result = m_average_sum / m_average_count;
+    float result = 0;
+    if (m_average_count) {
+      result = static_cast<float>(m_average_sum) / m_average_count / m_sample_max;
+    }
     m_average_sum = 0;
     m_average_count = 0;
     return result;
   }
 
 
+
+  float getRmsAmplitude()
+  {
+    float result = 0;
+    if (m_square_count) {
+      result = sqrtf(static_cast<float>(m_square_sum) / m_square_count) / m_sample_max;
+    }
+    m_square_sum = 0;
+    m_square_count = 0;
+    return result;
+  }
+
+
+
+  int getClipCount()
+  {
+    int result = m_clip_count;
+    m_clip_count = 0;
+    return result;
+  }
+
+
+
+  /**
+   * Callbacks for FLAC encoder; only ever called on the writer thread.
+   **/
+  FLAC__StreamEncoderWriteStatus cb_write(
+      FLAC__StreamEncoder const * encoder,
+      FLAC__byte const buffer[],
+      size_t bytes,
+      unsigned samples)
+  {
+    // After seeking back to finalize the header, FLAC rewrites what has
+    // long been read from the stream; that only goes to the mirror file.
+    if (m_stream_output && m_write_offset == m_stream_length) {
+      append_stream(buffer, bytes, samples);
+      m_stream_length += bytes;
+    }
+
+    // FLAC writes each frame with a single call, and only ever once.
+    if (0 != samples && m_seek_points) {
+      record_seek_point(samples);
+    }
+
+    if (m_file && 1 != fwrite(buffer, bytes, 1, m_file)) {
+      return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+    }
+    m_write_offset += bytes;
+
+    return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+  }
+
+
+
+  FLAC__StreamEncoderSeekStatus cb_seek(
+      FLAC__StreamEncoder const * encoder,
+      FLAC__uint64 absolute_byte_offset)
+  {
+    if (0 > fseeko(m_file, static_cast<off_t>(absolute_byte_offset), SEEK_SET)) {
+      return FLAC__STREAM_ENCODER_SEEK_STATUS_ERROR;
+    }
+
+    m_write_offset = absolute_byte_offset;
+    return FLAC__STREAM_ENCODER_SEEK_STATUS_OK;
+  }
+
+
+
+  FLAC__StreamEncoderTellStatus cb_tell(
+      FLAC__StreamEncoder const * encoder,
+      FLAC__uint64 * absolute_byte_offset)
+  {
+    *absolute_byte_offset = m_write_offset;
+    return FLAC__STREAM_ENCODER_TELL_STATUS_OK;
+  }
+
+
 private:
   /**
-   * Append current write buffer to FIFO, and clear it.
+   * Finalizes the file and frees the recording's metadata. The FLAC encoder
+   * is kept, along with its buffers, for the next recording. Returns true
+   * if everything written so far made it into the file.
+   **/
+  bool finish_encoder()
+  {
+    bool ok = !m_encode_failed;
+    if (m_encoder) {
+      ok = FLAC__stream_encoder_finish(m_encoder) && ok;
+
+      if (m_file) {
+        ok = (0 == fclose(m_file)) && ok;
+        m_file = NULL;
+      }
+
+      if (ok && m_seek_table) {
+        grow_seek_table();
+      }
+    }
+
+    // The encoder only borrows the metadata, so it must go after the encoder.
+    if (m_seek_table) {
+      FLAC__metadata_object_delete(m_seek_table);
+      m_seek_table = NULL;
+    }
+    if (m_padding) {
+      FLAC__metadata_object_delete(m_padding);
+      m_padding = NULL;
+    }
+    if (m_seek_points) {
+      FLAC__metadata_object_delete(m_seek_points);
+      m_seek_points = NULL;
+    }
+
+    return ok;
+  }
+
+
+
+  /**
+   * Passes what FLAC writes on to the stream, except for the seek table and
+   * the padding behind it. Only the mirror file gets those filled in when
+   * the recording is finished; in the stream they'd stay placeholders. FLAC
+   * writes each metadata block with a call of its own, after the stream
+   * marker and before any audio, and ours last; so the VORBIS_COMMENT FLAC
+   * adds in front of them becomes the stream's last metadata block.
    **/
-  inline void flush_to_fifo()
+  void append_stream(FLAC__byte const * buffer, size_t bytes,
+      unsigned samples)
   {
-    if (!m_write_buffer) {
+    if (0 != samples || !m_seek_table || 0 == m_stream_length) {
+      append_output(buffer, bytes);
       return;
     }
 
-    //aj::log(ANDROID_LOG_DEBUG, LTAG, "Flushing to FIFO.");
+    // Metadata block header: last block flag, then the block type.
+    FLAC__byte header = buffer[0];
+    switch (header & 0x7f) {
+      case FLAC__METADATA_TYPE_SEEKTABLE:
+      case FLAC__METADATA_TYPE_PADDING:
+        break;
+
+      case FLAC__METADATA_TYPE_VORBIS_COMMENT:
+        header |= 0x80;
+        append_output(&header, 1);
+        append_output(buffer + 1, bytes - 1);
+        break;
+
+      default:
+        append_output(buffer, bytes);
+        break;
+    }
+  }
+
+
+
+  /**
+   * Appends encoded output to the last chunk, and to new ones as that fills
+   * up, then wakes readOutput().
+   **/
+  void append_output(FLAC__byte const * buffer, size_t bytes)
+  {
+    pthread_mutex_lock(&m_output_mutex);
+    while (bytes > 0) {
+      if (!m_output_tail || m_output_tail->m_size >= OUTPUT_CHUNK_SIZE) {
+        output_chunk_t * chunk = m_output_free;
+        if (chunk) {
+          m_output_free = chunk->m_next;
+        }
+        else {
+          chunk = new output_chunk_t();
+        }
+        chunk->m_size = 0;
+        chunk->m_next = NULL;
 
-    write_fifo_t * next = new write_fifo_t(m_write_buffer,
-        m_write_buffer_offset);
-    m_write_buffer = NULL;
+        if (m_output_tail) {
+          m_output_tail->m_next = chunk;
+        }
+        else {
+          m_output_head = chunk;
+        }
+        m_output_tail = chunk;
+      }
 
-    pthread_mutex_lock(&m_fifo_mutex);
-    if (m_fifo) {
-      write_fifo_t * last = m_fifo->last();
-      last->m_next = next;
+      size_t count = OUTPUT_CHUNK_SIZE - m_output_tail->m_size;
+      if (count > bytes) {
+        count = bytes;
+      }
+      memcpy(m_output_tail->m_data + m_output_tail->m_size, buffer, count);
+      m_output_tail->m_size += count;
+      buffer += count;
+      bytes -= count;
     }
-    else {
-      m_fifo = next;
+    pthread_cond_broadcast(&m_output_cond);
+    pthread_mutex_unlock(&m_output_mutex);
+  }
+
+
+
+  /**
+   * Moves all output chunks to the free list. The writer thread must not be
+   * appending.
+   **/
+  void reset_output()
+  {
+    pthread_mutex_lock(&m_output_mutex);
+    while (m_output_head) {
+      output_chunk_t * chunk = m_output_head;
+      m_output_head = chunk->m_next;
+      chunk->m_next = m_output_free;
+      m_output_free = chunk;
+    }
+    m_output_tail = NULL;
+    m_output_offset = 0;
+    m_output_ended = false;
+    pthread_mutex_unlock(&m_output_mutex);
+  }
+
+
+
+  /**
+   * True if readOutput() has anything to copy; m_output_mutex must be held.
+   **/
+  inline bool output_available() const
+  {
+    return m_output_head && m_output_offset < m_output_head->m_size;
+  }
+
+
+
+  /**
+   * Absolute CLOCK_REALTIME deadline timeout_msec from now, as
+   * pthread_cond_timedwait() wants it.
+   **/
+  static void deadline_after(int timeout_msec, struct timespec & deadline)
+  {
+    if (timeout_msec < 0) {
+      timeout_msec = 0;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_msec / 1000;
+    deadline.tv_nsec += (timeout_msec % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+
+
+
+  /**
+   * Notes down the frame FLAC is about to write if it holds the next seek
+   * point's sample. When the room reserved in init() runs out, every other
+   * point is dropped and the spacing doubles, so the points always span the
+   * whole recording.
+   **/
+  void record_seek_point(unsigned samples)
+  {
+    if (0 == m_frame_sample) {
+      m_audio_offset = m_write_offset;
+    }
+    FLAC__uint64 first = m_frame_sample;
+    m_frame_sample += samples;
+    if (m_frame_sample <= next_seek_target()) {
+      return;
+    }
+
+    FLAC__StreamMetadata_SeekPoint * points = m_seek_points->data.seek_table.points;
+    unsigned capacity = m_seek_points->data.seek_table.num_points;
+    if (m_seek_point_count == capacity) {
+      for (unsigned i = 0 ; i < capacity ; i += 2) {
+        points[i / 2] = points[i];
+      }
+      m_seek_point_count = (capacity + 1) / 2;
+      m_seek_point_spacing *= 2;
+
+      // The points kept may already cover this frame's targets.
+      if (m_frame_sample <= next_seek_target()) {
+        return;
+      }
+    }
+
+    FLAC__StreamMetadata_SeekPoint & point = points[m_seek_point_count++];
+    point.sample_number = first;
+    point.stream_offset = m_write_offset - m_audio_offset;
+    point.frame_samples = samples;
+  }
+
+
+
+  /**
+   * The first sample a seek point is still needed for: the first multiple
+   * of the spacing past the frame the last point was recorded for.
+   **/
+  FLAC__uint64 next_seek_target() const
+  {
+    if (0 == m_seek_point_count) {
+      return 0;
+    }
+    FLAC__StreamMetadata_SeekPoint const & last =
+      m_seek_points->data.seek_table.points[m_seek_point_count - 1];
+    FLAC__uint64 end = last.sample_number + last.frame_samples;
+    return (end + m_seek_point_spacing - 1) / m_seek_point_spacing
+      * m_seek_point_spacing;
+  }
+
+
+
+  /**
+   * The reserved seek table only has points for the expected duration. If
+   * the recording ran longer, rewrite it with the points recorded as frames
+   * were written, using up to the padding behind it, so neither the audio
+   * nor the rest of the file needs to be read or rewritten.
+   **/
+  void grow_seek_table()
+  {
+    FLAC__uint64 expected = static_cast<FLAC__uint64>(m_expected_duration)
+      * m_sample_rate;
+    if (m_samples_encoded <= expected) {
+      return;
+    }
+
+    // The chain takes ownership of the new table once it's swapped in.
+    FLAC__StreamMetadata * table = FLAC__metadata_object_clone(m_seek_points);
+    if (!table || !FLAC__metadata_object_seektable_resize_points(table,
+          m_seek_point_count))
+    {
+      if (table) {
+        FLAC__metadata_object_delete(table);
+      }
+      AUDIOBOO_LOG(ANDROID_LOG_WARN, LTAG, "Could not grow the seek table of %s; "
+          "it only covers the first %d seconds.", m_outfile,
+          m_expected_duration);
+      return;
+    }
+
+    FLAC__Metadata_Chain * chain = FLAC__metadata_chain_new();
+    FLAC__Metadata_Iterator * iter = FLAC__metadata_iterator_new();
+    bool written = false;
+    if (chain && iter && FLAC__metadata_chain_read(chain, m_outfile)) {
+      FLAC__metadata_iterator_init(iter, chain);
+      do {
+        if (FLAC__METADATA_TYPE_SEEKTABLE
+            == FLAC__metadata_iterator_get_block_type(iter))
+        {
+          if (FLAC__metadata_iterator_set_block(iter, table)) {
+            table = NULL;
+          }
+          break;
+        }
+      } while (FLAC__metadata_iterator_next(iter));
+
+      written = !table
+        && !FLAC__metadata_chain_check_if_tempfile_needed(chain, true)
+        && FLAC__metadata_chain_write(chain, true, false);
+    }
+    if (!written) {
+      AUDIOBOO_LOG(ANDROID_LOG_WARN, LTAG, "Could not grow the seek table of %s; "
+          "it only covers the first %d seconds.", m_outfile,
+          m_expected_duration);
+    }
+
+    if (table) {
+      FLAC__metadata_object_delete(table);
+    }
+    if (iter) {
+      FLAC__metadata_iterator_delete(iter);
+    }
+    if (chain) {
+      FLAC__metadata_chain_delete(chain);
+    }
+  }
+
+
+
+  /**
+   * Hands a write ring block to FLAC. FLAC counts samples per channel here,
+   * not in total.
+   **/
+  inline FLAC__bool encodeBlock(write_block_t const * block)
+  {
+    int samples = block->m_buffer_fill_size / m_channels;
+
+    if (16 == m_bits_per_sample) {
+      return FLAC__stream_encoder_process_interleaved_int16(m_encoder,
+          reinterpret_cast<FLAC__int16 const *>(block->m_buffer), samples);
+    }
+
+    int8_t const * inbuf = reinterpret_cast<int8_t const *>(block->m_buffer);
+    for (int i = 0 ; i < block->m_buffer_fill_size ; ++i) {
+      m_widen_buffer[i] = inbuf[i];
+    }
+    return FLAC__stream_encoder_process_interleaved(m_encoder, m_widen_buffer,
+        samples);
+  }
+
+
+
+  /**
+   * Publish current write block to the writer thread, and wake it.
+   **/
+  inline void flush_to_ring()
+  {
+    if (!m_write_block) {
+      return;
     }
-    //aj::log(ANDROID_LOG_DEBUG, LTAG, "FIFO: %p, new entry: %p", m_fifo, next);
-    pthread_mutex_unlock(&m_fifo_mutex);
+
+    //aj::log(ANDROID_LOG_DEBUG, LTAG, "Flushing to ring.");
+
+    m_write_block = NULL;
+    m_ring->commit_write();
+
+    // Signal writer to wake up.
+    sem_post(&m_writer_sem);
   }
 
 
 
   /**
    * Wrapper around templatized copyBuffer that writes to the current write
-   * buffer at the current offset.
+   * block at the current offset.
    **/
-  inline int copyBuffer(char * buffer, int bufsize, int bufsize32)
+  inline int copyBuffer(char * buffer, int bufsize, int samples)
   {
-    FLAC__int32 * buf = m_write_buffer + m_write_buffer_offset;
+    char * buf = m_write_block->m_buffer
+      + m_write_block->m_buffer_fill_size * (m_bits_per_sample / 8);
 
-    //aj::log(ANDROID_LOG_DEBUG, LTAG, "Writing at %p[%d] = %p", m_write_buffer, m_write_buffer_offset, buf);
+    //aj::log(ANDROID_LOG_DEBUG, LTAG, "Writing at %p[%d] = %p", m_write_block->m_buffer, m_write_block->m_buffer_fill_size, buf);
     if (8 == m_bits_per_sample) {
-      copyBuffer<int8_t>(buf, buffer, bufsize);
-      m_write_buffer_offset += bufsize32;
+      copyBuffer<int8_t>(buf, buffer, samples);
+      m_write_block->m_buffer_fill_size += samples;
     }
     else if (16 == m_bits_per_sample) {
-      copyBuffer<int16_t>(buf, buffer, bufsize);
-      m_write_buffer_offset += bufsize32;
+      copyBuffer<int16_t>(buf, buffer, samples);
+      m_write_block->m_buffer_fill_size += samples;
     }
     else {
       // XXX should never happen, just exit.
@@ -464,40 +1312,26 @@ private:
 
 
   /**
-   * Copies inbuf to outpuf, assuming that inbuf is really a buffer of
+   * Copies inbuf to outpuf, assuming that both are really buffers of
    * sized_sampleT.
-   * As a side effect, m_max_amplitude, m_average_sum and m_average_count are
-   * modified.
+   * As a side effect, the amplitude statistics are updated; the metering
+   * kernel does that in the same pass as the copy.
    **/
   template <typename sized_sampleT>
-  void copyBuffer(FLAC__int32 * outbuf, char * inbuf, int inbufsize)
+  void copyBuffer(char * outbuf, char * inbuf, int samples)
   {
-    sized_sampleT * inbuf_sized = reinterpret_cast<sized_sampleT *>(inbuf);
-    for (int i = 0 ; i < inbufsize / sizeof(sized_sampleT) ; ++i) {
-      sized_sampleT cur = inbuf_sized[i];
-
-      // Convert sized sample to int32
-      outbuf[i] = cur;
-
-      // Convert to float on a range from 0..1
-      if (cur < 0) {
-        // Need to lose precision here, the positive value range is lower than
-        // the negative value range in a signed integer.
-        cur = -(cur + 1);
-      }
-      float amp = static_cast<float>(cur) / aj::type_traits<sized_sampleT>::MAX;
+    aj::meter_stats stats;
+    aj::meter_copy(reinterpret_cast<sized_sampleT const *>(inbuf),
+        reinterpret_cast<sized_sampleT *>(outbuf), samples, stats);
 
-      // Store max amplitude
-      if (amp > m_max_amplitude) {
-        m_max_amplitude = amp;
-      }
-
-      // Sum average.
-      if (!(i % m_channels)) {
-        m_average_sum += amp;
-        ++m_average_count;
-      }
+    if (stats.peak > m_max_amplitude) {
+      m_max_amplitude = stats.peak;
     }
+    m_average_sum += stats.abs_sum;
+    m_average_count += stats.count;
+    m_square_sum += stats.square_sum;
+    m_square_count += stats.count;
+    m_clip_count += stats.clip_count;
   }
 
 
@@ -518,42 +1352,156 @@ private:
 
 
 
-  // Configuration values passed to ctor
+  // Configuration values passed to init()
   char *  m_outfile;
   int     m_sample_rate;
   int     m_channels;
   int     m_bits_per_sample;
+  int     m_expected_duration;
+  int     m_seek_interval;
 
   // FLAC encoder instance
   FLAC__StreamEncoder * m_encoder;
 
-  // Max amplitude measured
-  float   m_max_amplitude;
-  float   m_average_sum;
-  int     m_average_count;
-
-  // JNI thread's buffer.
-  FLAC__int32 * m_write_buffer;
-  int           m_write_buffer_size;
-  int           m_write_buffer_offset;
-
-  // Write FIFO
-  volatile write_fifo_t * m_fifo;
-  pthread_mutex_t         m_fifo_mutex;
+  // Seek table template and the padding it may grow into, handed to the
+  // encoder as metadata. m_samples_encoded counts samples per channel, and
+  // is only touched by the writer thread until the recording is finished.
+  FLAC__StreamMetadata *  m_seek_table;
+  FLAC__StreamMetadata *  m_padding;
+  FLAC__uint64            m_samples_encoded;
+
+  // Seek points for growing the table, recorded as frames are written:
+  // m_seek_point_count of the points in m_seek_points are used, spaced
+  // m_seek_point_spacing samples apart. m_frame_sample is the first sample
+  // of the next frame, m_audio_offset the file offset of the first one.
+  // Writer thread only.
+  FLAC__StreamMetadata *  m_seek_points;
+  unsigned                m_seek_point_count;
+  FLAC__uint64            m_seek_point_spacing;
+  FLAC__uint64            m_frame_sample;
+  FLAC__uint64            m_audio_offset;
+
+  // Amplitude statistics measured since the respective getter was last
+  // called. Magnitudes are in sample units; getters scale them to 0..1 by
+  // dividing by m_sample_max.
+  int32_t m_max_amplitude;
+  int64_t m_average_sum;
+  int64_t m_average_count;
+  int64_t m_square_sum;
+  int64_t m_square_count;
+  int     m_clip_count;
+  int     m_sample_max;
+
+  // Size of each write ring block, in samples.
+  int             m_write_buffer_size;
+
+  // JNI thread's current block; NULL if none has been taken from the ring.
+  write_block_t * m_write_block;
+
+  // Write ring, and the sample storage backing its blocks.
+  write_ring_t *  m_ring;
+  char *          m_ring_storage;
+
+  // Writer thread's buffer for widening 8 bit samples.
+  FLAC__int32 *   m_widen_buffer;
+  int             m_overruns;
 
   // Writer thread
   pthread_t       m_writer;
-  pthread_cond_t  m_writer_condition;
+  sem_t           m_writer_sem;
+  bool            m_writer_started;
   volatile bool   m_kill_writer;
+
+  // Recordings are numbered by init(). m_finish_requested holds the number
+  // of the last recording finish() was called for, m_finished that of the
+  // last one the writer thread finalized.
+  unsigned          m_recording;
+  volatile unsigned m_finish_requested;
+  bool              m_encode_failed;
+
+  // Completion; the writer thread signals m_done_cond whenever it hands a
+  // block back, and once more when the file is finalized.
+  pthread_mutex_t m_done_mutex;
+  pthread_cond_t  m_done_cond;
+  unsigned        m_finished;
+  bool            m_finish_ok;
+
+  // Output. m_file is the outfile, which in stream mode mirrors the stream.
+  // m_stream_length counts the bytes appended to the output chunks,
+  // m_write_offset is FLAC's position in the stream; both belong to the
+  // writer thread.
+  bool            m_stream_output;
+  FILE *          m_file;
+  FLAC__uint64    m_stream_length;
+  FLAC__uint64    m_write_offset;
+
+  // Output chunks from m_output_head to m_output_tail, of which the first
+  // m_output_offset bytes have been read; m_output_ended is set once the
+  // recording is finished. All guarded by m_output_mutex.
+  pthread_mutex_t   m_output_mutex;
+  pthread_cond_t    m_output_cond;
+  output_chunk_t *  m_output_head;
+  output_chunk_t *  m_output_tail;
+  output_chunk_t *  m_output_free;
+  int               m_output_offset;
+  bool              m_output_ended;
 };
 
 
 
+/*****************************************************************************
+ * FLAC callbacks
+ **/
+FLAC__StreamEncoderWriteStatus flac_write_helper(
+    FLAC__StreamEncoder const * encoder,
+    FLAC__byte const buffer[],
+    size_t bytes,
+    unsigned samples,
+    unsigned current_frame,
+    void * client_data)
+{
+  FLACStreamEncoder * enc = static_cast<FLACStreamEncoder *>(client_data);
+  return enc->cb_write(encoder, buffer, bytes, samples);
+}
+
+
+
+FLAC__StreamEncoderSeekStatus flac_seek_helper(
+    FLAC__StreamEncoder const * encoder,
+    FLAC__uint64 absolute_byte_offset,
+    void * client_data)
+{
+  FLACStreamEncoder * enc = static_cast<FLACStreamEncoder *>(client_data);
+  return enc->cb_seek(encoder, absolute_byte_offset);
+}
+
+
+
+FLAC__StreamEncoderTellStatus flac_tell_helper(
+    FLAC__StreamEncoder const * encoder,
+    FLAC__uint64 * absolute_byte_offset,
+    void * client_data)
+{
+  FLACStreamEncoder * enc = static_cast<FLACStreamEncoder *>(client_data);
+  return enc->cb_tell(encoder, absolute_byte_offset);
+}
+
+
+
 
 /*****************************************************************************
  * Helper functions
  **/
 
+// Global reference to the Java class, and the ID of its mObject field. Both
+// are looked up once, in JNI_OnLoad; see FLACStreamEncoder_onload().
+static jclass   encoder_class         = NULL;
+static jfieldID encoder_object_field  = NULL;
+
+// Finished encoders, ready for the next recording.
+static aj::instance_pool<FLACStreamEncoder> encoder_pool(ENCODER_POOL_SIZE);
+
+
 /**
  * Retrieve FLACStreamEncoder instance from the passed jobject.
  **/
@@ -561,13 +1509,7 @@ static FLACStreamEncoder * get_encoder(JNIEnv * env, jobject obj)
 {
   assert(sizeof(jlong) >= sizeof(FLACStreamEncoder *));
 
-  // Do the JNI dance for getting the mObject field
-  jclass cls = env->FindClass(FLACStreamEncoder_classname);
-  jfieldID object_field = env->GetFieldID(cls, FLACStreamEncoder_mObject, "J");
-  jlong encoder_value = env->GetLongField(obj, object_field);
-
-  env->DeleteLocalRef(cls);
-
+  jlong encoder_value = env->GetLongField(obj, encoder_object_field);
   return reinterpret_cast<FLACStreamEncoder *>(encoder_value);
 }
 
@@ -579,12 +1521,23 @@ static void set_encoder(JNIEnv * env, jobject obj, FLACStreamEncoder * encoder)
 {
   assert(sizeof(jlong) >= sizeof(FLACStreamEncoder *));
 
-  // Do the JNI dance for setting the mObject field
   jlong encoder_value = reinterpret_cast<jlong>(encoder);
-  jclass cls = env->FindClass(FLACStreamEncoder_classname);
-  jfieldID object_field = env->GetFieldID(cls, FLACStreamEncoder_mObject, "J");
-  env->SetLongField(obj, object_field, encoder_value);
-  env->DeleteLocalRef(cls);
+  env->SetLongField(obj, encoder_object_field, encoder_value);
+}
+
+
+/**
+ * Convert the handle Java passes to the static native functions back into
+ * the FLACStreamEncoder instance. Throws if there is none.
+ **/
+static FLACStreamEncoder * from_handle(JNIEnv * env, jlong handle)
+{
+  FLACStreamEncoder * encoder = reinterpret_cast<FLACStreamEncoder *>(handle);
+  if (NULL == encoder) {
+    aj::throwByName(env, IllegalArgumentException_classname,
+        "Called without a valid encoder instance!");
+  }
+  return encoder;
 }
 
 
@@ -592,25 +1545,54 @@ static void set_encoder(JNIEnv * env, jobject obj, FLACStreamEncoder * encoder)
 
 
 
+namespace audioboo {
+namespace jni {
+
+bool FLACStreamEncoder_onload(JNIEnv * env)
+{
+  jclass cls = env->FindClass(FLACStreamEncoder_classname);
+  if (NULL == cls) {
+    return false;
+  }
+  encoder_class = static_cast<jclass>(env->NewGlobalRef(cls));
+  env->DeleteLocalRef(cls);
+
+  encoder_object_field = env->GetFieldID(encoder_class, FLACStreamEncoder_mObject, "J");
+  return (NULL != encoder_class && NULL != encoder_object_field);
+}
+
+}} // namespace audioboo::jni
+
+
+
 /*****************************************************************************
  * JNI Wrappers
+ *
+ * Apart from init() and deinit(), Java passes its mObject handle to static
+ * functions, so no call needs to look up the object's field.
  **/
 
 extern "C" {
 
 void
 Java_com_example_jni_FLACStreamEncoder_init(JNIEnv * env, jobject obj,
-    jstring outfile, jint sample_rate, jint channels, jint bits_per_sample)
+    jstring outfile, jboolean stream_output, jint sample_rate, jint channels,
+    jint bits_per_sample, jint expected_duration, jint seek_interval)
 {
   assert(sizeof(jlong) >= sizeof(FLACStreamEncoder *));
 
-  FLACStreamEncoder * encoder = new FLACStreamEncoder(
-      aj::convert_jstring_path(env, outfile), sample_rate, channels,
-      bits_per_sample);
+  FLACStreamEncoder * encoder = encoder_pool.acquire();
+  if (NULL == encoder) {
+    encoder = new FLACStreamEncoder();
+  }
 
-  char const * const error = encoder->init();
+  char * path = (NULL == outfile ? NULL : aj::convert_jstring_path(env, outfile));
+  char const * const error = encoder->init(path, stream_output, sample_rate,
+      channels, bits_per_sample, expected_duration, seek_interval);
   if (NULL != error) {
-    delete encoder;
+    // The instance, with its writer thread, is as good as before; keep it.
+    encoder->abandon();
+    encoder_pool.release(encoder);
 
     aj::throwByName(env, IllegalArgumentException_classname, error);
     return;
@@ -625,27 +1607,42 @@ void
 Java_com_example_jni_FLACStreamEncoder_deinit(JNIEnv * env, jobject obj)
 {
   FLACStreamEncoder * encoder = get_encoder(env, obj);
-  delete encoder;
+  if (NULL == encoder) {
+    return;
+  }
   set_encoder(env, obj, NULL);
+
+  // The file must be complete once release() returns; only then can the
+  // encoder take the next recording.
+  encoder->finish();
+  encoder->awaitFinish(-1);
+  encoder_pool.release(encoder);
 }
 
 
 
-jint
-Java_com_example_jni_FLACStreamEncoder_write(JNIEnv * env, jobject obj,
-    jobject buffer, jint bufsize)
+void
+Java_com_example_jni_FLACStreamEncoder_nativeSetPoolSize(JNIEnv * env,
+    jclass cls, jint size)
 {
-  FLACStreamEncoder * encoder = get_encoder(env, obj);
+  encoder_pool.set_capacity(size < 0 ? 0 : size);
+}
 
+
+
+jint
+Java_com_example_jni_FLACStreamEncoder_nativeWrite(JNIEnv * env, jclass cls,
+    jlong handle, jobject buffer, jint bufsize)
+{
+  FLACStreamEncoder * encoder = from_handle(env, handle);
   if (NULL == encoder) {
-    aj::throwByName(env, IllegalArgumentException_classname,
-        "Called without a valid encoder instance!");
     return 0;
   }
 
   if (bufsize > env->GetDirectBufferCapacity(buffer)) {
     aj::throwByName(env, IllegalArgumentException_classname,
         "Asked to read more from a buffer than the buffer's capacity!");
+    return 0;
   }
 
   char * buf = static_cast<char *>(env->GetDirectBufferAddress(buffer));
@@ -655,13 +1652,11 @@ Java_com_example_jni_FLACStreamEncoder_write(JNIEnv * env, jobject obj,
 
 
 void
-Java_com_example_jni_FLACStreamEncoder_flush(JNIEnv * env, jobject obj)
+Java_com_example_jni_FLACStreamEncoder_nativeFlush(JNIEnv * env, jclass cls,
+    jlong handle)
 {
-  FLACStreamEncoder * encoder = get_encoder(env, obj);
-
+  FLACStreamEncoder * encoder = from_handle(env, handle);
   if (NULL == encoder) {
-    aj::throwByName(env, IllegalArgumentException_classname,
-        "Called without a valid encoder instance!");
     return;
   }
 
@@ -670,30 +1665,137 @@ Java_com_example_jni_FLACStreamEncoder_flush(JNIEnv * env, jobject obj)
 
 
 
-jfloat
-Java_com_example_jni_FLACStreamEncoder_getMaxAmplitude(JNIEnv * env, jobject obj)
+void
+Java_com_example_jni_FLACStreamEncoder_nativeFinish(JNIEnv * env, jclass cls,
+    jlong handle)
 {
-  FLACStreamEncoder * encoder = get_encoder(env, obj);
+  FLACStreamEncoder * encoder = from_handle(env, handle);
+  if (NULL == encoder) {
+    return;
+  }
+
+  encoder->finish();
+}
+
+
+
+jboolean
+Java_com_example_jni_FLACStreamEncoder_nativeAwaitFinish(JNIEnv * env,
+    jclass cls, jlong handle, jint timeout_msec)
+{
+  FLACStreamEncoder * encoder = from_handle(env, handle);
+  if (NULL == encoder) {
+    return false;
+  }
+
+  return encoder->awaitFinish(timeout_msec);
+}
+
 
+
+jboolean
+Java_com_example_jni_FLACStreamEncoder_nativeFinishSucceeded(JNIEnv * env,
+    jclass cls, jlong handle)
+{
+  FLACStreamEncoder * encoder = from_handle(env, handle);
+  if (NULL == encoder) {
+    return false;
+  }
+
+  return encoder->finishSucceeded();
+}
+
+
+
+jboolean
+Java_com_example_jni_FLACStreamEncoder_nativeDrain(JNIEnv * env, jclass cls,
+    jlong handle, jint timeout_msec)
+{
+  FLACStreamEncoder * encoder = from_handle(env, handle);
   if (NULL == encoder) {
+    return false;
+  }
+
+  return encoder->drain(timeout_msec);
+}
+
+
+
+/**
+ * May block for as long as the recording lasts, on another thread than the
+ * one that releases the encoder. The Java side keeps deinit() from pooling
+ * the encoder while a call is in here, and from handing out a stale handle
+ * afterwards; see FLACStreamEncoder.release().
+ **/
+jint
+Java_com_example_jni_FLACStreamEncoder_nativeReadOutput(JNIEnv * env,
+    jclass cls, jlong handle, jobject buffer, jint bufsize, jint timeout_msec)
+{
+  FLACStreamEncoder * encoder = from_handle(env, handle);
+  if (NULL == encoder) {
+    return -1;
+  }
+
+  if (bufsize > env->GetDirectBufferCapacity(buffer)) {
     aj::throwByName(env, IllegalArgumentException_classname,
-        "Called without a valid encoder instance!");
+        "Asked to write more to a buffer than the buffer's capacity!");
+    return -1;
+  }
+
+  char * buf = static_cast<char *>(env->GetDirectBufferAddress(buffer));
+  return encoder->readOutput(buf, bufsize, timeout_msec);
+}
+
+
+
+jint
+Java_com_example_jni_FLACStreamEncoder_nativeGetQueueDepth(JNIEnv * env,
+    jclass cls, jlong handle)
+{
+  FLACStreamEncoder * encoder = from_handle(env, handle);
+  if (NULL == encoder) {
     return 0;
   }
 
-  return encoder->getMaxAmplitude();
+  return encoder->queueDepth();
+}
+
+
+
+jint
+Java_com_example_jni_FLACStreamEncoder_nativeGetQueueCapacity(JNIEnv * env,
+    jclass cls, jlong handle)
+{
+  FLACStreamEncoder * encoder = from_handle(env, handle);
+  if (NULL == encoder) {
+    return 0;
+  }
+
+  return encoder->queueCapacity();
 }
 
 
 
 jfloat
-Java_com_example_jni_FLACStreamEncoder_getAverageAmplitude(JNIEnv * env, jobject obj)
+Java_com_example_jni_FLACStreamEncoder_nativeGetMaxAmplitude(JNIEnv * env,
+    jclass cls, jlong handle)
 {
-  FLACStreamEncoder * encoder = get_encoder(env, obj);
+  FLACStreamEncoder * encoder = from_handle(env, handle);
+  if (NULL == encoder) {
+    return 0;
+  }
+
+  return encoder->getMaxAmplitude();
+}
+
 
+
+jfloat
+Java_com_example_jni_FLACStreamEncoder_nativeGetAverageAmplitude(JNIEnv * env,
+    jclass cls, jlong handle)
+{
+  FLACStreamEncoder * encoder = from_handle(env, handle);
   if (NULL == encoder) {
-    aj::throwByName(env, IllegalArgumentException_classname,
-        "Called without a valid encoder instance!");
     return 0;
   }
 
@@ -701,4 +1803,32 @@ Java_com_example_jni_FLACStreamEncoder_getAverageAmplitude(JNIEnv * env, jobject
 }
 
 
+
+jfloat
+Java_com_example_jni_FLACStreamEncoder_nativeGetRmsAmplitude(JNIEnv * env,
+    jclass cls, jlong handle)
+{
+  FLACStreamEncoder * encoder = from_handle(env, handle);
+  if (NULL == encoder) {
+    return 0;
+  }
+
+  return encoder->getRmsAmplitude();
+}
+
+
+
+jint
+Java_com_example_jni_FLACStreamEncoder_nativeGetClipCount(JNIEnv * env,
+    jclass cls, jlong handle)
+{
+  FLACStreamEncoder * encoder = from_handle(env, handle);
+  if (NULL == encoder) {
+    return 0;
+  }
+
+  return encoder->getClipCount();
+}
+
+
 } // extern "C"
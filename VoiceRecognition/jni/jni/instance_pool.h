@@ -0,0 +1,119 @@
+/**
+ * This file is part of AudioBoo, an android program for audio blogging.
+ * Copyright (C) 2011 Audioboo Ltd. All rights reserved.
+ *
+ * Author: Jens Finkhaeuser <jens@finkhaeuser.de>
+ *
+ * $Id$
+ **/
+
+#ifndef AUDIOBOO_JNI_INSTANCE_POOL_H
+#define AUDIOBOO_JNI_INSTANCE_POOL_H
+
+#include <pthread.h>
+
+namespace audioboo {
+namespace jni {
+
+
+/*****************************************************************************
+ * Pool of idle instances of a class that is expensive to set up, e.g. one
+ * that owns a thread and preallocated buffers.
+ *
+ * release() parks an instance in the pool instead of deleting it, and
+ * acquire() hands it out again, so that it can be initialized with a new
+ * stream. What "idle" means is up to the caller; the pool only stores
+ * pointers. Instances released while the pool is full are deleted.
+ *
+ * The pool holds at most MAX_SIZE instances; set_capacity() limits it
+ * further. All functions may be called from any thread.
+ *
+ * Pools are meant to be static, and have no destructor: deleting the
+ * instances may join their threads, which must not happen in static
+ * destructors at exit, when the log and other statics may already be gone.
+ * Instances still pooled at exit are leaked; call set_capacity(0) to delete
+ * them earlier.
+ **/
+template <typename T, unsigned MAX_SIZE = 8>
+class instance_pool
+{
+public:
+  explicit instance_pool(unsigned capacity)
+    : m_size(0)
+    , m_capacity(capacity > MAX_SIZE ? MAX_SIZE : capacity)
+  {
+    pthread_mutex_init(&m_mutex, NULL);
+  }
+
+
+  /**
+   * Returns an idle instance, or NULL if the pool is empty.
+   **/
+  T * acquire()
+  {
+    T * instance = NULL;
+
+    pthread_mutex_lock(&m_mutex);
+    if (m_size > 0) {
+      instance = m_instances[--m_size];
+    }
+    pthread_mutex_unlock(&m_mutex);
+
+    return instance;
+  }
+
+
+  /**
+   * Takes ownership of an idle instance; deletes it if the pool is full.
+   **/
+  void release(T * instance)
+  {
+    pthread_mutex_lock(&m_mutex);
+    if (m_size < m_capacity) {
+      m_instances[m_size++] = instance;
+      instance = NULL;
+    }
+    pthread_mutex_unlock(&m_mutex);
+
+    delete instance;
+  }
+
+
+  /**
+   * Limits the number of pooled instances, deleting any surplus. A capacity
+   * of 0 disables pooling.
+   **/
+  void set_capacity(unsigned capacity)
+  {
+    T * surplus[MAX_SIZE];
+    unsigned count = 0;
+
+    pthread_mutex_lock(&m_mutex);
+    m_capacity = (capacity > MAX_SIZE ? MAX_SIZE : capacity);
+    while (m_size > m_capacity) {
+      surplus[count++] = m_instances[--m_size];
+    }
+    pthread_mutex_unlock(&m_mutex);
+
+    // Deleting may join threads; don't hold the lock for that.
+    for (unsigned i = 0 ; i < count ; ++i) {
+      delete surplus[i];
+    }
+  }
+
+
+private:
+  // Not copyable.
+  instance_pool(instance_pool const &);
+  instance_pool & operator=(instance_pool const &);
+
+  pthread_mutex_t m_mutex;
+  T *             m_instances[MAX_SIZE];
+  unsigned        m_size;
+  unsigned        m_capacity;
+};
+
+
+}} // namespace audioboo::jni
+
+#endif // guard
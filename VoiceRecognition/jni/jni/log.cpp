@@ -0,0 +1,258 @@
+/**
+ * This file is part of AudioBoo, an android program for audio blogging.
+ * Copyright (C) 2011 Audioboo Ltd. All rights reserved.
+ *
+ * Author: Jens Finkhaeuser <jens@finkhaeuser.de>
+ *
+ * $Id$
+ **/
+
+#include "log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+namespace audioboo {
+namespace jni {
+
+namespace {
+
+/*****************************************************************************
+ * Constants
+ **/
+
+// Records per call site and second that AUDIOBOO_LOG lets through.
+static int const LOG_RATE_LIMIT         = 10;
+
+// Record queue dimensions; the queue size must be a power of two. Messages
+// are cut off at the same length as before there was a queue.
+static unsigned const LOG_QUEUE_SIZE    = 64;
+static int const LOG_MESSAGE_SIZE       = 4096;
+
+// Records of this priority and up skip the queue; see vlog().
+static int const LOG_SYNC_PRIORITY      = ANDROID_LOG_ERROR;
+
+static char const * const LTAG          = "audioboo/log";
+
+
+/*****************************************************************************
+ * Record queue
+ *
+ * Any thread may log, so unlike spsc_ring this is a multi-producer queue;
+ * the log thread is its only consumer. Each slot carries a sequence number
+ * that tells producers and the consumer whose turn it is (after Dmitry
+ * Vyukov's bounded queue). Producers claim a slot with a single compare and
+ * swap, format straight into it, publish it and post log_sem; nobody ever
+ * waits. The log thread sleeps on log_sem while there's nothing to write.
+ **/
+struct log_record
+{
+  volatile unsigned m_sequence;
+  int               m_priority;
+  char const *      m_tag;
+  int               m_suppressed;
+  char              m_message[LOG_MESSAGE_SIZE];
+};
+
+static log_record         queue[LOG_QUEUE_SIZE];
+static volatile unsigned  enqueue_pos = 0;
+static unsigned           dequeue_pos = 0;
+static volatile int       dropped = 0;
+
+static sem_t              log_sem;
+static pthread_once_t     log_once = PTHREAD_ONCE_INIT;
+
+
+
+/**
+ * Writes a record out; the only place that does I/O.
+ **/
+static void sink(int priority, char const * tag, char const * message)
+{
+#if defined(__ANDROID__)
+  __android_log_write(priority, tag, message);
+#else
+  static char const levels[] = "??VDIWEFS";
+  fprintf(stderr, "%c/%s: %s\n",
+      (priority >= 0 && priority < static_cast<int>(sizeof(levels) - 1))
+        ? levels[priority] : '?',
+      tag, message);
+#endif
+}
+
+
+
+/**
+ * Writes a record out, noting how many similar ones were suppressed before.
+ **/
+static void sink_record(int priority, char const * tag, int suppressed,
+    char const * message)
+{
+  if (suppressed) {
+    char line[LOG_MESSAGE_SIZE + 64];
+    snprintf(line, sizeof(line), "%s [%d similar suppressed]", message,
+        suppressed);
+    sink(priority, tag, line);
+  }
+  else {
+    sink(priority, tag, message);
+  }
+}
+
+
+
+/**
+ * Log thread; drains the queue whenever a producer posts log_sem.
+ **/
+static void * log_thread(void *)
+{
+  while (true) {
+    while (0 != sem_wait(&log_sem) && EINTR == errno) {
+      // Interrupted, wait again.
+    }
+
+    while (true) {
+      log_record & record = queue[dequeue_pos & (LOG_QUEUE_SIZE - 1)];
+      if (record.m_sequence != dequeue_pos + 1) {
+        break;
+      }
+      __sync_synchronize();
+
+      sink_record(record.m_priority, record.m_tag, record.m_suppressed,
+          record.m_message);
+
+      // Hand the slot back to producers for the next lap.
+      __sync_synchronize();
+      record.m_sequence = dequeue_pos + LOG_QUEUE_SIZE;
+      ++dequeue_pos;
+    }
+
+    int lost = __sync_lock_test_and_set(&dropped, 0);
+    if (lost) {
+      char line[64];
+      snprintf(line, sizeof(line), "Log queue full; %d records dropped.", lost);
+      sink(ANDROID_LOG_WARN, LTAG, line);
+    }
+  }
+  return NULL;
+}
+
+
+
+static void start_log_thread()
+{
+  for (unsigned i = 0 ; i < LOG_QUEUE_SIZE ; ++i) {
+    queue[i].m_sequence = i;
+  }
+  __sync_synchronize();
+  sem_init(&log_sem, 0, 0);
+
+  pthread_t thread;
+  if (0 == pthread_create(&thread, NULL, &log_thread, NULL)) {
+    pthread_detach(thread);
+  }
+}
+
+
+
+/**
+ * Queues a record for the log thread. Errors are written out right away
+ * instead, so they aren't lost with the queue if the process is about to
+ * die, at the price of the I/O on the calling thread; they may then
+ * overtake records still in the queue.
+ **/
+static void vlog(int priority, char const * tag, int suppressed,
+    char const * format, va_list args)
+{
+  if (priority >= LOG_SYNC_PRIORITY) {
+    char message[LOG_MESSAGE_SIZE];
+    vsnprintf(message, sizeof(message), format, args);
+    sink_record(priority, tag, suppressed, message);
+    return;
+  }
+
+  pthread_once(&log_once, &start_log_thread);
+
+  // Claim a slot.
+  unsigned pos = enqueue_pos;
+  log_record * record = NULL;
+  while (true) {
+    record = &queue[pos & (LOG_QUEUE_SIZE - 1)];
+    int diff = static_cast<int>(record->m_sequence - pos);
+    if (0 == diff) {
+      if (__sync_bool_compare_and_swap(&enqueue_pos, pos, pos + 1)) {
+        break;
+      }
+    }
+    else if (diff < 0) {
+      // The log thread is a whole lap behind.
+      __sync_add_and_fetch(&dropped, 1);
+      sem_post(&log_sem);
+      return;
+    }
+    pos = enqueue_pos;
+  }
+  __sync_synchronize();
+
+  record->m_priority = priority;
+  record->m_tag = tag;
+  record->m_suppressed = suppressed;
+  vsnprintf(record->m_message, sizeof(record->m_message), format, args);
+
+  // Publish it.
+  __sync_synchronize();
+  record->m_sequence = pos + 1;
+  sem_post(&log_sem);
+}
+
+} // anonymous namespace
+
+
+
+bool
+log_rate_limit::allow(int & suppressed)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  unsigned window = static_cast<unsigned>(now.tv_sec);
+
+  if (window != m_window) {
+    m_window = window;
+    m_count = 0;
+    suppressed = __sync_lock_test_and_set(&m_suppressed, 0);
+  }
+
+  if (__sync_add_and_fetch(&m_count, 1) > LOG_RATE_LIMIT) {
+    __sync_add_and_fetch(&m_suppressed, 1);
+    return false;
+  }
+  return true;
+}
+
+
+
+void log(int priority, char const * tag, char const * format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  vlog(priority, tag, 0, format, args);
+  va_end(args);
+}
+
+
+
+void log_limited(int priority, char const * tag, int suppressed,
+    char const * format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  vlog(priority, tag, suppressed, format, args);
+  va_end(args);
+}
+
+
+}} // namespace audioboo::jni
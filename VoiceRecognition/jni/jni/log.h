@@ -0,0 +1,108 @@
+/**
+ * This file is part of AudioBoo, an android program for audio blogging.
+ * Copyright (C) 2011 Audioboo Ltd. All rights reserved.
+ *
+ * Author: Jens Finkhaeuser <jens@finkhaeuser.de>
+ *
+ * $Id$
+ **/
+
+#ifndef AUDIOBOO_JNI_LOG_H
+#define AUDIOBOO_JNI_LOG_H
+
+#include <stdarg.h>
+
+#if defined(__ANDROID__)
+#include <android/log.h>
+#else
+// Host builds have no liblog; mirror its priorities so call sites compile
+// unchanged. Records go to stderr instead.
+enum {
+  ANDROID_LOG_UNKNOWN = 0,
+  ANDROID_LOG_DEFAULT,
+  ANDROID_LOG_VERBOSE,
+  ANDROID_LOG_DEBUG,
+  ANDROID_LOG_INFO,
+  ANDROID_LOG_WARN,
+  ANDROID_LOG_ERROR,
+  ANDROID_LOG_FATAL,
+  ANDROID_LOG_SILENT,
+};
+#endif
+
+
+/*****************************************************************************
+ * Records below this priority are compiled out by AUDIOBOO_LOG. Release
+ * builds keep INFO and up, debug builds everything from DEBUG.
+ **/
+#if !defined(AUDIOBOO_LOG_LEVEL)
+#  if defined(NDEBUG)
+#    define AUDIOBOO_LOG_LEVEL ANDROID_LOG_INFO
+#  else
+#    define AUDIOBOO_LOG_LEVEL ANDROID_LOG_DEBUG
+#  endif
+#endif
+
+
+namespace audioboo {
+namespace jni {
+
+
+/*****************************************************************************
+ * Per call site rate limit; see AUDIOBOO_LOG. Plain data, so that a static
+ * instance needs no guarded initialization. Races between threads sharing
+ * a call site only make the limit approximate.
+ **/
+struct log_rate_limit
+{
+  unsigned  m_window;
+  int       m_count;
+  int       m_suppressed;
+
+  /**
+   * Returns true if another record may be logged in the current one second
+   * window. When a new window starts, suppressed is set to the number of
+   * records dropped in the last one.
+   **/
+  bool allow(int & suppressed);
+};
+
+
+/**
+ * Log stuff printf-style. The record is formatted on the calling thread,
+ * and written out on a background thread; the call never blocks on I/O.
+ * tag must stay valid until then, e.g. be a string literal.
+ * If the record queue is full, the record is dropped and counted.
+ * ANDROID_LOG_ERROR and up are the exception: they are written out before
+ * the call returns.
+ **/
+void log(int priority, char const * tag, char const * format, ...);
+
+/**
+ * As log(), but noting how many records from the same call site were
+ * suppressed by rate limiting before this one.
+ **/
+void log_limited(int priority, char const * tag, int suppressed,
+    char const * format, ...);
+
+
+}} // namespace audioboo::jni
+
+
+/*****************************************************************************
+ * Preferred way of logging. Filters by AUDIOBOO_LOG_LEVEL at compile time,
+ * and logs at most a handful of records per second from each call site.
+ **/
+#define AUDIOBOO_LOG(priority, tag, ...)                                      \
+  do {                                                                        \
+    if ((priority) >= AUDIOBOO_LOG_LEVEL) {                                   \
+      static audioboo::jni::log_rate_limit audioboo_log_limit_;               \
+      int audioboo_log_suppressed_ = 0;                                       \
+      if (audioboo_log_limit_.allow(audioboo_log_suppressed_)) {              \
+        audioboo::jni::log_limited((priority), (tag),                         \
+            audioboo_log_suppressed_, __VA_ARGS__);                           \
+      }                                                                       \
+    }                                                                         \
+  } while (0)
+
+#endif // guard
@@ -0,0 +1,158 @@
+/**
+ * This file is part of AudioBoo, an android program for audio blogging.
+ * Copyright (C) 2011 Audioboo Ltd. All rights reserved.
+ *
+ * Author: Jens Finkhaeuser <jens@finkhaeuser.de>
+ *
+ * $Id$
+ **/
+
+#include "meter.h"
+#include "util.h"
+
+#if defined(AUDIOBOO_HAVE_NEON) && !defined(__aarch64__)
+#  if defined(__ANDROID__)
+#    include <cpu-features.h>
+#  else
+#    include <sys/auxv.h>
+#    include <asm/hwcap.h>
+#  endif
+#endif
+
+namespace audioboo {
+namespace jni {
+
+namespace {
+
+/*****************************************************************************
+ * Plain C kernel, also used for the tails the vector kernels leave over.
+ **/
+template <typename sized_sampleT>
+inline void
+meter_copy_c(sized_sampleT const * inbuf, sized_sampleT * outbuf, int count,
+    meter_stats & stats)
+{
+  int32_t peak = stats.peak;
+  int64_t abs_sum = 0;
+  int64_t square_sum = 0;
+  int32_t clip_count = 0;
+
+  for (int i = 0 ; i < count ; ++i) {
+    sized_sampleT cur = inbuf[i];
+    outbuf[i] = cur;
+
+    // Need to lose precision here, the positive value range is lower than
+    // the negative value range in a signed integer.
+    int32_t folded = (cur < 0) ? -(cur + 1) : cur;
+
+    if (folded > peak) {
+      peak = folded;
+    }
+    abs_sum += folded;
+    square_sum += folded * folded;
+    clip_count += (folded == type_traits<sized_sampleT>::MAX);
+  }
+
+  stats.peak = peak;
+  stats.abs_sum += abs_sum;
+  stats.square_sum += square_sum;
+  stats.clip_count += clip_count;
+  stats.count += count;
+}
+
+
+
+/*****************************************************************************
+ * Runtime kernel selection
+ **/
+#if defined(AUDIOBOO_HAVE_NEON) || defined(__aarch64__)
+bool have_neon()
+{
+#if defined(__aarch64__)
+  // NEON is mandatory on ARMv8.
+  return true;
+#elif defined(AUDIOBOO_HAVE_NEON)
+  // Built with the NEON kernels, but ARMv7 cores may still lack NEON (e.g.
+  // Tegra 2), so ask the CPU.
+#  if defined(__ANDROID__)
+  return ANDROID_CPU_FAMILY_ARM == android_getCpuFamily()
+    && (android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON);
+#  else
+  return getauxval(AT_HWCAP) & HWCAP_NEON;
+#  endif
+#endif
+}
+#endif
+
+
+
+meter_copy16_t select_copy16()
+{
+#if defined(AUDIOBOO_HAVE_NEON) || defined(__aarch64__)
+  if (have_neon()) {
+    return meter_copy16_neon;
+  }
+#endif
+#if defined(__SSE2__)
+  // SSE2 is part of the baseline of every x86 ABI we'd be built for.
+  return meter_copy16_sse2;
+#endif
+  return meter_copy16_c;
+}
+
+
+
+meter_copy8_t select_copy8()
+{
+#if defined(AUDIOBOO_HAVE_NEON) || defined(__aarch64__)
+  if (have_neon()) {
+    return meter_copy8_neon;
+  }
+#endif
+#if defined(__SSE2__)
+  return meter_copy8_sse2;
+#endif
+  return meter_copy8_c;
+}
+
+
+// Selected once, when the library is loaded.
+meter_copy16_t const meter_copy16_impl = select_copy16();
+meter_copy8_t const meter_copy8_impl = select_copy8();
+
+} // anonymous namespace
+
+
+
+void meter_copy16_c(int16_t const * inbuf, int16_t * outbuf, int count,
+    meter_stats & stats)
+{
+  meter_copy_c<int16_t>(inbuf, outbuf, count, stats);
+}
+
+
+
+void meter_copy8_c(int8_t const * inbuf, int8_t * outbuf, int count,
+    meter_stats & stats)
+{
+  meter_copy_c<int8_t>(inbuf, outbuf, count, stats);
+}
+
+
+
+void meter_copy(int16_t const * inbuf, int16_t * outbuf, int count,
+    meter_stats & stats)
+{
+  meter_copy16_impl(inbuf, outbuf, count, stats);
+}
+
+
+
+void meter_copy(int8_t const * inbuf, int8_t * outbuf, int count,
+    meter_stats & stats)
+{
+  meter_copy8_impl(inbuf, outbuf, count, stats);
+}
+
+
+}} // namespace audioboo::jni
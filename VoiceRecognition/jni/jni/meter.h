@@ -0,0 +1,89 @@
+/**
+ * This file is part of AudioBoo, an android program for audio blogging.
+ * Copyright (C) 2011 Audioboo Ltd. All rights reserved.
+ *
+ * Author: Jens Finkhaeuser <jens@finkhaeuser.de>
+ *
+ * $Id$
+ **/
+
+#ifndef AUDIOBOO_JNI_METER_H
+#define AUDIOBOO_JNI_METER_H
+
+// Define __STDINT_LIMITS to get INT8_MAX and INT16_MAX.
+#define __STDINT_LIMITS 1
+#include <stdint.h>
+
+namespace audioboo {
+namespace jni {
+
+
+/*****************************************************************************
+ * Amplitude metering
+ *
+ * The metering kernels copy PCM from one buffer to another and, in the same
+ * pass, gather the statistics below. All magnitudes are "folded" the way the
+ * encoder always measured amplitude: negative samples x count as -(x + 1), so
+ * that the full negative range maps onto the positive one.
+ **/
+struct meter_stats
+{
+  int32_t peak;         // Largest folded magnitude seen
+  int64_t abs_sum;      // Sum of folded magnitudes
+  int64_t square_sum;   // Sum of squared folded magnitudes
+  int32_t clip_count;   // Samples at either end of the value range
+  int64_t count;        // Number of samples measured
+
+  meter_stats()
+    : peak(0)
+    , abs_sum(0)
+    , square_sum(0)
+    , clip_count(0)
+    , count(0)
+  {
+  }
+};
+
+
+/**
+ * Copies count samples from inbuf to outbuf, and adds their statistics to
+ * stats. The buffers may be unaligned, but must not overlap.
+ *
+ * The implementation is picked at runtime from NEON, SSE2 or plain C,
+ * depending on what the CPU supports.
+ **/
+void meter_copy(int16_t const * inbuf, int16_t * outbuf, int count,
+    meter_stats & stats);
+void meter_copy(int8_t const * inbuf, int8_t * outbuf, int count,
+    meter_stats & stats);
+
+
+/**
+ * Kernel signatures and the individual implementations; only meant for use
+ * by meter.cpp and the kernel sources.
+ **/
+typedef void (*meter_copy16_t)(int16_t const *, int16_t *, int, meter_stats &);
+typedef void (*meter_copy8_t)(int8_t const *, int8_t *, int, meter_stats &);
+
+void meter_copy16_c(int16_t const * inbuf, int16_t * outbuf, int count,
+    meter_stats & stats);
+void meter_copy8_c(int8_t const * inbuf, int8_t * outbuf, int count,
+    meter_stats & stats);
+
+#if defined(AUDIOBOO_HAVE_NEON) || defined(__aarch64__)
+void meter_copy16_neon(int16_t const * inbuf, int16_t * outbuf, int count,
+    meter_stats & stats);
+void meter_copy8_neon(int8_t const * inbuf, int8_t * outbuf, int count,
+    meter_stats & stats);
+#endif
+
+#if defined(__SSE2__)
+void meter_copy16_sse2(int16_t const * inbuf, int16_t * outbuf, int count,
+    meter_stats & stats);
+void meter_copy8_sse2(int8_t const * inbuf, int8_t * outbuf, int count,
+    meter_stats & stats);
+#endif
+
+}} // namespace audioboo::jni
+
+#endif // guard
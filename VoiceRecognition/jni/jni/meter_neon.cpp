@@ -0,0 +1,177 @@
+/**
+ * This file is part of AudioBoo, an android program for audio blogging.
+ * Copyright (C) 2011 Audioboo Ltd. All rights reserved.
+ *
+ * Author: Jens Finkhaeuser <jens@finkhaeuser.de>
+ *
+ * $Id$
+ **/
+
+#include "meter.h"
+
+#if defined(AUDIOBOO_HAVE_NEON) || defined(__aarch64__)
+
+#include <arm_neon.h>
+
+namespace audioboo {
+namespace jni {
+
+namespace {
+
+// Vectors per round. Each round ends by widening the 16 and 32 bit lane
+// accumulators into 64 bit ones; this bounds them well below overflow.
+enum {
+  ROUND_VECTORS = 2048,
+};
+
+
+/*****************************************************************************
+ * Per-lane accumulators; all lanes are summed up once at the very end.
+ **/
+struct accumulators
+{
+  int16x8_t peak;       // folded maxima
+  int64x2_t abs_sum;
+  int64x2_t square_sum;
+  int64x2_t clips;
+
+  // Round accumulators
+  int32x4_t round_abs;
+  int16x8_t round_clips;
+
+  accumulators()
+  {
+    peak = vdupq_n_s16(0);
+    abs_sum = square_sum = clips = vdupq_n_s64(0);
+    round_abs = vdupq_n_s32(0);
+    round_clips = vdupq_n_s16(0);
+  }
+
+
+  /**
+   * Accumulates 8 int16 samples.
+   **/
+  inline void add(int16x8_t x, int16x8_t max)
+  {
+    // Fold negative x to -(x + 1), i.e. x ^ (x >> 15)
+    int16x8_t folded = veorq_s16(x, vshrq_n_s16(x, 15));
+
+    peak = vmaxq_s16(peak, folded);
+
+    round_abs = vpadalq_s16(round_abs, folded);
+
+    int16x4_t lo = vget_low_s16(folded);
+    int16x4_t hi = vget_high_s16(folded);
+    square_sum = vpadalq_s32(square_sum, vmull_s16(lo, lo));
+    square_sum = vpadalq_s32(square_sum, vmull_s16(hi, hi));
+
+    // Compare yields all bits set, i.e. -1, per clipped lane.
+    round_clips = vsubq_s16(round_clips,
+        vreinterpretq_s16_u16(vceqq_s16(folded, max)));
+  }
+
+
+  /**
+   * Widens the round accumulators.
+   **/
+  inline void end_round()
+  {
+    abs_sum = vpadalq_s32(abs_sum, round_abs);
+    clips = vpadalq_s32(clips, vpaddlq_s16(round_clips));
+
+    round_abs = vdupq_n_s32(0);
+    round_clips = vdupq_n_s16(0);
+  }
+
+
+  /**
+   * Sums up lanes into stats.
+   **/
+  inline void store(meter_stats & stats, int count)
+  {
+    int16_t peaks[8];
+    int64_t sums[2];
+
+    vst1q_s16(peaks, peak);
+    for (int i = 0 ; i < 8 ; ++i) {
+      if (peaks[i] > stats.peak) {
+        stats.peak = peaks[i];
+      }
+    }
+
+    vst1q_s64(sums, abs_sum);
+    stats.abs_sum += sums[0] + sums[1];
+
+    vst1q_s64(sums, square_sum);
+    stats.square_sum += sums[0] + sums[1];
+
+    vst1q_s64(sums, clips);
+    stats.clip_count += static_cast<int32_t>(sums[0] + sums[1]);
+
+    stats.count += count;
+  }
+};
+
+} // anonymous namespace
+
+
+
+void meter_copy16_neon(int16_t const * inbuf, int16_t * outbuf, int count,
+    meter_stats & stats)
+{
+  int16x8_t const max = vdupq_n_s16(INT16_MAX);
+  accumulators acc;
+
+  int i = 0;
+  int const vector_end = count & ~7;
+  while (i < vector_end) {
+    int round_end = i + ROUND_VECTORS * 8;
+    if (round_end > vector_end) {
+      round_end = vector_end;
+    }
+
+    for ( ; i < round_end ; i += 8) {
+      int16x8_t x = vld1q_s16(inbuf + i);
+      vst1q_s16(outbuf + i, x);
+      acc.add(x, max);
+    }
+    acc.end_round();
+  }
+  acc.store(stats, vector_end);
+
+  meter_copy16_c(inbuf + i, outbuf + i, count - i, stats);
+}
+
+
+
+void meter_copy8_neon(int8_t const * inbuf, int8_t * outbuf, int count,
+    meter_stats & stats)
+{
+  int16x8_t const max = vdupq_n_s16(INT8_MAX);
+  accumulators acc;
+
+  int i = 0;
+  int const vector_end = count & ~15;
+  while (i < vector_end) {
+    int round_end = i + ROUND_VECTORS * 16;
+    if (round_end > vector_end) {
+      round_end = vector_end;
+    }
+
+    for ( ; i < round_end ; i += 16) {
+      int8x16_t x = vld1q_s8(inbuf + i);
+      vst1q_s8(outbuf + i, x);
+      acc.add(vmovl_s8(vget_low_s8(x)), max);
+      acc.add(vmovl_s8(vget_high_s8(x)), max);
+    }
+    acc.end_round();
+  }
+  acc.store(stats, vector_end);
+
+  meter_copy8_c(inbuf + i, outbuf + i, count - i, stats);
+}
+
+
+}} // namespace audioboo::jni
+
+#endif // NEON
@@ -0,0 +1,185 @@
+/**
+ * This file is part of AudioBoo, an android program for audio blogging.
+ * Copyright (C) 2011 Audioboo Ltd. All rights reserved.
+ *
+ * Author: Jens Finkhaeuser <jens@finkhaeuser.de>
+ *
+ * $Id$
+ **/
+
+#include "meter.h"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+namespace audioboo {
+namespace jni {
+
+namespace {
+
+// Vectors per round. Each round ends by widening the 16 and 32 bit lane
+// accumulators into 64 bit ones; this bounds them well below overflow.
+enum {
+  ROUND_VECTORS = 2048,
+};
+
+
+/*****************************************************************************
+ * Per-lane accumulators; all lanes are summed up once at the very end.
+ **/
+struct accumulators
+{
+  __m128i peak;       // 8 x int16 folded maxima
+  __m128i abs_sum;    // 2 x int64
+  __m128i square_sum; // 2 x int64
+  __m128i clips;      // 2 x int64
+
+  // Round accumulators
+  __m128i round_abs;    // 4 x int32
+  __m128i round_clips;  // 8 x int16
+
+  accumulators()
+  {
+    peak = abs_sum = square_sum = clips = _mm_setzero_si128();
+    round_abs = round_clips = _mm_setzero_si128();
+  }
+
+
+  /**
+   * Accumulates 8 int16 samples.
+   **/
+  inline void add(__m128i x, __m128i max)
+  {
+    __m128i const zero = _mm_setzero_si128();
+
+    // Fold negative x to -(x + 1), i.e. x ^ (x >> 15)
+    __m128i folded = _mm_xor_si128(x, _mm_srai_epi16(x, 15));
+
+    peak = _mm_max_epi16(peak, folded);
+
+    round_abs = _mm_add_epi32(round_abs,
+        _mm_madd_epi16(folded, _mm_set1_epi16(1)));
+
+    // Folded values are at most 32767, so the pairwise sum of squares still
+    // fits a signed 32 bit lane and is never negative.
+    __m128i squares = _mm_madd_epi16(folded, folded);
+    square_sum = _mm_add_epi64(square_sum, _mm_unpacklo_epi32(squares, zero));
+    square_sum = _mm_add_epi64(square_sum, _mm_unpackhi_epi32(squares, zero));
+
+    // Compare yields -1 per clipped lane.
+    round_clips = _mm_sub_epi16(round_clips, _mm_cmpeq_epi16(folded, max));
+  }
+
+
+  /**
+   * Widens the round accumulators.
+   **/
+  inline void end_round()
+  {
+    __m128i const zero = _mm_setzero_si128();
+
+    abs_sum = _mm_add_epi64(abs_sum, _mm_unpacklo_epi32(round_abs, zero));
+    abs_sum = _mm_add_epi64(abs_sum, _mm_unpackhi_epi32(round_abs, zero));
+
+    __m128i c = _mm_madd_epi16(round_clips, _mm_set1_epi16(1));
+    clips = _mm_add_epi64(clips, _mm_unpacklo_epi32(c, zero));
+    clips = _mm_add_epi64(clips, _mm_unpackhi_epi32(c, zero));
+
+    round_abs = round_clips = zero;
+  }
+
+
+  /**
+   * Sums up lanes into stats.
+   **/
+  inline void store(meter_stats & stats, int count)
+  {
+    int16_t peaks[8];
+    int64_t sums[2];
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(peaks), peak);
+    for (int i = 0 ; i < 8 ; ++i) {
+      if (peaks[i] > stats.peak) {
+        stats.peak = peaks[i];
+      }
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(sums), abs_sum);
+    stats.abs_sum += sums[0] + sums[1];
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(sums), square_sum);
+    stats.square_sum += sums[0] + sums[1];
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(sums), clips);
+    stats.clip_count += static_cast<int32_t>(sums[0] + sums[1]);
+
+    stats.count += count;
+  }
+};
+
+} // anonymous namespace
+
+
+
+void meter_copy16_sse2(int16_t const * inbuf, int16_t * outbuf, int count,
+    meter_stats & stats)
+{
+  __m128i const max = _mm_set1_epi16(INT16_MAX);
+  accumulators acc;
+
+  int i = 0;
+  int const vector_end = count & ~7;
+  while (i < vector_end) {
+    int round_end = i + ROUND_VECTORS * 8;
+    if (round_end > vector_end) {
+      round_end = vector_end;
+    }
+
+    for ( ; i < round_end ; i += 8) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(inbuf + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(outbuf + i), x);
+      acc.add(x, max);
+    }
+    acc.end_round();
+  }
+  acc.store(stats, vector_end);
+
+  meter_copy16_c(inbuf + i, outbuf + i, count - i, stats);
+}
+
+
+
+void meter_copy8_sse2(int8_t const * inbuf, int8_t * outbuf, int count,
+    meter_stats & stats)
+{
+  __m128i const max = _mm_set1_epi16(INT8_MAX);
+  accumulators acc;
+
+  int i = 0;
+  int const vector_end = count & ~15;
+  while (i < vector_end) {
+    int round_end = i + ROUND_VECTORS * 16;
+    if (round_end > vector_end) {
+      round_end = vector_end;
+    }
+
+    for ( ; i < round_end ; i += 16) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(inbuf + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(outbuf + i), x);
+
+      // Sign-extend to int16: duplicate each byte, then shift the copy out.
+      acc.add(_mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8), max);
+      acc.add(_mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8), max);
+    }
+    acc.end_round();
+  }
+  acc.store(stats, vector_end);
+
+  meter_copy8_c(inbuf + i, outbuf + i, count - i, stats);
+}
+
+
+}} // namespace audioboo::jni
+
+#endif // __SSE2__
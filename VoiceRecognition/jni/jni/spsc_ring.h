@@ -0,0 +1,202 @@
+/**
+ * This file is part of AudioBoo, an android program for audio blogging.
+ * Copyright (C) 2011 Audioboo Ltd. All rights reserved.
+ *
+ * Author: Jens Finkhaeuser <jens@finkhaeuser.de>
+ *
+ * $Id$
+ **/
+
+#ifndef AUDIOBOO_JNI_SPSC_RING_H
+#define AUDIOBOO_JNI_SPSC_RING_H
+
+namespace audioboo {
+namespace jni {
+
+
+/*****************************************************************************
+ * Cache line size we pad shared indices to. 64 Bytes covers the ARM cores we
+ * ship on as well as x86; on cores with 32 Byte lines it merely wastes a
+ * little memory.
+ **/
+enum {
+  CACHE_LINE_SIZE = 64,
+};
+
+
+
+/*****************************************************************************
+ * Single-producer/single-consumer ring of preallocated slots.
+ *
+ * Exactly one thread may call the producer functions (write_slot() and
+ * commit_write()), and exactly one other thread may call the consumer
+ * functions (read_slot() and commit_read()). Neither side ever takes a lock
+ * or allocates memory; all slots are allocated up front in the constructor.
+ *
+ * Usage on the producer side:
+ *  1. write_slot() returns the next free slot, or NULL if the ring is full.
+ *  2. Fill the slot.
+ *  3. commit_write() publishes the slot to the consumer.
+ *
+ * The consumer side mirrors that with read_slot() and commit_read(). A slot
+ * returned from read_slot() stays owned by the consumer until commit_read()
+ * is called, so it's safe to work on it in place.
+ *
+ * The capacity is rounded up to the next power of two so that indices can be
+ * masked rather than divided.
+ **/
+template <typename slotT>
+class spsc_ring
+{
+public:
+  explicit spsc_ring(unsigned capacity)
+    : m_slots(NULL)
+    , m_capacity(1)
+  {
+    while (m_capacity < capacity) {
+      m_capacity <<= 1;
+    }
+    m_mask = m_capacity - 1;
+    m_slots = new slotT[m_capacity];
+
+    m_producer.m_head = 0;
+    m_producer.m_cached_tail = 0;
+    m_consumer.m_tail = 0;
+    m_consumer.m_cached_head = 0;
+  }
+
+
+  ~spsc_ring()
+  {
+    delete [] m_slots;
+  }
+
+
+  /**
+   * Number of slots in the ring.
+   **/
+  unsigned capacity() const
+  {
+    return m_capacity;
+  }
+
+
+  /**
+   * Number of slots currently published but not yet consumed. Only a snapshot
+   * when called from a third thread.
+   **/
+  unsigned size() const
+  {
+    return m_producer.m_head - m_consumer.m_tail;
+  }
+
+
+  /**
+   * Direct access to the slot storage, e.g. for attaching preallocated
+   * buffers to each slot before the ring is used. Not thread-safe.
+   **/
+  slotT & slot_at(unsigned index)
+  {
+    return m_slots[index & m_mask];
+  }
+
+
+  /**
+   * Producer: returns the slot to be filled next, or NULL if the ring is
+   * full. Calling this repeatedly without commit_write() returns the same
+   * slot.
+   **/
+  slotT * write_slot()
+  {
+    unsigned head = m_producer.m_head;
+    if (head - m_producer.m_cached_tail >= m_capacity) {
+      // Looks full, but the consumer may have moved on since we last looked.
+      m_producer.m_cached_tail = m_consumer.m_tail;
+      if (head - m_producer.m_cached_tail >= m_capacity) {
+        return NULL;
+      }
+      // Don't touch the slot before we've seen the consumer release it.
+      __sync_synchronize();
+    }
+    return &m_slots[head & m_mask];
+  }
+
+
+  /**
+   * Producer: publishes the slot returned by write_slot().
+   **/
+  void commit_write()
+  {
+    // Slot contents must be visible before the new head is.
+    __sync_synchronize();
+    m_producer.m_head = m_producer.m_head + 1;
+  }
+
+
+  /**
+   * Consumer: returns the oldest published slot, or NULL if the ring is
+   * empty.
+   **/
+  slotT * read_slot()
+  {
+    unsigned tail = m_consumer.m_tail;
+    if (tail == m_consumer.m_cached_head) {
+      m_consumer.m_cached_head = m_producer.m_head;
+      if (tail == m_consumer.m_cached_head) {
+        return NULL;
+      }
+      // Don't read slot contents before we've seen them published.
+      __sync_synchronize();
+    }
+    return &m_slots[tail & m_mask];
+  }
+
+
+  /**
+   * Consumer: hands the slot returned by read_slot() back to the producer.
+   **/
+  void commit_read()
+  {
+    // We must be done with the slot before the producer may see it as free.
+    __sync_synchronize();
+    m_consumer.m_tail = m_consumer.m_tail + 1;
+  }
+
+
+private:
+  // Not copyable.
+  spsc_ring(spsc_ring const &);
+  spsc_ring & operator=(spsc_ring const &);
+
+  // Producer and consumer indices live on separate cache lines, so that
+  // neither side's writes invalidate the line the other side is spinning on.
+  // Each side also keeps a cached copy of the other side's index, and only
+  // re-reads the shared value when the cached one suggests full/empty.
+  struct producer_t
+  {
+    volatile unsigned m_head;
+    unsigned          m_cached_tail;
+    char              m_pad[CACHE_LINE_SIZE - 2 * sizeof(unsigned)];
+  };
+
+  struct consumer_t
+  {
+    volatile unsigned m_tail;
+    unsigned          m_cached_head;
+    char              m_pad[CACHE_LINE_SIZE - 2 * sizeof(unsigned)];
+  };
+
+  char        m_pad_front[CACHE_LINE_SIZE];
+  producer_t  m_producer;
+  consumer_t  m_consumer;
+
+  // Read-only after construction.
+  slotT *     m_slots;
+  unsigned    m_capacity;
+  unsigned    m_mask;
+};
+
+
+}} // namespace audioboo::jni
+
+#endif // guard
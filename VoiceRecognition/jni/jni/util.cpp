@@ -57,21 +57,27 @@ void throwByName(JNIEnv * env, const char * name, const char * msg)
 }
 
 
-/**
- * Log stuff printf-style
- **/
-void log(int priority, char const * tag, char const * format, ...)
-{
-  va_list argptr;
-  va_start(argptr, format);
+}} // namespace audioboo::jni
 
-  char line[4096];
-  vsnprintf(line, sizeof(line), format, argptr);
 
-  va_end(argptr);
 
-  __android_log_write(priority, tag, line);
-}
+/*****************************************************************************
+ * Library entry point; caches what the JNI wrappers need from Java once,
+ * rather than on every call.
+ **/
+extern "C" jint
+JNI_OnLoad(JavaVM * vm, void * reserved)
+{
+  JNIEnv * env = NULL;
+  if (JNI_OK != vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_4)) {
+    return JNI_ERR;
+  }
 
+  if (!audioboo::jni::FLACStreamEncoder_onload(env)
+      || !audioboo::jni::FLACStreamDecoder_onload(env))
+  {
+    return JNI_ERR;
+  }
 
-}} // namespace audioboo::jni
+  return JNI_VERSION_1_4;
+}
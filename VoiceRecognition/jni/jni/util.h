@@ -13,7 +13,7 @@
 
 #include <jni.h>
 
-#include <android/log.h>
+#include "log.h"
 
 
 namespace audioboo {
@@ -65,8 +65,10 @@ void throwByName(JNIEnv * env, const char * name, const char * msg);
 
 
 /**
- * Log stuff printf-style.
+ * Look up and cache the class and field IDs the JNI wrappers of each class
+ * need; called from JNI_OnLoad. Each is defined along with the wrappers.
  **/
-void log(int priority, char const * tag, char const * format, ...);
+bool FLACStreamEncoder_onload(JNIEnv * env);
+bool FLACStreamDecoder_onload(JNIEnv * env);
 
 }} // namespace audioboo::jni
@@ -32,11 +32,28 @@ public class FLACStreamDecoder
    **/
   public FLACStreamDecoder(String infile)
   {
-    init(infile);
+    init(infile, false);
   }
 
 
 
+  /**
+   * As above, but if read_ahead is true, a native thread decodes ahead of
+   * read(), which then mostly just copies already decoded data. That keeps
+   * slow storage from stalling the caller.
+   **/
+  public FLACStreamDecoder(String infile, boolean read_ahead)
+  {
+    init(infile, read_ahead);
+  }
+
+
+
+  /**
+   * Closes the file. The native decoder, with its read-ahead thread and
+   * buffers, is then kept for the next FLACStreamDecoder, up to the pool
+   * size; see setPoolSize().
+   **/
   public void release()
   {
     deinit();
@@ -44,10 +61,41 @@ public class FLACStreamDecoder
 
 
 
+  /**
+   * Sets how many released decoders are kept for reuse. 0 disables pooling;
+   * the default is 1.
+   **/
+  public static void setPoolSize(int size)
+  {
+    nativeSetPoolSize(size);
+  }
+
+
+
+  /**
+   * Sets the directory in which decoders save the frame index they build for
+   * exact seeks in files without a fine enough seek table, and look for it
+   * again. Without one, every decoder has to scan such a file on its first
+   * seek. Pass null to stop saving indices.
+   **/
+  public static void setIndexDirectory(String directory)
+  {
+    nativeSetIndexDirectory(directory);
+  }
+
+
+
   public void reset(String infile)
+  {
+    reset(infile, false);
+  }
+
+
+
+  public void reset(String infile, boolean read_ahead)
   {
     deinit();
-    init(infile);
+    init(infile, read_ahead);
   }
 
 
@@ -73,7 +121,7 @@ public class FLACStreamDecoder
   /**
    * Constructor equivalent
    **/
-  native private void init(String infile);
+  native private void init(String infile, boolean read_ahead);
 
   /**
    * Destructor equivalent, but can be called multiple times.
@@ -83,45 +131,88 @@ public class FLACStreamDecoder
   /**
    * Returns the bits per sample in the infile, or -1 if that is unknown.
    **/
-  native public int bitsPerSample();
+  public int bitsPerSample()
+  {
+    return nativeBitsPerSample(mObject);
+  }
 
   /**
    * Returns the number of channels in the infile, or -1 if that is unknown.
    **/
-  native public int channels();
+  public int channels()
+  {
+    return nativeChannels(mObject);
+  }
 
   /**
    * Returns the sample rate in the infile, or -1 if that is unknown.
    **/
-  native public int sampleRate();
+  public int sampleRate()
+  {
+    return nativeSampleRate(mObject);
+  }
 
   /**
-   * Returns the minimum buffer size you need to hand to read() below, or -1
-   * if it's unknown.
+   * Returns the size of a buffer that holds the largest block in the infile,
+   * or -1 if it's unknown. read() below needs the fewest calls with buffers
+   * of at least this size, but accepts any size.
    **/
-  native public int minBufferSize();
+  public int minBufferSize()
+  {
+    return nativeMinBufferSize(mObject);
+  }
 
   /**
-   * Reads data from the decoder, and writes it into the provided buffer. The
-   * buffer must be at least minBufferSize() in size.
-   * Returns the number of bytes actually read, or -1 on fatal errors.
+   * Reads data from the decoder, and writes it into the provided buffer.
+   * Fills up to bufsize bytes, rounded down to whole samples for all
+   * channels; decoded data that doesn't fit is returned by the next call.
+   * Returns the number of bytes actually read, or a negative value at the
+   * end of the stream and on fatal errors.
    **/
-  native public int read(ByteBuffer buffer, int bufsize);
+  public int read(ByteBuffer buffer, int bufsize)
+  {
+    return nativeRead(mObject, buffer, bufsize);
+  }
 
   /**
    * Returns the number of samples in the file.
    **/
-  native public int totalSamples();
+  public int totalSamples()
+  {
+    return nativeTotalSamples(mObject);
+  }
 
   /**
    * Seeks to a particular sample.
    **/
-  native public void seekTo(int sample);
+  public void seekTo(int sample)
+  {
+    nativeSeekTo(mObject, sample);
+  }
 
   /**
    * Returns read position, in samples.
    **/
-  native public int position();
+  public int position()
+  {
+    return nativePosition(mObject);
+  }
+
+  /**
+   * Static counterparts of the public functions above. They take mObject
+   * as a handle, so that native code doesn't need to look up the field on
+   * every call.
+   **/
+  native private static int nativeBitsPerSample(long handle);
+  native private static int nativeChannels(long handle);
+  native private static int nativeSampleRate(long handle);
+  native private static int nativeMinBufferSize(long handle);
+  native private static int nativeRead(long handle, ByteBuffer buffer, int bufsize);
+  native private static int nativeTotalSamples(long handle);
+  native private static void nativeSeekTo(long handle, int sample);
+  native private static int nativePosition(long handle);
+  native private static void nativeSetPoolSize(int size);
+  native private static void nativeSetIndexDirectory(String directory);
 
   // Load native library
   static {
@@ -10,6 +10,7 @@
 package com.example.jni;
 
 import java.nio.ByteBuffer;
+import java.util.concurrent.locks.ReentrantReadWriteLock;
 
 
 /**
@@ -22,6 +23,54 @@ public class FLACStreamEncoder
    * Interface
    **/
 
+  /**
+   * Defaults for the seek table written to the file; see the constructor
+   * below.
+   **/
+  public static final int DEFAULT_EXPECTED_DURATION = 600; // seconds
+  public static final int DEFAULT_SEEK_INTERVAL     = 10;  // seconds
+
+
+  /**
+   * Handle returned by finish(). It stays usable until the encoder is
+   * released or reset; release() itself waits for the file to be finished.
+   **/
+  public class Completion
+  {
+    /**
+     * Returns true once the file has been finalized.
+     **/
+    public boolean isDone()
+    {
+      return await(0);
+    }
+
+    /**
+     * Waits up to timeout_msec for the file to be finalized; returns true if
+     * it is. A negative timeout waits as long as it takes.
+     **/
+    public boolean await(int timeout_msec)
+    {
+      if (0 == mObject) {
+        return true;
+      }
+      return nativeAwaitFinish(mObject, timeout_msec);
+    }
+
+    /**
+     * Returns true if the file was finalized and all audio encoded without
+     * errors. Only meaningful once isDone() returns true.
+     **/
+    public boolean succeeded()
+    {
+      if (0 == mObject) {
+        return false;
+      }
+      return nativeFinishSucceeded(mObject);
+    }
+  }
+
+
   /**
    * channels must be either 1 (mono) or 2 (stereo)
    * bits_per_sample must be either 8 or 16
@@ -29,14 +78,76 @@ public class FLACStreamEncoder
   public FLACStreamEncoder(String outfile, int sample_rate, int channels,
       int bits_per_sample)
   {
-    init(outfile, sample_rate, channels, bits_per_sample);
+    this(outfile, sample_rate, channels, bits_per_sample,
+        DEFAULT_EXPECTED_DURATION, DEFAULT_SEEK_INTERVAL);
   }
 
 
 
+  /**
+   * As above, but the file's seek table gets a point every seek_interval
+   * seconds, and is sized for a recording of expected_duration seconds.
+   * Longer recordings still get seek points throughout when the encoder is
+   * released, at the cost of a scan of the file then. A seek_interval of 0
+   * writes no seek table. FLACStreamDecoder seeks in recordings made with
+   * the default seek_interval without indexing them first.
+   **/
+  public FLACStreamEncoder(String outfile, int sample_rate, int channels,
+      int bits_per_sample, int expected_duration, int seek_interval)
+  {
+    init(outfile, false, sample_rate, channels, bits_per_sample,
+        expected_duration, seek_interval);
+  }
+
+
+
+  /**
+   * With stream_output, the encoded stream is kept in memory for
+   * readOutput(), so it can be consumed while recording goes on. If outfile
+   * is not null, the stream is also written there; only that copy gets a
+   * seek table, and the final sample count and MD5 sum in its header.
+   **/
+  public FLACStreamEncoder(String outfile, boolean stream_output,
+      int sample_rate, int channels, int bits_per_sample)
+  {
+    init(outfile, stream_output, sample_rate, channels, bits_per_sample,
+        DEFAULT_EXPECTED_DURATION, DEFAULT_SEEK_INTERVAL);
+  }
+
+
+
+  /**
+   * Finishes the file, if that hasn't happened yet, and waits for it to be
+   * complete. The native encoder, with its thread and buffers, is then kept
+   * for the next FLACStreamEncoder, up to the pool size; see setPoolSize().
+   * Also waits for readOutput() calls on other threads to return; finishing
+   * ends the output, so they do. readOutput() returns -1 afterwards.
+   **/
   public void release()
   {
-    deinit();
+    if (0 != mObject) {
+      nativeFinish(mObject);
+    }
+
+    mHandleLock.writeLock().lock();
+    try {
+      deinit();
+    } finally {
+      mHandleLock.writeLock().unlock();
+    }
+  }
+
+
+
+  /**
+   * Sets how many released encoders are kept for reuse. Creating an encoder
+   * from the pool skips allocating its buffers and starting its thread,
+   * which matters when recording many short utterances. 0 disables pooling;
+   * the default is 1.
+   **/
+  public static void setPoolSize(int size)
+  {
+    nativeSetPoolSize(size);
   }
 
 
@@ -44,8 +155,28 @@ public class FLACStreamEncoder
   public void reset(String outfile, int sample_rate, int channels,
       int bits_per_sample)
   {
-    deinit();
-    init(outfile, sample_rate, channels, bits_per_sample);
+    reset(outfile, sample_rate, channels, bits_per_sample,
+        DEFAULT_EXPECTED_DURATION, DEFAULT_SEEK_INTERVAL);
+  }
+
+
+
+  public void reset(String outfile, int sample_rate, int channels,
+      int bits_per_sample, int expected_duration, int seek_interval)
+  {
+    release();
+    init(outfile, false, sample_rate, channels, bits_per_sample,
+        expected_duration, seek_interval);
+  }
+
+
+
+  public void reset(String outfile, boolean stream_output, int sample_rate,
+      int channels, int bits_per_sample)
+  {
+    release();
+    init(outfile, stream_output, sample_rate, channels, bits_per_sample,
+        DEFAULT_EXPECTED_DURATION, DEFAULT_SEEK_INTERVAL);
   }
 
 
@@ -68,11 +199,18 @@ public class FLACStreamEncoder
   // Pointer to opaque data in C
   private long  mObject;
 
+  // readOutput() holds the read lock while it uses mObject, release() the
+  // write lock while it hands the native encoder back to the pool. That way
+  // no reader can get at an encoder that already records for someone else.
+  private final ReentrantReadWriteLock mHandleLock =
+    new ReentrantReadWriteLock();
+
   /**
    * Constructor equivalent
    **/
-  native private void init(String outfile, int sample_rate, int channels,
-      int bits_per_sample);
+  native private void init(String outfile, boolean stream_output,
+      int sample_rate, int channels, int bits_per_sample,
+      int expected_duration, int seek_interval);
 
   /**
    * Destructor equivalent, but can be called multiple times.
@@ -83,25 +221,139 @@ public class FLACStreamEncoder
    * Returns the maximum amplitude written to the file since the last call
    * to this function.
    **/
-  native public float getMaxAmplitude();
+  public float getMaxAmplitude()
+  {
+    return nativeGetMaxAmplitude(mObject);
+  }
 
   /**
    * Returns the average amplitude written to the file since the last call
-   * to this function.
+   * to this function. All channels are averaged together.
+   **/
+  public float getAverageAmplitude()
+  {
+    return nativeGetAverageAmplitude(mObject);
+  }
+
+  /**
+   * Returns the RMS amplitude written to the file since the last call
+   * to this function, on the same 0..1 scale as the other amplitudes.
+   **/
+  public float getRmsAmplitude()
+  {
+    return nativeGetRmsAmplitude(mObject);
+  }
+
+  /**
+   * Returns the number of samples written to the file since the last call
+   * to this function that were at the limits of the sample range, i.e.
+   * likely clipped.
    **/
-  native public float getAverageAmplitude();
+  public int getClipCount()
+  {
+    return nativeGetClipCount(mObject);
+  }
 
   /**
    * Writes data to the encoder. The provided buffer must be at least as long
    * as the provided buffer size.
-   * Returns the number of bytes actually written.
+   * Returns the number of bytes actually written. This is less than bufsize
+   * if the encoder's write ring is full because encoding can't keep up; the
+   * remainder is dropped rather than blocking the caller.
+   **/
+  public int write(ByteBuffer buffer, int bufsize)
+  {
+    return nativeWrite(mObject, buffer, bufsize);
+  }
+
+  /**
+   * Flushes internal buffers to the write ring. Returns immediately; use
+   * drain() to wait until the encoder has taken the data.
+   **/
+  public void flush()
+  {
+    nativeFlush(mObject);
+  }
+
+  /**
+   * Flushes, then waits up to timeout_msec until everything written so far
+   * has been handed to libFLAC. Returns false if that didn't happen in time.
+   * This is no sync point for the file: libFLAC may hold back the last
+   * partial frame, and nothing is synced to storage. Only a finished file
+   * is complete; see finish().
+   **/
+  public boolean drain(int timeout_msec)
+  {
+    return nativeDrain(mObject, timeout_msec);
+  }
+
+  /**
+   * Stops accepting writes, and finalizes the file in the background. Returns
+   * at once; the Completion tells when the file is complete.
+   **/
+  public Completion finish()
+  {
+    nativeFinish(mObject);
+    return new Completion();
+  }
+
+  /**
+   * Backpressure: the number of write ring blocks waiting to be encoded.
+   * When this reaches getQueueCapacity(), write() starts dropping data.
    **/
-  native public int write(ByteBuffer buffer, int bufsize);
+  public int getQueueDepth()
+  {
+    return nativeGetQueueDepth(mObject);
+  }
+
+  public int getQueueCapacity()
+  {
+    return nativeGetQueueCapacity(mObject);
+  }
+
+  /**
+   * Stream output only: copies up to bufsize bytes of the encoded stream
+   * into buffer, which must be a direct ByteBuffer, waiting up to
+   * timeout_msec for any to arrive; a negative timeout waits as long as it
+   * takes. Returns the number of bytes copied, 0 on timeout, or -1 once the
+   * encoder is finished and everything has been read.
+   * Output not read by the time the encoder is released is lost.
+   * May be called on another thread than the rest of the encoder; see
+   * release().
+   **/
+  public int readOutput(ByteBuffer buffer, int bufsize, int timeout_msec)
+  {
+    mHandleLock.readLock().lock();
+    try {
+      if (0 == mObject) {
+        return -1;
+      }
+      return nativeReadOutput(mObject, buffer, bufsize, timeout_msec);
+    } finally {
+      mHandleLock.readLock().unlock();
+    }
+  }
 
   /**
-   * Flushes internal buffers to FIFO.
+   * Static counterparts of the public functions above. They take mObject
+   * as a handle, so that native code doesn't need to look up the field on
+   * every call.
    **/
-  native public void flush();
+  native private static float nativeGetMaxAmplitude(long handle);
+  native private static float nativeGetAverageAmplitude(long handle);
+  native private static float nativeGetRmsAmplitude(long handle);
+  native private static int nativeGetClipCount(long handle);
+  native private static int nativeWrite(long handle, ByteBuffer buffer, int bufsize);
+  native private static void nativeFlush(long handle);
+  native private static boolean nativeDrain(long handle, int timeout_msec);
+  native private static void nativeFinish(long handle);
+  native private static boolean nativeAwaitFinish(long handle, int timeout_msec);
+  native private static boolean nativeFinishSucceeded(long handle);
+  native private static int nativeGetQueueDepth(long handle);
+  native private static int nativeGetQueueCapacity(long handle);
+  native private static int nativeReadOutput(long handle, ByteBuffer buffer,
+      int bufsize, int timeout_msec);
+  native private static void nativeSetPoolSize(int size);
 
   // Load native library
   static {
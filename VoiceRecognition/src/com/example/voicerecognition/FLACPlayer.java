@@ -132,9 +132,16 @@ public class FLACPlayer extends Thread
 
   public void run()
   {
-    // Try to initialize the decoder.
+    // Frame indices for seeking go into the app's cache, not next to the
+    // file, which the app may not own.
+    if (null != mContext) {
+      FLACStreamDecoder.setIndexDirectory(mContext.getCacheDir().getPath());
+    }
+
+    // Try to initialize the decoder. It decodes ahead on its own thread, so
+    // slow storage doesn't stall playback.
     try {
-      mDecoder = new FLACStreamDecoder(mPath);
+      mDecoder = new FLACStreamDecoder(mPath, true);
     } catch (IllegalArgumentException ex) {
       
       if (null != mListener) {
@@ -148,16 +155,17 @@ public class FLACPlayer extends Thread
     int channelConfig = mapChannelConfig(mDecoder.channels());
     int format = mapFormat(mDecoder.bitsPerSample());
 
-    // Determine buffer size
-    int decoder_bufsize = mDecoder.minBufferSize();
-    //Samsung galaxy S2 doesn't work here
-    //int playback_bufsize = AudioTrack.getMinBufferSize(sampleRate, channelConfig, format); 
-    //int bufsize = Math.max(playback_bufsize, decoder_bufsize);   
-    int bufsize = decoder_bufsize; 
+    // Determine buffer size. The decoder fills buffers of any size exactly,
+    // so we read in chunks of AudioTrack's preferred size, and give the track
+    // room for two of them so it never runs dry while we decode the next.
+    int bufsize = AudioTrack.getMinBufferSize(sampleRate, channelConfig, format);
+    if (bufsize <= 0) {
+      bufsize = mDecoder.minBufferSize();
+    }
     // Create AudioTrack.
     try {
       mAudioTrack = new AudioTrack(AudioManager.STREAM_MUSIC, sampleRate,
-          channelConfig, format, bufsize, AudioTrack.MODE_STREAM);
+          channelConfig, format, 2 * bufsize, AudioTrack.MODE_STREAM);
       mAudioTrack.play();
 
       ByteBuffer buffer = ByteBuffer.allocateDirect(bufsize);
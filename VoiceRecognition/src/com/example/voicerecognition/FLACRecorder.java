@@ -12,6 +12,8 @@ package com.example.voicerecognition;
 
 import java.nio.ByteBuffer;
 import java.util.Locale;
+import java.util.concurrent.BlockingQueue;
+import java.util.concurrent.LinkedBlockingQueue;
 
 import android.media.AudioFormat;
 import android.media.AudioRecord;
@@ -24,7 +26,8 @@ import com.example.jni.FLACStreamEncoder;
 
 /**
  * Records a single FLAC file from the microphone. Overwrites the file if it
- * already exists.
+ * already exists. In stream mode, the encoded stream is also handed out as
+ * it is recorded; see getOutput().
  **/
 public class FLACRecorder extends Thread
 {
@@ -40,6 +43,9 @@ public class FLACRecorder extends Thread
   public static final int MSG_WRITE_ERROR           = 5;
   public static final int MSG_AMPLITUDES            = 6;
 
+  // Last entry in the output queue; see getOutput().
+  public static final byte[] END_OF_OUTPUT          = new byte[0];
+
 
   /***************************************************************************
    * Private constants
@@ -47,6 +53,13 @@ public class FLACRecorder extends Thread
   // Log ID
   private static final String LTAG  = "FLACRecorder";
 
+  // How long to wait for the encoder to finalize the file before leaving
+  // that to release(), in msec.
+  private static final int FINISH_TIMEOUT = 2000;
+
+  // Size of the buffer the encoded stream is read into, in bytes.
+  private static final int OUTPUT_BUFFER_SIZE = 16384;
+
 
   /***************************************************************************
    * Simple class for reporting measured Amplitudes to user of FLACRecorder
@@ -118,6 +131,9 @@ public class FLACRecorder extends Thread
   // File path for the output file.
   private String                  mPath;
 
+  // Encoded stream in stream mode, else null.
+  private BlockingQueue<byte[]>   mOutput;
+
   // Handler to notify at the above report interval
   private Handler                 mHandler;
 
@@ -132,11 +148,36 @@ public class FLACRecorder extends Thread
    * Implementation
    **/
   public FLACRecorder(String path, Handler handler)
+  {
+    this(path, false, handler);
+  }
+
+
+
+  /**
+   * With stream_output, the encoded stream is queued for getOutput() while
+   * recording goes on; the file at path then only mirrors it, and path may
+   * be null.
+   **/
+  public FLACRecorder(String path, boolean stream_output, Handler handler)
   {
     mPath = path;
     mHandler = handler;
-    Log.d(LTAG, "New FLACRecorder, path: " + mPath);
+    if (stream_output) {
+      mOutput = new LinkedBlockingQueue<byte[]>();
+    }
+    Log.d(LTAG, "New FLACRecorder, path: " + mPath + ", streaming: " + stream_output);
+  }
+
+
 
+  /**
+   * Stream mode only: the encoded FLAC stream, in pieces, as it's recorded.
+   * The last piece is always END_OF_OUTPUT, even if recording fails.
+   **/
+  public BlockingQueue<byte[]> getOutput()
+  {
+    return mOutput;
   }
 
 
@@ -257,6 +298,7 @@ public class FLACRecorder extends Thread
           if (AudioRecord.ERROR == bufsize) {
             Log.e(LTAG, "Unable to query hardware!");
             mHandler.obtainMessage(MSG_HARDWARE_UNAVAILABLE).sendToTarget();
+            endOutput();
             return;
           }
 
@@ -283,6 +325,7 @@ public class FLACRecorder extends Thread
     if (!found) {
       Log.e(LTAG, "Sample rate, channel config or format not supported!");
       mHandler.obtainMessage(MSG_INVALID_FORMAT).sendToTarget();
+      endOutput();
       return;
     }
     Log.d(LTAG, "Using: " + format + "/" + channel_config + "/" + sample_rate);
@@ -290,7 +333,7 @@ public class FLACRecorder extends Thread
     mShouldRun = true;
     boolean oldShouldRecord = false;
 
-
+    OutputThread output_thread = null;
 
     try {
       // Initialize variables for calculating the recording duration.
@@ -301,7 +344,15 @@ public class FLACRecorder extends Thread
       // Set up encoder. Create path for the file if it doesn't yet exist.
       Log.d(LTAG, "Setting up encoder " + mPath + " rate: " + sample_rate + " channels: " + mapped_channels + " format " + mapped_format);
 
-      mEncoder = new FLACStreamEncoder(mPath, sample_rate, mapped_channels, mapped_format);
+      mEncoder = new FLACStreamEncoder(mPath, null != mOutput, sample_rate,
+          mapped_channels, mapped_format);
+
+      // The encoded stream is queued on a thread of its own, so that this
+      // loop only reads and writes audio.
+      if (null != mOutput) {
+        output_thread = new OutputThread(mEncoder);
+        output_thread.start();
+      }
 
       // Start recording loop
       mDuration = 0.0;
@@ -370,18 +421,92 @@ public class FLACRecorder extends Thread
         }
       }
 
+      // Let the encoder finalize the file while the recorder is released.
+      FLACStreamEncoder.Completion completion = mEncoder.finish();
       recorder.release();
+      if (completion.await(FINISH_TIMEOUT) && !completion.succeeded()) {
+        Log.e(LTAG, "Could not finish writing " + mPath);
+        mHandler.obtainMessage(MSG_WRITE_ERROR).sendToTarget();
+      }
+      // The stream must be read in full before the encoder is released.
+      joinOutput(output_thread);
       mEncoder.release();
       mEncoder = null;
 
     } catch (IllegalArgumentException ex) {
       Log.e(LTAG, "Illegal argument: " + ex.getMessage());
       mHandler.obtainMessage(MSG_ILLEGAL_ARGUMENT, ex.getMessage()).sendToTarget();
+
+      // Releasing the encoder ends its output, and so the output thread.
+      if (null != mEncoder) {
+        mEncoder.release();
+        mEncoder = null;
+      }
+      joinOutput(output_thread);
     }
 
+    endOutput();
     mHandler.obtainMessage(MSG_OK).sendToTarget();
   }
 
 
 
+  /**
+   * Stream mode only: moves the encoded stream to the output queue as the
+   * encoder produces it. Ends once the encoder is finished and the stream
+   * has been read in full.
+   **/
+  private class OutputThread extends Thread
+  {
+    private FLACStreamEncoder mStreamEncoder;
+
+
+    public OutputThread(FLACStreamEncoder encoder)
+    {
+      mStreamEncoder = encoder;
+    }
+
+
+    public void run()
+    {
+      ByteBuffer buffer = ByteBuffer.allocateDirect(OUTPUT_BUFFER_SIZE);
+      int read;
+      while ((read = mStreamEncoder.readOutput(buffer, OUTPUT_BUFFER_SIZE, -1)) >= 0) {
+        if (read > 0) {
+          byte[] data = new byte[read];
+          buffer.rewind();
+          buffer.get(data);
+          mOutput.add(data);
+        }
+      }
+    }
+  }
+
+
+
+  private void joinOutput(Thread thread)
+  {
+    if (null == thread) {
+      return;
+    }
+
+    try {
+      thread.join();
+    } catch (InterruptedException ex) {
+      // release() still waits for the thread to leave the encoder.
+      Log.w(LTAG, "Interrupted while waiting for the output thread.");
+    }
+  }
+
+
+
+  private void endOutput()
+  {
+    if (null != mOutput) {
+      mOutput.add(END_OF_OUTPUT);
+    }
+  }
+
+
+
 }
@@ -1,17 +1,13 @@
 package com.example.voicerecognition;
 
-import java.io.File;
-import java.io.FileInputStream;
-import java.io.FileNotFoundException;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.OutputStream;
 import java.net.MalformedURLException;
 import java.net.URL;
 import java.net.URLConnection;
-import java.nio.MappedByteBuffer;
-import java.nio.channels.FileChannel;
 import java.util.Scanner;
+import java.util.concurrent.BlockingQueue;
 
 import javax.net.ssl.HttpsURLConnection;
 
@@ -177,7 +173,10 @@ public class MainActivity extends Activity {
 
 	public void recordButton(View v) {
 
-		mRecorder.start(fileName);
+		// Record to the file for listenRecord(), and upload the same stream
+		// while recording.
+		mRecorder.start(fileName, true);
+		getTranscription(mRecorder.mFLACRecorder);
 
 		txtView.setText("");
 		recordButton.setEnabled(false);
@@ -198,8 +197,7 @@ public class MainActivity extends Activity {
 		recordButton.setEnabled(true);
 		listenButton.setEnabled(true);
 
-		sampleRate = mRecorder.mFLACRecorder.getSampleRate();
-		getTranscription(sampleRate);
+		// Ends the stream, and with it the upload.
 		mRecorder.stop();
 
 	}
@@ -219,11 +217,7 @@ public class MainActivity extends Activity {
 	 * Method related to Google Voice Recognition
 	 **/
 
-	public void getTranscription(int sampleRate) {
-
-		File myfil = new File(fileName);
-		if (!myfil.canRead())
-			Log.d("ParseStarter", "FATAL no read access");
+	public void getTranscription(FLACRecorder recorder) {
 
 		// first is a GET for the speech-api DOWNSTREAM
 		// then a future exec for the UPSTREAM / chunked encoding used so as not
@@ -234,32 +228,13 @@ public class MainActivity extends Activity {
 		// DOWN URL just like in curl full-duplex example plus the handler
 		downChannel(API_DOWN_URL + PAIR, messageHandler);
 
-		// UP chan, process the audio byteStream for interface to UrlConnection
-		// using 'chunked-encoding'
-		FileInputStream fis;
-		try {
-			fis = new FileInputStream(myfil);
-			FileChannel fc = fis.getChannel(); // Get the file's size and then
-												// map it into memory
-			int sz = (int) fc.size();
-			MappedByteBuffer bb = fc.map(FileChannel.MapMode.READ_ONLY, 0, sz);
-			byte[] data2 = new byte[bb.remaining()];
-			Log.d("ParseStarter", "mapfil " + sz + " " + bb.remaining());
-			bb.get(data2);
-			// conform to the interface from the curl examples on full-duplex
-			// calls
-			// see curl examples full-duplex for more on 'PAIR'. Just a globally
-			// uniq value typ=long->String.
-			// API KEY value is part of value in UP_URL_p2
-			upChannel(root + up_p1 + PAIR + up_p2 + api_key, messageHandler2,
-					data2);
-		} catch (FileNotFoundException e) {
-			// TODO Auto-generated catch block
-			e.printStackTrace();
-		} catch (IOException e) {
-			// TODO Auto-generated catch block
-			e.printStackTrace();
-		}
+		// UP chan, sends the audio byteStream to UrlConnection using
+		// 'chunked-encoding' as the recorder produces it.
+		// see curl examples full-duplex for more on 'PAIR'. Just a globally
+		// uniq value typ=long->String.
+		// API KEY value is part of value in UP_URL_p2
+		upChannel(root + up_p1 + PAIR + up_p2 + api_key, messageHandler2,
+				recorder);
 	}
 
 	private void downChannel(String urlStr, final Handler messageHandler) {
@@ -300,17 +275,19 @@ public class MainActivity extends Activity {
 	}
 
 	private void upChannel(String urlStr, final Handler messageHandler,
-			byte[] arg3) {
+			final FLACRecorder recorder) {
 
 		final String murl = urlStr;
-		final byte[] mdata = arg3;
-		Log.d("ParseStarter", "upChan " + mdata.length);
+		Log.d("ParseStarter", "upChan");
 		new Thread() {
 			public void run() {
 				String response = "NAO FOI";
 				Message msg = Message.obtain();
 				msg.what = 2;
-				Scanner inStream = openHttpsPostConnection(murl, mdata);
+				Scanner inStream = openHttpsPostConnection(murl, recorder);
+				if (inStream == null) {
+					return;
+				}
 				inStream.hasNext();
 				// process the stream and store it in StringBuilder
 				while (inStream.hasNextLine()) {
@@ -364,13 +341,23 @@ public class MainActivity extends Activity {
 	}
 
 	// GET for UPSTREAM
-	private Scanner openHttpsPostConnection(String urlStr, byte[] data) {
+	private Scanner openHttpsPostConnection(String urlStr,
+			FLACRecorder recorder) {
 		InputStream in = null;
-		byte[] mextrad = data;
+		BlockingQueue<byte[]> output = recorder.getOutput();
 		int resCode = -1;
 		OutputStream out = null;
 		// int http_status;
 		try {
+			// The recorder settles on a sample rate before it encodes
+			// anything, so it's known once the first data arrives.
+			byte[] data = output.take();
+			if (data == FLACRecorder.END_OF_OUTPUT) {
+				Log.d("ParseStarter", "POST nothing recorded");
+				return null;
+			}
+			sampleRate = recorder.getSampleRate();
+
 			URL url = new URL(urlStr);
 			URLConnection urlConn = url.openConnection();
 
@@ -391,17 +378,14 @@ public class MainActivity extends Activity {
 			try {
 				// this opens a connection, then sends POST & headers.
 				out = httpConn.getOutputStream();
-				// Note : if the audio is more than 15 seconds
-				// dont write it to UrlConnInputStream all in one block as this
-				// sample does.
-				// Rather, segment the byteArray and on intermittently, sleeping
-				// thread
-				// supply bytes to the urlConn Stream at a rate that approaches
-				// the bitrate ( =30K per sec. in this instance ).
+				// Supply bytes to the urlConn Stream as they are recorded,
+				// i.e. at the bitrate, until the recording is stopped.
 				Log.d("ParseStarter", "IO beg on data");
-				out.write(mextrad); // one big block supplied instantly to the
-									// underlying chunker wont work for duration
-									// > 15 s.
+				while (data != FLACRecorder.END_OF_OUTPUT) {
+					out.write(data);
+					out.flush();
+					data = output.take();
+				}
 				Log.d("ParseStarter", "IO fin on data");
 				// do you need the trailer?
 				// NOW you can look at the status.
@@ -427,6 +411,8 @@ public class MainActivity extends Activity {
 			e.printStackTrace();
 		} catch (IOException e) {
 			e.printStackTrace();
+		} catch (InterruptedException e) {
+			e.printStackTrace();
 		}
 		return null;
 	}
@@ -112,6 +112,17 @@ public class Recorder
 
 
   public void start(String fileName)
+  {
+    start(fileName, false);
+  }
+
+
+
+  /**
+   * With stream_output, the recording's FLAC stream is also available from
+   * mFLACRecorder.getOutput() while it's being recorded.
+   **/
+  public void start(String fileName, boolean stream_output)
   {
     // Every time we start recording, we create a new recorder instance, and
     // record to a new file.
@@ -122,7 +133,7 @@ public class Recorder
     }
 
     // Start recording!
-    mFLACRecorder = new FLACRecorder( fileName, mInternalHandler);
+    mFLACRecorder = new FLACRecorder(fileName, stream_output, mInternalHandler);
     mFLACRecorder.start();
     mFLACRecorder.resumeRecording();
   }